@@ -0,0 +1,57 @@
+//
+// File:        ByteOrder.h
+//
+// Description: Byte-order policies for reading and writing ZDAB files
+//
+// Notes:       ZEBRA exchange format (the "external" format) is big-endian, but
+//              the byte order of a file being read is detected from its steering
+//              block signature.  The reader and writer are templated on one of
+//              the policies below, which convert 32-bit words between the host
+//              order and the order of the data.  NoSwap does no work at all.
+//
+//              SWAP_BYTES is defined here for little-endian hosts if it was not
+//              given on the command line.  It still selects the host-dependent
+//              bitfield layouts in Record_Info.h, which describe how the host
+//              compiler lays out bitfields in a (native) 32-bit word.
+//
+#ifndef __ByteOrder_h__
+#define __ByteOrder_h__
+
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(SWAP_BYTES) && defined(__BYTE_ORDER__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SWAP_BYTES
+#endif
+
+// data already in host byte order
+struct NoSwap {
+    enum { kSwap = 0 };
+    static constexpr uint32_t Word(uint32_t word) { return(word); }
+    static void Words(uint32_t *, uint32_t) { }
+    static void Copy(uint32_t *dst, const uint32_t *src, uint32_t num) {
+        memcpy(dst, src, num * sizeof(uint32_t));
+    }
+};
+
+// data in the opposite byte order to the host
+struct ByteSwap {
+    enum { kSwap = 1 };
+    static constexpr uint32_t Word(uint32_t word) { return(__builtin_bswap32(word)); }
+    static void Words(uint32_t *data, uint32_t num) {
+        for (uint32_t i=0; i<num; ++i) data[i] = __builtin_bswap32(data[i]);
+    }
+    static void Copy(uint32_t *dst, const uint32_t *src, uint32_t num) {
+        for (uint32_t i=0; i<num; ++i) dst[i] = __builtin_bswap32(src[i]);
+    }
+};
+
+// conversion between host order and the external (big-endian) format
+#ifdef SWAP_BYTES
+typedef ByteSwap    HostToExternal;
+#else
+typedef NoSwap      HostToExternal;
+#endif
+
+#endif // __ByteOrder_h__
@@ -11,6 +11,9 @@
  *
  * Notes:		ZDAB external format is big-endian.
  *				ZDAB native format is platform dependent.
+ *				The byte order of the file being read is found from the signature
+ *				of its first steering block, so files written in the native order
+ *				of a little-endian host can also be read.
  */
 
 #include <string.h>
@@ -28,12 +31,6 @@
 
 /* constants */
 #define BASE_BUFFSIZE		32768UL		// base size of zdab record buffer
-#define MAX_BUFFSIZE		0x400000UL	// maximum size of zdab record buffer (4 MB)
-		
-// the builder won't put out events with NHIT > 10000
-// (note that these are possible due to hardware problems)
-// but XSNOED can write an event with up to 10240 channels
-#define MAX_NHIT			10240
 
 // static member declarations
 #ifdef DEBUG_RECORD_HEADERS
@@ -62,6 +59,20 @@ PZdabFile::PZdabFile()
 	mBytesTotal		= 0;
 	mLastGTID		= 0;
 	mLastRecord		= NULL;
+	mSubDirRecord	= NULL;
+	mFileSwap		= -1;
+	mHaveSteering	= 0;
+	mSpareBuffer	= NULL;
+	mSpareBuffsize	= 0;
+	mLeftover		= NULL;
+	mNumSegments	= 0;
+	mNumSpareSegments = 0;
+	mFilePos		= 0;
+	mBufferSwaps	= 0;
+	mHoldBuffers	= 0;
+	mBuffersHeld	= 0;
+	mEndOfFile		= 0;
+	mResync			= 0;
 }
 
 PZdabFile::~PZdabFile()
@@ -76,6 +87,11 @@ void PZdabFile::Free()
 		mRecBuffer = NULL;
 		mRecBuffsize = 0;
 	}
+	if (mSpareBuffsize) {
+		free(mSpareBuffer);
+		mSpareBuffer = NULL;
+		mSpareBuffsize = 0;
+	}
 }
 
 // initialize for reading from zdab file
@@ -90,6 +106,13 @@ int PZdabFile::Init( FILE *inFile )
 		mBufferEmpty = 1;
 		mLastGTID = 0;
 		mLastRecord = NULL;
+		mFileSwap = -1;		// byte order is found from the first steering block
+		mHaveSteering = 0;
+		mNumSegments = 0;
+		mFilePos = 0;
+		mHoldBuffers = 0;
+		mEndOfFile = 0;
+		mResync = 0;
 		// set up zdab record buffer if not already done
 		if (!mRecBuffsize) {
 			mRecBuffsize = BASE_BUFFSIZE;
@@ -106,9 +129,218 @@ int PZdabFile::Init( FILE *inFile )
 	}
 }
 
-// NextRecord - get next record in ZDAB file (based on code by Yuen-Dat Chan)
-// Returns: pointer to nZDAB record (native format) with trailing data (external format)
+// FindFileOrder - find the byte order of the file from the signature of its first steering block
+// Returns: non-zero if the byte order is known
+int PZdabFile::FindFileOrder()
+{
+	if (mFileSwap < 0) {
+		if (fread(&mSteering, sizeof(mSteering), 1, mFile) != 1) {
+			printf("Unexpected EOF while reading zdab file!\x07\n");
+			return(0);
+		}
+		mFilePos += sizeof(mSteering);
+		if (mSteering.MPR[0] == ZEBRA_SIG0) {
+			mFileSwap = 0;
+		} else if (ByteSwap::Word(mSteering.MPR[0]) == ZEBRA_SIG0) {
+			mFileSwap = 1;
+		} else {
+			printf("Invalid ZEBRA steering block!\x07\n");
+			return(0);
+		}
+		mHaveSteering = 1;
+	}
+	return(1);
+}
+
+// NextRecord - get next record in ZDAB file
+// Returns: pointer to nZDAB record (native format) with trailing data (file byte order)
 nZDAB *PZdabFile::NextRecord()
+{
+	if (!mFile) return(0);
+	
+	// the sub-field directory no longer describes the current record
+	mSubDirRecord = NULL;
+	
+	if (!FindFileOrder()) return(0);
+	if (mFileSwap) {
+		return(NextRecordT<ByteSwap>());
+	} else {
+		return(NextRecordT<NoSwap>());
+	}
+}
+
+// NextRecords - get a batch of up to 'max' records from the ZDAB file
+// - the records are taken from the current physical record and the next ones,
+//   but at most one new buffer is started after the first record of the batch,
+//   so all records stay valid until the next call to NextRecord[s]()
+// - the byte order is dispatched once per batch, and the records chained
+//   within a physical record are walked by the batch loop itself; each
+//   record's header is still swapped and its extent checked against the
+//   buffer as it is reached, since its length is only known from its header
+// Returns: number of records in batch (0 at end of file or on error)
+int PZdabFile::NextRecords(ZdabRecordRef *refs, int max)
+{
+	if (!mFile || mEndOfFile) return(0);
+	
+	mSubDirRecord = NULL;
+	
+	if (!FindFileOrder()) return(0);
+	if (mFileSwap) {
+		return(NextRecordsT<ByteSwap>(refs, max));
+	} else {
+		return(NextRecordsT<NoSwap>(refs, max));
+	}
+}
+
+template <class Order>
+int PZdabFile::NextRecordsT(ZdabRecordRef *refs, int max)
+{
+	int		num = 0;
+	u_int32	swaps = mBufferSwaps;
+	nZDAB  *nzdabPtr;
+	
+	while (num < max) {
+		// the records following in the same physical record are walked here,
+		// and only the scan for the next one (and reading the file) is left
+		// to NextRecordT()
+		nzdabPtr = mLastRecord ? ChainedRecordT<Order>(mLastRecord, mBuffPtr32) : NULL;
+		mLastRecord = nzdabPtr;
+		if (!nzdabPtr) {
+			// don't switch buffers a second time while the batch has records in both
+			mHoldBuffers = (num && mBufferSwaps != swaps);
+			mBuffersHeld = 0;
+			nzdabPtr = NextRecordT<Order>();
+			if (!nzdabPtr) {
+				if (!mBuffersHeld) mEndOfFile = 1;
+				break;
+			}
+			if (!num) swaps = mBufferSwaps;
+		}
+		
+		ZdabRecordRef *ref = refs + num++;
+		ref->rec = nzdabPtr;
+		ref->bank_name = nzdabPtr->bank_name;
+		ref->length = nzdabPtr->data_words;
+		ref->file_offset = GetFileOffset((u_int32 *)nzdabPtr);
+	}
+	mHoldBuffers = 0;
+	return(num);
+}
+
+// GetFileOffset - get byte offset in the file of a word in the record buffer
+// Returns: offset from the position at Init() (-1 if unknown)
+int64_t PZdabFile::GetFileOffset(u_int32 *ptr)
+{
+	u_int32 index = (u_int32)(ptr - mRecBuffer);
+	
+	for (int i=mNumSegments-1; i>=0; --i) {
+		if (mSegment[i].start <= index) {
+			if (mSegment[i].offset < 0) break;
+			return(mSegment[i].offset + (int64_t)(index - mSegment[i].start) * sizeof(u_int32));
+		}
+	}
+	return(-1);
+}
+
+// SetSegments - set the file segments of the record buffer after reading
+// a physical record into it behind the mWordOffset words left from the last one
+// - dataPos is the file offset of the data read from the physical record
+void PZdabFile::SetSegments(int64_t dataPos)
+{
+	int		num = 0;
+	
+	if (mWordOffset) {
+		// the leftover words keep their segments from the other buffer
+		u_int32 first = (u_int32)(mLeftover - mSpareBuffer);
+		for (int i=0; i<mNumSpareSegments; ++i) {
+			if (i+1 < mNumSpareSegments && mSpareSegment[i+1].start <= first) continue;
+			if (num == MAX_BUFFER_SEGMENTS - 1) {
+				mSegment[num-1].offset = -1;	// too many segments to keep track of
+				break;
+			}
+			u_int32 start = mSpareSegment[i].start > first ? mSpareSegment[i].start : first;
+			mSegment[num].start = start - first;
+			mSegment[num].offset = mSpareSegment[i].offset < 0 ? -1 :
+						mSpareSegment[i].offset + (int64_t)(start - mSpareSegment[i].start) * sizeof(u_int32);
+			++num;
+		}
+	}
+	mSegment[num].start = mWordOffset;
+	mSegment[num].offset = dataPos;
+	mNumSegments = num + 1;
+}
+
+// SeekBlock - continue reading from the specified physical record
+// - any part of a logical record continued from the previous physical
+//   record is skipped (using the control record offset in the steering block)
+// Returns: 0 on success
+int PZdabFile::SeekBlock(u_int32 block)
+{
+	int64_t pos = (int64_t)block * ZEBRA_BLOCKSIZE * sizeof(u_int32);
+	
+	if (!mFile || fseeko(mFile, pos, SEEK_SET)) {
+		printf("Can't seek to ZEBRA block %ld\x07\n", (long)block);
+		return(-1);
+	}
+	mFilePos = pos;
+	mWordOffset = 0;
+	mBufferEmpty = 1;
+	mHaveSteering = 0;
+	mLastRecord = NULL;
+	mSubDirRecord = NULL;
+	mEndOfFile = 0;
+	mResync = 1;
+	return(0);
+}
+
+// ChainedRecordT - get the record which follows prev in the same physical record
+// - end is the end of the data read into the buffer
+// - the i/o control word after prev is swapped whether or not a record follows
+// Returns: next record (header in native order), or NULL if there is none
+template <class Order>
+inline nZDAB *PZdabFile::ChainedRecordT(nZDAB *prev, u_int32 *end)
+{
+	// get pointer to first word after bank data (the i/o control word)
+	u_int32 *ioControlPtr = (u_int32 *)(prev + 1) + prev->data_words;
+	
+	// make sure the ioControlPtr is in the buffer
+	if (ioControlPtr >= end) return(NULL);
+	
+	// swap the i/o control word
+	Order::Words(ioControlPtr,1);
+	
+	// get length of the next zdab header (lower 16 bits of i/o control word)
+	// - for some reason this is actually 3 greater than the actual
+	// size of the header which is a minimum of 9 words
+	// (not counting the i/o control word as part of the header)
+	u_int32 hdrLen = (*ioControlPtr & 0x0000ffffUL);
+	
+	// make sure the header is at least the minimum size
+	if (hdrLen < 12) return(NULL);
+	
+	// get pointer to next bank header
+	nZDAB *nzdabPtr = (nZDAB *)(ioControlPtr + hdrLen - 2) - 1;
+	
+	// make sure the next header is contained in the buffer
+	if ((u_int32 *)(nzdabPtr+1) > end) return(NULL);
+	
+	// swap the next zdab header
+	Order::Words((u_int32 *)nzdabPtr, NZDAB_WORD_SIZE);
+	
+	// make sure the data is contained in the buffer
+	if ((u_int32 *)(nzdabPtr+1)+nzdabPtr->data_words > end) return(NULL);
+	
+	if (sVerbose > 1) {
+		printf("-- same block --\n");
+	}
+	// success!! -- we have a good zdab record.
+	return(nzdabPtr);
+}
+
+// NextRecordT - get next record in ZDAB file (based on code by Yuen-Dat Chan)
+// - Order converts between the file byte order and the host order
+template <class Order>
+nZDAB *PZdabFile::NextRecordT()
 {
 	int				n;
 	u_int32			recLength, recType, nb_to_read, nw_count, block_size;
@@ -119,56 +351,14 @@ nZDAB *PZdabFile::NextRecord()
 	pilotHeaderPtr 	pHPtr;
 	ZEBRA_ST		daqST;			// Steering block control words (ZEBRA FZ must)
 	
-	if (!mFile) return(0);
 /*
 ** return the next bank within this physical record if available - PH 12/01/99
 ** - on any error, drop through to read the next record from file
 */
-	if ((nzdabPtr = mLastRecord) != NULL) {
-	
-		// reset our last record pointer
-		mLastRecord = NULL;
-		
-		// get pointer to first word after bank data (the i/o control word)
-		u_int32 *ioControlPtr = (u_int32 *)(nzdabPtr + 1) + nzdabPtr->data_words;
-		
-		// make sure the ioControlPtr is in the buffer
-		if (ioControlPtr < mBuffPtr32) {
-		
-			// swap the i/o control word
-			SWAP_INT32(ioControlPtr,1);
-			
-			// get length of the next zdab header (lower 16 bits of i/o control word)
-			// - for some reason this is actually 3 greater than the actual
-			// size of the header which is a minimum of 9 words
-			// (not counting the i/o control word as part of the header)
-			u_int32 hdrLen = (*ioControlPtr & 0x0000ffffUL);
-			
-			// make sure the header is at least the minimum size
-			if (hdrLen >= 12) {
-			
-				// get pointer to next bank header
-				nzdabPtr = (nZDAB *)(ioControlPtr + hdrLen - 2) - 1;
-				
-				// make sure the next header is contained in the buffer
-				if ((u_int32 *)(nzdabPtr+1) <= mBuffPtr32) {
-				
-					// swap the next zdab header
-					SWAP_INT32(nzdabPtr, NZDAB_WORD_SIZE);
-					
-					// make sure the data is contained in the buffer
-					if ((u_int32 *)(nzdabPtr+1)+nzdabPtr->data_words <= mBuffPtr32) {
-					
-						if (sVerbose > 1) {
-							printf("-- same block --\n");
-						}
-						// success!! -- we have a good zdab record.
-						// save the pointer in mLastRecord and return it
-						return(mLastRecord = nzdabPtr);
-					}
-				}
-			}
-		}
+	if (mLastRecord != NULL) {
+		nzdabPtr = ChainedRecordT<Order>(mLastRecord, mBuffPtr32);
+		mLastRecord = nzdabPtr;
+		if (nzdabPtr) return(nzdabPtr);
 	}
 /*
 ** loop through Zebra records from file
@@ -177,12 +367,19 @@ nZDAB *PZdabFile::NextRecord()
 	
 		if( mBufferEmpty ) {   // need to read in new buffer
 		
-			n = fread( &daqST, sizeof(daqST), 1, mFile );
-			if (n != 1) {
-				printf("Unexpected EOF while reading zdab file!\x07\n");
-				return(0);
+			// (the first steering block was already read to find the byte order)
+			if (mHaveSteering) {
+				daqST = mSteering;
+				mHaveSteering = 0;
+			} else {
+				n = fread( &daqST, sizeof(daqST), 1, mFile );
+				if (n != 1) {
+					printf("Unexpected EOF while reading zdab file!\x07\n");
+					return(0);
+				}
+				mFilePos += sizeof(daqST);
 			}
-			SWAP_INT32( &daqST, 8 );
+			Order::Words( daqST.MPR, 8 );
 			
 			/* check zebra signature - PH 07/03/98 */
 			if( daqST.MPR[0] != ZEBRA_SIG0 || daqST.MPR[1] != ZEBRA_SIG1 ||
@@ -209,6 +406,10 @@ nZDAB *PZdabFile::NextRecord()
 				nw_count = block_size * ( 1 + daqST.MPR[7] ) - 8;
 			}
 			
+			if (mResync) {
+				// the bank number of the block we seeked to
+				mBlockCount = daqST.MPR[5];
+			}
 			if( daqST.MPR[5] != mBlockCount ) {
 				printf("Wrong ZEBRA bank number: %ld (should be %ld)\n",
 							(long)daqST.MPR[5], (long)mBlockCount );
@@ -230,15 +431,17 @@ nZDAB *PZdabFile::NextRecord()
 					printf("Out of memory for ZDAB record buffer!\x07\n");
 					return(0);
 				}
-				// copy any old zdab data into new (larger) buffer
-				if (mWordOffset) {
-					memcpy(new_buffer, mRecBuffer, mWordOffset * sizeof(u_int32));
-				}
 				// install new buffer
-				Free();	// free old zdab buffer
+				// (this buffer holds no records in use -- they are in the other one)
+				free(mRecBuffer);	// free old zdab buffer
 				mRecBuffer = new_buffer;
 				mRecBuffsize = new_buffsize;
 			}
+			// copy the remaining record from the other buffer
+			if (mWordOffset) {
+				memcpy(mRecBuffer, mLeftover, mWordOffset * sizeof(u_int32));
+			}
+			SetSegments(mFilePos);
 			n = fread( mRecBuffer+mWordOffset, sizeof(u_int32), nw_count, mFile );
 			if ((u_int32)n != nw_count) {
 				if (!n) {
@@ -248,11 +451,24 @@ nZDAB *PZdabFile::NextRecord()
 				nw_count = n;
 				mWordsTotal = nw_count + mWordOffset;
 			}
+			mFilePos += (int64_t)nw_count * sizeof(u_int32);
 			mBuffPtr32 = mRecBuffer;
 			mWordOffset = 0;
 			mBytesRead = 0;
 			mBytesTotal = mWordsTotal * sizeof(u_int32);
 			mBufferEmpty = 0;
+			
+			if (mResync) {
+				// skip the end of a logical record started in an earlier block
+				u_int32 skip = daqST.MPR[6] - sizeof(ZEBRA_ST) / sizeof(u_int32);
+				if (daqST.MPR[6] < sizeof(ZEBRA_ST) / sizeof(u_int32) || skip >= mWordsTotal) {
+					mBufferEmpty = 1;	// nothing starts in this block
+					continue;
+				}
+				mBuffPtr32 += skip;
+				mBytesRead = skip * sizeof(u_int32);
+				mResync = 0;
+			}
 
 		} else {	// still has data in buffer, search for zdab banks   
 
@@ -268,7 +484,7 @@ nZDAB *PZdabFile::NextRecord()
 				}
 
 				pHPtr = (pilotHeaderPtr)mBuffPtr32;
-				SWAP_INT32( pHPtr, 12 );
+				Order::Words( (u_int32 *)pHPtr, 12 );
 				controlPtr = &( pHPtr->control );
 				pilotPtr = &( pHPtr->pilot );
 				recLength = (u_int32)( controlPtr->length );
@@ -280,7 +496,7 @@ nZDAB *PZdabFile::NextRecord()
 					if( nb_to_read <= mBytesTotal ) {						
 						mBuffPtr32 += ( recLength + 1 );
 						mBytesRead = nb_to_read;
-						SWAP_INT32( pHPtr, 12 );     //undo swapping .....
+						Order::Words( (u_int32 *)pHPtr, 12 );     //undo swapping .....
 						continue;
 					}
 				} else if( recType == 2 || recType == 3 || recType == 4 ) {  // normal data
@@ -295,7 +511,7 @@ nZDAB *PZdabFile::NextRecord()
 							printf("Error 1 reading zdab file\x07\n");
 							return(0);
 						}
-						SWAP_INT32( skip32Ptr, 1 );	/* swap zdab offset word */
+						Order::Words( skip32Ptr, 1 );	/* swap zdab offset word */
 						
 						/* get pointer to start of zdab record header */
 						skip32Ptr += ( *skip32Ptr & 0x0000ffff ) - 12 + 1;
@@ -316,7 +532,7 @@ nZDAB *PZdabFile::NextRecord()
 							printf("Error 3 reading zdab file\x07\n");
 							return(0);
 						}
-						SWAP_INT32(nzdabPtr, 9);	// swap the zdab header
+						Order::Words((u_int32 *)nzdabPtr, 9);	// swap the zdab header
 						
 						// make sure the bank data is contained in our buffer
 						if ((u_int32 *)(nzdabPtr+1)+nzdabPtr->data_words > mBuffPtr32) {
@@ -335,7 +551,7 @@ nZDAB *PZdabFile::NextRecord()
 					if( nb_to_read <= mBytesTotal ) {						
 						mBuffPtr32 += ( recLength + 2 );
 						mBytesRead = nb_to_read;
-						SWAP_INT32( pHPtr, 12 );     //undo swapping .....
+						Order::Words( (u_int32 *)pHPtr, 12 );     //undo swapping .....
 						continue;
 					}
 				} else {
@@ -344,7 +560,7 @@ nZDAB *PZdabFile::NextRecord()
 					return(0);
 				}
 				// swap back pHPtr because we're going to try again
-				SWAP_INT32( pHPtr, 12 );
+				Order::Words( (u_int32 *)pHPtr, 12 );
 			}
 			// calculate word offset of end of remaining record in buffer
 			mWordOffset = ( mBytesTotal - mBytesRead ) / sizeof(u_int32);
@@ -353,14 +569,44 @@ nZDAB *PZdabFile::NextRecord()
 				printf("Record too large!\x07\n");
 				return(0);
 			}				
-			// move remaining data to the beginning of buffer 
-			memmove( (char *)mRecBuffer, (char *)mBuffPtr32, mWordOffset * sizeof(u_int32) );	
+			// leave records of a batch in this buffer if it can't be switched now
+			if (mHoldBuffers) {
+				mBuffersHeld = 1;
+				return(0);
+			}
+			// switch buffers, leaving this one intact so records returned from
+			// it stay valid, and move the remaining data to the beginning of the
+			// other one when the next physical record is read into it
+			SwitchBuffers();
 			mBufferEmpty = 1;
 		}								
 	}
 }
 
 
+// SwitchBuffers - make the other record buffer current
+// - the remaining data at mBuffPtr32 is left in the buffer being switched out
+void PZdabFile::SwitchBuffers()
+{
+	u_int32			*buffer = mRecBuffer;
+	u_int32			buffsize = mRecBuffsize;
+	BufferSegment	segment[MAX_BUFFER_SEGMENTS];
+	int				num = mNumSegments;
+	
+	mLeftover = mBuffPtr32;
+	mRecBuffer = mSpareBuffer;
+	mRecBuffsize = mSpareBuffsize;
+	mSpareBuffer = buffer;
+	mSpareBuffsize = buffsize;
+	memcpy(segment, mSegment, sizeof(segment));
+	memcpy(mSegment, mSpareSegment, sizeof(segment));
+	memcpy(mSpareSegment, segment, sizeof(segment));
+	mNumSegments = mNumSpareSegments;
+	mNumSpareSegments = num;
+	++mBufferSwaps;
+}
+
+
 // get pointer to next PmtEventRecord in zdab file
 // Returns: pointer to PmtEventRecord (native format) or NULL on error or EOF
 PmtEventRecord *PZdabFile::NextPmt()
@@ -395,11 +641,21 @@ u_int32 *PZdabFile::NextBank(u_int32 bank_name)
 
 
 // GetPmtRecord - analyze this nZDAB record
-// Accepts: pointer to nZDAB record (external format)
+// Accepts: pointer to nZDAB record (file byte order)
 // Returns: pointer to the PmtEventRecord (native format) if it has one. 
 //          Otherwise, returns NULL
 // Swaps: PmtEventRecord to native format
 PmtEventRecord *PZdabFile::GetPmtRecord(nZDAB *nzdabPtr)
+{
+	if (GetFileSwap()) {
+		return(GetPmtRecordT<ByteSwap>(nzdabPtr));
+	} else {
+		return(GetPmtRecordT<NoSwap>(nzdabPtr));
+	}
+}
+
+template <class Order>
+PmtEventRecord *PZdabFile::GetPmtRecordT(nZDAB *nzdabPtr)
 {
 	PmtEventRecord *pmtEventPtr;
 	// test the bank name
@@ -409,7 +665,8 @@ PmtEventRecord *PZdabFile::GetPmtRecord(nZDAB *nzdabPtr)
 		}
 		pmtEventPtr = (PmtEventRecord *)(nzdabPtr + 1);
 		
-		SWAP_PMT_RECORD( pmtEventPtr );		// swap the PmtEventRecord into native format
+		// swap the PmtEventRecord into native format
+		Order::Words( (u_int32 *)pmtEventPtr, WORD_SIZE(PmtEventRecord) );
 
 		int npmt = pmtEventPtr->NPmtHit;
 		
@@ -421,7 +678,7 @@ PmtEventRecord *PZdabFile::GetPmtRecord(nZDAB *nzdabPtr)
 		}  else {
 		
 			// swap the hit data
-			SWAP_INT32( pmtEventPtr + 1, 3 * npmt );
+			Order::Words( (u_int32 *)(pmtEventPtr + 1), 3 * npmt );
 #ifdef DEBUG_EXTENDED_ZDAB
 			static int count = 0;
 			printf("ZDAB %2d) %d hits\n",++count,npmt);
@@ -430,15 +687,13 @@ PmtEventRecord *PZdabFile::GetPmtRecord(nZDAB *nzdabPtr)
 			u_int32	*sub_header = &pmtEventPtr->CalPckType;
 			while (*sub_header & SUB_NOT_LAST) {
 				sub_header += (*sub_header & SUB_LENGTH_MASK);
-				SWAP_INT32( sub_header, 1 );	// swap the sub-field header
+				Order::Words( sub_header, 1 );	// swap the sub-field header
 				// get number of data words (-1 because we don't want to include header size)
-#if defined(SWAP_BYTES) || defined(DEBUG_EXTENDED_ZDAB)
 				u_int32 data_words = (*sub_header & SUB_LENGTH_MASK) - 1;
-#endif
 #ifdef DEBUG_EXTENDED_ZDAB
 				printf("  Sub-field %d - %d words\n", (int)(*sub_header >> SUB_TYPE_BITNUM),(int)data_words);
 #endif			
-				SWAP_INT32( sub_header+1, data_words );
+				Order::Words( sub_header+1, data_words );
 			}
 			
 			// Disable the extended PmtEventRecord feature:
@@ -468,7 +723,7 @@ PmtEventRecord *PZdabFile::GetPmtRecord(nZDAB *nzdabPtr)
 
 
 // GetBank - get specified type to bank data (or any type if bank_name is 0)
-// Accepts: pointer to nZDAB record (native format) with bank data (external format)
+// Accepts: pointer to nZDAB record (native format) with bank data (file byte order)
 // Returns: pointer to bank data (native format)
 // Swaps: data to native format if specified type
 u_int32 *PZdabFile::GetBank(nZDAB *nzdabPtr, u_int32 bank_name)
@@ -480,7 +735,7 @@ u_int32 *PZdabFile::GetBank(nZDAB *nzdabPtr, u_int32 bank_name)
 		// get pointer to bank data
 		dataPt = (u_int32 *)(nzdabPtr + 1);
 		// swap the bank data
-		SWAP_INT32(dataPt, nzdabPtr->data_words);
+		if (GetFileSwap()) ByteSwap::Words(dataPt, nzdabPtr->data_words);
 	} else {
 		dataPt = NULL;		// not the specified type of bank
 	}
@@ -488,6 +743,26 @@ u_int32 *PZdabFile::GetBank(nZDAB *nzdabPtr, u_int32 bank_name)
 	return(dataPt);
 }
 
+// CopyToNative - copy data from the file byte order to native format
+void PZdabFile::CopyToNative(u_int32 *dst, const u_int32 *src, u_int32 num)
+{
+	if (GetFileSwap()) {
+		ByteSwap::Copy(dst, src, num);
+	} else {
+		NoSwap::Copy(dst, src, num);
+	}
+}
+
+// CopyToExternal - copy data from the file byte order to external format
+void PZdabFile::CopyToExternal(u_int32 *dst, const u_int32 *src, u_int32 num)
+{
+	if (IsExternalOrder()) {
+		NoSwap::Copy(dst, src, num);
+	} else {
+		ByteSwap::Copy(dst, src, num);
+	}
+}
+
 
 // BankName - convert string to bank name (native format)
 // - string must be 4 characters long (this is not validated)
@@ -728,46 +1003,117 @@ void PZdabFile::AddSubField(u_int32 **io_sub_header_pt, int sub_type, u_int32 nu
 	*io_sub_header_pt = sub_header;
 }
 
+// BuildDir - build the sub-field directory of a PMT record
+// - Order converts the words of the record to native format as they are read
+template <class Order>
+static void BuildDir(PmtEventRecord *pmtRecord, u_int32 maxWords, SubFieldDir *dir)
+{
+	u_int32 *pmtWords = (u_int32 *)pmtRecord;
+	u_int32 pmtHeaderWords = sizeof(aPmtEventRecord) / sizeof(u_int32);
+	
+	memset(dir, 0, sizeof(SubFieldDir));
+	if (maxWords < pmtHeaderWords) {
+		dir->error = 1;
+		return;
+	}
+	// (NPmtHit is the low 16 bits of the word once it is in native format)
+	u_int32 npmt = Order::Word(pmtWords[3]) & 0xffff;
+	dir->size = sizeof(aPmtEventRecord) + 12 * npmt;
+	
+	u_int32 offset = (u_int32 *)&pmtRecord->CalPckType - pmtWords;
+	u_int32 header = Order::Word(pmtWords[offset]);
+	while (header & SUB_NOT_LAST) {
+		u_int32 jump = (header & SUB_LENGTH_MASK);
+		if (jump == 0 || offset + jump >= maxWords) {
+			dir->error = 1;
+			break;
+		}
+		offset += jump;
+		header = Order::Word(pmtWords[offset]);
+		u_int32 length = (header & SUB_LENGTH_MASK);
+		if (offset + length > maxWords) {
+			dir->error = 1;
+			break;
+		}
+		dir->size += length * sizeof(u_int32);
+		if (dir->count < MAX_SUB_FIELDS) {
+			SubFieldEntry *entry = dir->entry + dir->count;
+			entry->type = header >> SUB_TYPE_BITNUM;
+			entry->offset = offset;
+			entry->length = length;
+			++dir->count;
+			if (entry->type < SUB_TYPE_SLOTS && !dir->slot[entry->type]) {
+				dir->slot[entry->type] = dir->count;
+			}
+		}
+	}
+}
+
+// BuildSubFieldDir [static]
+// build the sub-field directory of a PMT record in a single walk of the chain
+// pmtRecord - pointer to pmt record (it is not modified)
+// maxWords - size of the buffer containing the record (bounds the walk)
+// swap - non-zero if the record is in the opposite byte order to the host
+void PZdabFile::BuildSubFieldDir(PmtEventRecord *pmtRecord, u_int32 maxWords,
+								 int swap, SubFieldDir *dir)
+{
+	if (swap) {
+		BuildDir<ByteSwap>(pmtRecord, maxWords, dir);
+	} else {
+		BuildDir<NoSwap>(pmtRecord, maxWords, dir);
+	}
+}
+
+// FindSubField [static]
+// return directory entry for the first sub-field of the specified type (or NULL)
+SubFieldEntry *PZdabFile::FindSubField(SubFieldDir *dir, int subType)
+{
+	if (subType >= 0 && subType < SUB_TYPE_SLOTS) {
+		int n = dir->slot[subType];
+		return(n ? dir->entry + n - 1 : NULL);
+	}
+	for (int i=0; i<dir->count; ++i) {
+		if ((int)dir->entry[i].type == subType) return(dir->entry + i);
+	}
+	return(NULL);
+}
+
+// GetSubFieldDir
+// get the sub-field directory of a ZDAB record returned by NextRecord()
+// - the bank data is in the file byte order and is not modified
+// - the directory is built once and reused until the next record is read
+SubFieldDir *PZdabFile::GetSubFieldDir(nZDAB *nzdabPtr)
+{
+	if (nzdabPtr != mSubDirRecord) {
+		BuildSubFieldDir((PmtEventRecord *)(nzdabPtr + 1), nzdabPtr->data_words,
+						 GetFileSwap(), &mSubDir);
+		mSubDirRecord = nzdabPtr;
+	}
+	return(&mSubDir);
+}
+
 // getExtendedData [static]
 // get pointer to specified extended data in PMT record
 u_int32 *PZdabFile::GetExtendedData(PmtEventRecord *pmtRecord, int subType)
 {
-    u_int32 *theData = NULL;
-    u_int32	*sub_header = &pmtRecord->CalPckType;
-    while (*sub_header & SUB_NOT_LAST) {
-        sub_header += (*sub_header & SUB_LENGTH_MASK);
-        if ((int)(*sub_header >> SUB_TYPE_BITNUM) == subType) {
-            theData = (u_int32 *)(sub_header + 1);
-            break;
-        }
-    }
-    return(theData);
+	SubFieldDir dir;
+	BuildSubFieldDir(pmtRecord, MAX_BUFFSIZE/4, 0, &dir);
+	SubFieldEntry *entry = FindSubField(&dir, subType);
+	if (!entry) return(NULL);
+	return((u_int32 *)pmtRecord + entry->offset + 1);
 }
 
 // GetSize - get the size of a PMT event record (including sub-fields)
 // pmtRecord - pointer to pmt record in native format
 u_int32 PZdabFile::GetSize(PmtEventRecord *pmtRecord)
 {
-	/* create new buffer for event */
-	u_int32 event_size = sizeof(aPmtEventRecord) + 12 * pmtRecord->NPmtHit;
-		
-	/* make room for sub-headers */
-	u_int32	*sub_header = &pmtRecord->CalPckType;
-    SWAP_INT32(sub_header, 1);
-	while (*sub_header & SUB_NOT_LAST) {
-        u_int32 jump = (*sub_header & SUB_LENGTH_MASK);
-        if( jump > MAX_BUFFSIZE/4 ){
-            printf("Error: wanted to jump past the end of the buffer");
-            return(0);
-        }
-        if( jump > event_size )
-            printf("Warning: jump to subrecord suspiciously far");
-		sub_header += jump;
-		event_size += (*sub_header & SUB_LENGTH_MASK) * sizeof(u_int32);
-	}
-    SWAP_INT32(sub_header, 1);
-
-	return(event_size);
+	SubFieldDir dir;
+	BuildSubFieldDir(pmtRecord, MAX_BUFFSIZE/4, 0, &dir);
+	if (dir.error) {
+		printf("Error: wanted to jump past the end of the buffer");
+		return(0);
+	}
+	return(dir.size);
 }
 
 
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include "Record_Info.h"
 
+// (these convert between the host order and the external format in place)
 #ifdef SWAP_BYTES
 #define SWAP_INT32(a,b)	swap_bytes((char *)(a),(b), sizeof(int32))
 #define SWAP_INT16(a,b)	swap_bytes((char *)(a),(b), sizeof(int16))
@@ -29,6 +30,12 @@
 /* definitions require for ZDAB/ZEBRA */
 
 #define ZEBRA_BLOCKSIZE 		3840		// maximum size of zebra record (32-bit words)
+#define MAX_BUFFSIZE			0x400000UL	// maximum size of zdab record buffer (4 MB)
+
+// the builder won't put out events with NHIT > 10000
+// (note that these are possible due to hardware problems)
+// but XSNOED can write an event with up to 10240 channels
+#define MAX_NHIT				10240
 
 /* flag bits for steering block MPR[4] - PH 07/03/98 */
 #define ZEBRA_EMERGENCY_STOP	0x80000000UL
@@ -102,22 +109,58 @@ typedef  struct pilotHeader{
 	PILOT     pilot;				// 10 u_int32 : Pilot (ZEBRA)
 } pilotHeader, *pilotHeaderPtr;
 
-class PackedCharArray {
+// array of characters packed into 32-bit words which have been converted
+// with the Order policy (characters are stored in big-endian word order)
+template <class Order>
+class PackedCharArrayT {
 public:
-    PackedCharArray(char *data)      { mData = data; }
+    PackedCharArrayT(char *data)     { mData = data; }
 
-#ifdef SWAP_BYTES
-    char    Get(int index)           { return(mData[index ^ 0x03]); }
-    void    Set(int index, char val) { mData[index ^ 0x03] = val;   }
-#else
-    char    Get(int index)           { return(mData[index]); }
-    void    Set(int index, char val) { mData[index] = val;   }
-#endif
+    char    Get(int index)           { return(mData[index ^ (Order::kSwap ? 0x03 : 0)]); }
+    void    Set(int index, char val) { mData[index ^ (Order::kSwap ? 0x03 : 0)] = val; }
 
 private:
     char    *mData;
 };
 
+typedef PackedCharArrayT<HostToExternal> PackedCharArray;
+
+// sub-field directory of a PMT event record
+// - built in a single walk of the sub-field chain so the chain need not
+//   be walked again for each sub-field that is looked up
+#define MAX_SUB_FIELDS			8		// maximum number of sub-fields in the directory
+#define SUB_TYPE_SLOTS			64		// sub-field types which can be looked up directly
+
+typedef struct SubFieldEntry {
+	u_int32		type;			// sub-field type
+	u_int32		offset;			// offset of sub-field header from start of PMT record (words)
+	u_int32		length;			// length of sub-field including header (words)
+} SubFieldEntry;
+
+typedef struct SubFieldDir {
+	u_int32			size;		// size of PMT record including sub-fields (bytes)
+	int				count;		// number of sub-fields in directory
+	int				error;		// non-zero if the sub-field chain was corrupt
+	unsigned char	slot[SUB_TYPE_SLOTS];	// index+1 of first entry for each type (0=none)
+	SubFieldEntry	entry[MAX_SUB_FIELDS];
+} SubFieldDir;
+
+// handle to a record returned by PZdabFile::NextRecords()
+typedef struct ZdabRecordRef {
+	nZDAB		  *	rec;			// nZDAB record (as returned by NextRecord())
+	u_int32			bank_name;		// hollerith name bank-id
+	u_int32			length;			// number of data words
+	int64_t			file_offset;	// byte offset of bank header in file (-1 if unknown)
+} ZdabRecordRef;
+
+// contiguous run of words in a record buffer that were read from the file
+#define MAX_BUFFER_SEGMENTS		8
+
+typedef struct BufferSegment {
+	u_int32		start;			// index of first word in buffer
+	int64_t		offset;			// file byte offset of first word (-1 if unknown)
+} BufferSegment;
+
 //-------------------------------------------------------------------------
 
 
@@ -133,19 +176,44 @@ public:
 	// return next nZDAB record from file
 	nZDAB				  *	NextRecord();
 	
+	// return next batch of up to 'max' records from file
+	// - the records stay valid until the next call to NextRecord[s]()
+	// - saves the per-call overhead of NextRecord(), not the per-record checks
+	int						NextRecords(ZdabRecordRef *refs, int max);
+	
+	// continue reading at the physical record starting at word block*ZEBRA_BLOCKSIZE
+	// (must be a steering block, not a fast block; the input must be seekable)
+	int						SeekBlock(u_int32 block);
+	
+	// number of bytes read from the file so far
+	int64_t					GetFilePos()		{ return mFilePos; }
+	
+	// byte order of the file (detected from the first steering block)
+	// - the bank data returned by NextRecord() is left in the file byte order
+	int						GetFileSwap()		{ return mFileSwap > 0; }
+	int						IsExternalOrder()	{ return GetFileSwap() == HostToExternal::kSwap; }
+	void					CopyToNative(u_int32 *dst, const u_int32 *src, u_int32 num);
+	void					CopyToExternal(u_int32 *dst, const u_int32 *src, u_int32 num);
+	
 	// return next specified data type from file
 	PmtEventRecord		  *	NextPmt();
 	u_int32				  *	NextBank(u_int32 bank_name);
 	
 	// extract various records from nZDAB record
 	PmtEventRecord		  *	GetPmtRecord(nZDAB *nzdabPtr);
-	static u_int32		  *	GetBank(nZDAB *nzdabPtr, u_int32 bank_name=0);
+	u_int32				  *	GetBank(nZDAB *nzdabPtr, u_int32 bank_name=0);
 	
 	static u_int32			GetSize(PmtEventRecord *pmtRecord);
 	static u_int32        * GetExtendedData(PmtEventRecord *pmtRecord, int subType);
 	static u_int32        * GetNcdData(PmtEventRecord *pmtRecord)
 	                            { return GetExtendedData(pmtRecord, SUB_TYPE_NCD); }
-	
+
+	// sub-field directory of a ZDAB record (built once per record)
+	SubFieldDir			  *	GetSubFieldDir(nZDAB *nzdabPtr);
+	static void				BuildSubFieldDir(PmtEventRecord *pmtRecord, u_int32 maxWords,
+											 int swap, SubFieldDir *dir);
+	static SubFieldEntry  *	FindSubField(SubFieldDir *dir, int subType);
+
 #if 0
         static void				DumpRecord(u_int32 *bankData, int bankSize, u_int32 bankName, u_int32 lastGTID=0);
 	static void				DumpRecord(nZDAB *nzdabPtr, u_int32 lastGTID=0);
@@ -164,21 +232,88 @@ protected:
 	FILE		  *	mFile;
 
 private:
+	int						FindFileOrder();
+	template <class Order> nZDAB *NextRecordT();
+	template <class Order> int NextRecordsT(ZdabRecordRef *refs, int max);
+	template <class Order> nZDAB *ChainedRecordT(nZDAB *prev, u_int32 *end);
+	void					SwitchBuffers();
+	void					SetSegments(int64_t dataPos);
+	int64_t					GetFileOffset(u_int32 *ptr);
+	template <class Order> PmtEventRecord *GetPmtRecordT(nZDAB *nzdabPtr);
 
+	int				mFileSwap;			// file byte order is opposite to host (-1 if unknown)
+	int				mHaveSteering;		// mSteering was read to find the byte order
+	ZEBRA_ST		mSteering;			// first steering block (file byte order)
 	u_int32			mWordOffset;
 	u_int32			mBlockCount, mRecordCount;
 	int				mBufferEmpty;
 	u_int32		  *	mRecBuffer;
 	u_int32			mRecBuffsize;		// size of temporary ZDAB buffer
+	u_int32		  *	mSpareBuffer;		// buffer of the previous physical record
+	u_int32			mSpareBuffsize;
+	u_int32		  *	mLeftover;			// remaining data in mSpareBuffer to carry over
+	BufferSegment	mSegment[MAX_BUFFER_SEGMENTS];		// file segments of mRecBuffer
+	BufferSegment	mSpareSegment[MAX_BUFFER_SEGMENTS];	// file segments of mSpareBuffer
+	int				mNumSegments, mNumSpareSegments;
+	int64_t			mFilePos;			// number of bytes read from file
+	u_int32			mBufferSwaps;		// number of times the buffers were switched
+	int				mHoldBuffers;		// don't switch buffers (records of a batch in both)
+	int				mBuffersHeld;		// NextRecordT() stopped because of mHoldBuffers
+	int				mEndOfFile;			// NextRecords() reached the end of file
+	int				mResync;			// skip to the first logical record of the next block
 	u_int32		  *	mBuffPtr32;
 	u_int32			mBytesRead, mWordsTotal, mBytesTotal;
 	u_int32			mLastGTID;
 	nZDAB		  *	mLastRecord;
-	
+	nZDAB		  *	mSubDirRecord;		// record described by mSubDir (NULL if none)
+	SubFieldDir		mSubDir;
+
 	static int		sVerbose;		// 0=off, 1=dump records, 2=hex dump non-zdab, 3=hex dump all
 };
 
 
+// range over the remaining records of a file, read in batches with NextRecords()
+// e.g.  for (ZdabRecordRef &ref : ZdabRecordRange(zfile)) { ... ref.rec ... }
+// - a record stays valid until the iteration moves past the end of its batch
+#define ZDAB_RECORD_BATCH		64
+
+class ZdabRecordRange {
+public:
+	class iterator {
+	public:
+						iterator(ZdabRecordRange *range)	{ mRange = range; }
+		
+		ZdabRecordRef &	operator*() const	{ return(mRange->mRefs[mRange->mPos]); }
+		ZdabRecordRef *	operator->() const	{ return(mRange->mRefs + mRange->mPos); }
+		iterator	  &	operator++()		{ mRange->Advance(); return(*this); }
+		bool			operator!=(const iterator &it) const { return(AtEnd() != it.AtEnd()); }
+		bool			AtEnd() const		{ return(!mRange || mRange->mPos >= mRange->mNum); }
+		
+	private:
+		ZdabRecordRange	  *	mRange;
+	};
+	
+					ZdabRecordRange(PZdabFile *zfile, int batchSize=ZDAB_RECORD_BATCH)
+						{ mFile = zfile; mBatchSize = batchSize > ZDAB_RECORD_BATCH ?
+						  ZDAB_RECORD_BATCH : batchSize; mNum = mPos = 0; }
+	
+	iterator		begin()		{ Fill(); return(iterator(this)); }
+	iterator		end()		{ return(iterator(NULL)); }
+	
+	// current batch (for consumers which divide up the records of a batch)
+	ZdabRecordRef *	GetBatch(int &num)	{ num = mNum - mPos; return(mRefs + mPos); }
+	int				Fill()		{ mPos = 0; return(mNum = mFile->NextRecords(mRefs, mBatchSize)); }
+	
+private:
+	void			Advance()	{ if (++mPos >= mNum) Fill(); }
+	
+	PZdabFile	  *	mFile;
+	int				mBatchSize;
+	int				mNum, mPos;
+	ZdabRecordRef	mRefs[ZDAB_RECORD_BATCH];
+};
+
+
 extern "C" {
 	int	zdab_get_subrun(char *filename);
 	int zdab_set_subrun(char *filename, int subrun);
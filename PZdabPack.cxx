@@ -0,0 +1,524 @@
+/* Packed-hit zdab format - see PZdabPack.h for a description of the format */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "PZdabPack.h"
+
+#define BLOCK_HEADER_SIZE   16      // bytes in block header
+#define INDEX_ENTRY_SIZE    16      // bytes in block index entry
+#define FOOTER_SIZE         16      // bytes in footer
+#define HIT_SIZE            8       // bytes in packed hit (without extensions)
+#define NO_GTID             0xffffffffUL
+
+// hit words (native format)
+#define HIT_LCN(w)          ( (UNPK_CRATE_ID(w) << 9) | (UNPK_BOARD_ID(w) << 5) | UNPK_CHANNEL_ID(w) )
+#define HIT_FLAGS(w)        ( (*(w) >> 30) | ((*((w)+1) >> 28) << 2) )
+
+static void PutWord(std::vector<unsigned char> &buff, u_int32 val)
+{
+    for (int i=0; i<4; ++i, val>>=8) buff.push_back(val & 0xff);
+}
+
+static void PutVarint(std::vector<unsigned char> &buff, uint64_t val)
+{
+    while (val >= 0x80) {
+        buff.push_back((val & 0x7f) | 0x80);
+        val >>= 7;
+    }
+    buff.push_back(val);
+}
+
+static void PutSigned(std::vector<unsigned char> &buff, int64_t val)
+{
+    PutVarint(buff, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+static u_int32 GetLE32(const unsigned char *pt)
+{
+    return(pt[0] | (pt[1] << 8) | (pt[2] << 16) | ((u_int32)pt[3] << 24));
+}
+
+static int WriteBytes(FILE *fp, std::vector<unsigned char> &buff)
+{
+    return(buff.size() && fwrite(&buff[0], buff.size(), 1, fp) != 1);
+}
+
+//===================================================================================
+// PZdabPacker
+
+PZdabPacker::PZdabPacker(FILE *file)
+{
+    mFile = file;
+    mError = 0;
+    mFilePos = 0;
+    mNumRecords = 0;
+    mFirstGTID = NO_GTID;
+    mLastGTID = mLastRun = 0;
+    mLastBc10 = mLastBc50 = 0;
+
+    if (!mFile) {
+        mError = 1;
+        return;
+    }
+    PutWord(mBlock, PACK_FILE_MAGIC);
+    PutWord(mBlock, PACK_VERSION);
+    if (WriteBytes(mFile, mBlock)) {
+        printf("Error writing packed zdab file!\x07\n");
+        mError = 1;
+    }
+    mFilePos = mBlock.size();
+    mBlock.clear();
+}
+
+PZdabPacker::~PZdabPacker()
+{
+    Close();
+}
+
+// write the last block and the block index
+// - the file itself is left open
+// - returns non-zero if any error occurred
+int PZdabPacker::Close()
+{
+    if (!mFile) return(mError);
+
+    if (!WriteBlock()) {
+        std::vector<unsigned char> buff;
+        PutWord(buff, PACK_INDEX_MAGIC);
+        PutWord(buff, mIndex.size());
+        for (size_t i=0; i<mIndex.size(); ++i) {
+            PutWord(buff, (u_int32)mIndex[i].offset);
+            PutWord(buff, (u_int32)(mIndex[i].offset >> 32));
+            PutWord(buff, mIndex[i].gtid);
+            PutWord(buff, mIndex[i].nrecords);
+        }
+        PutWord(buff, (u_int32)mFilePos);
+        PutWord(buff, (u_int32)(mFilePos >> 32));
+        PutWord(buff, mIndex.size());
+        PutWord(buff, PACK_INDEX_MAGIC);
+        if (WriteBytes(mFile, buff) || fflush(mFile)) {
+            printf("Error writing packed zdab file!\x07\n");
+            mError = 1;
+        }
+    }
+    mFile = NULL;
+    return(mError);
+}
+
+// write out the current block - returns non-zero on error
+int PZdabPacker::WriteBlock()
+{
+    if (mError) return(mError);
+    if (!mNumRecords) return(0);
+
+    std::vector<unsigned char> header;
+    PutWord(header, PACK_BLOCK_MAGIC);
+    PutWord(header, mNumRecords);
+    PutWord(header, mFirstGTID);
+    PutWord(header, mBlock.size());
+    if (WriteBytes(mFile, header) || WriteBytes(mFile, mBlock)) {
+        printf("Error writing packed zdab file!\x07\n");
+        return(mError = 1);
+    }
+    SPackBlock blk = { mFilePos, mFirstGTID, mNumRecords };
+    mIndex.push_back(blk);
+    mFilePos += header.size() + mBlock.size();
+
+    // start a new block
+    mBlock.clear();
+    mNumRecords = 0;
+    mFirstGTID = NO_GTID;
+    mLastGTID = mLastRun = 0;
+    mLastBc10 = mLastBc50 = 0;
+    return(0);
+}
+
+// add a PMT event record of nwords words
+int PZdabPacker::AddEvent(PmtEventRecord *pmtRecord, u_int32 nwords)
+{
+    const u_int32 nhdr = WORD_SIZE(PmtEventRecord);
+    u_int32 *data = (u_int32 *)pmtRecord;
+    u_int32 *mtc = (u_int32 *)&pmtRecord->TriggerCardData;
+    u_int32 nhit = pmtRecord->NPmtHit;
+
+    if (mError) return(mError);
+
+    // store records we can't take apart as they are
+    if (nwords < nhdr + 3 * nhit) {
+        return(AddBank(ZDAB_RECORD, data, nwords));
+    }
+    u_int32 gtid = UNPK_MTC_GT_ID(mtc);
+    uint64_t bc10 = UNPK_MTC_BC10_1(mtc) | ((uint64_t)UNPK_MTC_BC10_2(mtc) << 32);
+    uint64_t bc50 = UNPK_MTC_BC50_1(mtc) | ((uint64_t)UNPK_MTC_BC50_2(mtc) << 11);
+
+    if (mFirstGTID == NO_GTID) mFirstGTID = gtid;
+
+    mBlock.push_back(PACK_EVENT);
+    PutSigned(mBlock, (int64_t)gtid - mLastGTID);
+    mBlock.push_back(mtc[3] >> 24);
+    PutSigned(mBlock, (int64_t)(bc10 - mLastBc10));
+    PutSigned(mBlock, (int64_t)(bc50 - mLastBc50));
+    PutVarint(mBlock, mtc[4]);
+    PutVarint(mBlock, mtc[5]);
+    PutVarint(mBlock, data[0]);
+    PutSigned(mBlock, (int64_t)pmtRecord->RunNumber - mLastRun);
+    PutSigned(mBlock, (int32_t)(pmtRecord->EvNumber - gtid));
+    PutVarint(mBlock, nhit);
+    PutVarint(mBlock, pmtRecord->DaqStatus);
+    PutVarint(mBlock, pmtRecord->CalPckType);
+
+    // pack the hits
+    mHits.clear();
+    u_int32 *hit = data + nhdr;
+    u_int32 last_lcn = 0;
+    for (u_int32 i=0; i<nhit; ++i, hit+=3) {
+        u_int32 lcn = HIT_LCN(hit);
+        u_int32 hit_gtid = UNPK_FEC_GT_ID(hit);
+        int32_t delta = (int32_t)lcn - (int32_t)last_lcn;
+        uint64_t small = (delta > 0 && delta < 32) ? delta : 0;
+        uint64_t packed = (uint64_t)(hit[1] & 0xfff) |
+                          (uint64_t)((hit[1] >> 16) & 0xfff) << 12 |
+                          (uint64_t)(hit[2] & 0xfff) << 24 |
+                          (uint64_t)((hit[2] >> 16) & 0xfff) << 36 |
+                          (uint64_t)UNPK_CELL_ID(hit) << 48 |
+                          (uint64_t)HIT_FLAGS(hit) << 52 |
+                          (uint64_t)(hit_gtid != gtid) << 58 |
+                          small << 59;
+        for (int j=0; j<HIT_SIZE; ++j, packed>>=8) mHits.push_back(packed & 0xff);
+        if (!small) PutSigned(mHits, delta);
+        if (hit_gtid != gtid) {
+            for (int j=0; j<3; ++j, hit_gtid>>=8) mHits.push_back(hit_gtid & 0xff);
+        }
+        last_lcn = lcn;
+    }
+    PutVarint(mBlock, mHits.size());
+    mBlock.insert(mBlock.end(), mHits.begin(), mHits.end());
+
+    // sub-fields are stored as they are
+    u_int32 nextra = nwords - nhdr - 3 * nhit;
+    PutVarint(mBlock, nextra);
+    for (u_int32 i=0; i<nextra; ++i) PutWord(mBlock, hit[i]);
+
+    mLastGTID = gtid;
+    mLastRun = pmtRecord->RunNumber;
+    mLastBc10 = bc10;
+    mLastBc50 = bc50;
+
+    if (++mNumRecords >= PACK_BLOCK_RECORDS) return(WriteBlock());
+    return(0);
+}
+
+// add any other bank of nwords words
+int PZdabPacker::AddBank(u_int32 bank_name, u_int32 *data, u_int32 nwords)
+{
+    if (mError) return(mError);
+
+    mBlock.push_back(PACK_BANK);
+    PutWord(mBlock, bank_name);
+    PutVarint(mBlock, nwords);
+    for (u_int32 i=0; i<nwords; ++i) PutWord(mBlock, data[i]);
+
+    if (++mNumRecords >= PACK_BLOCK_RECORDS) return(WriteBlock());
+    return(0);
+}
+
+//===================================================================================
+// PZdabPackFile
+
+PZdabPackFile::PZdabPackFile()
+{
+    mFile = NULL;
+    mIndexRead = 0;
+    mPos = 0;
+    mRecordsLeft = 0;
+    mError = 0;
+    mLastGTID = mLastRun = 0;
+    mLastBc10 = mLastBc50 = 0;
+}
+
+PZdabPackFile::~PZdabPackFile()
+{
+}
+
+// initialize for reading from a packed file
+// returns < 0 on error
+int PZdabPackFile::Init(FILE *file)
+{
+    unsigned char header[8];
+
+    mFile = file;
+    mIndexRead = 0;
+    mIndex.clear();
+    mRecordsLeft = 0;
+    mError = 0;
+    if (!mFile) return(-1);
+    if (fread(header, sizeof(header), 1, mFile) != 1 ||
+        GetLE32(header) != PACK_FILE_MAGIC)
+    {
+        printf("Not a packed zdab file!\x07\n");
+        return(-1);
+    }
+    if (GetLE32(header + 4) != PACK_VERSION) {
+        printf("Unknown packed zdab version %ld\x07\n", (long)GetLE32(header + 4));
+        return(-1);
+    }
+    return(0);
+}
+
+// read the next block into mBlock - returns non-zero at end of file or on error
+int PZdabPackFile::ReadBlock()
+{
+    unsigned char header[BLOCK_HEADER_SIZE];
+
+    if (fread(header, 4, 1, mFile) != 1) {
+        printf("Unexpected EOF while reading packed zdab file!\x07\n");
+        return(-1);
+    }
+    if (GetLE32(header) == PACK_INDEX_MAGIC) return(-1);  // end of the blocks
+    if (GetLE32(header) != PACK_BLOCK_MAGIC ||
+        fread(header + 4, BLOCK_HEADER_SIZE - 4, 1, mFile) != 1)
+    {
+        printf("Invalid packed zdab block!\x07\n");
+        return(-1);
+    }
+    mRecordsLeft = GetLE32(header + 4);
+    mBlock.resize(GetLE32(header + 12));
+    if (mBlock.size() && fread(&mBlock[0], mBlock.size(), 1, mFile) != 1) {
+        printf("Unexpected EOF while reading packed zdab file!\x07\n");
+        mRecordsLeft = 0;
+        return(-1);
+    }
+    mPos = 0;
+    mLastGTID = mLastRun = 0;
+    mLastBc10 = mLastBc50 = 0;
+    return(0);
+}
+
+u_int32 PZdabPackFile::GetWord()
+{
+    if (mPos + 4 > mBlock.size()) {
+        mError = 1;
+        return(0);
+    }
+    mPos += 4;
+    return(GetLE32(&mBlock[mPos - 4]));
+}
+
+uint64_t PZdabPackFile::GetVarint()
+{
+    uint64_t val = 0;
+
+    for (int shift=0; shift<64; shift+=7) {
+        if (mPos >= mBlock.size()) break;
+        unsigned char byte = mBlock[mPos++];
+        val |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return(val);
+    }
+    mError = 1;
+    return(0);
+}
+
+// NextRecord - get next record in packed file
+// Returns: pointer to bank data (native format) or NULL at end of file or on error
+u_int32 *PZdabPackFile::NextRecord(u_int32 &bank_name, u_int32 &nwords, int header_only)
+{
+    const u_int32 nhdr = WORD_SIZE(PmtEventRecord);
+
+    if (!mFile || mError) return(NULL);
+    while (!mRecordsLeft) {
+        if (ReadBlock()) return(NULL);
+    }
+    --mRecordsLeft;
+
+    if (mPos >= mBlock.size()) {
+        mError = 1;
+    } else if (mBlock[mPos++] == PACK_BANK) {
+        bank_name = GetWord();
+        nwords = GetVarint();
+        if (nwords > (mBlock.size() - mPos) / 4) {
+            mError = 1;
+        } else {
+            mData.resize(nwords + 1);
+            for (u_int32 i=0; i<nwords; ++i) mData[i] = GetWord();
+        }
+    } else {
+        bank_name = ZDAB_RECORD;
+
+        u_int32 gtid = mLastGTID + (int32_t)GetSigned();
+        u_int32 trig = mPos < mBlock.size() ? mBlock[mPos++] : 0;
+        uint64_t bc10 = mLastBc10 + GetSigned();
+        uint64_t bc50 = mLastBc50 + GetSigned();
+        u_int32 mtc4 = GetVarint();
+        u_int32 mtc5 = GetVarint();
+        u_int32 word0 = GetVarint();
+        u_int32 run = mLastRun + (int32_t)GetSigned();
+        u_int32 evnum = gtid + (int32_t)GetSigned();
+        u_int32 nhit = GetVarint();
+        u_int32 daq = GetVarint();
+        u_int32 calpck = GetVarint();
+        size_t hit_bytes = GetVarint();
+        size_t hit_end = mPos + hit_bytes;
+
+        if (mError || nhit > 0xffff || hit_end > mBlock.size()) {
+            mError = 1;
+        } else {
+            mData.resize(nhdr + 3 * nhit);
+            PmtEventRecord *pmtRecord = (PmtEventRecord *)&mData[0];
+            u_int32 *mtc = (u_int32 *)&pmtRecord->TriggerCardData;
+            mData[0] = word0;
+            pmtRecord->RunNumber = run;
+            pmtRecord->EvNumber = evnum;
+            pmtRecord->NPmtHit = nhit;
+            pmtRecord->DaqStatus = daq;
+            pmtRecord->CalPckType = calpck;
+            mtc[0] = (u_int32)bc10;
+            mtc[1] = ((u_int32)(bc10 >> 32) & 0x1fffff) | ((u_int32)bc50 << 21);
+            mtc[2] = (u_int32)(bc50 >> 11);
+            mtc[3] = (gtid & 0x00ffffff) | (trig << 24);
+            mtc[4] = mtc4;
+            mtc[5] = mtc5;
+
+            if (header_only) {
+                mPos = hit_end;
+                u_int32 nextra = GetVarint();
+                mPos += 4 * (size_t)nextra;
+                if (mPos > mBlock.size()) mError = 1;
+                nwords = nhdr;
+            } else {
+                // unpack the hits
+                u_int32 *hit = &mData[nhdr];
+                u_int32 lcn = 0;
+                for (u_int32 i=0; i<nhit && !mError; ++i, hit+=3) {
+                    if (mPos + HIT_SIZE > hit_end) {
+                        mError = 1;
+                        break;
+                    }
+                    uint64_t packed = 0;
+                    for (int j=HIT_SIZE-1; j>=0; --j) packed = (packed << 8) | mBlock[mPos + j];
+                    mPos += HIT_SIZE;
+                    u_int32 small = packed >> 59;
+                    lcn += small ? small : (u_int32)GetSigned();
+                    u_int32 hit_gtid = gtid;
+                    if ((packed >> 58) & 1) {
+                        if (mPos + 3 > hit_end) {
+                            mError = 1;
+                            break;
+                        }
+                        hit_gtid = mBlock[mPos] | (mBlock[mPos+1] << 8) | (mBlock[mPos+2] << 16);
+                        mPos += 3;
+                    }
+                    u_int32 flags = (packed >> 52) & 0x3f;
+                    hit[0] = (hit_gtid & 0xffff) | (lcn & 0x1f) << 16 |
+                             ((lcn >> 9) & 0x1f) << 21 | ((lcn >> 5) & 0xf) << 26 |
+                             (flags & 0x3) << 30;
+                    hit[1] = (u_int32)(packed & 0xfff) | ((u_int32)(packed >> 48) & 0xf) << 12 |
+                             ((u_int32)(packed >> 12) & 0xfff) << 16 | (flags >> 2) << 28;
+                    hit[2] = ((u_int32)(packed >> 24) & 0xfff) | ((hit_gtid >> 16) & 0xf) << 12 |
+                             ((u_int32)(packed >> 36) & 0xfff) << 16 | ((hit_gtid >> 20) & 0xf) << 28;
+                }
+                if (mPos != hit_end) mError = 1;
+
+                // and the sub-fields
+                u_int32 nextra = GetVarint();
+                if (mError || nextra > (mBlock.size() - mPos) / 4) {
+                    mError = 1;
+                } else {
+                    mData.resize(nhdr + 3 * nhit + nextra);
+                    for (u_int32 i=0; i<nextra; ++i) mData[nhdr + 3 * nhit + i] = GetWord();
+                    nwords = mData.size();
+                }
+            }
+            mLastGTID = gtid;
+            mLastRun = run;
+            mLastBc10 = bc10;
+            mLastBc50 = bc50;
+        }
+    }
+    if (mError) {
+        printf("Corrupt packed zdab block!\x07\n");
+        return(NULL);
+    }
+    return(&mData[0]);
+}
+
+// read the block index from the end of the file
+// - the file position is left unchanged
+// - returns non-zero on error
+int PZdabPackFile::ReadIndex()
+{
+    unsigned char footer[FOOTER_SIZE];
+
+    if (mIndexRead) return(0);
+    if (!mFile) return(-1);
+
+    off_t pos = ftello(mFile);
+    int err = -1;
+    if (!fseeko(mFile, -FOOTER_SIZE, SEEK_END) &&
+        fread(footer, FOOTER_SIZE, 1, mFile) == 1 &&
+        GetLE32(footer + 12) == PACK_INDEX_MAGIC)
+    {
+        int64_t offset = GetLE32(footer) | ((int64_t)GetLE32(footer + 4) << 32);
+        u_int32 nblocks = GetLE32(footer + 8);
+        std::vector<unsigned char> buff(8 + (size_t)nblocks * INDEX_ENTRY_SIZE);
+        if (!fseeko(mFile, offset, SEEK_SET) &&
+            fread(&buff[0], buff.size(), 1, mFile) == 1 &&
+            GetLE32(&buff[0]) == PACK_INDEX_MAGIC && GetLE32(&buff[4]) == nblocks)
+        {
+            mIndex.resize(nblocks);
+            for (u_int32 i=0; i<nblocks; ++i) {
+                unsigned char *pt = &buff[8 + i * INDEX_ENTRY_SIZE];
+                mIndex[i].offset = GetLE32(pt) | ((int64_t)GetLE32(pt + 4) << 32);
+                mIndex[i].gtid = GetLE32(pt + 8);
+                mIndex[i].nrecords = GetLE32(pt + 12);
+            }
+            mIndexRead = 1;
+            err = 0;
+        }
+    }
+    if (err) printf("Can't read packed zdab block index!\x07\n");
+    fseeko(mFile, pos, SEEK_SET);
+    return(err);
+}
+
+int PZdabPackFile::GetNumBlocks()
+{
+    if (ReadIndex()) return(0);
+    return(mIndex.size());
+}
+
+SPackBlock *PZdabPackFile::GetBlock(int block)
+{
+    if (block < 0 || block >= GetNumBlocks()) return(NULL);
+    return(&mIndex[block]);
+}
+
+// find the block which should contain an event with the given GTID
+// (the last block starting at or before it)
+// - returns -1 if not found
+int PZdabPackFile::FindGTID(u_int32 gtid)
+{
+    int found = -1;
+
+    for (int i=0; i<GetNumBlocks(); ++i) {
+        if (mIndex[i].gtid == NO_GTID) continue;
+        if (mIndex[i].gtid > gtid) {
+            if (found >= 0) break;
+        } else {
+            found = i;
+        }
+    }
+    return(found);
+}
+
+// continue reading at the start of a block
+int PZdabPackFile::SeekBlock(int block)
+{
+    if (!GetBlock(block) || fseeko(mFile, mIndex[block].offset, SEEK_SET)) {
+        printf("Can't seek to packed zdab block %d\x07\n", block);
+        return(-1);
+    }
+    mRecordsLeft = 0;
+    mError = 0;
+    return(0);
+}
@@ -0,0 +1,137 @@
+/* Packed-hit zdab format */
+/*
+** A compact format for ZDAB data which can be converted back to ZDAB
+** without loss through PZdabWriter.
+**
+** Records are grouped into blocks which can be decoded independently, and
+** an index of the blocks is written at the end of the file.  Within a block
+** event GTIDs, clocks and run numbers are delta-encoded, and each PMT hit
+** is packed into 64 bits:  the GTID copy in every hit is dropped (unless it
+** differs from the event GTID), and the crate/card/channel number is stored
+** as the difference from the previous hit.  Events are stored with the
+** length of their hit data, so the event headers of a file can be scanned
+** without unpacking the hits.
+**
+** All values are written little-endian, independent of the host order.
+**
+** File layout:
+**   file header        PACK_FILE_MAGIC, PACK_VERSION
+**   blocks             PACK_BLOCK_MAGIC, number of records, GTID of first
+**                      event, payload size (bytes), payload
+**   block index        PACK_INDEX_MAGIC, number of blocks, then for each
+**                      block: file offset (64 bits), GTID of first event
+**                      (-1 if none), number of records
+**   footer             index offset (64 bits), number of blocks, PACK_INDEX_MAGIC
+**
+** Payload records (integers are LEB128 varints, "zz" is zigzag-encoded):
+**   PACK_BANK          bank name (32 bits), data words, data (32 bits each)
+**   PACK_EVENT         zz GTID delta, MTC trigger bits (8 bits),
+**                      zz 10 MHz clock delta, zz 50 MHz clock delta,
+**                      MTC words 4 and 5, PmtEventRecord word 0,
+**                      zz run number delta, zz event number - GTID,
+**                      NPmtHit, DaqStatus, CalPckType,
+**                      hit data size (bytes), hits, sub-field words, sub-fields
+**   hit                Qlx, Qhs, Qhl and TAC (12 bits each with sign bits),
+**                      CellID (4), flag bits (6), GTID-differs bit,
+**                      channel number delta 1-31 (5 bits, 0 if the zz delta
+**                      follows as a varint), then the hit GTID (24 bits)
+**                      if it differs from the event
+*/
+
+#ifndef __PZdabPack_h__
+#define __PZdabPack_h__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "PZdabFile.h"
+
+#define PACK_FILE_MAGIC     0x314b505aUL    // "ZPK1"
+#define PACK_BLOCK_MAGIC    0x424b505aUL    // "ZPKB"
+#define PACK_INDEX_MAGIC    0x494b505aUL    // "ZPKI"
+#define PACK_VERSION        1
+#define PACK_BLOCK_RECORDS  256             // records per block
+
+enum EPackRecord {
+    PACK_BANK   = 0,    // any bank, stored as it is
+    PACK_EVENT  = 1     // PMT event record (ZDAB bank)
+};
+
+// entry in the block index
+struct SPackBlock {
+    int64_t     offset;     // file offset of block header
+    u_int32     gtid;       // GTID of first event in block
+    u_int32     nrecords;   // number of records in block
+};
+
+// writer of packed files
+class PZdabPacker {
+public:
+    PZdabPacker(FILE *file);
+    ~PZdabPacker();
+
+    int         GetError()      { return mError; }
+    int         Close();
+
+    // add a record (all data in native format) - return non-zero on error
+    int         AddEvent(PmtEventRecord *pmtRecord, u_int32 nwords);
+    int         AddBank(u_int32 bank_name, u_int32 *data, u_int32 nwords);
+
+private:
+    int         WriteBlock();
+
+    FILE      * mFile;
+    int         mError;
+    int64_t     mFilePos;
+    std::vector<unsigned char>  mBlock;     // payload of current block
+    std::vector<unsigned char>  mHits;      // hit data of current event
+    std::vector<SPackBlock>     mIndex;
+    u_int32     mNumRecords;                // records in current block
+    u_int32     mFirstGTID;                 // first GTID in current block (-1 if none yet)
+
+    // state of the delta encoding (reset at the start of each block)
+    u_int32     mLastGTID, mLastRun;
+    uint64_t    mLastBc10, mLastBc50;
+};
+
+// reader of packed files
+class PZdabPackFile {
+public:
+    PZdabPackFile();
+    ~PZdabPackFile();
+
+    int         Init(FILE *file);   // returns < 0 on error
+
+    // return the next record (native format) or NULL at end of file or on error
+    // - for events, the hits and sub-fields are only unpacked if header_only
+    //   is zero (otherwise just the PmtEventRecord is returned)
+    // - the data is valid until the next call
+    u_int32   * NextRecord(u_int32 &bank_name, u_int32 &nwords, int header_only=0);
+
+    // random access by block (requires a seekable file)
+    int         GetNumBlocks();
+    SPackBlock* GetBlock(int block);
+    int         FindGTID(u_int32 gtid);     // block which should contain the GTID
+    int         SeekBlock(int block);       // returns non-zero on error
+
+private:
+    int         ReadIndex();
+    int         ReadBlock();
+    u_int32     GetWord();
+    uint64_t    GetVarint();
+    int64_t     GetSigned()     { uint64_t v = GetVarint(); return((int64_t)(v >> 1) ^ -(int64_t)(v & 1)); }
+
+    FILE      * mFile;
+    int         mIndexRead;                 // non-zero once mIndex has been read
+    std::vector<SPackBlock>     mIndex;
+    std::vector<unsigned char>  mBlock;     // payload of current block
+    size_t      mPos;                       // read position in payload
+    u_int32     mRecordsLeft;               // records left in current block
+    int         mError;
+    std::vector<u_int32>        mData;      // unpacked record
+
+    u_int32     mLastGTID, mLastRun;
+    uint64_t    mLastBc10, mLastBc50;
+};
+
+#endif // __PZdabPack_h__
@@ -0,0 +1,123 @@
+/* Work-stealing pool of threads for offline zdab tools */
+/*
+** The deques are guarded by a lock each, which is only contended when a
+** thread steals.  mPending counts the tasks queued and not yet taken, so
+** that an idle thread can sleep until there is something to steal; a
+** thread waiting for a group sleeps on the same condition, which is also
+** signalled when the last task of a group finishes.
+*/
+
+#include "PZdabPool.h"
+
+// the pool the present thread works for, and its deque there
+static thread_local PZdabPool * tPool = NULL;
+static thread_local int         tSelf = 0;
+
+PZdabPool::PZdabPool(int nthreads)
+{
+    if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+    if (nthreads <= 0) nthreads = 1;
+    mPending = 0;
+    mStop = 0;
+    for (int i=0; i<nthreads; ++i) {
+        mDeques.push_back(new Deque);
+    }
+    for (int i=1; i<nthreads; ++i) {
+        mThreads.push_back(std::thread(&PZdabPool::Work, this, i));
+    }
+}
+
+PZdabPool::~PZdabPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(mSleep);
+        mStop = 1;
+    }
+    mWake.notify_all();
+    for (size_t i=0; i<mThreads.size(); ++i) {
+        mThreads[i].join();
+    }
+    for (size_t i=0; i<mDeques.size(); ++i) {
+        delete mDeques[i];
+    }
+}
+
+// the deque of the present thread
+int PZdabPool::Self()
+{
+    return tPool == this ? tSelf : 0;
+}
+
+void PZdabPool::Submit(PZdabTaskGroup &group, std::function<void()> task)
+{
+    group.mLeft.fetch_add(1, std::memory_order_relaxed);
+    Deque *dq = mDeques[Self()];
+    {
+        std::lock_guard<std::mutex> guard(dq->lock);
+        Task t = { task, &group };
+        dq->tasks.push_back(t);
+    }
+    mPending.fetch_add(1);
+    std::lock_guard<std::mutex> guard(mSleep);
+    mWake.notify_all();
+}
+
+// run the newest task on our own deque, or else steal the oldest from
+// another
+// - returns zero if there was none
+int PZdabPool::RunOne(int self)
+{
+    Task task;
+    int found = 0;
+    const int n = (int)mDeques.size();
+    for (int i=0; i<n && !found; ++i) {
+        Deque *dq = mDeques[(self + i) % n];
+        std::lock_guard<std::mutex> guard(dq->lock);
+        if (dq->tasks.empty()) continue;
+        if (i == 0) {
+            task = dq->tasks.back();
+            dq->tasks.pop_back();
+        } else {
+            task = dq->tasks.front();
+            dq->tasks.pop_front();
+        }
+        found = 1;
+    }
+    if (!found) return(0);
+    mPending.fetch_sub(1);
+
+    task.run();
+
+    if (task.group->mLeft.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> guard(mSleep);
+        mWake.notify_all();
+    }
+    return(1);
+}
+
+// the loop of each thread of the pool
+void PZdabPool::Work(int self)
+{
+    tPool = this;
+    tSelf = self;
+    for (;;) {
+        if (RunOne(self)) continue;
+        std::unique_lock<std::mutex> guard(mSleep);
+        while (!mStop && mPending.load() <= 0) {
+            mWake.wait(guard);
+        }
+        if (mStop) break;
+    }
+}
+
+void PZdabPool::Wait(PZdabTaskGroup &group)
+{
+    const int self = Self();
+    while (!group.IsDone()) {
+        if (RunOne(self)) continue;
+        std::unique_lock<std::mutex> guard(mSleep);
+        while (!group.IsDone() && mPending.load() <= 0) {
+            mWake.wait(guard);
+        }
+    }
+}
@@ -0,0 +1,137 @@
+/* Work-stealing pool of threads for offline zdab tools */
+/*
+** Each thread of the pool has its own deque of tasks.  A thread runs the
+** newest task on its own deque first (its data is likely still in cache),
+** and once that is empty steals the oldest task from another's.  Tasks
+** queued by a thread of the pool go on its own deque; those queued from
+** outside go on a deque of their own, which any thread may steal from.
+**
+** A thread waiting for a group of tasks runs tasks itself until the group
+** has finished, so a task may queue tasks and wait for them (a file waiting
+** for the block ranges of that file, say) without tying up a thread, and
+** the waiting thread counts as one of the pool's threads.
+**
+** MapRanges() divides work over a number of items (files, or physical
+** records of a file) into ranges, and splits them in halves as it goes:
+** the first half is run and the second queued, so that whatever a thief
+** takes is the largest piece of work left.  The results come back in the
+** order of the ranges, however the work was divided among the threads.
+*/
+
+#ifndef __PZdabPool_h__
+#define __PZdabPool_h__
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+// a set of tasks which can be waited for
+class PZdabTaskGroup {
+public:
+    PZdabTaskGroup() : mLeft(0) { }
+
+    int         IsDone()        { return mLeft.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class PZdabPool;
+    std::atomic<int64_t>    mLeft;      // tasks queued or running
+};
+
+class PZdabPool {
+public:
+    // start a pool of nthreads threads in all, counting the thread which
+    // waits for the tasks (0 for one per CPU)
+    PZdabPool(int nthreads=0);
+    // - every task queued must have been waited for
+    ~PZdabPool();
+
+    int         GetThreads()    { return (int)mDeques.size(); }
+
+    // queue a task in the group
+    void        Submit(PZdabTaskGroup &group, std::function<void()> task);
+
+    // run tasks until every task in the group has finished
+    void        Wait(PZdabTaskGroup &group);
+
+    // run fn(first, last) for each range [first, last) of grain items
+    // dividing nitems items (the last range may be shorter), and set
+    // results[i] to the result for range i
+    // - Result must not be bool, since the elements of a vector<bool> cannot
+    //   be set from different threads
+    template <class Result, class Func>
+    void        MapRanges(int64_t nitems, int64_t grain,
+                          std::vector<Result> &results, Func fn);
+
+    // set results[i] to fn(i) for each of nitems items
+    template <class Result, class Func>
+    void        Map(int64_t nitems, std::vector<Result> &results, Func fn)
+                {
+                    MapRanges(nitems, 1, results,
+                              [&fn](int64_t first, int64_t) { return fn(first); });
+                }
+
+private:
+    struct Task {
+        std::function<void()>   run;
+        PZdabTaskGroup        * group;
+    };
+    struct Deque {
+        std::mutex              lock;
+        std::deque<Task>        tasks;
+    };
+
+    void        Work(int self);
+    int         Self();
+    int         RunOne(int self);
+
+    template <class Result, class Func>
+    void        Split(PZdabTaskGroup &group, int64_t nitems, int64_t grain,
+                      int64_t a, int64_t b, std::vector<Result> &results,
+                      Func &fn);
+
+    std::vector<Deque *>        mDeques;    // deque 0 is for the outside threads
+    std::vector<std::thread>    mThreads;   // thread i runs deque i+1
+    std::atomic<int64_t>        mPending;   // tasks queued but not yet taken
+    std::mutex                  mSleep;
+    std::condition_variable     mWake;      // tasks queued, or a group finished
+    int                         mStop;
+};
+
+// run the ranges [a, b), queueing the second half until one is left
+template <class Result, class Func>
+void PZdabPool::Split(PZdabTaskGroup &group, int64_t nitems, int64_t grain,
+                      int64_t a, int64_t b, std::vector<Result> &results,
+                      Func &fn)
+{
+    while (b - a > 1) {
+        const int64_t mid = a + (b - a) / 2;
+        Submit(group, [this, &group, nitems, grain, mid, b, &results, &fn]() {
+            Split(group, nitems, grain, mid, b, results, fn);
+        });
+        b = mid;
+    }
+    const int64_t last = (a + 1) * grain;
+    results[a] = fn(a * grain, last < nitems ? last : nitems);
+}
+
+template <class Result, class Func>
+void PZdabPool::MapRanges(int64_t nitems, int64_t grain,
+                          std::vector<Result> &results, Func fn)
+{
+    if (grain < 1) grain = 1;
+    const int64_t nranges = (nitems + grain - 1) / grain;
+    results.resize(nranges);
+    if (nranges == 0) return;
+    PZdabTaskGroup group;
+    Submit(group, [this, &group, nitems, grain, nranges, &results, &fn]() {
+        Split(group, nitems, grain, 0, nranges, results, fn);
+    });
+    Wait(group);
+}
+
+#endif // __PZdabPool_h__
@@ -0,0 +1,272 @@
+/* Shared-memory ring of zdab records */
+/*
+** The head and tail positions are the only words shared between the
+** producer and the consumers.  The producer is their only writer, so it
+** reads them plainly;  they are published with release stores, and a
+** release fence follows the tail store so that no record data can be
+** overwritten before the new tail is visible.  Consumers load them with
+** acquire loads, and put an acquire fence between copying a record and
+** checking the tail again.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "PZdabRing.h"
+#include "ByteOrder.h"
+
+// bytes taken in the ring by a record with nwords words of data
+static uint64_t RecordBytes(u_int32 nwords)
+{
+    const uint64_t nbytes = sizeof(SRingRecord) + (uint64_t)nwords * sizeof(u_int32);
+    return((nbytes + RING_ALIGN - 1) & ~(uint64_t)(RING_ALIGN - 1));
+}
+
+//===================================================================================
+// producer
+//
+
+// create the ring, or reuse it if one of this size exists already
+// - the size is rounded up to a power of 2
+PZdabRingWriter::PZdabRingWriter(const char *name, uint64_t size)
+{
+    mHeader = NULL;
+    mData = NULL;
+    for (mSize=RING_ALIGN; mSize<size; mSize<<=1) ;
+    mMapSize = sizeof(SRingHeader) + mSize;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        printf("Error creating shared memory ring %s\x07\n",name);
+        return;
+    }
+    struct stat st;
+    const off_t oldsize = fstat(fd, &st) ? 0 : st.st_size;
+    int reuse = 0;
+    if ((size_t)oldsize == mMapSize) {
+        mHeader = (SRingHeader *)mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mHeader == MAP_FAILED) {
+            mHeader = NULL;
+        } else {
+            reuse = (mHeader->magic == RING_MAGIC && mHeader->version == RING_VERSION &&
+                     mHeader->size == mSize);
+            if (!reuse) {
+                munmap(mHeader, mMapSize);
+                mHeader = NULL;
+            }
+        }
+    }
+    if (!reuse) {
+        // start again with a new ring, so consumers of an old one (which may be
+        // a different size) are never left with a mapping past its end
+        if (oldsize >= (off_t)sizeof(u_int32)) {
+            // tell consumers of the old ring that it has been abandoned
+            u_int32 zero = 0;
+            pwrite(fd, &zero, sizeof(zero), 0);
+        }
+        close(fd);
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0 || ftruncate(fd, mMapSize)) {
+            printf("Error creating shared memory ring %s\x07\n",name);
+            if (fd >= 0) close(fd);
+            return;
+        }
+        mHeader = (SRingHeader *)mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mHeader == MAP_FAILED) {
+            printf("Error mapping shared memory ring %s\x07\n",name);
+            mHeader = NULL;
+            close(fd);
+            return;
+        }
+        mHeader->version = RING_VERSION;
+        mHeader->size = mSize;
+        mHeader->head = 0;
+        mHeader->tail = 0;
+        mHeader->nrecords = 0;
+        __atomic_store_n(&mHeader->magic, RING_MAGIC, __ATOMIC_RELEASE);
+        printf("Created shared memory ring %s (%lu MB)\n",name,(unsigned long)(mSize >> 20));
+    } else {
+        printf("Publishing to existing shared memory ring %s\n",name);
+    }
+    close(fd);
+    mData = (unsigned char *)(mHeader + 1);
+}
+
+PZdabRingWriter::~PZdabRingWriter()
+{
+    if (mHeader) munmap(mHeader, mMapSize);
+}
+
+// copy words into the ring at position pos, wrapping at the end
+// (records are aligned, so a wrap always falls between two words)
+template <class Order>
+void PZdabRingWriter::CopyIn(uint64_t pos, const u_int32 *data, u_int32 nwords)
+{
+    const uint64_t off = pos & (mSize - 1);
+    u_int32 n = nwords;
+    if (off + (uint64_t)nwords * sizeof(u_int32) > mSize) {
+        n = (u_int32)((mSize - off) / sizeof(u_int32));
+    }
+    Order::Copy((u_int32 *)(mData + off), data, n);
+    if (n < nwords) {
+        Order::Copy((u_int32 *)mData, data + n, nwords - n);
+    }
+}
+
+// publish a bank
+int PZdabRingWriter::Publish(u_int32 bank_name, u_int32 *data, u_int32 nwords, int swap)
+{
+    if (!mHeader) return(-1);
+    const uint64_t nbytes = RecordBytes(nwords);
+    if (nbytes > mSize) return(-1);
+
+    // drop the oldest records until there is room for this one
+    const uint64_t head = mHeader->head;
+    uint64_t tail = mHeader->tail;
+    if (head + nbytes - tail > mSize) {
+        while (head + nbytes - tail > mSize) {
+            SRingRecord old;
+            const uint64_t off = tail & (mSize - 1);
+            // (the record header may itself wrap)
+            if (off + sizeof(old) > mSize) {
+                memcpy(&old, mData + off, mSize - off);
+                memcpy((unsigned char *)&old + (mSize - off), mData, sizeof(old) - (mSize - off));
+            } else {
+                memcpy(&old, mData + off, sizeof(old));
+            }
+            tail += RecordBytes(old.nwords);
+        }
+        __atomic_store_n(&mHeader->tail, tail, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    SRingRecord rec;
+    rec.bank_name = bank_name;
+    rec.nwords = nwords;
+    rec.seq = mHeader->nrecords;
+    CopyIn<NoSwap>(head, (u_int32 *)&rec, sizeof(rec) / sizeof(u_int32));
+    if (swap) {
+        CopyIn<ByteSwap>(head + sizeof(rec), data, nwords);
+    } else {
+        CopyIn<NoSwap>(head + sizeof(rec), data, nwords);
+    }
+    __atomic_store_n(&mHeader->nrecords, rec.seq + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&mHeader->head, head + nbytes, __ATOMIC_RELEASE);
+    return(0);
+}
+
+//===================================================================================
+// consumer
+//
+
+PZdabRingReader::PZdabRingReader()
+{
+    mHeader = NULL;
+    mData = NULL;
+    mSize = 0;
+    mMapSize = 0;
+    mCursor = 0;
+    mNextSeq = (uint64_t)(-1);
+    mLost = 0;
+    mOverruns = 0;
+}
+
+PZdabRingReader::~PZdabRingReader()
+{
+    if (mHeader) munmap((void *)mHeader, mMapSize);
+}
+
+// attach to the ring
+int PZdabRingReader::Init(const char *name, int from_start)
+{
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        printf("Error opening shared memory ring %s\x07\n",name);
+        return(-1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(SRingHeader)) {
+        printf("Shared memory ring %s is not ready\x07\n",name);
+        close(fd);
+        return(-1);
+    }
+    mMapSize = st.st_size;
+    void *map = mmap(NULL, mMapSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Error mapping shared memory ring %s\x07\n",name);
+        return(-1);
+    }
+    mHeader = (const SRingHeader *)map;
+    if (__atomic_load_n(&mHeader->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+        mHeader->version != RING_VERSION ||
+        mHeader->size + sizeof(SRingHeader) != mMapSize)
+    {
+        printf("Shared memory ring %s is not a valid ring\x07\n",name);
+        munmap(map, mMapSize);
+        mHeader = NULL;
+        return(-1);
+    }
+    mSize = mHeader->size;
+    mData = (const unsigned char *)(mHeader + 1);
+    mCursor = __atomic_load_n(from_start ? &mHeader->tail : &mHeader->head, __ATOMIC_ACQUIRE);
+    return(0);
+}
+
+// copy bytes out of the ring from position pos, wrapping at the end
+void PZdabRingReader::CopyOut(uint64_t pos, void *dst, uint64_t nbytes)
+{
+    const uint64_t off = pos & (mSize - 1);
+    if (off + nbytes > mSize) {
+        memcpy(dst, mData + off, mSize - off);
+        memcpy((unsigned char *)dst + (mSize - off), mData, nbytes - (mSize - off));
+    } else {
+        memcpy(dst, mData + off, nbytes);
+    }
+}
+
+// return the next record
+u_int32 *PZdabRingReader::NextRecord(u_int32 &bank_name, u_int32 &nwords)
+{
+    if (!mHeader || IsAbandoned()) return(NULL);
+
+    for (;;) {
+        const uint64_t head = __atomic_load_n(&mHeader->head, __ATOMIC_ACQUIRE);
+        if (mCursor == head) return(NULL);
+        uint64_t tail = __atomic_load_n(&mHeader->tail, __ATOMIC_ACQUIRE);
+        if (mCursor < tail || mCursor > head) {
+            // the producer overtook us -- skip to the oldest record
+            mCursor = tail;
+            ++mOverruns;
+            continue;
+        }
+        SRingRecord rec;
+        CopyOut(mCursor, &rec, sizeof(rec));
+        // (the size may be garbage if the record was being overwritten)
+        if (RecordBytes(rec.nwords) <= mSize) {
+            mBuff.resize(rec.nwords + 1);
+            CopyOut(mCursor + sizeof(rec), &mBuff[0], (uint64_t)rec.nwords * sizeof(u_int32));
+        }
+        // the copy is good if the record was not dropped while we copied it
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        tail = __atomic_load_n(&mHeader->tail, __ATOMIC_RELAXED);
+        if (mCursor < tail) {
+            mCursor = tail;
+            ++mOverruns;
+            continue;
+        }
+        if (mNextSeq != (uint64_t)(-1) && rec.seq > mNextSeq) {
+            mLost += rec.seq - mNextSeq;
+        }
+        mNextSeq = rec.seq + 1;
+        mCursor += RecordBytes(rec.nwords);
+        bank_name = rec.bank_name;
+        nwords = rec.nwords;
+        return(&mBuff[0]);
+    }
+}
@@ -0,0 +1,113 @@
+/* Shared-memory ring of zdab records */
+/*
+** One producer publishes records into a ring buffer in POSIX shared memory,
+** and any number of local consumers follow it, each with its own cursor.
+** The producer never waits for the consumers:  a consumer which falls more
+** than the size of the ring behind loses the records that were overwritten,
+** and counts them.
+**
+** Shared memory layout:
+**   SRingHeader        magic, version, size of the record data, head, tail,
+**                      number of records published
+**   record data        records, each starting on an 8-byte boundary and
+**                      wrapping around the end of the ring:  an SRingRecord
+**                      (bank name, data size, record number), then the bank
+**                      data in native byte order
+**
+** Positions in the ring count the bytes published since it was created.
+** head is the end of the last record, and tail the start of the oldest
+** record which is still intact.  Before writing, the producer moves tail
+** past the records it is about to overwrite, and afterwards moves head past
+** the new record.  So a consumer which copies a record out and then still
+** finds tail at or before it knows that its copy is good.
+**
+** The ring is kept between runs of the producer (if its size is unchanged),
+** so consumers can follow one run after another.
+*/
+
+#ifndef __PZdabRing_h__
+#define __PZdabRing_h__
+
+#include <stdint.h>
+#include <vector>
+#include "PZdabFile.h"
+
+#define RING_MAGIC          0x474e4952UL    // "RING"
+#define RING_VERSION        1
+#define RING_ALIGN          8               // alignment of records (bytes)
+#define RING_DEFAULT_SIZE   (64 << 20)      // default size of record data (bytes)
+
+struct SRingHeader {
+    u_int32     magic;          // RING_MAGIC, or 0 once the ring is abandoned
+    u_int32     version;
+    uint64_t    size;           // bytes of record data (a power of 2)
+    uint64_t    head;           // end of the last record published
+    uint64_t    tail;           // start of the oldest intact record
+    uint64_t    nrecords;       // records published
+};
+
+struct SRingRecord {
+    u_int32     bank_name;
+    u_int32     nwords;         // words of bank data
+    uint64_t    seq;            // record number
+};
+
+// producer
+class PZdabRingWriter {
+public:
+    PZdabRingWriter(const char *name, uint64_t size=RING_DEFAULT_SIZE);
+    ~PZdabRingWriter();
+
+    int         IsOpen()        { return mHeader != NULL; }
+
+    // publish a bank of nwords words
+    // - swap is non-zero if the data is in the opposite byte order to the host
+    //   (it is swapped as it is copied, and is not modified)
+    // - returns non-zero if the bank is too big for the ring
+    int         Publish(u_int32 bank_name, u_int32 *data, u_int32 nwords, int swap=0);
+
+private:
+    template <class Order>
+    void        CopyIn(uint64_t pos, const u_int32 *data, u_int32 nwords);
+
+    SRingHeader   * mHeader;
+    unsigned char * mData;
+    uint64_t    mSize;
+    size_t      mMapSize;
+};
+
+// consumer
+class PZdabRingReader {
+public:
+    PZdabRingReader();
+    ~PZdabRingReader();
+
+    // attach to the ring, starting at the next record published
+    // (or the oldest record in the ring if from_start is non-zero)
+    // - returns < 0 on error
+    int         Init(const char *name, int from_start=0);
+
+    // return the next record (native format), or NULL if there is none yet
+    // or the ring has been abandoned by its producer (see IsAbandoned())
+    // - the data is valid until the next call
+    u_int32   * NextRecord(u_int32 &bank_name, u_int32 &nwords);
+
+    int         IsAbandoned()   { return mHeader && mHeader->magic != RING_MAGIC; }
+    uint64_t    GetLost()       { return mLost; }
+    uint64_t    GetOverruns()   { return mOverruns; }
+
+private:
+    void        CopyOut(uint64_t pos, void *dst, uint64_t nbytes);
+
+    const SRingHeader   * mHeader;
+    const unsigned char * mData;
+    uint64_t    mSize;
+    size_t      mMapSize;
+    uint64_t    mCursor;        // position of the next record to read
+    uint64_t    mNextSeq;       // number of the next record expected (-1 if unknown)
+    uint64_t    mLost;          // records lost by falling behind
+    uint64_t    mOverruns;      // times the producer overtook us
+    std::vector<u_int32>    mBuff;
+};
+
+#endif // __PZdabRing_h__
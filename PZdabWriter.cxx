@@ -15,6 +15,9 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "PZdabWriter.h"
 #include "CUtils.h"
 #include "Record_Info.h"
@@ -31,19 +34,123 @@
 // (eventually, all this could go into a data file to be read in at run time)
 //
 
-#define SNOMAN_VERSION      3.0190      // snoman version number for MAST bank
-#define ORIGINAL_VERSION    3.0190      // original version number for MAST bank
+// MAST bank data: SNOMAN version numbers (3.0190) as IEEE floats
+#define SNOMAN_VERSION_BITS     0x4041374cUL    // snoman version number for MAST bank
+#define ORIGINAL_VERSION_BITS   0x4041374cUL    // original version number for MAST bank
+
+#define BANK_DEF(index, name, id, nwords, nlinks, status, ...) \
+    { name, id, nwords, nlinks, status, { __VA_ARGS__ } },
 
 // Note: The order of these entries corresponds to the EBankIndex enum in the header file
-SBankDef PZdabWriter::sBankDef[NUM_BANKS] = {
-    { ZDAB_RECORD,  6,                    0,  0, 0x00000, { 0x0002000c } }, // must fill in bank size
-    { MAST_RECORD,  1, WORD_SIZE(SBankMAST), 25, 0x00004, { 0x00030025 } }, // must fill in links after iochar[0]
-    { RHDR_RECORD,  5, WORD_SIZE(SBankRHDR),  0, 0x00000, { 0x0002000c } },
-    { EPED_RECORD,  6, WORD_SIZE(SBankEPED),  0, 0x00000, { 0x0002000c } },
-    { TRIG_RECORD,  7, WORD_SIZE(SBankTRIG),  0, 0x00000, { 0x0002000c } },
-    { SOSL_RECORD,  8, WORD_SIZE(SBankSOSL),  0, 0x00000, { 0x0323000c } },
-    { CAST_RECORD, 10, WORD_SIZE(SBankCAST),  0, 0x80000, { 0xc9a3000e, 0x40041803, 0x000e005a } },
-    { CAAC_RECORD, 11, WORD_SIZE(SBankCAAC),  0, 0x00000, { 0x0003000c } },
+static constexpr SBankDef sBankDef[NUM_BANKS] = {
+    ZDAB_BANK_LIST(BANK_DEF)
+};
+
+// check that the numerical ID of each bank written after a MAST bank is a MAST link
+static constexpr bool CheckBankIDs()
+{
+    for (int i=0; i<NUM_BANKS; ++i) {
+        if (i == kZDABindex || i == kMASTindex) continue;
+        if (sBankDef[i].id < 1 || sBankDef[i].id > sBankDef[kMASTindex].nlinks) return(false);
+    }
+    return(true);
+}
+static_assert(CheckBankIDs(), "ZEBRA bank ID is not a MAST link");
+
+// build the header template for a bank
+// - this is everything written ahead of the bank data by WriteBankData(),
+//   so only the sizes need be filled in for variable-length banks
+static constexpr SBankHeader MakeBankHeader(int index)
+{
+    SBankHeader hdr = {};
+    const SBankDef &bank = sBankDef[index];
+    const SBankDef &mast = sBankDef[kMASTindex];
+    // MAST bank goes before all but ZDAB banks
+    // (MAST banks are never written alone, so their own template is unused)
+    const int has_mast = (index != kZDABindex && index != kMASTindex);
+    
+    // get the number of i/o control words and links
+    const int nio_nl = (int)(bank.iochar[0] & 0x0000ffff) - 12;
+    const int mast_nio_nl = (int)(mast.iochar[0] & 0x0000ffff) - 12;
+
+    // calculate size of bank header including i/o control and link words
+    hdr.hdr_size = 1 + nio_nl + NBANK;
+    if (has_mast) hdr.hdr_size += 1 + mast_nio_nl + NBANK + mast.nwords;
+    hdr.npilot = NPILOT + (has_mast ? 2 : 0);   // write relocation table with pilot record
+    hdr.nsize = bank.nwords;
+    
+    u_int32 *pt = hdr.words;
+    // logical record info (size and data type)
+    *pt++ = hdr.npilot + hdr.hdr_size + hdr.nsize;
+    *pt++ = 2;
+    // pilot record (signature and ZEBRA version, then bank material size)
+    *pt++ = 0x4640e400UL;
+    *pt++ = 37700;
+    *pt++ = 0;
+    *pt++ = 0;
+    *pt++ = 0;
+    *pt++ = 0;
+    *pt++ = has_mast ? 2 : 0;                   // entries in relocation table
+    *pt++ = hdr.hdr_size + hdr.nsize;
+    *pt++ = has_mast ? SUPP_BANK_LINK : 0;      // entry link
+    *pt++ = 0;
+    if (has_mast) {
+        *pt++ = BASE_LINK;                      // relocation table
+        *pt++ = BASE_LINK + hdr.hdr_size + hdr.nsize;
+        // i/o characteristic for the MAST bank, with the link for the bank we are writing
+        *pt++ = mast.iochar[0];
+        for (int i=1; i<=mast_nio_nl; ++i) {
+            *pt++ = (i == 1 + mast_nio_nl - bank.id)
+                  ? BASE_LINK + 1 + mast_nio_nl + NBANK + mast.nwords + 1 + nio_nl
+                  : (i <= mast_nio_nl - mast.nlinks ? mast.iochar[i] : 0);
+        }
+        // MAST bank info
+        *pt++ = 0;
+        *pt++ = 0;
+        *pt++ = 0;
+        *pt++ = mast.id;
+        *pt++ = mast.name;
+        *pt++ = mast.nlinks;
+        *pt++ = mast.nlinks;
+        *pt++ = mast.nwords;
+        *pt++ = mast.status;
+        // MAST bank data
+        *pt++ = SNOMAN_VERSION_BITS;
+        *pt++ = ORIGINAL_VERSION_BITS;
+    }
+    // i/o characteristic for the bank we are writing
+    for (int i=0; i<=nio_nl; ++i) {
+        *pt++ = bank.iochar[i];
+    }
+    // bank info
+    *pt++ = 0;
+    *pt++ = SUPP_BANK_LINK;
+    *pt++ = SUPP_BANK_LINK - bank.id;
+    *pt++ = bank.id;
+    *pt++ = bank.name;
+    *pt++ = bank.nlinks;
+    *pt++ = bank.nlinks;
+    *pt++ = hdr.nsize;
+    *pt++ = bank.status;
+    
+    hdr.nwords = (int)(pt - hdr.words);
+    for (int i=0; i<hdr.nwords; ++i) {
+        hdr.words[i] = HostToExternal::Word(hdr.words[i]);
+    }
+    return(hdr);
+}
+
+// positions of the bank size words in a header template
+#define HDR_LOGICAL_SIZE    0                       // logical record size
+#define HDR_PILOT_SIZE      (NLOGIC + 7)            // bank material size in pilot
+#define HDR_RELOC_SIZE      (NLOGIC + NPILOT + 1)   // 2nd relocation table entry (MAST'd banks only)
+#define HDR_BANK_SIZE(n)    ((n) - NBANK + 7)       // data size in bank header
+
+#define BANK_HEADER(index, ...)    MakeBankHeader(index),
+
+// header templates for all banks (in EBankIndex order)
+static constexpr SBankHeader sBankHeader[NUM_BANKS] = {
+    ZDAB_BANK_LIST(BANK_HEADER)
 };
 
 //===================================================================================
@@ -83,32 +190,11 @@ static void rewrite_zdab(char *infile, char *outfile)
 //*** open zdab file and reset counters ***//
 PZdabWriter::PZdabWriter(char *file_name, int calcMD5)
 {
-    mBytesWritten = 0;
-    mWritePos = 0;
-    mError = 0;
-    mCalcMD5 = calcMD5;
-    if (mCalcMD5) {
-        mMD5.Init();
-    }
-    
-    // zero the buffer
-    memset(mbuf, 0, sizeof(mbuf));
-    
 #ifdef DEBUG_ZDAB
     int block_count = 0;
 #endif
-    // ignore NULL and empty file names
-    if (!file_name || *file_name=='\0') {
-        zdaboutput = NULL;
-        mError = 1;
-        return;
-    }
-    strncpy((char *)zdab_output_file,file_name,MAX_NAMELEN);
-    zdab_output_file[MAX_NAMELEN-1] = '\0';
+    if (Init(file_name, calcMD5)) return;
     
-    //FZ physical records counter
-    irec = (u_int32)(-1);
-
     //check if file exists already and contains valid FZ structure
     zdaboutput = fopen(zdab_output_file,"r+b");
     if (zdaboutput) {
@@ -122,7 +208,7 @@ PZdabWriter::PZdabWriter(char *file_name, int calcMD5)
                 mError = 1;
                 return;
             }
-            SWAP_INT32(mbuf, NWREC);
+            HostToExternal::Words(mbuf, NWREC);
             
             //check for physical records FZ signature
             if (mbuf[0] != ZEBRA_SIG0 ||
@@ -185,6 +271,7 @@ PZdabWriter::PZdabWriter(char *file_name, int calcMD5)
     } else {
         zdaboutput = fopen(zdab_output_file,"wb");
         if (zdaboutput) {
+            mNewFile = 1;
             printf("Created output zdab file %s\n",zdab_output_file);
 // test to see if a bigger buffer improves throughput
 //          setvbuf(zdaboutput,NULL,_IOFBF,65536L);
@@ -192,9 +279,63 @@ PZdabWriter::PZdabWriter(char *file_name, int calcMD5)
             printf("Error creating output zdab file %s\x07\n",zdab_output_file);
         }
     }
-/*
-** initialize static fields of our record structures
-*/
+    InitRecords();
+}
+
+//*** write to a new stream which is already open (e.g. a compressed file) ***//
+// - file_name is only used for messages and GetFilename()
+PZdabWriter::PZdabWriter(FILE *file, char *file_name, int calcMD5)
+{
+    if (Init(file_name, calcMD5)) return;
+    
+    zdaboutput = file;
+    if (!zdaboutput) {
+        printf("Error creating output zdab file %s\x07\n",zdab_output_file);
+        mError = 1;
+        return;
+    }
+    printf("Created output zdab file %s\n",zdab_output_file);
+    InitRecords();
+}
+
+//*** reset counters - returns non-zero if the file name is empty ***//
+int PZdabWriter::Init(char *file_name, int calcMD5)
+{
+    mBytesWritten = 0;
+    mWritePos = 0;
+    mError = 0;
+    mNewFile = 0;
+    mDirectFd = -1;
+    mDirectBuf = NULL;
+    mDirectLen = 0;
+    mDirectPos = 0;
+    mAllocated = 0;
+    mExtent = 0;
+    mCalcMD5 = calcMD5;
+    if (mCalcMD5) {
+        mMD5.Init();
+    }
+    
+    // zero the buffer
+    memset(mbuf, 0, sizeof(mbuf));
+    
+    // ignore NULL and empty file names
+    if (!file_name || *file_name=='\0') {
+        zdaboutput = NULL;
+        mError = 1;
+        return(-1);
+    }
+    strncpy((char *)zdab_output_file,file_name,MAX_NAMELEN);
+    zdab_output_file[MAX_NAMELEN-1] = '\0';
+    
+    //FZ physical records counter
+    irec = (u_int32)(-1);
+    return(0);
+}
+
+//*** initialize static fields of our record structures ***//
+void PZdabWriter::InitRecords()
+{
     // physical record signature
     mpr[0] = ZEBRA_SIG0;
     mpr[1] = ZEBRA_SIG1; 
@@ -205,34 +346,6 @@ PZdabWriter::PZdabWriter(char *file_name, int calcMD5)
     mpr[6] = NPHREC;
     mpr[7] = 0;
 
-    // logical record type
-    mlr[1] = 2;
-
-    // pilot record information (signature and ZEBRA version)
-    mpili[0] = 0x4640e400UL;
-    mpili[1] = 37700;
-    mpili[2] = 0;
-    mpili[3] = 0;
-    mpili[4] = 0;
-    mpili[5] = 0;
-    mpili[6] = 0;   // this is 2 for MAST banks
-    mpili[7] = 0;
-    mpili[8] = 0;   // this is 'SUPP_BANK_LINK' for MAST banks
-    mpili[9] = 0;
-    mpili[10]= BASE_LINK;   // 1st link of MAST relocation table (constant)
-
-    // bank information (name, etc.) 
-    // (all but mbk[0] must be set for the specific bank type)
-    mbk[0] = 0; // constant
-    mbk[1] = 0;
-    mbk[2] = 0;
-    mbk[3] = 0;
-    mbk[4] = 0;
-    mbk[5] = 0;
-    mbk[6] = 0;
-    mbk[7] = 0;
-    mbk[8] = 0;
-
     // end of run record
     meor[0] = 1;   // record length
     meor[1] = 1;   // record type
@@ -246,10 +359,6 @@ PZdabWriter::PZdabWriter(char *file_name, int calcMD5)
     meoz[4] =  0;
     meoz[5] = 73;
     
-    // mast bank data
-    mMastData.currentVersion = SNOMAN_VERSION;
-    mMastData.originalVersion = ORIGINAL_VERSION;
-    
     // add first steering block to the buffer
     ipos = 0;
     ADD_RECORD(mpr);
@@ -289,24 +398,74 @@ int PZdabWriter::Close()
         WritePhysicalRecord();
 
         //end of DATA (system EOF)
-        if (fclose(zdaboutput)) {
+        if (CloseFile()) {
             printf("Error closing output zdab file %s\n",zdab_output_file);
             mError = 1;
         } else {
             printf("Closed output zdab file %s\n",zdab_output_file);
         }
-        zdaboutput = NULL;
-        
     }
     return(mError);
 }
 
+/* close the file, writing out anything left in the direct I/O buffer */
+/* returns non-zero on error */
+int PZdabWriter::CloseFile()
+{
+    int err = 0;
+    
+    if (mDirectFd >= 0) {
+        // the last page is padded for the write, so trim the file afterwards
+        if (DirectWrite(1) || ftruncate(mDirectFd, mDirectPos + mDirectLen)) err = 1;
+        if (close(mDirectFd)) err = 1;
+        mDirectFd = -1;
+        free(mDirectBuf);
+        mDirectBuf = NULL;
+    }
+    if (fclose(zdaboutput)) err = 1;
+    zdaboutput = NULL;
+    return(err);
+}
+
+// SetDirectIO - write the file with direct I/O, bypassing the page cache
+// - physical records are collected into an aligned buffer and written
+//   DIRECT_RECORDS at a time, and the file is preallocated in extents of the
+//   given size (in bytes, or 0 to not preallocate)
+// - only for files we created, and only before anything has been written
+// - returns 0 on success, or non-zero if the file is still written normally
+int PZdabWriter::SetDirectIO(int64_t extent)
+{
+#ifdef O_DIRECT
+    if (!zdaboutput || !mNewFile || mBytesWritten || mDirectFd >= 0) return(-1);
+    
+    if (posix_memalign((void **)&mDirectBuf, DIRECT_ALIGN, DIRECT_RECORDS * sizeof(mbuf))) {
+        mDirectBuf = NULL;
+        return(-1);
+    }
+    mDirectFd = open(zdab_output_file, O_WRONLY | O_DIRECT);
+    if (mDirectFd < 0) {
+        printf("Can't use direct I/O for output zdab file %s\n",zdab_output_file);
+        free(mDirectBuf);
+        mDirectBuf = NULL;
+        return(-1);
+    }
+    mDirectLen = 0;
+    mDirectPos = 0;
+    mAllocated = 0;
+    mExtent = extent > 0 ? extent : 0;
+    return(0);
+#else
+    return(-1);
+#endif
+}
+
 // get array index for specified bank
 // - returns -1 if bank is not recognized
+#define BANK_CASE(index, name, ...)     case name: return(index);
 int PZdabWriter::GetIndex(u_int32 bank_name)
 {
-    for (int i=0; i<NUM_BANKS; ++i) {
-        if (bank_name == sBankDef[i].name) return(i);
+    switch (bank_name) {
+        ZDAB_BANK_LIST(BANK_CASE)
     }
     return(-1);
 }
@@ -319,56 +478,65 @@ int PZdabWriter::GetBankNWords(int index)
 }
 
 // WriteBank - write an arbitrary bank to the file
+// - the bank must be in native format (it is not modified)
 // - returns 0 on success
 int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
 {
-    int i, nsize, hdr_size, nfast, nio_nl;
-    int npilot, mast_nio_nl = 0, fast = 0;
-    
-    if (!zdaboutput) {
-        printf("Zdab output file not open!\n");
-        return(-1);
-    }
-    
+    int nsize;
+
     // don't write MAST banks alone
     // they will be written automatically before the appropriate banks
     if (index == kMASTindex) return(0);
-    
-    // must set the size of PMT event records (since it is variable)
+
+    // must get the size of PMT event records (since it is variable)
     if (index == kZDABindex) {
-        sBankDef[kZDABindex].nwords = PZdabFile::GetSize((PmtEventRecord *)bank_ptr) / sizeof(u_int32);
-        // K Labe - Feb 3 2015
-        // Adding this line for consistency with newer version of PZdabWriter
-        SWAP_INT32(bank_ptr, 11);
+        nsize = PZdabFile::GetSize((PmtEventRecord *)bank_ptr) / sizeof(u_int32);
+    } else {
+        nsize = sBankDef[index].nwords;
     }
-    
-    // get the size of the record to be written
-    nsize = sBankDef[index].nwords;
-    // get the number of i/o control words and links
-    nio_nl = (int)(sBankDef[index].iochar[0] & 0x0000ffff) - 12;
 
-    // calculate size of bank header including i/o control and link words
-    hdr_size = 1 + nio_nl + NBANK;
-    
-    if (index != kZDABindex) {
-        // add size of MAST bank (goes before all but ZDAB banks)
-        mast_nio_nl = (int)(sBankDef[kMASTindex].iochar[0] & 0x0000ffff) - 12;
-        hdr_size += 1 + mast_nio_nl + NBANK + sBankDef[kMASTindex].nwords;
-        mpili[6] = 2;                               // 2 entries in relocation table
-        mpili[8] = SUPP_BANK_LINK;                  // entry link
-        mpili[11] = BASE_LINK + hdr_size + nsize;   // 2nd relocation table entry
+    // byte swap the bank to the external format as it is copied
+    return(WriteBankData<HostToExternal>(bank_ptr, index, nsize));
+}
+
+// WriteExternalBank - write a bank which is already in external format
+// - nwords is the size of the bank, so the size of PMT event records
+//   need not be found again from the sub-field chain
+// - swap is non-zero if the bank is instead in the opposite byte order
+//   to the external format (it is swapped as it is copied)
+// - the bank is not modified
+// - returns 0 on success
+int PZdabWriter::WriteExternalBank(u_int32 *bank_ptr, int index, int nwords, int swap)
+{
+    if (index == kMASTindex) return(0);
+    if (swap) {
+        return(WriteBankData<ByteSwap>(bank_ptr, index, nwords));
     } else {
-        mpili[6] = 0;           // no relocation table
-        mpili[8] = 0;           // no entry link
+        return(WriteBankData<NoSwap>(bank_ptr, index, nwords));
     }
-    npilot = NPILOT + mpili[6]; // write relocation table with pilot record
+}
 
+// WriteBankData - write the bank data of nsize words
+// - Order converts the bank data to external format
+// - returns 0 on success
+template <class Order>
+int PZdabWriter::WriteBankData(u_int32 *bank_ptr, int index, int nsize)
+{
+    int i, nfast, fast = 0;
+    const SBankHeader &hdr = sBankHeader[index];
+    const int npilot = hdr.npilot;
+    const int hdr_size = hdr.hdr_size;
+    
+    if (!zdaboutput) {
+        printf("Zdab output file not open!\n");
+        return(-1);
+    }
+    
     // start a logical record if we have already written the steering block and the
     // next record will need a fast block
     if (mWritePos && ipos + NLOGIC + npilot + hdr_size + nsize > 2 * NWREC - NPHREC) {
         if (WritePhysicalRecord()) {
-            fclose(zdaboutput);
-            zdaboutput = NULL;
+            CloseFile();
             mError = 1;
             printf("Error writing to output zdab file %s!  File closed.\x07\n",zdab_output_file);
             return(-2);
@@ -383,8 +551,7 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
     //(otherwise complete the steering block with a padding block)
     if ( ipos >= (u_int32)(NWREC-NLOGIC-npilot-hdr_size) ) {
         if (WritePhysicalRecord()) {
-            fclose(zdaboutput);
-            zdaboutput = NULL;
+            CloseFile();
             mError = 1;
             printf("Error writing to output zdab file %s!  File closed.\x07\n",zdab_output_file);
             return(-2);
@@ -395,59 +562,18 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
         ADD_RECORD(mpr);
     }
 
-    // logical record info (size and data type)
-    mlr[0] = npilot + hdr_size + nsize;
-    ADD_RECORD(mlr);
-
-    // Pilot record info (mostly constant except for bank material size)
-    mpili[7] = hdr_size + nsize;
-    AddRecord(mpili, npilot);
-
-    // add MAST bank if necessary
-    if (index != kZDABindex) {
-        // first clear all the mast links
-        int nlinks = sBankDef[kMASTindex].nlinks;
-        memset(sBankDef[kMASTindex].iochar + 1 + (mast_nio_nl - nlinks), 0, nlinks * sizeof(u_int32));
-        // then set the link for the bank we are writing
-        sBankDef[kMASTindex].iochar[1 + mast_nio_nl - sBankDef[index].id] 
-            = BASE_LINK + 1 + mast_nio_nl + NBANK + sBankDef[kMASTindex].nwords + 1 + nio_nl;
-        // add the i/o characteristic for the MAST bank
-        AddRecord(sBankDef[kMASTindex].iochar, mast_nio_nl + 1);
-        
-        // add MAST Bank info
-        mbk[1] = 0;
-        mbk[2] = 0;
-        mbk[3] = sBankDef[kMASTindex].id;
-        mbk[4] = sBankDef[kMASTindex].name;
-        mbk[5] = sBankDef[kMASTindex].nlinks;
-        mbk[6] = sBankDef[kMASTindex].nlinks;
-        mbk[7] = sBankDef[kMASTindex].nwords;
-        mbk[8] = sBankDef[kMASTindex].status;
-        ADD_RECORD(mbk);
-        
-        // add the MAST bank data
-        ADD_RECORD(mMastData);
+    // add the logical record, pilot record, MAST bank and bank header
+    // from the template for this bank (filling in the size if it differs)
+    u_int32 *pt = mbuf + ipos;
+    memcpy(pt, hdr.words, hdr.nwords * sizeof(u_int32));
+    if (nsize != hdr.nsize) {
+        pt[HDR_LOGICAL_SIZE] = HostToExternal::Word(npilot + hdr_size + nsize);
+        pt[HDR_PILOT_SIZE] = HostToExternal::Word(hdr_size + nsize);
+        if (index != kZDABindex) pt[HDR_RELOC_SIZE] = HostToExternal::Word(BASE_LINK + hdr_size + nsize);
+        pt[HDR_BANK_SIZE(hdr.nwords)] = HostToExternal::Word(nsize);
     }
+    ipos += hdr.nwords;
     
-    // add the i/o characteristic for the bank we are writing
-    AddRecord(sBankDef[index].iochar, nio_nl + 1);
-    
-    // add Bank info
-    mbk[1] = SUPP_BANK_LINK;
-    mbk[2] = SUPP_BANK_LINK - sBankDef[index].id;
-    mbk[3] = sBankDef[index].id;
-    mbk[4] = sBankDef[index].name;
-    mbk[5] = sBankDef[index].nlinks;
-    mbk[6] = sBankDef[index].nlinks;
-    mbk[7] = nsize;
-    mbk[8] = sBankDef[index].status;
-    ADD_RECORD(mbk);
-    
-    // byte swap the bank to the external format
-    if(index!=kZDABindex){
-        SWAP_INT32(bank_ptr, nsize);
-    }    
-
     // write the bank data
     for (i=0; i<nsize; ++i) { 
         if (ipos > NWREC-1) {
@@ -459,8 +585,7 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
                 if (!fast) {
                     // be sure our steering record hasn't been written
                     if (mWritePos >= 7) {
-                        fclose(zdaboutput);
-                        zdaboutput = NULL;
+                        CloseFile();
                         mError = 1;
                         break;
                     }
@@ -469,11 +594,10 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
 // careful!  fixed fast block calculation problem - PH 06/09/99
                     nfast = (nleft-(NWREC-NPHREC)-1)/NWREC + 1; 
                     mbuf[7] = nfast;
-                    SWAP_INT32(mbuf+7, 1);
+                    mbuf[7] = HostToExternal::Word(mbuf[7]);
                 }
                 if (FWrite(&mbuf,sizeof(mbuf))) {
-                    fclose(zdaboutput);
-                    zdaboutput = NULL;
+                    CloseFile();
                     mError = 1;
                     break;
                 }
@@ -481,8 +605,7 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
             } else {
                 fast = 0;
                 if (FWrite(&mbuf,sizeof(mbuf))) {
-                    fclose(zdaboutput);
-                    zdaboutput = NULL;
+                    CloseFile();
                     mError = 1;
                     break;
                 }
@@ -492,19 +615,16 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
                 ADD_RECORD(mpr);
             } 
         }
-        mbuf[ipos] = bank_ptr[i];
+        mbuf[ipos] = Order::Word(bank_ptr[i]);
 #ifdef DEBUG_ZDAB
         if (mpr[0] != ZEBRA_SIG0) {
             printf("ZDAB Buffer overrun!!!\n");
         }
 #endif
-        // (already swapped)
+        // (swapped as it was copied)
         ++ipos;
     }
     
-    // byte swap the bank back again
-    SWAP_INT32(bank_ptr, nsize);
-    
     if (mError) {
         printf("Error writing to output zdab file %s!  File closed.\x07\n",zdab_output_file);
         return(-1);
@@ -514,8 +634,7 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
     if (fast) {
         // fill in with a padding block
         if (WritePhysicalRecord()) {
-            fclose(zdaboutput);
-            zdaboutput = NULL;
+            CloseFile();
             mError = 1;
             printf("Error writing to output zdab file %s!  File closed.\x07\n",zdab_output_file);
             return(-1);
@@ -527,10 +646,6 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
         fast = 0;
     }
 
-    // KLabe - February 3 2015 - SWAP back if necessary
-    if(index == kZDABindex)
-      SWAP_INT32(bank_ptr, 11);
-
     return(0);
 }
 
@@ -538,8 +653,7 @@ int PZdabWriter::WriteBank(u_int32 *bank_ptr, int index)
 /* add a record to our buffer */
 void PZdabWriter::AddRecord(u_int32 *data, u_int32 nwords)
 {
-    memcpy(mbuf+ipos, data, nwords * sizeof(u_int32));
-    SWAP_INT32(mbuf+ipos, nwords);
+    HostToExternal::Copy(mbuf+ipos, data, nwords);
     
     ipos += nwords; // update buffer pointer
 }
@@ -557,7 +671,7 @@ int PZdabWriter::FWrite(void *buff, unsigned long size)
         size -= (mWritePos * sizeof(u_int32));
         mWritePos = 0;      // reset write position since we wrote it all
     }
-    if (fwrite(buff,size,1,zdaboutput) != 1) {
+    if (mDirectFd >= 0 ? DirectCopy(buff, size) : fwrite(buff,size,1,zdaboutput) != 1) {
         mError = 1;
     } else {
         mBytesWritten += size;
@@ -567,7 +681,74 @@ int PZdabWriter::FWrite(void *buff, unsigned long size)
 }
 
 
+/* copy data into the direct I/O buffer, writing the buffer when it is full */
+/* returns non-zero on error */
+int PZdabWriter::DirectCopy(void *buff, unsigned long size)
+{
+    const unsigned long buffsize = DIRECT_RECORDS * sizeof(mbuf);
+    unsigned char *pt = (unsigned char *)buff;
+    
+    while (size) {
+        unsigned long n = buffsize - mDirectLen;
+        if (n > size) n = size;
+        memcpy(mDirectBuf + mDirectLen, pt, n);
+        mDirectLen += n;
+        pt += n;
+        size -= n;
+        if (mDirectLen == buffsize && DirectWrite(0)) return(-1);
+    }
+    return(0);
+}
+
+/* write the whole pages in the direct I/O buffer to the file */
+/* - if all is non-zero, the last partial page is padded with zeros and written too */
+/* - the partial page stays at the start of the buffer, to be written again */
+/*   in full at the same offset once more data follows it */
+/* - returns non-zero on error */
+int PZdabWriter::DirectWrite(int all)
+{
+    const u_int32 whole = mDirectLen - mDirectLen % DIRECT_ALIGN;
+    u_int32 len = whole;
+    if (all && len < mDirectLen) {
+        memset(mDirectBuf + mDirectLen, 0, len + DIRECT_ALIGN - mDirectLen);
+        len += DIRECT_ALIGN;
+    }
+    if (!len) return(0);
+    
+#ifdef FALLOC_FL_KEEP_SIZE
+    // preallocate another extent (without changing the file size) when we reach
+    // the end of the last one -- give up if the file system can't do it
+    while (mExtent && mDirectPos + len > mAllocated) {
+        if (fallocate(mDirectFd, FALLOC_FL_KEEP_SIZE, mAllocated, mExtent)) {
+            mExtent = 0;
+        } else {
+            mAllocated += mExtent;
+        }
+    }
+#endif
+    for (u_int32 done=0; done<len; ) {
+        ssize_t n = pwrite(mDirectFd, mDirectBuf + done, len - done, mDirectPos + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return(-1);
+        done += n;
+    }
+    mDirectPos += whole;
+    
+    // move what is left (less than a page) to the start of the buffer
+    if (whole < mDirectLen) {
+        memmove(mDirectBuf, mDirectBuf + whole, mDirectLen - whole);
+        mDirectLen -= whole;
+    } else {
+        mDirectLen = 0;
+    }
+    return(0);
+}
+
+
 // flush the output file
+// - with direct I/O, the last partial page is written padded and the padding
+//   trimmed off, so that a sync makes everything written so far durable; the
+//   page stays in the buffer, and is written again once it has more data
 int PZdabWriter::Flush()
 {
     int     err = 0;
@@ -579,11 +760,17 @@ int PZdabWriter::Flush()
     }
     // flush the file
     if (!err) {
-        err = fflush(zdaboutput);
+        err = mDirectFd >= 0 ?
+              DirectWrite(1) || ftruncate(mDirectFd, mDirectPos + mDirectLen) :
+              fflush(zdaboutput);
+    }
+    // the trim also frees the extent preallocated past the end of the file,
+    // so the next write preallocates afresh from there
+    if (!err && mDirectFd >= 0 && mAllocated > mDirectPos + mDirectLen) {
+        mAllocated = mDirectPos + mDirectLen;
     }
     if (err) {
-        fclose(zdaboutput);
-        zdaboutput = NULL;
+        CloseFile();
         mError = 1;
         printf("Error flushing output zdab file %s!  File closed.\x07\n",zdab_output_file);
     }
@@ -598,7 +785,7 @@ int PZdabWriter::WritePhysicalRecord()
         mbuf[ipos] = NWREC - ipos - 1; // Length of this padding record
         mbuf[ipos+1] = 5; // RecordID of a padding record
         memset(mbuf+ipos+2, 0, sizeof(u_int32)*(NWREC - ipos - 2));
-        SWAP_INT32(mbuf+ipos, 2);
+        HostToExternal::Words(mbuf+ipos, 2);
     } else if (ipos < NWREC) {
         mbuf[ipos] = 0; // write a 1-word padding record
     }
@@ -6,6 +6,7 @@
 #define __PZdabWriter_h__
 
 #include <stdio.h>
+#include <stdint.h>
 #include "PZdabFile.h"
 #include "MD5Checksum.h"
 
@@ -20,34 +21,65 @@
 
 #define MAX_NAMELEN 256
 
+// direct I/O output (see SetDirectIO())
+#define DIRECT_ALIGN    4096    // alignment of direct I/O buffers, sizes and offsets (bytes)
+#define DIRECT_RECORDS  16      // physical records per direct I/O write
+                                // (a multiple of 4, since 4 records fill 15 pages)
+
+// ZEBRA bank definitions (one entry per bank type)
+// - writer index, hollerith name, numerical bank ID, size in 32-bit words
+//   (0 if variable), number of links, bank status, then the i/o characteristic
+//   plus any extra i/o control words
+// - all banks but ZDAB are written after a MAST bank, so their numerical ID
+//   must be one of the MAST links
+// - the header templates for each bank are generated from this list at compile time
+#define ZDAB_BANK_LIST(BANK) \
+    BANK(kZDABindex, ZDAB_RECORD,  6,                    0,  0, 0x00000, 0x0002000c) \
+    BANK(kMASTindex, MAST_RECORD,  1, WORD_SIZE(SBankMAST), 25, 0x00004, 0x00030025) \
+    BANK(kRHDRindex, RHDR_RECORD,  5, WORD_SIZE(SBankRHDR),  0, 0x00000, 0x0002000c) \
+    BANK(kEPEDindex, EPED_RECORD,  6, WORD_SIZE(SBankEPED),  0, 0x00000, 0x0002000c) \
+    BANK(kTRIGindex, TRIG_RECORD,  7, WORD_SIZE(SBankTRIG),  0, 0x00000, 0x0002000c) \
+    BANK(kSOSLindex, SOSL_RECORD,  8, WORD_SIZE(SBankSOSL),  0, 0x00000, 0x0323000c) \
+    BANK(kCASTindex, CAST_RECORD, 10, WORD_SIZE(SBankCAST),  0, 0x80000, 0xc9a3000e, 0x40041803, 0x000e005a) \
+    BANK(kCAACindex, CAAC_RECORD, 11, WORD_SIZE(SBankCAAC),  0, 0x00000, 0x0003000c)
+
 // order of the bank entries in the sBankDef array
+#define BANK_INDEX(index, ...)  index,
 enum EBankIndex {
-    kZDABindex,
-    kMASTindex,
-    kRHDRindex,
-    kEPEDindex,
-    kTRIGindex,
-    kSOSLindex,
-    kCASTindex,
-    kCAACindex,
-    NUM_BANKS       //  number of bank definitions in following array
+    ZDAB_BANK_LIST(BANK_INDEX)
+    NUM_BANKS       //  number of bank definitions
 };
+#undef BANK_INDEX
 
 // bank definition structure
 struct SBankDef {
     u_int32     name;       // hollerith name bank ID
     int         id;         // numerical bank ID
-    int         nwords;     // word size of bank structure
+    int         nwords;     // word size of bank structure (0 if variable)
     int         nlinks;     // number of links
     u_int32     status;     // bank status
     u_int32     iochar[40]; // i/o characteristic, plus extra i/o control words, plus links
 };
 
+#define MAX_HEADER_WORDS    80  // maximum size of a bank header template
+
+// words written before the data of a bank, in external format
+// (logical record control, pilot record and relocation table, MAST bank
+//  if required, then the i/o characteristic and header of the bank itself)
+struct SBankHeader {
+    int         nwords;     // number of words in template
+    int         npilot;     // size of pilot record including relocation table
+    int         hdr_size;   // size of bank material before the bank data
+    int         nsize;      // size of bank data in template (0 if variable)
+    u_int32     words[MAX_HEADER_WORDS];
+};
+
 
 // class definition
 class PZdabWriter {
 public:
     PZdabWriter(char *file_name, int calcMD5=0);
+    PZdabWriter(FILE *file, char *file_name, int calcMD5=0);
     ~PZdabWriter();
 
     int         IsOpen()        { return zdaboutput != NULL; }
@@ -55,30 +87,36 @@ public:
     int         Close();
     
     int         WriteBank(u_int32 *bank_ptr, int index);
+    int         WriteExternalBank(u_int32 *bank_ptr, int index, int nwords, int swap=0);
 
     int         Write(PmtEventRecord *aPmtRecord) {
                     return WriteBank((u_int32 *)aPmtRecord, kZDABindex);
                 }
 
     char *      GetMD5()            { return mMD5.GetMD5(); }
-    u_int32     GetBytesWritten()   { return mBytesWritten; }
+    uint64_t    GetBytesWritten()   { return mBytesWritten; }
     char      * GetFilename()       { return zdab_output_file; }
     int         Flush();
+    int         SetDirectIO(int64_t extent);
     
     static int  GetIndex(u_int32 bank_name);
     static int  GetBankNWords(int index);
 
 private:
+    int         Init(char *file_name, int calcMD5);
+    void        InitRecords();
+    template <class Order>
+    int         WriteBankData(u_int32 *bank_ptr, int index, int nsize);
     void        AddRecord(u_int32 *data, u_int32 nwords);
     int         WritePhysicalRecord();
     int         FWrite(void *buff, unsigned long size);
+    int         DirectCopy(void *buff, unsigned long size);
+    int         DirectWrite(int all);
+    int         CloseFile();
     
-    u_int32     mBytesWritten;
+    uint64_t    mBytesWritten;
     u_int32     mbuf[NWREC];
     u_int32     mpr[NPHREC];
-    u_int32     mlr[NLOGIC]; 
-    u_int32     mpili[NPILOT+2];    // 2 extra words for MAST relocation table entries
-    u_int32     mbk[NBANK];
     u_int32     meor[NEOR];
     u_int32     meoz[NEOZ];
     u_int32     irec, ipos;
@@ -87,13 +125,18 @@ private:
     int         mCalcMD5;
     MD5Checksum mMD5;
     u_int32     mWritePos;          // current write position
-    
-    MastRecord  mMastData;
 
     char        zdab_output_file[MAX_NAMELEN];
     FILE     *  zdaboutput;
+    int         mNewFile;           // non-zero if we created the file
 
-    static SBankDef sBankDef[NUM_BANKS];    // bank definition structures
+    // direct I/O
+    int         mDirectFd;          // file descriptor (-1 if not using direct I/O)
+    unsigned char * mDirectBuf;     // aligned buffer of DIRECT_RECORDS physical records
+    u_int32     mDirectLen;         // bytes in buffer
+    int64_t     mDirectPos;         // file offset of start of buffer
+    int64_t     mAllocated;         // bytes preallocated in file
+    int64_t     mExtent;            // size of preallocated extents (0 if none)
 };
 
 #endif // __PZdabWriter_h__
@@ -0,0 +1,432 @@
+/* Seekable zstd container for zdab files */
+/*
+** File layout (zstd seekable format):
+**   frame 0 ... frame N-1      independent zstd frames, each holding a whole
+**                              number of ZEBRA physical records
+**   skippable frame            seek table: magic 0x184D2A5E, table size,
+**                              then the compressed and decompressed size of
+**                              each frame, then the footer (number of frames,
+**                              descriptor byte, magic 0x8F92EAB1)
+** All seek table words are little-endian.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <zstd.h>
+#include "PZdabZstd.h"
+#include "PZdabWriter.h"
+
+#define ZSTD_FRAME_MAGIC        0xFD2FB528UL
+#define ZSTD_SKIPPABLE_MAGIC    0x184D2A5EUL
+#define ZSTD_SKIPPABLE_MASK     0xFFFFFFF0UL
+#define ZSTD_SEEKABLE_MAGIC     0x8F92EAB1UL
+#define SEEK_FOOTER_SIZE        9       // bytes in seek table footer
+#define SEEK_CHECKSUM_FLAG      0x80    // descriptor bit for per-frame checksums
+
+static void PutLE32(unsigned char *pt, uint32_t val)
+{
+    pt[0] = val & 0xff;
+    pt[1] = (val >> 8) & 0xff;
+    pt[2] = (val >> 16) & 0xff;
+    pt[3] = (val >> 24) & 0xff;
+}
+
+static uint32_t GetLE32(const unsigned char *pt)
+{
+    return(pt[0] | (pt[1] << 8) | (pt[2] << 16) | ((uint32_t)pt[3] << 24));
+}
+
+//===================================================================================
+// Writer
+
+struct ZstdFrame {
+    char      * data;
+    size_t      size;
+};
+
+class PZstdWriter {
+public:
+    PZstdWriter(FILE *fp, int level, size_t frameSize);
+    ~PZstdWriter();
+
+    int         IsOpen()        { return mBuff != NULL; }
+    ssize_t     Write(const char *buff, size_t size);
+    int         Close();
+
+private:
+    int         QueueFrame();
+    void        Compress();
+
+    FILE      * mFile;
+    int         mLevel;
+    size_t      mFrameSize;         // uncompressed bytes per frame
+    char      * mBuff;              // frame being filled
+    size_t      mBuffLen;
+
+    std::deque<ZstdFrame>   mQueue; // frames waiting to be written (front is in progress)
+    std::mutex              mMutex;
+    std::condition_variable mCond;
+    bool        mDone;
+    int         mError;
+    std::vector<uint32_t>   mSeekTable; // compressed and decompressed size of each frame
+    std::thread mThread;
+};
+
+PZstdWriter::PZstdWriter(FILE *fp, int level, size_t frameSize)
+{
+    mFile = fp;
+    mLevel = level;
+    mFrameSize = frameSize;
+    mBuffLen = 0;
+    mDone = false;
+    mError = 0;
+    mBuff = (char *)malloc(mFrameSize);
+    if (mBuff) {
+        mThread = std::thread(&PZstdWriter::Compress, this);
+    }
+}
+
+PZstdWriter::~PZstdWriter()
+{
+    free(mBuff);
+}
+
+// add data to the current frame, queueing the frame when it is full
+// - returns the number of bytes taken (less than size on error)
+ssize_t PZstdWriter::Write(const char *buff, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size && !mError) {
+        size_t n = mFrameSize - mBuffLen;
+        if (n > size - done) n = size - done;
+        memcpy(mBuff + mBuffLen, buff + done, n);
+        mBuffLen += n;
+        done += n;
+        if (mBuffLen == mFrameSize && QueueFrame()) break;
+    }
+    return(mError ? 0 : done);
+}
+
+// hand the current frame to the compression thread and start another
+// - waits if the thread is too far behind
+// - returns non-zero on error
+int PZstdWriter::QueueFrame()
+{
+    char *next = (char *)malloc(mFrameSize);
+    if (!next) {
+        printf("Out of memory for zstd frame buffer!\x07\n");
+        return(mError = 1);
+    }
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (mQueue.size() >= ZSTD_MAX_QUEUED && !mError) mCond.wait(lock);
+    ZstdFrame frame = { mBuff, mBuffLen };
+    mQueue.push_back(frame);
+    mCond.notify_all();
+    mBuff = next;
+    mBuffLen = 0;
+    return(mError);
+}
+
+// compression thread - compress and write the queued frames in order
+void PZstdWriter::Compress()
+{
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    size_t bound = ZSTD_compressBound(mFrameSize);
+    char *out = (char *)malloc(bound);
+    int err = (!cctx || !out);
+
+    if (err) printf("Out of memory for zstd compression!\x07\n");
+    for (;;) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (mQueue.empty() && !mDone) mCond.wait(lock);
+        if (mQueue.empty()) break;
+        ZstdFrame frame = mQueue.front();
+        lock.unlock();
+
+        if (!err) {
+            size_t csize = ZSTD_compressCCtx(cctx, out, bound, frame.data, frame.size, mLevel);
+            if (ZSTD_isError(csize)) {
+                printf("zstd compression error: %s\x07\n", ZSTD_getErrorName(csize));
+                err = 1;
+            } else if (fwrite(out, csize, 1, mFile) != 1) {
+                printf("Error writing compressed zdab file!\x07\n");
+                err = 1;
+            } else {
+                mSeekTable.push_back((uint32_t)csize);
+                mSeekTable.push_back((uint32_t)frame.size);
+            }
+        }
+        free(frame.data);
+
+        lock.lock();
+        mQueue.pop_front();
+        if (err) mError = 1;
+        mCond.notify_all();
+    }
+    ZSTD_freeCCtx(cctx);
+    free(out);
+}
+
+// write the last frame and the seek table, and close the file
+// - returns non-zero on error
+int PZstdWriter::Close()
+{
+    if (mBuff) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mBuffLen) {
+                ZstdFrame frame = { mBuff, mBuffLen };
+                mQueue.push_back(frame);
+                mBuff = NULL;
+            }
+            mDone = true;
+            mCond.notify_all();
+        }
+        mThread.join();
+    }
+    if (!mError) {
+        u_int32 nframes = mSeekTable.size() / 2;
+        u_int32 nbytes = nframes * 8 + SEEK_FOOTER_SIZE;
+        std::vector<unsigned char> table(nbytes + 8);
+        unsigned char *pt = &table[0];
+        PutLE32(pt, ZSTD_SKIPPABLE_MAGIC);
+        PutLE32(pt + 4, nbytes);
+        pt += 8;
+        for (size_t i=0; i<mSeekTable.size(); ++i, pt+=4) {
+            PutLE32(pt, mSeekTable[i]);
+        }
+        PutLE32(pt, nframes);
+        pt[4] = 0;      // no checksums
+        PutLE32(pt + 5, ZSTD_SEEKABLE_MAGIC);
+        if (fwrite(&table[0], table.size(), 1, mFile) != 1) {
+            printf("Error writing compressed zdab seek table!\x07\n");
+            mError = 1;
+        }
+    }
+    if (fclose(mFile)) mError = 1;
+    return(mError);
+}
+
+static ssize_t zstd_write(void *cookie, const char *buff, size_t size)
+{
+    return(((PZstdWriter *)cookie)->Write(buff, size));
+}
+
+static int zstd_close_write(void *cookie)
+{
+    PZstdWriter *writer = (PZstdWriter *)cookie;
+    int err = writer->Close();
+    delete writer;
+    return(err ? EOF : 0);
+}
+
+FILE *ZstdOpenWrite(const char *file_name, int level, int frameRecords)
+{
+    FILE *fp = fopen(file_name, "wb");
+    if (!fp) return(NULL);
+    return(ZstdOpenWrite(fp, level, frameRecords));
+}
+
+FILE *ZstdOpenWrite(FILE *fp, int level, int frameRecords)
+{
+    PZstdWriter *writer = new PZstdWriter(fp, level, (size_t)frameRecords * NWREC * sizeof(u_int32));
+    if (!writer->IsOpen()) {
+        printf("Out of memory for zstd frame buffer!\x07\n");
+        writer->Close();
+        delete writer;
+        return(NULL);
+    }
+    cookie_io_functions_t funcs = { NULL, zstd_write, NULL, zstd_close_write };
+    FILE *stream = fopencookie(writer, "wb", funcs);
+    if (!stream) {
+        writer->Close();
+        delete writer;
+    }
+    return(stream);
+}
+
+//===================================================================================
+// Reader
+
+class PZstdReader {
+public:
+    PZstdReader(FILE *fp);
+    ~PZstdReader();
+
+    int         Open();
+    ssize_t     Read(char *buff, size_t size);
+    int         Seek(off64_t *offset, int whence);
+
+private:
+    int         LoadFrame(int frame);
+
+    FILE      * mFile;
+    int         mNumFrames;
+    std::vector<int64_t>    mCompPos;   // file offset of each frame (plus end)
+    std::vector<int64_t>    mPos;       // decompressed offset of each frame (plus end)
+    ZSTD_DCtx * mDCtx;
+    std::vector<char>       mCompData;
+    std::vector<char>       mFrameData; // decompressed data of frame mFrame
+    int         mFrame;
+    int64_t     mReadPos;               // decompressed read position
+};
+
+PZstdReader::PZstdReader(FILE *fp)
+{
+    mFile = fp;
+    mNumFrames = 0;
+    mDCtx = NULL;
+    mFrame = -1;
+    mReadPos = 0;
+}
+
+PZstdReader::~PZstdReader()
+{
+    if (mDCtx) ZSTD_freeDCtx(mDCtx);
+    fclose(mFile);
+}
+
+// read the seek table - returns non-zero on error
+int PZstdReader::Open()
+{
+    unsigned char footer[SEEK_FOOTER_SIZE], header[8];
+
+    if (fseeko(mFile, -SEEK_FOOTER_SIZE, SEEK_END) ||
+        fread(footer, SEEK_FOOTER_SIZE, 1, mFile) != 1 ||
+        GetLE32(footer + 5) != ZSTD_SEEKABLE_MAGIC)
+    {
+        printf("Compressed zdab file has no seek table\x07\n");
+        return(-1);
+    }
+    mNumFrames = GetLE32(footer);
+    int entry_size = (footer[4] & SEEK_CHECKSUM_FLAG) ? 12 : 8;
+    int64_t nbytes = (int64_t)mNumFrames * entry_size + SEEK_FOOTER_SIZE;
+    std::vector<unsigned char> table(nbytes);
+    if (fseeko(mFile, -(nbytes + 8), SEEK_END) ||
+        fread(header, 8, 1, mFile) != 1 ||
+        (GetLE32(header) & ZSTD_SKIPPABLE_MASK) != (ZSTD_SKIPPABLE_MAGIC & ZSTD_SKIPPABLE_MASK) ||
+        GetLE32(header + 4) != nbytes ||
+        fread(&table[0], nbytes, 1, mFile) != 1)
+    {
+        printf("Corrupt seek table in compressed zdab file\x07\n");
+        return(-1);
+    }
+    mCompPos.resize(mNumFrames + 1);
+    mPos.resize(mNumFrames + 1);
+    mCompPos[0] = mPos[0] = 0;
+    for (int i=0; i<mNumFrames; ++i) {
+        mCompPos[i+1] = mCompPos[i] + GetLE32(&table[i * entry_size]);
+        mPos[i+1] = mPos[i] + GetLE32(&table[i * entry_size + 4]);
+    }
+    mDCtx = ZSTD_createDCtx();
+    return(mDCtx ? 0 : -1);
+}
+
+// decompress a frame into mFrameData - returns non-zero on error
+int PZstdReader::LoadFrame(int frame)
+{
+    size_t csize = mCompPos[frame+1] - mCompPos[frame];
+    size_t size = mPos[frame+1] - mPos[frame];
+
+    mFrame = -1;
+    mCompData.resize(csize);
+    mFrameData.resize(size);
+    if (fseeko(mFile, mCompPos[frame], SEEK_SET) ||
+        fread(&mCompData[0], csize, 1, mFile) != 1)
+    {
+        printf("Error reading compressed zdab file!\x07\n");
+        return(-1);
+    }
+    size_t n = ZSTD_decompressDCtx(mDCtx, &mFrameData[0], size, &mCompData[0], csize);
+    if (ZSTD_isError(n) || n != size) {
+        printf("Error decompressing zdab frame %d\x07\n", frame);
+        return(-1);
+    }
+    mFrame = frame;
+    return(0);
+}
+
+// read decompressed data - returns number of bytes read (0 at end of file, -1 on error)
+ssize_t PZstdReader::Read(char *buff, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size && mReadPos < mPos[mNumFrames]) {
+        if (mFrame < 0 || mReadPos < mPos[mFrame] || mReadPos >= mPos[mFrame+1]) {
+            // find the frame containing the read position
+            int frame = std::upper_bound(mPos.begin(), mPos.end(), mReadPos) - mPos.begin() - 1;
+            if (LoadFrame(frame)) return(done ? (ssize_t)done : -1);
+        }
+        size_t n = mPos[mFrame+1] - mReadPos;
+        if (n > size - done) n = size - done;
+        memcpy(buff + done, &mFrameData[mReadPos - mPos[mFrame]], n);
+        mReadPos += n;
+        done += n;
+    }
+    return(done);
+}
+
+// set the decompressed read position
+int PZstdReader::Seek(off64_t *offset, int whence)
+{
+    int64_t pos = *offset;
+
+    switch (whence) {
+        case SEEK_CUR:  pos += mReadPos;            break;
+        case SEEK_END:  pos += mPos[mNumFrames];    break;
+    }
+    if (pos < 0) return(-1);
+    *offset = mReadPos = pos;
+    return(0);
+}
+
+static ssize_t zstd_read(void *cookie, char *buff, size_t size)
+{
+    return(((PZstdReader *)cookie)->Read(buff, size));
+}
+
+static int zstd_seek(void *cookie, off64_t *offset, int whence)
+{
+    return(((PZstdReader *)cookie)->Seek(offset, whence));
+}
+
+static int zstd_close_read(void *cookie)
+{
+    delete (PZstdReader *)cookie;
+    return(0);
+}
+
+FILE *ZstdOpenRead(const char *file_name)
+{
+    FILE *fp = fopen(file_name, "rb");
+    if (!fp) return(NULL);
+
+    PZstdReader *reader = new PZstdReader(fp);
+    if (reader->Open()) {
+        delete reader;
+        return(NULL);
+    }
+    cookie_io_functions_t funcs = { zstd_read, NULL, zstd_seek, zstd_close_read };
+    FILE *stream = fopencookie(reader, "rb", funcs);
+    if (!stream) delete reader;
+    return(stream);
+}
+
+int IsZstdFile(FILE *fp)
+{
+    unsigned char magic[4];
+    off_t pos = ftello(fp);
+    int n = fread(magic, sizeof(magic), 1, fp);
+
+    fseeko(fp, pos, SEEK_SET);
+    return(n == 1 && GetLE32(magic) == ZSTD_FRAME_MAGIC);
+}
@@ -0,0 +1,40 @@
+/* Seekable zstd container for zdab files */
+/*
+** Groups of ZEBRA physical records are compressed as independent zstd
+** frames, and a seek table in the zstd seekable format (a skippable frame
+** which ordinary zstd tools ignore) is written at the end of the file.
+** The files are opened as stdio streams, so PZdabWriter and PZdabFile
+** use them like any other file:  frames are compressed on a worker thread
+** as they fill, and the reader decompresses only the frames it needs,
+** so a read stream can be positioned anywhere with fseeko().
+**
+** Only built when WITH_ZSTD is defined (make WITH_ZSTD=1).
+*/
+
+#ifndef __PZdabZstd_h__
+#define __PZdabZstd_h__
+
+#include <stdio.h>
+
+#define ZSTD_FRAME_RECORDS  64      // physical records per frame
+#define ZSTD_ZDAB_LEVEL     3       // default compression level
+#define ZSTD_MAX_QUEUED     4       // frames waiting for the compression thread
+
+// open a compressed file for writing (returns NULL on error)
+// - the file is completed when the stream is closed with fclose()
+FILE *  ZstdOpenWrite(const char *file_name, int level=ZSTD_ZDAB_LEVEL,
+                      int frameRecords=ZSTD_FRAME_RECORDS);
+
+// compress onto a stream already open for writing (returns NULL on error)
+// - fp is closed when the returned stream is closed, or on error
+FILE *  ZstdOpenWrite(FILE *fp, int level=ZSTD_ZDAB_LEVEL,
+                      int frameRecords=ZSTD_FRAME_RECORDS);
+
+// open a compressed file for reading (returns NULL on error)
+FILE *  ZstdOpenRead(const char *file_name);
+
+// return non-zero if the open file begins with a zstd frame
+// (the file is left positioned at the start)
+int     IsZstdFile(FILE *fp);
+
+#endif // __PZdabZstd_h__
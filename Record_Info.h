@@ -17,6 +17,7 @@
 #define __RECORD_INFO_H__
 
 #include "sno_sys.h"
+#include "ByteOrder.h"     // defines SWAP_BYTES for little-endian hosts
 
 /*  version numbers...
  *  as of Feb 1997 (from UW) 
@@ -0,0 +1,464 @@
+// Burst Simulator
+//
+// Replays Stonehenge's burst trigger over a run for many choices of its
+// parameters (nhitbcut, burstwindow, burstsize and endrate) at once,
+// without reading the ZDAB files again.  The events of the run's subfiles
+// are reduced once to a compact stream of (time, nhit, trigger word), which
+// can be saved and replayed later.  For each choice of parameters the
+// stream is passed through the burst trigger of bursttrigger.h, which
+// snbuf.cpp is built on, keeping only the times of the events, and the
+// bursts, their lengths and how long after their first event they were
+// noticed are reported.  The choices are replayed in parallel.
+//
+// The times are worked out as Stonehenge does, including epochs, orphans,
+// events out of order and resets, except that the 10 MHz clock is not
+// read.  As in Stonehenge, a burst ongoing at the end of a subfile is ended
+// there, and the buffer carries on into the next subfile.  The trigger sum
+// integral cut (caenint) is not simulated.
+
+#include "PZdabFile.h"
+#include "PZdabWriter.h"
+#include "PZdabPool.h"
+#include "struct.h"
+#include "bursttrigger.h"
+#include "config.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <map>
+#include <vector>
+
+// Stream files
+#define SIM_MAGIC     0x4d495342UL  // "BSIM"
+#define SIM_VERSION   1
+
+// Flags of an event of the stream
+#define SIM_ENDOFFILE 1  // the last event of a subfile
+#define SIM_RESET     2  // the times were reset, clearing the buffer, before it
+#define SIM_CANDIDATE 4  // (in a replay) a burst candidate
+
+// Most values a parameter may be swept over
+#define MAXVALUES 1024
+
+// An event of the stream, in native byte order.  A stream file is a
+// simheader followed by its events.
+struct simevent
+{
+uint64_t longtime; // 50 MHz ticks, as Stonehenge's alltime.longtime
+uint32_t word;     // trigger word
+uint16_t nhit;
+uint16_t flags;
+};
+
+struct simheader
+{
+uint32_t magic;
+uint32_t version;
+uint64_t nevents;
+};
+
+// An event replayed: its time, and flags
+struct simtick
+{
+uint64_t longtime;
+uint32_t flags;
+};
+
+// A choice of the parameters
+struct simsetting
+{
+int nhitbcut;
+int burstwindow;
+int burstsize;
+int endrate;
+};
+
+// What a replay found
+struct simresult
+{
+int bursts;             // bursts begun
+int ended;              // bursts ended
+long events;            // events written to the burst files
+double seconds;         // total length of the bursts ended
+double longest;         // longest of them
+double latency;         // total time from first event to start of burst (s)
+double maxlatency;      // longest of those
+long overflows;         // events added to a full buffer outside a burst
+};
+
+// This function prints the usage information
+static void printhelp(){
+  printf(
+  "burstsim: replay Stonehenge's burst trigger over a run for many choices\n"
+  "of its parameters.\n"
+  "\n"
+  "  -i [string]: ZDAB subfile to read (may be given several times, in\n"
+  "               order; further subfiles may follow the options)\n"
+  "  -r [string]: Read the events from this stream file instead\n"
+  "  -w [string]: Write the events read to this stream file\n"
+  "  -c [string]: Configuration file, giving the bitmask and the\n"
+  "               parameters not swept (the physics run column)\n"
+  "  -s [string]: Sweep a parameter, as name=values, where name is\n"
+  "               nhitbcut, burstwindow, burstsize or endrate, and values\n"
+  "               is a list such as 20,30,40 or a range such as 10:50:5\n"
+  "               (first:last:step).  May be given once for each parameter\n"
+  "  -j [int]: Number of threads (default one per CPU)\n"
+  "  -h: This help text\n"
+  );
+}
+
+// This function reads the events of the subfile infilename onto the end of
+// events, working out their times as compute_times() does.  The epoch
+// carries on from the last subfile.  It returns false if the file cannot
+// be read.
+static bool Readsubfile(const char* const infilename, int & epoch,
+                        std::vector<simevent> & events){
+  FILE* const infile = fopen(infilename, "rb");
+  PZdabFile* const zfile = new PZdabFile();
+  if(!infile || zfile->Init(infile) < 0){
+    fprintf(stderr, "burstsim: could not open %s\n", infilename);
+    delete zfile;
+    return false;
+  }
+
+  bool first = true, problem = false, reset = false;
+  uint64_t standard50 = 0, standardlong = 0, longtime = 0;
+  for(ZdabRecordRef & ref : ZdabRecordRange(zfile)){
+    nZDAB* const zrec = ref.rec;
+    if(zrec->bank_name != ZDAB_RECORD)
+      continue;
+    PmtEventRecord pmt;
+    zfile->CopyToNative((u_int32*) &pmt, (const u_int32*) (zrec + 1),
+                        WORD_SIZE(PmtEventRecord));
+    if(pmt.NPmtHit > MAX_NHIT)
+      continue;
+    uint32_t mtcwords[6];
+    memcpy(mtcwords, &pmt.TriggerCardData, 6*sizeof(uint32_t));
+    const uint64_t time50 = (uint64_t(pmt.TriggerCardData.Bc50_2) << 11)
+                            + pmt.TriggerCardData.Bc50_1;
+
+    if(first){
+      longtime = standard50 = standardlong = time50;
+      first = false;
+    }
+    else if(time50 != 0){
+      // As IsConsistent(), with no drift between the clocks
+      const int found = Checktime(time50, standard50, 0);
+      if(!(found & (TIME_BACKWARD | TIME_JUMP))){
+        if(found & TIME_NEWEPOCH)
+          epoch++;
+        longtime = standardlong = time50 + maxtime*epoch;
+        standard50 = time50;
+        problem = false;
+      }
+      else if(problem){
+        // The buffer is cleared and the times start again
+        epoch = 0;
+        longtime = standardlong = standard50 = time50;
+        problem = false;
+        reset = true;
+      }
+      else{
+        problem = true;
+        longtime = standardlong;
+      }
+    }
+    // (an orphan keeps the last time)
+
+    simevent ev;
+    ev.longtime = longtime;
+    ev.nhit = pmt.NPmtHit;
+    ev.word = ((mtcwords[3] & 0xff000000) >> 24) |
+              ((mtcwords[4] & 0x3ffff) << 8);
+    ev.flags = reset ? SIM_RESET : 0;
+    reset = false;
+    events.push_back(ev);
+  }
+  if(!first)
+    events.back().flags |= SIM_ENDOFFILE;
+  delete zfile;
+  return true;
+}
+
+// This function reads the stream file fn into events
+static bool Readstream(const char* const fn, std::vector<simevent> & events){
+  FILE* const f = fopen(fn, "rb");
+  simheader h;
+  bool ok = f && fread(&h, sizeof(h), 1, f) == 1 &&
+            h.magic == SIM_MAGIC && h.version == SIM_VERSION;
+  if(ok){
+    events.resize(h.nevents);
+    ok = h.nevents == 0 ||
+         fread(&events[0], sizeof(simevent), h.nevents, f) == h.nevents;
+  }
+  if(f)
+    fclose(f);
+  if(!ok)
+    fprintf(stderr, "burstsim: %s is not a stream file\n", fn);
+  return ok;
+}
+
+// This function writes events to the stream file fn
+static bool Writestream(const char* const fn,
+                        const std::vector<simevent> & events){
+  FILE* const f = fopen(fn, "wb");
+  simheader h;
+  h.magic = SIM_MAGIC;
+  h.version = SIM_VERSION;
+  h.nevents = events.size();
+  bool ok = f && fwrite(&h, sizeof(h), 1, f) == 1 &&
+            (events.empty() ||
+             fwrite(&events[0], sizeof(simevent), events.size(), f)
+             == events.size());
+  if(f)
+    ok = !fclose(f) && ok;
+  if(!ok)
+    fprintf(stderr, "burstsim: could not write %s\n", fn);
+  return ok;
+}
+
+// This function picks out of events those which matter to a replay with
+// the burst nhit cut nhitbcut and the bitmask: the burst candidates, and
+// the ends of subfiles and resets
+static void Candidates(const std::vector<simevent> & events,
+                       const int nhitbcut, const uint32_t bitmask,
+                       std::vector<simtick> & ticks){
+  for(size_t i=0; i<events.size(); i++){
+    const simevent & ev = events[i];
+    uint32_t flags = ev.flags;
+    if(ev.nhit > nhitbcut && (ev.word & bitmask) == 0)
+      flags |= SIM_CANDIDATE;
+    if(flags){
+      simtick t;
+      t.longtime = ev.longtime;
+      t.flags = flags;
+      ticks.push_back(t);
+    }
+  }
+}
+
+// As Finishburst(): the burst written out is counted in r
+static void Finishburst(burstring & s, const uint64_t longtime,
+                        simresult & r){
+  const double seconds = (longtime - s.starttick)/50000000.;
+  r.ended++;
+  r.events += Endburst(s, [&]{ Writehead(s); });
+  r.seconds += seconds;
+  if(seconds > r.longest)
+    r.longest = seconds;
+}
+
+// This function replays the events ticks with the parameters set, as
+// Processrecord() and Closepipeline() would, and returns what was found
+static simresult Replay(const std::vector<simtick> & ticks,
+                        const simsetting & set){
+  simresult r;
+  memset(&r, 0, sizeof(r));
+  burstring* const s = new burstring;
+  memset(s, 0, sizeof(burstring));
+  s->burstptr.head = -1;
+  s->burstptr.tail = -1;
+  uint64_t last = 0;
+  for(size_t i=0; i<ticks.size(); i++){
+    const simtick & t = ticks[i];
+    // As ClearBuffer(), with the time of the last event replayed standing
+    // in for that of the last event
+    if(t.flags & SIM_RESET)
+      Clearburst(*s, [&]{ Finishburst(*s, last, r); });
+    // As UpdateBuf(), AddEvBuf() and Burstfile()
+    if(t.flags & SIM_CANDIDATE){
+      Expire(*s, t.longtime, set.burstwindow, [](int){});
+      Addtime(*s, t.longtime, [&]{ Writehead(*s); }, [&]{
+        if(!s->burstptr.burst)
+          r.overflows++; });
+      Stepburst(*s, t.longtime, set.burstsize, set.endrate,
+                [&]{
+                  // As Openburst(): the start is counted in r
+                  s->starttick = s->bursttime[s->burstptr.head];
+                  const double latency = (t.longtime - s->starttick)/50000000.;
+                  r.bursts++;
+                  r.latency += latency;
+                  if(latency > r.maxlatency)
+                    r.maxlatency = latency; },
+                [&]{ Writehead(*s); },
+                [&]{ Finishburst(*s, t.longtime, r); });
+    }
+    // As BurstEndofFile(): the buffer is saved before the burst is ended,
+    // and the next subfile starts from what was saved, not in a burst
+    if(t.flags & SIM_ENDOFFILE){
+      burstring saved = *s;
+      if(s->burstptr.burst)
+        Finishburst(*s, t.longtime, r);
+      *s = saved;
+      s->burstptr.burst = false;
+      s->bcount = 0;
+      s->starttick = 0;
+    }
+    last = t.longtime;
+  }
+  delete s;
+  return r;
+}
+
+// This function reads the values to sweep parameter name over from the
+// string list into values.  It aborts the program if the list cannot be
+// understood.
+static void Readvalues(const char* const name, const char* const given,
+                       std::vector<int> & values){
+  values.clear();
+  const char* list = given;
+  char* end;
+  const long first = strtol(list, &end, 10);
+  bool ok = end != list;
+  if(ok && *end == ':'){
+    list = end + 1;
+    const long last = strtol(list, &end, 10);
+    long step = 1;
+    ok = end != list;
+    if(ok && *end == ':'){
+      list = end + 1;
+      step = strtol(list, &end, 10);
+      ok = end != list && step > 0;
+    }
+    ok = ok && !*end && last >= first && (last - first)/step < MAXVALUES;
+    for(long v=first; ok && v<=last; v+=step)
+      values.push_back(v);
+  }
+  else{
+    values.push_back(first);
+    while(ok && *end == ',' && values.size() < MAXVALUES){
+      list = end + 1;
+      values.push_back(strtol(list, &end, 10));
+      ok = end != list;
+    }
+    ok = ok && !*end;
+  }
+  if(!ok){
+    fprintf(stderr, "burstsim: cannot sweep %s over %s\n", name, given);
+    exit(1);
+  }
+}
+
+int main(int argc, char** argv){
+  std::vector<const char*> infilenames;
+  const char* streamin = NULL, * streamout = NULL, * configfile = NULL;
+  std::vector<const char*> sweeps;
+  int nthreads = 0;
+
+  int ch;
+  while((ch = getopt(argc, argv, "hi:r:w:c:s:j:")) != -1){
+    switch(ch){
+      case 'i': infilenames.push_back(optarg); break;
+      case 'r': streamin = optarg; break;
+      case 'w': streamout = optarg; break;
+      case 'c': configfile = optarg; break;
+      case 's': sweeps.push_back(optarg); break;
+      case 'j': nthreads = atoi(optarg) > 1 ? atoi(optarg) : 1; break;
+      case 'h': printhelp(); return 0;
+      default:  printhelp(); return 1;
+    }
+  }
+  for(int i=optind; i<argc; i++)
+    infilenames.push_back(argv[i]);
+  if(infilenames.empty() == !streamin || (!configfile && !streamout)){
+    printhelp();
+    return 1;
+  }
+
+  // The events
+  const double start = Now();
+  std::vector<simevent> events;
+  if(streamin){
+    if(!Readstream(streamin, events))
+      return 1;
+  }
+  else{
+    int epoch = 0;
+    for(size_t i=0; i<infilenames.size(); i++)
+      if(!Readsubfile(infilenames[i], epoch, events))
+        return 1;
+  }
+  if(streamout && !Writestream(streamout, events))
+    return 1;
+  printf("%lu events, %.2f s of data, read in %.2f s\n",
+         (unsigned long) events.size(), events.empty() ? 0 :
+         (events.back().longtime - events.front().longtime)/50000000.,
+         Now() - start);
+  if(!configfile)
+    return 0;
+
+  // The choices of parameters: those swept, and the others from the
+  // configuration file
+  configuration allconfigs[2] = {};
+  ReadConfig(configfile, allconfigs);
+  const configuration & config = allconfigs[0];
+  const char* const names[4] = {"nhitbcut", "burstwindow", "burstsize",
+                                "endrate"};
+  std::vector<int> values[4];
+  values[0].push_back(config.nhitbcut);
+  values[1].push_back(config.burstwindow);
+  values[2].push_back(config.burstsize);
+  values[3].push_back(config.endrate);
+  for(size_t i=0; i<sweeps.size(); i++){
+    const char* const equals = strchr(sweeps[i], '=');
+    int n = 0;
+    while(n < 4 && (!equals || strlen(names[n]) != (size_t) (equals - sweeps[i])
+                    || strncmp(sweeps[i], names[n], equals - sweeps[i])))
+      n++;
+    if(n == 4){
+      fprintf(stderr, "burstsim: %s is not of the form name=values, with name"
+              " nhitbcut, burstwindow, burstsize or endrate\n", sweeps[i]);
+      return 1;
+    }
+    Readvalues(names[n], equals + 1, values[n]);
+  }
+  std::vector<simsetting> settings;
+  for(size_t a=0; a<values[0].size(); a++)
+    for(size_t b=0; b<values[1].size(); b++)
+      for(size_t c=0; c<values[2].size(); c++)
+        for(size_t d=0; d<values[3].size(); d++){
+          simsetting set;
+          set.nhitbcut = values[0][a];
+          set.burstwindow = values[1][b];
+          set.burstsize = values[2][c];
+          set.endrate = values[3][d];
+          settings.push_back(set);
+        }
+
+  // The candidates for each burst nhit cut are picked out once, and then
+  // every choice is replayed, all in parallel
+  const double sweepstart = Now();
+  PZdabPool pool(nthreads);
+  std::vector<std::vector<simtick> > ticks;
+  pool.Map(values[0].size(), ticks, [&](int64_t i){
+             std::vector<simtick> t;
+             Candidates(events, values[0][i], config.bitmask, t);
+             return t; });
+  std::map<int, size_t> cut;
+  for(size_t i=0; i<values[0].size(); i++)
+    cut[values[0][i]] = i;
+  std::vector<simresult> results;
+  pool.Map(settings.size(), results, [&](int64_t i){
+             return Replay(ticks[cut.at(settings[i].nhitbcut)], settings[i]); });
+
+  printf("%lu settings replayed in %.2f s on %d threads\n\n",
+         (unsigned long) settings.size(), Now() - sweepstart,
+         pool.GetThreads());
+  printf("nhitbcut window  size endrate   bursts   length (s)    events"
+         "   latency (s)   overflows\n");
+  printf("                                         mean     max  per burst"
+         "  mean     max\n");
+  for(size_t i=0; i<settings.size(); i++){
+    const simsetting & set = settings[i];
+    const simresult & r = results[i];
+    printf("%8d %6d %5d %7d %8d %8.2f %7.2f %9.1f %7.3f %7.3f %9ld\n",
+           set.nhitbcut, set.burstwindow, set.burstsize, set.endrate,
+           r.bursts, r.ended ? r.seconds/r.ended : 0, r.longest,
+           r.ended ? (double) r.events/r.ended : 0,
+           r.bursts ? r.latency/r.bursts : 0, r.maxlatency, r.overflows);
+  }
+  return 0;
+}
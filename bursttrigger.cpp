@@ -0,0 +1,65 @@
+// Burst Trigger
+//
+// The functions of the burst trigger which are not templates (see
+// bursttrigger.h).
+
+#include "bursttrigger.h"
+
+// This function advances the head pointer appropriately
+void AdvanceHead(burstring & s){
+  if(s.burstptr.head < EVENTNUM - 1)
+    s.burstptr.head++;
+  else
+    s.burstptr.head = 0;
+}
+
+// This function computes the number of burst candidate events currently
+// in the buffer
+int Burstlength(const burstring & s){
+  int burstlength = 0;
+  if(s.burstptr.head!=-1){
+    if(s.burstptr.head<s.burstptr.tail)
+      burstlength = s.burstptr.tail - s.burstptr.head;
+    else
+      burstlength = EVENTNUM + s.burstptr.tail - s.burstptr.head;
+  }
+  return burstlength;
+}
+
+// This function drops the head event once it is written out
+void Writehead(burstring & s){
+  s.bursttime[s.burstptr.head] = 0;
+  AdvanceHead(s);
+  s.bcount++;
+}
+
+// This function returns the epoch value used to write timestamp
+// s.bursttime[s.burstptr.head]
+int GetEpoch(const burstring & s)
+{
+  if(s.burstptr.head == -1)
+    return 0;
+  uint64_t time = s.bursttime[s.burstptr.head];
+  int epoch = time/maxtime;
+  return epoch;
+}
+
+// This function checks the clocks for time running backward or jumping
+// ahead
+int Checktime(const uint64_t time50, const uint64_t standard50,
+              const int dd){
+  int found = 0;
+  // Check for time running backward:
+  if(time50 < standard50){
+    // Is it reasonable that the clock rolled over?
+    if((standard50 + time50 < maxtime + maxjump) &&
+        dd < maxdrift && (standard50 > maxtime - maxjump) )
+      found |= TIME_NEWEPOCH;
+    else
+      return found | TIME_BACKWARD;
+  }
+  // Check that time has not jumped too far ahead
+  if(time50 - standard50 > maxjump)
+    found |= TIME_JUMP;
+  return found;
+}
@@ -0,0 +1,208 @@
+// Burst Trigger Header
+//
+// The part of the burst trigger which depends only on the times of the
+// burst candidates: the buffer of their times, when a burst starts and
+// ends, which candidates expire or are written out of the buffer as it goes
+// on, and the checks on the clock which keep the times in order.  The burst
+// buffer of snbuf.h is built on it, adding the events themselves and the
+// burst files, and burstsim replays it with the times alone.
+//
+// The functions which move events out of the buffer are templates over
+// what is done with the events (for instance, write() writes the one at the
+// head of the buffer to the burst file and then calls Writehead).  Those
+// given by snbuf.cpp write the events and raise alarms; burstsim's keep
+// statistics.
+
+#ifndef __BURSTTRIGGER_H__
+#define __BURSTTRIGGER_H__
+
+#include <stdint.h>
+
+// Burst buffer depth
+static const int EVENTNUM = 1000;
+
+// Integration window for ending bursts (50 MHz ticks)
+static const int ENDWINDOW = 1*50000000;
+
+// Tells us when the 50MHz clock rolls over
+static const uint64_t maxtime = (1UL << 43);
+
+// Maximum time allowed between events without a complaint
+static const uint64_t maxjump = 10*50000000; // 50 MHz time
+
+// Maximum time drift allowed between two clocks without a complaint
+static const int maxdrift = 5000; // 50 MHz ticks (1 us)
+
+// What Checktime finds wrong with the time of an event
+#define TIME_NEWEPOCH 1  // the 50 MHz clock rolled over
+#define TIME_BACKWARD 2  // the time ran backward
+#define TIME_JUMP     4  // the time jumped too far ahead
+
+// Pointers to the head and tail of the burst buffer
+struct burststate
+{
+int head;
+int tail;
+bool burst;
+};
+
+// This structure holds the times of the events in the burst buffer, and
+// where the burst stands
+struct burstring
+{
+uint64_t bursttime[EVENTNUM]; // Burst Time Buffer
+burststate burstptr;          // Pointers to head and tail of burst
+uint64_t starttick;           // Start time (in 50 MHz ticks) of burst
+int bcount;                   // Number of events in present burst
+bool forced;                  // Whether the present burst was started by
+                              // hand, and so only ends by hand
+};
+
+// This function just advances the pointer to the head of the burst properly
+// when the buffer is updated.
+void AdvanceHead(burstring & s);
+
+// This function returns the number of events in the buffer
+int Burstlength(const burstring & s);
+
+// This function drops the event at the head of the buffer once it has been
+// written to the burst file, and counts it in the burst.
+void Writehead(burstring & s);
+
+// This function checks the buffer to return the value of the epoch
+// parameter at the time of the last available write
+int GetEpoch(const burstring & s);
+
+// This function checks the 50 MHz time time50 of an event against that of
+// the last event in order, standard50, with dd the drift of the 50 MHz
+// clock against the 10 MHz clock between them.  It returns 0 if the time
+// follows on, and otherwise the TIME_ flags of what it found.  The time is
+// in order unless TIME_BACKWARD or TIME_JUMP is set.
+int Checktime(const uint64_t time50, const uint64_t standard50,
+              const int dd);
+
+// This function drops old events from the buffer once they expire, calling
+// drop(i) for the place i of each before it is dropped.  longtime
+// specifies the current time.  Events older than BurstLength (in secs) are
+// expired.
+template <class Drop>
+void Expire(burstring & s, const uint64_t longtime, const int BurstLength,
+            Drop drop){
+  // The case that the buffer is empty
+  if(s.burstptr.head==-1)
+    return;
+  // Normal Case
+  int BurstTicks = BurstLength*50000000; // length in ticks
+  while((s.burstptr.head!=-1) && (s.bursttime[s.burstptr.head] < longtime - BurstTicks)){
+    drop(s.burstptr.head);
+    s.bursttime[s.burstptr.head] = 0;
+    AdvanceHead(s);
+    // Reset to empty state if we have emptied the queue
+    if(s.burstptr.head==s.burstptr.tail){
+      s.burstptr.head=-1;
+      s.burstptr.tail=-1;
+    }
+  }
+}
+
+// This function adds the time longtime of a new event to the buffer, and
+// returns the place of the event in it.  If the buffer is full, full() is
+// called, and the oldest event is written out first with write() if a
+// burst is ongoing; otherwise it is lost.
+template <class Write, class Full>
+int Addtime(burstring & s, const uint64_t longtime, Write write, Full full){
+  // Check whether we will overflow the buffer
+  // If so, first drop oldest event, then write
+  if(s.burstptr.head==s.burstptr.tail && s.burstptr.head!=-1){
+    full();
+    if(s.burstptr.burst)
+      write();
+  }
+
+  // If buffer empty, set pointers appropriately
+  if(s.burstptr.tail==-1){
+    s.burstptr.tail=0;
+    s.burstptr.head=0;
+  }
+  const int place = s.burstptr.tail;
+  s.bursttime[place] = longtime;
+  if(s.burstptr.tail<EVENTNUM - 1)
+    s.burstptr.tail++;
+  else
+    s.burstptr.tail=0;
+  return place;
+}
+
+// This function writes out with write() the allowable portion of the
+// buffer, that not occuring within the integration period used to
+// determine whether the burst has ended.
+template <class Write>
+void Writeready(burstring & s, const uint64_t longtime, Write write){
+  while((s.bursttime[s.burstptr.head] < longtime - ENDWINDOW) && (s.burstptr.head < s.burstptr.tail)){
+    write();
+  }
+}
+
+// This function writes out with write() the remainder of the buffer when
+// the burst ends, leaving it empty and out of a burst.  It returns the
+// number of events the burst wrote.
+template <class Write>
+int Endburst(burstring & s, Write write){
+  while(s.burstptr.head < s.burstptr.tail+1){
+    write();
+  }
+  s.burstptr.head = -1;
+  s.burstptr.tail = -1;
+  const int bcount = s.bcount;
+  // Reset to prepare for next burst
+  s.bcount = 0;
+  s.burstptr.burst = false;
+  s.forced = false;
+  return bcount;
+}
+
+// This function moves the burst on after an event is added to the buffer at
+// longtime.  A burst starts, with open(), once the buffer holds more than
+// burstsize events; while it goes on, the events are written out with
+// write(), and it ends, with finish(), once fewer than endrate are left,
+// unless it was started by hand.  It returns whether a burst is ongoing.
+template <class Open, class Write, class Finish>
+bool Stepburst(burstring & s, const uint64_t longtime, const int burstsize,
+               const int endrate, Open open, Write write, Finish finish){
+  // Open a new burst file if a burst starts
+  if(!s.burstptr.burst){
+    if(Burstlength(s) > burstsize){
+      open();
+      s.burstptr.burst = true;
+    }
+  }
+
+  // While in a burst
+  if(s.burstptr.burst){
+    Writeready(s, longtime, write);
+    // Check whether the burst has ended
+    if(Burstlength(s) < endrate && !s.forced){
+      finish();
+    }
+  }
+  return s.burstptr.burst;
+}
+
+// This function empties the buffer when the times have jumped in a
+// non-recoverable way.  An ongoing burst is ended with finish(); otherwise
+// the events are dropped.
+template <class Finish>
+void Clearburst(burstring & s, Finish finish){
+  if(s.burstptr.burst)
+    finish();
+  else{
+    for(int i=0; i<EVENTNUM; i++){
+      s.bursttime[i] = 0;
+    }
+    s.burstptr.head = -1;
+    s.burstptr.tail = -1;
+    s.burstptr.burst = false;
+  }
+}
+
+#endif // __BURSTTRIGGER_H__
@@ -0,0 +1,134 @@
+// CAEN Trigger Sum code
+//
+// The CAEN sub-field begins with a four word header (see the UNPK_CAEN
+// macros in Record_Info.h) followed by the trace of each channel in the
+// channel mask, in order.  In the normal (unpacked) readout each word holds
+// two 12-bit samples, the earlier one in the low half-word.  The trigger
+// sums are negative-going pulses, so heights and integrals are measured
+// below the baseline.
+
+#include "caen.h"
+#include "PZdabFile.h"
+#include <string.h>
+
+// Largest number of samples per channel that we decode
+#define CAEN_MAX_SAMPLES 4096
+
+// The traces are processed in blocks of this many samples.  The inner loops
+// run over a single block with a fixed trip count and independent lanes, so
+// that the compiler turns them into vector instructions.
+#define CAEN_BLOCK 16
+
+// This function zeros out a caeninfo object
+void ClearCaen(caeninfo & caen){
+  memset(&caen, 0, sizeof(caen));
+}
+
+// This function unpacks the nwords words of one trace into samples, using
+// the Order policy to bring each word into host byte order
+template <class Order>
+static void Unpack(const u_int32* const words, const int nwords,
+                   int32_t* const samples){
+  int k = 0;
+  for(; k + CAEN_BLOCK/2 <= nwords; k += CAEN_BLOCK/2){
+    for(int j=0; j<CAEN_BLOCK/2; j++){
+      const uint32_t w = Order::Word(words[k + j]);
+      samples[2*(k+j)]   = w & 0xfff;
+      samples[2*(k+j)+1] = (w >> 16) & 0xfff;
+    }
+  }
+  for(; k < nwords; k++){
+    const uint32_t w = Order::Word(words[k]);
+    samples[2*k]   = w & 0xfff;
+    samples[2*k+1] = (w >> 16) & 0xfff;
+  }
+}
+
+// This function computes the peak height, integral and time over threshold
+// of one trace.  The trace is padded to a whole number of blocks with the
+// baseline value, which contributes nothing to any of the sums.
+static void Trace(int32_t* const samples, const int nsamples,
+                  const int threshold, uint16_t & peak, int32_t & integral,
+                  uint16_t & tot){
+  const int nbase = nsamples < CAEN_BASELINE_SAMPLES ? nsamples
+                                                     : CAEN_BASELINE_SAMPLES;
+  int32_t base = 0;
+  for(int i=0; i<nbase; i++)
+    base += samples[i];
+  base /= nbase;
+
+  const int npadded = (nsamples + CAEN_BLOCK - 1)/CAEN_BLOCK*CAEN_BLOCK;
+  for(int i=nsamples; i<npadded; i++)
+    samples[i] = base;
+
+  int32_t lanemax[CAEN_BLOCK], lanesum[CAEN_BLOCK], laneover[CAEN_BLOCK];
+  for(int j=0; j<CAEN_BLOCK; j++){
+    lanemax[j] = 0;
+    lanesum[j] = 0;
+    laneover[j] = 0;
+  }
+  for(int i=0; i<npadded; i+=CAEN_BLOCK){
+    for(int j=0; j<CAEN_BLOCK; j++){
+      const int32_t d = base - samples[i+j];
+      lanemax[j] = d > lanemax[j] ? d : lanemax[j];
+      lanesum[j] += d;
+      laneover[j] += d > threshold;
+    }
+  }
+
+  int32_t dmax = 0, sum = 0, over = 0;
+  for(int j=0; j<CAEN_BLOCK; j++){
+    dmax = lanemax[j] > dmax ? lanemax[j] : dmax;
+    sum += lanesum[j];
+    over += laneover[j];
+  }
+  peak = dmax;
+  integral = sum;
+  tot = over;
+}
+
+// This function decodes the CAEN sub-field data
+int DecodeCaen(const u_int32* const data, const uint32_t nwords,
+               const int swap, const int threshold, caeninfo & caen){
+  ClearCaen(caen);
+  if(nwords < 4)
+    return 1;
+
+  // Read the header without swapping it in place
+  u_int32 header[4];
+  for(int i=0; i<4; i++)
+    header[i] = swap ? ByteSwap::Word(data[i]) : data[i];
+  const uint32_t wordcount = UNPK_CAEN_WORD_COUNT(header);
+  if(UNPK_CAEN_MAGIC(header) != 0xA || wordcount < 4 || wordcount > nwords)
+    return 1;
+  // The packed (2.5 samples per word) readout is not used by SNO+
+  if(UNPK_CAEN_PACK_FLAG(header))
+    return 1;
+
+  const uint32_t mask = UNPK_CAEN_CHANNEL_MASK(header);
+  const int nchan = __builtin_popcount(mask);
+  if(nchan == 0)
+    return 1;
+  const int chanwords = (wordcount - 4)/nchan;
+  const int nsamples = 2*chanwords;
+  if(nsamples == 0 || nsamples > CAEN_MAX_SAMPLES)
+    return 1;
+
+  int32_t samples[CAEN_MAX_SAMPLES + CAEN_BLOCK];
+  const u_int32* trace = data + 4;
+  for(int ch=0; ch<CAEN_CHANNELS; ch++){
+    if(!(mask & (1 << ch)))
+      continue;
+    if(swap)
+      Unpack<ByteSwap>(trace, chanwords, samples);
+    else
+      Unpack<NoSwap>(trace, chanwords, samples);
+    Trace(samples, nsamples, threshold, caen.peak[ch], caen.integral[ch],
+          caen.tot[ch]);
+    trace += chanwords;
+  }
+  caen.present = true;
+  caen.mask = mask;
+  caen.nsamples = nsamples;
+  return 0;
+}
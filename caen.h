@@ -0,0 +1,25 @@
+// CAEN Trigger Sum Header
+//
+// Decoding of the SNO+ CAEN digitizer sub-field (SUB_TYPE_CAEN) of ZDAB
+// records.  The digitizer records the analogue trigger sums, and the
+// quantities computed here can be used as inputs to the L2 and burst cuts.
+
+#include <stdint.h>
+#include "Record_Info.h"
+#include "struct.h"
+
+// Number of samples at the start of each trace used to compute the baseline
+#define CAEN_BASELINE_SAMPLES 16
+
+// This function decodes the CAEN sub-field whose data (following the sub-field
+// header) begins at data and is nwords long.  swap is non-zero if the data is
+// in the opposite byte order to the host; the data is only read, never
+// modified.  For each channel present it fills the peak height and integral
+// below the baseline, and the number of samples more than threshold counts
+// below the baseline (time over threshold).
+// It returns 0 on success, and 1 if the data cannot be decoded.
+int DecodeCaen(const u_int32* const data, const uint32_t nwords,
+               const int swap, const int threshold, caeninfo & caen);
+
+// This function zeros out a caeninfo object
+void ClearCaen(caeninfo & caen);
@@ -0,0 +1,18 @@
+// Clock Header
+//
+// Stonehenge, and the tools beside it, take all their timings (of startup,
+// syncs, writes and so on) from the one monotonic clock.
+
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <time.h>
+
+// This function returns the time in seconds on a monotonic clock
+inline double Now(){
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+#endif // __CLOCK_H__
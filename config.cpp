@@ -66,6 +66,10 @@ void SetConfig(int runtype, configuration allconfigs[2], configuration & config)
   config.burstsize    = allconfigs[configno].burstsize;
   config.endrate      = allconfigs[configno].endrate;
   config.bitmask      = allconfigs[configno].bitmask;
+  config.caenchan     = allconfigs[configno].caenchan;
+  config.caenthresh   = allconfigs[configno].caenthresh;
+  config.caenpeak     = allconfigs[configno].caenpeak;
+  config.caenint      = allconfigs[configno].caenint;
 }
 
 // This function reads the configuration file and writes the results in the
@@ -82,7 +86,12 @@ void ReadConfig(const char* filename, configuration allconfigs[2]){
 
   resetstate();
   // Read file and check that each parameter set exactly once
+  // The trigger sum parameters are optional, and default to off
   for(int i=0; i<2; i++){
+    allconfigs[i].caenchan   = 0;
+    allconfigs[i].caenthresh = 0;
+    allconfigs[i].caenpeak   = 0;
+    allconfigs[i].caenint    = 0;
     while(fscanf(configfile, "%s %d %d\n", param, &value[0], &value[1])==3){
       if     (!strcmp(param, "nhithi")      )
         {allconfigs[i].nhithi       = value[i]; bit(0);}
@@ -104,6 +113,14 @@ void ReadConfig(const char* filename, configuration allconfigs[2]){
         {allconfigs[i].burstsize    = value[i]; bit(8);}
       else if(!strcmp(param, "endrate")     )
         {allconfigs[i].endrate      = value[i]; bit(9);}
+      else if(!strcmp(param, "caenchan")    )
+        {allconfigs[i].caenchan     = value[i];}
+      else if(!strcmp(param, "caenthresh")  )
+        {allconfigs[i].caenthresh   = value[i];}
+      else if(!strcmp(param, "caenpeak")    )
+        {allconfigs[i].caenpeak     = value[i];}
+      else if(!strcmp(param, "caenint")     )
+        {allconfigs[i].caenint      = value[i];}
       else if(!strcmp(param, "bitmask")     ){;} // Do nothing
       else{
          printf("ReadConfig does not recognize parameter %s.  Ignoring.\n",
@@ -121,6 +138,10 @@ void ReadConfig(const char* filename, configuration allconfigs[2]){
       printf("The configuration file did not set all the parameters!\n");
       exit(1);
     }
+    if(allconfigs[i].caenchan < 0 || allconfigs[i].caenchan >= CAEN_CHANNELS){
+      printf("caenchan must be between 0 and %d.\n", CAEN_CHANNELS - 1);
+      exit(1);
+    }
     rewind(configfile);
     resetstate();
   }
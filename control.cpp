@@ -0,0 +1,408 @@
+// Control Socket
+//
+// The queue is a ring of CONTROL_SLOTS slots with a single producer, the
+// control thread, and a single consumer, the event loop.  The control thread
+// fills the slot at controlhead and then publishes it by advancing
+// controlhead; the event loop carries out the command in the slot at
+// controltail, writes the reply into the slot, marks it done and advances
+// controltail, which frees the slot.  The control thread serves one
+// connection at a time, and waits for each command to be done before
+// reading the next.
+
+#include "PZdabFile.h"
+#include "PZdabWriter.h"
+#include "control.h"
+#include "pipeline.h"
+#include "curl.h"
+#include "placement.h"
+#include "counters.h"
+#include "targets.h"
+#include "clock.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <pthread.h>
+
+// A command and its reply
+struct controlslot
+{
+char command[CONTROL_LINE];
+char reply[CONTROL_REPLY];
+int done;                   // Set once the reply is written
+};
+
+uint32_t controlhead = 0;
+uint32_t controltail = 0;
+static controlslot slots[CONTROL_SLOTS];
+
+static int listenfd = -1;              // The control socket
+static char socketpath[108] = "";      // Its path
+
+// The parameters of the cuts which can be read and set
+struct controlfield
+{
+const char* name;
+int configuration::* field;
+};
+
+static const int NFIELDS = 14;
+static const controlfield fields[NFIELDS] = {
+  {"nhithi", &configuration::nhithi},
+  {"nhitlo", &configuration::nhitlo},
+  {"lothresh", &configuration::lothresh},
+  {"lowindow", &configuration::lowindow},
+  {"retrigcut", &configuration::retrigcut},
+  {"retrigwindow", &configuration::retrigwindow},
+  {"nhitbcut", &configuration::nhitbcut},
+  {"burstwindow", &configuration::burstwindow},
+  {"burstsize", &configuration::burstsize},
+  {"endrate", &configuration::endrate},
+  {"caenchan", &configuration::caenchan},
+  {"caenthresh", &configuration::caenthresh},
+  {"caenpeak", &configuration::caenpeak},
+  {"caenint", &configuration::caenint}
+};
+
+static const char* const helptext =
+  "get [field]         print a cut parameter, or all of them\n"
+  "set field value     change a cut parameter for the rest of the file,\n"
+  "                    once the run header has set the cuts (fields:\n"
+  "                    those printed by get; nhitcut is the nhit cut\n"
+  "                    now in use)\n"
+  "stats               print the counts so far\n"
+  "metrics             print every counter in the OpenMetrics text format\n"
+  "targets             print the health of each output directory\n"
+  "flush               write the statistics to redis and flush the alarms\n"
+  "burst open|close    start a burst now, or end the present one\n"
+  "silent on|off       stop or start sending alarms\n"
+  "redis on|off        stop or start writing statistics to redis\n"
+  "gtidcheck on|off    stop or start checking GTIDs\n"
+  "ratemon on|off      stop or start watching trigger rates\n"
+  "quit                close the connection\n";
+
+// This function appends to the reply in slot c
+static void Reply(controlslot & c, const char* const format, ...){
+  const size_t len = strlen(c.reply);
+  va_list args;
+  va_start(args, format);
+  vsnprintf(c.reply + len, CONTROL_REPLY - len, format, args);
+  va_end(args);
+}
+
+// This function parses "on" or "off" into on, and returns 0 on success
+static int Onoff(const char* const word, bool & on){
+  if(word && !strcmp(word, "on"))
+    on = true;
+  else if(word && !strcmp(word, "off"))
+    on = false;
+  else
+    return 1;
+  return 0;
+}
+
+// This function carries out the get command
+static void Get(pipeline & p, controlslot & c, const char* const name){
+  bool found = false;
+  for(int i=0; i<NFIELDS; i++){
+    if(!name || !strcmp(name, fields[i].name)){
+      Reply(c, "%s %d\n", fields[i].name, p.config.*fields[i].field);
+      found = true;
+    }
+  }
+  if(!name || !strcmp(name, "bitmask")){
+    Reply(c, "bitmask 0x%x\n", p.config.bitmask);
+    found = true;
+  }
+  if(!name || !strcmp(name, "nhitcut")){
+    Reply(c, "nhitcut %d\n", p.nhitcut);
+    found = true;
+  }
+  if(!found)
+    Reply(c, "error: no parameter %s\n", name);
+}
+
+// This function carries out the set command
+static void Set(pipeline & p, controlslot & c, const char* const name,
+                const char* const value){
+  if(!name || !value){
+    Reply(c, "error: set needs a parameter and a value\n");
+    return;
+  }
+  // The cuts are set from the run header, which would overwrite the change
+  // (said on stderr too, since a queued command's reply may not be read)
+  if(!p.configknown){
+    fprintf(stderr, "Control: set %s refused: the cuts are not set until the"
+            " run header is read\n", name);
+    Reply(c, "error: the cuts are not set until the run header is read\n");
+    return;
+  }
+  char* end;
+  const long v = strtol(value, &end, 0);
+  if(*end || end == value){
+    Reply(c, "error: bad value %s\n", value);
+    return;
+  }
+  if(!strcmp(name, "bitmask")){
+    p.config.bitmask = v;
+  }
+  else if(!strcmp(name, "nhitcut")){
+    p.nhitcut = v;
+  }
+  else{
+    int i = 0;
+    while(i < NFIELDS && strcmp(name, fields[i].name))
+      i++;
+    if(i == NFIELDS){
+      Reply(c, "error: no parameter %s\n", name);
+      return;
+    }
+    if(!strcmp(name, "caenchan") && (v < 0 || v >= CAEN_CHANNELS)){
+      Reply(c, "error: caenchan must be from 0 to %d\n", CAEN_CHANNELS - 1);
+      return;
+    }
+    p.config.*fields[i].field = v;
+  }
+  p.decide = Choosedecider(p.config);
+  char msg[CONTROL_LINE + 64];
+  sprintf(msg, "Stonehenge: %s set to %s by the control socket\n", name, value);
+  fprintf(stderr, msg);
+  alarm(20, msg, 0);
+  Get(p, c, name);
+}
+
+// This function carries out the stats command
+static void Stats(pipeline & p, controlslot & c){
+  const uint64_t events = Readcounter(p.events);
+  Reply(c, "records %lu\n", (unsigned long) Readcounter(p.stat.l1.id));
+  Reply(c, "events %lu\n", (unsigned long) events);
+  Reply(c, "l2 %lu\n", (unsigned long) (events - Readcounter(p.keys[0])));
+  for(int i=0; i<16; i++)
+    Reply(c, "key%d %lu\n", i, (unsigned long) Readcounter(p.keys[i]));
+  const gtidcounts & g = p.gtids.total;
+  Reply(c, "gtidmissing %lu\ngtidduplicate %lu\ngtidlate %lu\n",
+        (unsigned long) (g.missing + p.gtids.interval.missing),
+        (unsigned long) (g.duplicate + p.gtids.interval.duplicate),
+        (unsigned long) (g.late + p.gtids.interval.late));
+  Reply(c, "nhitcut %d\n", p.nhitcut);
+  Reply(c, "burst %d\nbursts %d\nburstbuffer %d\n", p.buf.burstptr.burst,
+        p.buf.burstindex, Burstlength(p.buf));
+}
+
+// This function carries out the burst command
+static void Burst(pipeline & p, controlslot & c, const char* const what,
+                  const bool clobber){
+  if(what && !strcmp(what, "open")){
+    if(p.buf.burstptr.burst)
+      Reply(c, "error: a burst is already ongoing\n");
+    else if(!Burstlength(p.buf))
+      Reply(c, "error: the burst buffer is empty\n");
+    else{
+      Openburst(p.buf, p.b, p.alltime.longtime, p.outfilebase, clobber);
+      p.buf.burstptr.burst = true;
+      p.buf.forced = true;
+      p.stat.burstbool = true;
+      Count(p.bursts);
+      Reply(c, "burst %d opened\n", p.buf.burstindex);
+    }
+  }
+  else if(what && !strcmp(what, "close")){
+    if(!p.buf.burstptr.burst)
+      Reply(c, "error: there is no burst\n");
+    else{
+      const int index = p.buf.burstindex;
+      Finishburst(p.buf, p.b, p.alltime.longtime);
+      Reply(c, "burst %d closed\n", index);
+    }
+  }
+  else
+    Reply(c, "error: burst open or burst close\n");
+}
+
+// This function carries out the command in slot c
+static void Apply(pipeline & p, controlslot & c, const bool clobber){
+  char line[CONTROL_LINE];
+  strcpy(line, c.command);
+  char* save;
+  const char* const cmd = strtok_r(line, " \t", &save);
+  const char* const arg1 = strtok_r(NULL, " \t", &save);
+  const char* const arg2 = strtok_r(NULL, " \t", &save);
+  bool on;
+  if(!strcmp(cmd, "get"))
+    Get(p, c, arg1);
+  else if(!strcmp(cmd, "set"))
+    Set(p, c, arg1, arg2);
+  else if(!strcmp(cmd, "stats"))
+    Stats(p, c);
+  else if(!strcmp(cmd, "flush")){
+    if(p.redis){
+      gtid(p.stat, p.hits);
+      Writetoredis(p.stat, time(NULL));
+    }
+    Flusherrors();
+    Reply(c, "flushed\n");
+  }
+  else if(!strcmp(cmd, "burst"))
+    Burst(p, c, arg1, clobber);
+  else if(!strcmp(cmd, "silent") && !Onoff(arg1, on)){
+    setsilent(on);
+    Reply(c, "silent %s\n", arg1);
+  }
+  else if(!strcmp(cmd, "redis") && !Onoff(arg1, on)){
+    if(on && !Redisopen())
+      Openredis(p.stat);
+    p.redis = on && Redisopen();
+    Reply(c, "redis %s\n", p.redis ? "on" : "off (not connected)");
+  }
+  else if(!strcmp(cmd, "gtidcheck") && !Onoff(arg1, on)){
+    p.gtidoff = !on;
+    Reply(c, "gtidcheck %s\n", arg1);
+  }
+  else if(!strcmp(cmd, "ratemon") && !Onoff(arg1, on)){
+    p.ratesoff = !on;
+    Reply(c, "ratemon %s\n", arg1);
+  }
+  else
+    Reply(c, "error: unknown command %s (try help)\n", c.command);
+}
+
+// This function carries out the waiting commands
+void Applycontrol(pipeline & p, const bool clobber){
+  const uint32_t head = __atomic_load_n(&controlhead, __ATOMIC_ACQUIRE);
+  while(controltail != head){
+    controlslot & c = slots[controltail % CONTROL_SLOTS];
+    Apply(p, c, clobber);
+    __atomic_store_n(&c.done, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&controltail, controltail + 1, __ATOMIC_RELEASE);
+  }
+}
+
+// This function queues the command line, waits for it to be carried out,
+// and sends the reply to the connection fd
+static void Submit(const int fd, const char* const line){
+  const uint32_t head = controlhead;
+  if(head - __atomic_load_n(&controltail, __ATOMIC_ACQUIRE) >= CONTROL_SLOTS){
+    dprintf(fd, "error: too many commands waiting\n.\n");
+    return;
+  }
+  controlslot & c = slots[head % CONTROL_SLOTS];
+  snprintf(c.command, CONTROL_LINE, "%s", line);
+  c.reply[0] = 0;
+  c.done = 0;
+  __atomic_store_n(&controlhead, head + 1, __ATOMIC_RELEASE);
+
+  const double start = Now();
+  while(!__atomic_load_n(&c.done, __ATOMIC_ACQUIRE)){
+    if(Now() - start > CONTROL_TIMEOUT){
+      dprintf(fd, "queued: will be carried out before the next record\n.\n");
+      return;
+    }
+    const timespec ts = {0, 1000000};
+    nanosleep(&ts, NULL);
+  }
+  dprintf(fd, "%s.\n", c.reply);
+}
+
+// This function serves the control socket.  Each reply ends with a line
+// holding a single ".".
+static void* Controlthread(void*){
+  Placethread(ROLE_CONTROL);
+  for(;;){
+    const int fd = accept(listenfd, NULL, NULL);
+    if(fd < 0){
+      if(errno != EINTR && errno != ECONNABORTED){
+        fprintf(stderr, "Control socket: accept failed: %s\n",
+                strerror(errno));
+        sleep(1);
+      }
+      continue;
+    }
+    FILE* const in = fdopen(fd, "r");
+    char line[CONTROL_LINE];
+    while(in && fgets(line, CONTROL_LINE, in)){
+      line[strcspn(line, "\r\n")] = 0;
+      const char* cmd = line + strspn(line, " \t");
+      if(!*cmd)
+        continue;
+      if(!strcmp(cmd, "quit"))
+        break;
+      // The counters, and the health of the output targets, can be read
+      // from this thread without waiting for the event loop
+      if(!strcmp(cmd, "help"))
+        dprintf(fd, "%s.\n", helptext);
+      else if(!strcmp(cmd, "metrics")){
+        static char metrics[MAXCOUNTERS*256];
+        Writemetrics(metrics, sizeof(metrics));
+        dprintf(fd, "%s.\n", metrics);
+      }
+      else if(!strcmp(cmd, "targets")){
+        char health[MAXTARGETS*512];
+        Writetargets(health, sizeof(health));
+        dprintf(fd, "%s.\n", health);
+      }
+      else
+        Submit(fd, cmd);
+    }
+    if(in)
+      fclose(in);
+    else
+      close(fd);
+  }
+  return NULL;
+}
+
+// This function opens the control socket
+void Opencontrol(const char* const path){
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(addr.sun_path)){
+    fprintf(stderr, "Control socket name %s is too long\n", path);
+    alarm(30, "Stonehenge: control socket name too long.  No control.", 0);
+    return;
+  }
+  strcpy(addr.sun_path, path);
+
+  // A socket left by an earlier run is replaced
+  struct stat st;
+  if(!lstat(path, &st) && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  // Only the owner may connect, since commands change the cuts.  Nothing
+  // can connect before listen(), so it is restricted in time.
+  listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listenfd < 0 || bind(listenfd, (sockaddr*) &addr, sizeof(addr)) ||
+     chmod(path, S_IRUSR | S_IWUSR) || listen(listenfd, 4)){
+    fprintf(stderr, "Could not open control socket %s: %s\n", path,
+            strerror(errno));
+    alarm(30, "Stonehenge: could not open control socket.  No control.", 0);
+    if(listenfd >= 0)
+      close(listenfd);
+    listenfd = -1;
+    return;
+  }
+  strcpy(socketpath, path);
+
+  if(Startthread(Controlthread, NULL)){
+    fprintf(stderr, "Could not start the control thread\n");
+    alarm(30, "Stonehenge: could not start control thread.  No control.", 0);
+    Closecontrol();
+    return;
+  }
+}
+
+// This function removes the control socket
+void Closecontrol(){
+  if(listenfd < 0)
+    return;
+  close(listenfd);
+  listenfd = -1;
+  unlink(socketpath);
+}
@@ -0,0 +1,51 @@
+// Control Socket Header
+//
+// Stonehenge can be controlled while it runs through a Unix-domain socket,
+// served by a background thread.  Each line sent to the socket is a command
+// (send "help" for the list); the reply comes back once the command has been
+// carried out.  Commands are passed to the event loop through a lock-free
+// queue and carried out between records, so they never touch the trigger
+// state while an event is being processed.  When no command is waiting, the
+// event loop pays only for a single load and branch per record.
+
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+#include <stdint.h>
+
+struct pipeline;
+
+// Number of commands which can wait in the queue
+#define CONTROL_SLOTS 16
+
+// Longest command, and longest reply, in characters
+#define CONTROL_LINE 256
+#define CONTROL_REPLY 4096
+
+// Seconds to wait for a command to be carried out before replying that it
+// is still queued
+#define CONTROL_TIMEOUT 5
+
+// Numbers of commands queued and carried out.  Only the control thread
+// writes controlhead, and only the event loop writes controltail.
+extern uint32_t controlhead;
+extern uint32_t controltail;
+
+// This function opens the control socket at path, which only the user
+// running Stonehenge may connect to, and starts the thread serving it.  If it cannot, it raises an alarm and Stonehenge carries on
+// without one.
+void Opencontrol(const char* const path);
+
+// This function removes the control socket, if one was opened.
+void Closecontrol();
+
+// This function returns whether any commands are waiting.
+inline bool Controlpending(){
+  return __atomic_load_n(&controlhead, __ATOMIC_RELAXED) != controltail;
+}
+
+// This function carries out the waiting commands on the pipeline p.  clobber
+// tells whether burst files opened by hand may write over existing files.
+void Applycontrol(pipeline & p, const bool clobber);
+
+#endif // __CONTROL_H__
@@ -0,0 +1,139 @@
+// Counters
+//
+// Shards are claimed and counters registered under a mutex, since both are
+// rare; counting and reading take no lock.  A shard's owner reads and
+// writes its slots with relaxed atomic loads and stores, which compile to
+// plain moves, so that a reader summing the shards never sees a torn value.
+// The last shard belongs to no thread:  the threads after the first
+// COUNTERSHARDS - 1 share it, and count into it with atomic adds.
+
+#include "counters.h"
+#include "curl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+__thread uint64_t* countershard = NULL;
+__thread bool countershared = false;
+
+static counterregistry localregistry;
+static counterregistry* registry = &localregistry;
+static pthread_mutex_t countermutex = PTHREAD_MUTEX_INITIALIZER;
+
+// This function fills in the header of an empty registry.  The mutex must
+// be held.
+static void Initregistry(){
+  if(registry->magic == COUNTER_MAGIC)
+    return;
+  registry->version = COUNTER_VERSION;
+  registry->ncounters = 1;
+  registry->nshards = 0;
+  strcpy(registry->info[0].name, "unused");
+  __atomic_store_n(&registry->magic, COUNTER_MAGIC, __ATOMIC_RELEASE);
+}
+
+// This function claims a shard for the present thread
+uint64_t* Claimshard(){
+  pthread_mutex_lock(&countermutex);
+  Initregistry();
+  uint32_t n = registry->nshards;
+  if(n >= COUNTERSHARDS - 1){
+    n = COUNTERSHARDS - 1;
+    countershared = true;
+  }
+  __atomic_store_n(&registry->nshards, n + 1, __ATOMIC_RELEASE);
+  countershard = registry->shard[n];
+  pthread_mutex_unlock(&countermutex);
+  return countershard;
+}
+
+// This function puts the registry in shared memory
+void Opencounters(const char* const name){
+  pthread_mutex_lock(&countermutex);
+  counterregistry* shared = (counterregistry*) MAP_FAILED;
+  const int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+  if(fd >= 0 && !ftruncate(fd, sizeof(counterregistry)))
+    shared = (counterregistry*) mmap(NULL, sizeof(counterregistry),
+                                     PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(fd >= 0)
+    close(fd);
+  if(shared == MAP_FAILED || registry->ncounters > 1){
+    fprintf(stderr, "Could not put the counters in shared memory %s: %s\n",
+            name, shared == MAP_FAILED ? strerror(errno) : "already in use");
+    alarm(30, "Stonehenge: could not put the counters in shared memory.", 0);
+    if(shared != MAP_FAILED)
+      munmap(shared, sizeof(counterregistry));
+    pthread_mutex_unlock(&countermutex);
+    return;
+  }
+  // The counters start from zero each run
+  __atomic_store_n(&shared->magic, 0, __ATOMIC_RELEASE);
+  memset(shared, 0, sizeof(counterregistry));
+  registry = shared;
+  Initregistry();
+  pthread_mutex_unlock(&countermutex);
+}
+
+// This function registers a counter
+int Registercounter(const char* const name, const char* const help){
+  pthread_mutex_lock(&countermutex);
+  Initregistry();
+  uint32_t id;
+  for(id=1; id<registry->ncounters; id++)
+    if(!strcmp(registry->info[id].name, name))
+      break;
+  if(id == MAXCOUNTERS || strlen(name) >= COUNTERNAME){
+    char buff[256];
+    snprintf(buff, 256, "Stonehenge: cannot register counter %s\n", name);
+    fprintf(stderr, buff);
+    alarm(40, buff, 2);
+    exit(1);
+  }
+  if(id == registry->ncounters){
+    strcpy(registry->info[id].name, name);
+    snprintf(registry->info[id].help, COUNTERHELP, "%s", help);
+    __atomic_store_n(&registry->ncounters, id + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&countermutex);
+  return id;
+}
+
+// This function returns the value of a counter
+uint64_t Readcounter(const int id){
+  uint32_t n = __atomic_load_n(&registry->nshards, __ATOMIC_ACQUIRE);
+  uint64_t sum = 0;
+  for(uint32_t i=0; i<n; i++)
+    sum += __atomic_load_n(&registry->shard[i][id], __ATOMIC_RELAXED);
+  return sum;
+}
+
+// This function writes the counters in the OpenMetrics text format.  The
+// counters sharing a name apart from their labels make one family.
+int Writemetrics(char* const buff, const int len){
+  const uint32_t n = __atomic_load_n(&registry->ncounters, __ATOMIC_ACQUIRE);
+  int used = 0;
+  char family[COUNTERNAME] = "";
+  for(uint32_t id=1; id<n && used < len; id++){
+    const counterinfo & c = registry->info[id];
+    const size_t flen = strcspn(c.name, "{");
+    if(strlen(family) != flen || strncmp(family, c.name, flen)){
+      memcpy(family, c.name, flen);
+      family[flen] = '\0';
+      used += snprintf(buff + used, len - used,
+                       "# TYPE stonehenge_%s counter\n"
+                       "# HELP stonehenge_%s %s\n", family, family, c.help);
+      if(used >= len)
+        break;
+    }
+    used += snprintf(buff + used, len - used, "stonehenge_%s_total%s %lu\n",
+                     family, c.name + flen, (unsigned long) Readcounter(id));
+  }
+  if(used < len)
+    used += snprintf(buff + used, len - used, "# EOF\n");
+  return used < len ? used : len - 1;
+}
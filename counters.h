@@ -0,0 +1,91 @@
+// Counters Header
+//
+// The statistics Stonehenge keeps (records, events, L2 records, orphans,
+// events passing each combination of cuts, bursts, GTID problems and so on)
+// are counters in one registry, from which they are written to redis,
+// printed in the OpenMetrics text format, and read by other processes from
+// shared memory.
+//
+// Each thread which counts has a shard of the registry to itself: a block
+// of cache lines holding one 64-bit value for each counter, which no other
+// thread writes.  Counting is an ordinary add to the thread's own shard,
+// with no locked instruction and no cache line shared between threads, and
+// the value of a counter is the sum over the shards, read without locks.
+//
+// Shared memory layout (native byte order):
+//   counterregistry    COUNTER_MAGIC, COUNTER_VERSION, number of counters
+//                      registered, number of shards claimed, the name and
+//                      help text of each counter, then the shards
+// A counter's value is the sum of its slot in each shard claimed.  Counter
+// 0 is never used, so that a counter number of 0 means "none".
+
+#ifndef __COUNTERS_H__
+#define __COUNTERS_H__
+
+#include <stdint.h>
+
+#define COUNTER_MAGIC   0x544e4355UL  // "UCNT"
+#define COUNTER_VERSION 1
+#define MAXCOUNTERS     128   // counters, including the unused counter 0
+#define COUNTERSHARDS   8     // shards (the last shared by any further threads)
+#define COUNTERNAME     64
+#define COUNTERHELP     96
+
+// The name and meaning of a counter.  The name may end in OpenMetrics
+// labels, as in cutkey{key="3"}.
+struct counterinfo
+{
+char name[COUNTERNAME];
+char help[COUNTERHELP];
+};
+
+// The registry
+struct counterregistry
+{
+uint32_t magic;
+uint32_t version;
+uint32_t ncounters;  // counters registered, including counter 0
+uint32_t nshards;    // shards claimed
+counterinfo info[MAXCOUNTERS];
+uint64_t shard[COUNTERSHARDS][MAXCOUNTERS] __attribute__((aligned(64)));
+};
+
+// The shard of the present thread, and whether the thread shares the last
+// shard, since all the others were taken
+extern __thread uint64_t* countershard;
+extern __thread bool countershared;
+
+// This function claims a shard for the present thread, and returns it.
+uint64_t* Claimshard();
+
+// This function puts the registry in shared memory of the name given, for
+// other processes to read.  It must be called before any counter is
+// registered.  If it cannot, it raises an alarm and the registry stays in
+// the process's own memory.
+void Opencounters(const char* const name);
+
+// This function registers a counter of the given name, and returns its
+// number.  Registering a name again returns the same counter.  It aborts
+// the program if the registry is full.
+int Registercounter(const char* const name, const char* const help);
+
+// This function adds n to counter id.
+inline void Count(const int id, const uint64_t n = 1){
+  uint64_t* s = countershard;
+  if(__builtin_expect(!s, 0))
+    s = Claimshard();
+  if(__builtin_expect(countershared, 0))
+    __atomic_fetch_add(s + id, n, __ATOMIC_RELAXED);
+  else
+    __atomic_store_n(s + id, __atomic_load_n(s + id, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+// This function returns the value of counter id.
+uint64_t Readcounter(const int id);
+
+// This function writes every counter into buff (of length len) in the
+// OpenMetrics text format, and returns the length written.
+int Writemetrics(char* const buff, const int len);
+
+#endif // __COUNTERS_H__
@@ -0,0 +1,140 @@
+// Decision
+//
+// The kernels are one template, with the cuts which are off compiled out.
+// Each computes exactly what the generic decision computes, in the same
+// order, so that they agree event for event; only the tests whose outcome
+// is fixed by the shape of the cuts are left out.
+
+#include "decide.h"
+#include "pipeline.h"
+
+// Whether the generic decision is used in place of the kernels
+static bool generic = false;
+
+// This function sets the trigger threshold of pipeline p appropriately
+// The "Kalpana" solution
+static void setthreshold(pipeline & p, const uint16_t nhit){
+  alltimes & alltime = p.alltime;
+  if(nhit > p.config.lothresh){
+    alltime.exptime = alltime.longtime + p.config.lowindow;
+    p.nhitcut = p.config.nhitlo;
+  }
+  if(alltime.longtime > alltime.exptime){
+    p.nhitcut = p.config.nhithi;
+  }
+}
+
+// This function says whether an event is a burst candidate: if it is over
+// the burst nhit threshold (nhitbcut), or its trigger sum integral is over
+// caenint, and it is not externally triggered
+static bool burstcandidate(const pipeline & p, const uint16_t nhit,
+                           const uint32_t word, const caeninfo & caen){
+  const configuration & config = p.config;
+  const bool caenburst = config.caenint &&
+                         caen.integral[config.caenchan] > config.caenint;
+  return (nhit > config.nhitbcut || caenburst) &&
+         ((word & config.bitmask) == 0);
+}
+
+// This Function performs the actual L2 cut
+// It returns the key of the cuts passed, which is non-zero if we write out
+// the event and zero otherwise
+// Keep event if it is over nhit threshold (1)
+// or, if it was externally triggered (2)
+// or, if it is a retrigger to an accepted event (4)
+// or, if its trigger sum peak is over threshold (8)
+// The cuts are those of the pipeline p.
+static int l2filter(const pipeline & p, const uint16_t nhit,
+                    const uint32_t word, const caeninfo & caen){
+  const configuration & config = p.config;
+  int key = 0;
+  if(nhit > p.nhitcut){
+    key +=1;
+  }
+  if((word & config.bitmask) != 0){
+    key +=2;
+  }
+  if(p.passretrig && p.retrig && nhit > config.retrigcut){
+    key +=4;
+  }
+  if(config.caenpeak && caen.peak[config.caenchan] > config.caenpeak){
+    key +=8;
+  }
+  return key;
+}
+
+// This function is the generic decision
+int Decidegeneric(pipeline & p, const uint16_t nhit, const uint32_t word,
+                  const caeninfo & caen, bool & candidate){
+  setthreshold(p, nhit);
+  candidate = burstcandidate(p, nhit, word, caen);
+  return l2filter(p, nhit, word, caen);
+}
+
+// The bitmask a kernel uses
+enum maskkind{
+  MASK_NONE,      // none (bitmask 0): no event is externally triggered
+  MASK_STANDARD,  // STANDARD_BITMASK
+  MASK_ANY,       // whatever the configuration says
+  MASKKINDS
+};
+
+// The cuts a kernel applies, besides the nhit cut
+#define CUT_RETRIG   1  // retriggers (retrigwindow != 0)
+#define CUT_PEAK     2  // trigger sum peak (caenpeak != 0)
+#define CUT_INTEGRAL 4  // trigger sum integral for bursts (caenint != 0)
+#define CUTSHAPES    8
+
+// This function is the decision for the shape of cuts given by mask and
+// cuts
+template <int mask, int cuts>
+static int Decide(pipeline & p, const uint16_t nhit, const uint32_t word,
+                  const caeninfo & caen, bool & candidate){
+  const configuration & config = p.config;
+  setthreshold(p, nhit);
+
+  const uint32_t bitmask = mask == MASK_NONE ? 0 :
+                           mask == MASK_STANDARD ? STANDARD_BITMASK :
+                           config.bitmask;
+  const bool external = mask != MASK_NONE && (word & bitmask) != 0;
+
+  bool over = nhit > config.nhitbcut;
+  if(cuts & CUT_INTEGRAL)
+    over = over || caen.integral[config.caenchan] > config.caenint;
+  candidate = over && !external;
+
+  int key = (nhit > p.nhitcut) + 2*external;
+  if((cuts & CUT_RETRIG) && p.passretrig && p.retrig && nhit > config.retrigcut)
+    key += 4;
+  if((cuts & CUT_PEAK) && caen.peak[config.caenchan] > config.caenpeak)
+    key += 8;
+  return key;
+}
+
+// The kernels, by mask and shape of the cuts
+#define KERNELS(mask) \
+  { Decide<mask, 0>, Decide<mask, 1>, Decide<mask, 2>, Decide<mask, 3>, \
+    Decide<mask, 4>, Decide<mask, 5>, Decide<mask, 6>, Decide<mask, 7> }
+static const decider kernels[MASKKINDS][CUTSHAPES] = {
+  KERNELS(MASK_NONE), KERNELS(MASK_STANDARD), KERNELS(MASK_ANY)
+};
+
+// This function sets whether the generic decision is used
+void setgeneric(const bool on){
+  generic = on;
+}
+
+// This function returns the decision for the shape of the cuts in config
+decider Choosedecider(const configuration & config){
+  if(generic)
+    return Decidegeneric;
+  // A retrigger is an event from 1 to retrigwindow ticks after the last
+  // (compared unsigned), so there are none if retrigwindow is zero
+  const int cuts = (config.retrigwindow != 0 ? CUT_RETRIG : 0) |
+                   (config.caenpeak ? CUT_PEAK : 0) |
+                   (config.caenint ? CUT_INTEGRAL : 0);
+  const int mask = config.bitmask == 0 ? MASK_NONE :
+                   config.bitmask == STANDARD_BITMASK ? MASK_STANDARD :
+                   MASK_ANY;
+  return kernels[mask][cuts];
+}
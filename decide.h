@@ -0,0 +1,52 @@
+// Decision Header
+//
+// The decision made for each event is to set the nhit threshold (lowered
+// for a while after a large event), to say whether the event is a burst
+// candidate, and to apply the L2 cuts.  Read from the configuration, the
+// decision tests every cut on every event, though for any one run most of
+// the tests always come out the same way: the trigger sum cuts are usually
+// off, and the bitmask is usually the standard one.
+//
+// The decision is therefore also compiled as a kernel for each shape of the
+// cuts (whether the retrigger, external trigger and trigger sum cuts are in
+// use, and whether the bitmask is the standard one, in which case it is a
+// constant), and the kernel for the cuts in use is taken from a table when
+// they are set: at the run header, and whenever they are changed through
+// the control socket.  The generic decision, which reads every cut at run
+// time, is kept as the reference the kernels must agree with, and can be
+// used in their place with stonehenge -g.  decidebench checks that every
+// kernel agrees with it, and times them.
+
+#ifndef __DECIDE_H__
+#define __DECIDE_H__
+
+#include <stdint.h>
+#include "struct.h"
+
+// The bitmask of the standard configuration (default.cnfg), which the
+// kernels can hold as a constant
+#define STANDARD_BITMASK 0x02FFF800
+
+struct pipeline;
+
+// A decision for one event of nhit hits and trigger word word, with the
+// trigger sums caen, made with the cuts and state of the pipeline p.  It
+// updates the nhit threshold of p, sets candidate to whether the event
+// belongs in the burst buffer, and returns the key of the L2 cuts passed
+// (see l2filter), which is zero if the event is not written out.
+typedef int (*decider)(pipeline & p, const uint16_t nhit, const uint32_t word,
+                       const caeninfo & caen, bool & candidate);
+
+// This function is the generic decision
+int Decidegeneric(pipeline & p, const uint16_t nhit, const uint32_t word,
+                  const caeninfo & caen, bool & candidate);
+
+// This function sets whether the generic decision is used in place of the
+// kernels
+void setgeneric(const bool on);
+
+// This function returns the decision compiled for the shape of the cuts in
+// config, or the generic decision if it has been asked for
+decider Choosedecider(const configuration & config);
+
+#endif // __DECIDE_H__
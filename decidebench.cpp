@@ -0,0 +1,263 @@
+// Decision Benchmark
+//
+// Checks that the decision kernels compiled for each shape of the cuts (see
+// decide.h) make the same decisions as the generic decision, and times
+// both.  The events of a ZDAB file are read once, and then each decision is
+// run over them as Stonehenge would run it, with the retrigger flags worked
+// out from the 50 MHz clock in the same way.  Every kernel is run, with the
+// cuts of the configuration file changed to give each shape, as well as the
+// kernels chosen for the configuration file's own cuts.
+
+#include "PZdabFile.h"
+#include "pipeline.h"
+#include "decide.h"
+#include "config.h"
+#include "caen.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+
+// Shortest time each decision is timed for (s), and the number of times it
+// is timed, of which the fastest is reported
+#define MINTIME 0.2
+#define TRIALS  3
+
+// What is needed of an event to decide on it
+struct benchevent
+{
+uint64_t time50;
+uint16_t nhit;
+uint32_t word;
+caeninfo caen;
+};
+
+// What was decided for an event
+struct outcome
+{
+int key;
+bool candidate;
+int nhitcut;
+};
+
+// This function prints the usage information
+static void printhelp(){
+  printf(
+  "decidebench: check the decision kernels against the generic decision,\n"
+  "and time them.\n"
+  "\n"
+  "  -i [string]: ZDAB file to take the events from\n"
+  "  -c [string]: Configuration file whose cuts are used\n"
+  "  -h: This help text\n"
+  );
+}
+
+// This function reads the events of zfile into events, with the trigger
+// sums decoded with threshold caenthresh.  Events without trigger sums are
+// given some made up from their nhit, so that the trigger sum cuts are
+// exercised.
+static void Readevents(PZdabFile* const zfile, const int caenthresh,
+                       std::vector<benchevent> & events){
+  for(ZdabRecordRef & ref : ZdabRecordRange(zfile)){
+    nZDAB* const zrec = ref.rec;
+    if(zrec->bank_name != ZDAB_RECORD)
+      continue;
+    PmtEventRecord pmt;
+    zfile->CopyToNative((u_int32*) &pmt, (const u_int32*) (zrec + 1),
+                        WORD_SIZE(PmtEventRecord));
+    uint32_t mtcwords[6];
+    memcpy(mtcwords, &pmt.TriggerCardData, 6*sizeof(uint32_t));
+
+    benchevent ev;
+    ev.nhit = pmt.NPmtHit;
+    ev.time50 = (uint64_t(pmt.TriggerCardData.Bc50_2) << 11)
+                + pmt.TriggerCardData.Bc50_1;
+    ev.word = ((mtcwords[3] & 0xff000000) >> 24) |
+              ((mtcwords[4] & 0x3ffff) << 8);
+
+    ClearCaen(ev.caen);
+    SubFieldDir* const dir = zfile->GetSubFieldDir(zrec);
+    const SubFieldEntry* const sub = PZdabFile::FindSubField(dir, SUB_TYPE_CAEN);
+    if(sub && sub->length > 0)
+      DecodeCaen((u_int32*) (zrec + 1) + sub->offset + 1, sub->length - 1,
+                 zfile->GetFileSwap(), caenthresh, ev.caen);
+    if(!ev.caen.present){
+      for(int i=0; i<CAEN_CHANNELS; i++){
+        ev.caen.peak[i] = 4*ev.nhit;
+        ev.caen.integral[i] = 64*ev.nhit;
+      }
+    }
+    events.push_back(ev);
+  }
+}
+
+// This function runs the decision decide over the events with the cuts
+// config, in the pipeline p, and if out is not NULL records what was
+// decided for each event in it.  It returns the number of events accepted.
+static int Run(pipeline & p, const decider decide,
+               const configuration & config,
+               const std::vector<benchevent> & events, outcome* const out){
+  p.config = config;
+  p.nhitcut = 0;
+  p.passretrig = false;
+  p.retrig = false;
+  p.alltime.exptime = 0;
+  uint64_t last = 0;
+  int accepted = 0;
+  for(size_t i=0; i<events.size(); i++){
+    const benchevent & ev = events[i];
+    // As in compute_times
+    if(i > 0 && ev.time50 - last > 0 &&
+       ev.time50 - last <= (uint64_t) config.retrigwindow)
+      p.retrig = true;
+    else{
+      p.retrig = false;
+      p.passretrig = false;
+    }
+    last = ev.time50;
+    p.alltime.longtime = ev.time50;
+
+    bool candidate;
+    const int key = decide(p, ev.nhit, ev.word, ev.caen, candidate);
+    if(key){
+      p.passretrig = true;
+      accepted++;
+    }
+    if(out){
+      out[i].key = key;
+      out[i].candidate = candidate;
+      out[i].nhitcut = p.nhitcut;
+    }
+  }
+  return accepted;
+}
+
+// This function returns the fastest time per event (ns) of the decision
+// decide with the cuts config
+static double Time(pipeline & p, const decider decide,
+                   const configuration & config,
+                   const std::vector<benchevent> & events){
+  double best = 0;
+  for(int trial=0; trial<TRIALS; trial++){
+    long n = 0;
+    const double start = Now();
+    double elapsed;
+    do{
+      Run(p, decide, config, events, NULL);
+      n++;
+    } while((elapsed = Now() - start) < MINTIME);
+    const double each = elapsed*1e9/(n*events.size());
+    if(trial == 0 || each < best)
+      best = each;
+  }
+  return best;
+}
+
+// This function checks the decision chosen for the cuts config against the
+// generic decision, and times both.  It prints a line about them, named
+// name, and returns whether they agreed.
+static bool Compare(pipeline & p, const char* const name,
+                    const configuration & config,
+                    const std::vector<benchevent> & events){
+  std::vector<outcome> generic(events.size()), kernel(events.size());
+  const decider chosen = Choosedecider(config);
+  const int accepted = Run(p, Decidegeneric, config, events, &generic[0]);
+  Run(p, chosen, config, events, &kernel[0]);
+
+  size_t bad = 0, first = 0;
+  for(size_t i=events.size(); i-- > 0; ){
+    if(generic[i].key != kernel[i].key ||
+       generic[i].candidate != kernel[i].candidate ||
+       generic[i].nhitcut != kernel[i].nhitcut){
+      bad++;
+      first = i;
+    }
+  }
+
+  const double tgeneric = Time(p, Decidegeneric, config, events);
+  const double tkernel = Time(p, chosen, config, events);
+  printf("%-38s %8d %9.2f %9.2f %7.2fx", name, accepted, tgeneric, tkernel,
+         tgeneric/tkernel);
+  if(bad)
+    printf("  %lu DISAGREE, first at event %lu\n", (unsigned long) bad,
+           (unsigned long) first);
+  else
+    printf("  agree\n");
+  return !bad;
+}
+
+int main(int argc, char** argv){
+  char* infilename = NULL;
+  char* configfile = NULL;
+
+  int ch;
+  while((ch = getopt(argc, argv, "hi:c:")) != -1){
+    switch(ch){
+      case 'i': infilename = optarg; break;
+      case 'c': configfile = optarg; break;
+      case 'h': printhelp(); return 0;
+      default:  printhelp(); return 1;
+    }
+  }
+  if(!infilename || !configfile){
+    printhelp();
+    return 1;
+  }
+
+  configuration allconfigs[2] = {};
+  ReadConfig(configfile, allconfigs);
+
+  FILE* const infile = fopen(infilename, "rb");
+  PZdabFile* const zfile = new PZdabFile();
+  if(!infile || zfile->Init(infile) < 0){
+    fprintf(stderr, "decidebench: could not open %s\n", infilename);
+    return 1;
+  }
+  std::vector<benchevent> events;
+  Readevents(zfile, allconfigs[0].caenthresh, events);
+  delete zfile;
+  if(events.empty()){
+    fprintf(stderr, "decidebench: no events in %s\n", infilename);
+    return 1;
+  }
+  printf("%lu events from %s\n\n", (unsigned long) events.size(), infilename);
+  printf("%-38s %8s %9s %9s %8s\n", "cuts", "accepted", "generic",
+         "kernel", "speedup");
+  printf("%-38s %8s %9s %9s\n", "", "", "(ns/ev)", "(ns/ev)");
+
+  pipeline* const p = new pipeline();
+  bool agree = true;
+
+  // The configuration file's own cuts
+  agree &= Compare(*p, "configuration file, physics runs", allconfigs[0],
+                   events);
+  agree &= Compare(*p, "configuration file, other runs", allconfigs[1],
+                   events);
+
+  // Every shape, changing the physics cuts.  Cuts turned on are given the
+  // configuration's value if it has one.
+  const configuration & base = allconfigs[0];
+  const uint32_t masks[3] = {0, STANDARD_BITMASK, STANDARD_BITMASK >> 4};
+  const char* const masknames[3] = {"no bitmask", "standard", "other bitmask"};
+  for(int m=0; m<3; m++){
+    for(int cuts=0; cuts<8; cuts++){
+      configuration config = base;
+      config.bitmask = masks[m];
+      config.retrigwindow = !(cuts & 1) ? 0 :
+                            base.retrigwindow ? base.retrigwindow : 23;
+      config.caenpeak = !(cuts & 2) ? 0 : base.caenpeak ? base.caenpeak : 100;
+      config.caenint = !(cuts & 4) ? 0 : base.caenint ? base.caenint : 2000;
+      char name[64];
+      snprintf(name, 64, "%s%s%s%s", masknames[m],
+               (cuts & 1) ? ", retrig" : "", (cuts & 2) ? ", peak" : "",
+               (cuts & 4) ? ", integral" : "");
+      agree &= Compare(*p, name, config, events);
+    }
+  }
+
+  delete p;
+  return agree ? 0 : 1;
+}
@@ -0,0 +1,401 @@
+// Output Durability
+//
+// Files are synced by a single background thread.  Requests are queued by
+// the threads writing and closing the output; each time the thread wakes it takes the whole queue,
+// syncs each file in it once, then writes the lock files of the files that
+// were closed, and syncs the directories holding them all.  A lock file is
+// only written once its file has been synced.  Requests that arrive
+// while it is syncing wait for the next group.
+
+#include "PZdabWriter.h"
+#include "durable.h"
+#include "curl.h"
+#include "placement.h"
+#include "targets.h"
+#include "clock.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <libgen.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <pthread.h>
+
+// A file to be synced, and the lock file to write afterwards (if any).  A
+// file written to the output targets is synced in each of its copies.
+struct syncrequest{
+  std::vector<std::string> filenames;
+  std::string lockname;
+  std::string checksum;
+  double requested;  // time of the request (s)
+};
+
+// When an open file was last synced
+struct syncstate{
+  uint64_t bytes;    // bytes written
+  double time;       // time (s)
+};
+
+// Time spent making the output durable
+struct syncstats{
+  unsigned long requests;  // files asked for
+  unsigned long groups;    // groups synced
+  unsigned long syncs;     // fdatasync calls
+  double synctime, syncmax;  // time in fdatasync (s)
+  unsigned long locks;     // lock files written
+  double locktime, lockmax;  // delay from close to lock file (s)
+  double maintime, mainmax;  // time spent in the main thread (s)
+  unsigned long errors;
+};
+
+static durability policy = DURABLE_NONE;
+static double syncperiod = 0;   // seconds between syncs (periodic policy)
+static uint64_t syncbytes = 0;  // bytes between syncs (size policy)
+
+// Open files, and when they were last synced
+static std::map<PZdabWriter*, syncstate> writers;
+
+// The lock files asked for so far, and the note appended to each once the
+// output has been marked as suspect.  These and writers are shared by the
+// event loop and the rotation thread (rotation.h), which closes the pieces
+// of a rotated output, and are guarded by their own mutex.
+static pthread_mutex_t lockmutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<std::string> locknames;
+static std::string suspect;
+
+// State shared with the background thread
+// (statically initialized; see Startthread in placement.h)
+static pthread_mutex_t syncmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t syncwake = PTHREAD_COND_INITIALIZER;  // there are requests
+static pthread_cond_t syncidle = PTHREAD_COND_INITIALIZER;  // the queue has been synced
+static std::vector<syncrequest> syncqueue;
+static bool syncbusy = false;
+static bool syncstarted = false;
+static syncstats stats;
+
+// This function syncs the file or directory name.  It returns 0 on success.
+static int Syncfile(const char* const name){
+  const int fd = open(name, O_RDONLY);
+  if(fd < 0)
+    return 1;
+  const double start = Now();
+  const int err = fdatasync(fd);
+  const double dt = Now() - start;
+  close(fd);
+
+  pthread_mutex_lock(&syncmutex);
+  stats.syncs++;
+  stats.synctime += dt;
+  if(dt > stats.syncmax)
+    stats.syncmax = dt;
+  pthread_mutex_unlock(&syncmutex);
+  return err != 0;
+}
+
+// This function appends checksum to the lock file lockname, and syncs it if
+// sync is true.  It returns 0 on success.
+static int Writelock(const char* const lockname, const char* const checksum,
+                     const bool sync){
+  FILE* const f = fopen(lockname, "a");
+  if(!f)
+    return 1;
+  int err = fprintf(f, "%s\n", checksum) < 0;
+  err |= fflush(f) != 0;
+  if(sync)
+    err |= fdatasync(fileno(f)) != 0;
+  err |= fclose(f) != 0;
+  return err;
+}
+
+// This function returns the directory holding the file name
+static std::string Dirname(const std::string & name){
+  std::vector<char> buff(name.begin(), name.end());
+  buff.push_back(0);
+  return dirname(&buff[0]);
+}
+
+// This function syncs one group of requests
+static void Syncgroup(const std::vector<syncrequest> & group){
+  unsigned long errors = 0;
+
+  // Each file is synced once, however many times it was asked for, and
+  // so are the directories holding the closed files
+  std::map<std::string, int> failed;
+  std::set<std::string> dirs, lockdirs;
+  for(size_t i=0; i<group.size(); i++){
+    for(size_t j=0; j<group[i].filenames.size(); j++){
+      failed[group[i].filenames[j]] = 0;
+      if(!group[i].lockname.empty())
+        dirs.insert(Dirname(group[i].filenames[j]));
+    }
+  }
+  for(std::map<std::string, int>::iterator f = failed.begin();
+      f != failed.end(); f++)
+    errors += f->second = Syncfile(f->first.c_str());
+  for(std::set<std::string>::iterator d = dirs.begin(); d != dirs.end(); d++)
+    errors += Syncfile(d->c_str());
+
+  // Only now can the checksums be published, and only for durable files
+  for(size_t i=0; i<group.size(); i++){
+    int bad = 0;
+    for(size_t j=0; j<group[i].filenames.size(); j++)
+      bad += failed[group[i].filenames[j]];
+    if(group[i].lockname.empty() || bad)
+      continue;
+    errors += Writelock(group[i].lockname.c_str(), group[i].checksum.c_str(),
+                        true);
+    lockdirs.insert(Dirname(group[i].lockname));
+
+    const double dt = Now() - group[i].requested;
+    pthread_mutex_lock(&syncmutex);
+    stats.locks++;
+    stats.locktime += dt;
+    if(dt > stats.lockmax)
+      stats.lockmax = dt;
+    pthread_mutex_unlock(&syncmutex);
+  }
+  for(std::set<std::string>::iterator d = lockdirs.begin();
+      d != lockdirs.end(); d++)
+    errors += Syncfile(d->c_str());
+
+  pthread_mutex_lock(&syncmutex);
+  stats.groups++;
+  stats.errors += errors;
+  pthread_mutex_unlock(&syncmutex);
+}
+
+// This function is the background thread, which syncs the queued requests
+// a group at a time
+static void* Syncthread(void*){
+  Placethread(ROLE_SYNC);
+  std::vector<syncrequest> group;
+  pthread_mutex_lock(&syncmutex);
+  while(true){
+    while(syncqueue.empty())
+      pthread_cond_wait(&syncwake, &syncmutex);
+    group.swap(syncqueue);
+    syncbusy = true;
+    pthread_mutex_unlock(&syncmutex);
+    Syncgroup(group);
+    group.clear();
+    pthread_mutex_lock(&syncmutex);
+    syncbusy = false;
+    if(syncqueue.empty())
+      pthread_cond_broadcast(&syncidle);
+  }
+  return NULL;
+}
+
+// This function queues request for the background thread
+static void Queue(const syncrequest & request){
+  pthread_mutex_lock(&syncmutex);
+  stats.requests++;
+  syncqueue.push_back(request);
+  pthread_cond_signal(&syncwake);
+  pthread_mutex_unlock(&syncmutex);
+}
+
+// This function queues a request to sync the file w, and to write its lock
+// file lockname afterwards if lockname is not NULL.
+static void Request(PZdabWriter* const w, const char* const lockname){
+  syncrequest request;
+  if(!Targetcopies(w->GetFilename(), request.filenames))
+    request.filenames.push_back(w->GetFilename());
+  if(lockname){
+    request.lockname = lockname;
+    request.checksum = w->GetMD5();
+  }
+  request.requested = Now();
+  Queue(request);
+}
+
+// This function counts an error writing the lock file lockname, which is
+// alarmed by Finishdurable, since it may not be on the main thread
+static void Lockerror(const char* const lockname){
+  fprintf(stderr, "Could not write lock file %s\n", lockname);
+  pthread_mutex_lock(&syncmutex);
+  stats.errors++;
+  pthread_mutex_unlock(&syncmutex);
+}
+
+// This function is called back once the closed file of the request arg,
+// on the output targets, has been written, with its copies: they are synced
+// and the lock file written as for any other file.  A file with no copy
+// left gets no lock file.  It is called from a writer thread.
+static void Copieswritten(const std::vector<std::string> & copies,
+                          void* const arg){
+  syncrequest* const request = (syncrequest*) arg;
+  request->filenames = copies;
+  if(!copies.empty() && policy != DURABLE_NONE)
+    Queue(*request);
+  else if(!copies.empty() && !request->lockname.empty() &&
+          Writelock(request->lockname.c_str(), request->checksum.c_str(),
+                    false))
+    Lockerror(request->lockname.c_str());
+  delete request;
+}
+
+// This function records time spent in the main thread since start
+static void Maintime(const double start){
+  const double dt = Now() - start;
+  pthread_mutex_lock(&syncmutex);
+  stats.maintime += dt;
+  if(dt > stats.mainmax)
+    stats.mainmax = dt;
+  pthread_mutex_unlock(&syncmutex);
+}
+
+// This function sets the durability policy
+void setdurability(const char* const p){
+  char* end;
+  const double value = strtod(p, &end);
+  if(!strcmp(p, "none"))
+    policy = DURABLE_NONE;
+  else if(!strcmp(p, "close"))
+    policy = DURABLE_CLOSE;
+  else if(end != p && value > 0 && !strcmp(end, "s")){
+    policy = DURABLE_PERIODIC;
+    syncperiod = value;
+  }
+  else if(end != p && value > 0 && value < 4000 && !strcmp(end, "MB")){
+    policy = DURABLE_SIZE;
+    syncbytes = value*1e6;
+  }
+  else{
+    char buff[256];
+    snprintf(buff, 256, "Stonehenge: durability policy %s is not one of none,"
+             " close, [seconds]s or [size]MB\n", p);
+    fprintf(stderr, buff);
+    alarm(40, buff, 2);
+    exit(1);
+  }
+}
+
+// This function starts the background thread
+void Opendurable(){
+  if(policy == DURABLE_NONE)
+    return;
+  if(Startthread(Syncthread, NULL)){
+    fprintf(stderr, "Could not start the sync thread\n");
+    alarm(40, "Stonehenge: Could not start the sync thread.", 14);
+    exit(1);
+  }
+  syncstarted = true;
+}
+
+// This function syncs an open file if it is due
+void Syncwriter(PZdabWriter* const w){
+  if(policy < DURABLE_PERIODIC)
+    return;
+  const double now = Now();
+  const uint64_t bytes = w->GetBytesWritten();
+  pthread_mutex_lock(&lockmutex);
+  std::map<PZdabWriter*, syncstate>::iterator s = writers.find(w);
+  if(s == writers.end()){
+    const syncstate start = { 0, now };
+    s = writers.insert(std::make_pair(w, start)).first;
+  }
+  const bool due = policy == DURABLE_PERIODIC ?
+                   now - s->second.time >= syncperiod :
+                   bytes - s->second.bytes >= syncbytes;
+  if(due){
+    s->second.bytes = bytes;
+    s->second.time = now;
+  }
+  pthread_mutex_unlock(&lockmutex);
+  if(!due)
+    return;
+  // The data must be out of the writer's buffers before it can be synced
+  if(w->Flush()){
+    fprintf(stderr, "Error flushing %s\n", w->GetFilename());
+    alarm(30, "Stonehenge: Error flushing output file.", 0);
+    return;
+  }
+  Request(w, NULL);
+  Maintime(now);
+}
+
+// This function syncs a closed file and then writes its lock file
+void Syncclose(PZdabWriter* const w, const char* const lockname){
+  pthread_mutex_lock(&lockmutex);
+  writers.erase(w);
+  if(lockname){
+    locknames.push_back(lockname);
+    if(!suspect.empty() && Writelock(lockname, suspect.c_str(), false))
+      Lockerror(lockname);
+  }
+  pthread_mutex_unlock(&lockmutex);
+  const double start = Now();
+
+  // A file on the output targets may still be being written; it is synced,
+  // and its lock file written, once it has been (by then w is gone)
+  syncrequest* const request = new syncrequest;
+  if(lockname){
+    request->lockname = lockname;
+    request->checksum = w->GetMD5();
+  }
+  request->requested = start;
+  if(Targetwritten(w->GetFilename(), Copieswritten, request)){
+    if(policy != DURABLE_NONE)
+      Maintime(start);
+    return;
+  }
+  delete request;
+
+  if(policy == DURABLE_NONE){
+    if(lockname && Writelock(lockname, w->GetMD5(), false))
+      Lockerror(lockname);
+    return;
+  }
+  Request(w, lockname);
+  Maintime(start);
+}
+
+// This function marks every lock file as suspect.  The note is appended
+// separately from the checksum, which the background thread may not have
+// written yet; the two appends do not interleave.
+void Marksuspect(const char* const why){
+  pthread_mutex_lock(&lockmutex);
+  suspect = std::string("# suspect: ") + why;
+  for(size_t i=0; i<locknames.size(); i++){
+    if(Writelock(locknames[i].c_str(), suspect.c_str(), false)){
+      fprintf(stderr, "Could not write lock file %s\n", locknames[i].c_str());
+      alarm(30, "Stonehenge: Could not write lock file.", 0);
+    }
+  }
+  pthread_mutex_unlock(&lockmutex);
+}
+
+// This function waits for the background thread to sync everything
+void Finishdurable(){
+  pthread_mutex_lock(&syncmutex);
+  while(syncstarted && (syncbusy || !syncqueue.empty()))
+    pthread_cond_wait(&syncidle, &syncmutex);
+  const bool started = syncstarted;
+  const syncstats s = stats;
+  pthread_mutex_unlock(&syncmutex);
+
+  char buff[512];
+  if(started){
+    snprintf(buff, 512, "Durability: %lu files synced in %lu groups with %lu"
+             " syncs (mean %.2f ms, max %.2f ms).  %lu lock files written"
+             " %.2f ms after close (max %.2f ms).  Main thread spent %.3f ms"
+             " (max %.3f ms).\n", s.requests, s.groups, s.syncs,
+             s.syncs ? 1e3*s.synctime/s.syncs : 0., 1e3*s.syncmax, s.locks,
+             s.locks ? 1e3*s.locktime/s.locks : 0., 1e3*s.lockmax,
+             1e3*s.maintime, 1e3*s.mainmax);
+    fprintf(stderr, buff);
+  }
+  if(s.errors){
+    snprintf(buff, 512, "Stonehenge: %lu errors syncing output files or "
+             "writing their lock files\n", s.errors);
+    fprintf(stderr, buff);
+    alarm(40, buff, 14);
+  }
+}
@@ -0,0 +1,51 @@
+// Output Durability Header
+//
+// Policies for making the output files durable (synced to disk) while they
+// are written, and before their .lock checksums are published.  The syncs
+// are done by a background thread, which syncs together everything asked for
+// while it was busy with the last group (group commit), so the event loop
+// does not wait for the disk.
+
+#include "PZdabWriter.h"
+
+enum durability{
+  DURABLE_NONE,      // never sync; lock files are written at once
+  DURABLE_CLOSE,     // sync each file once it is closed
+  DURABLE_PERIODIC,  // also sync open files every so many seconds
+  DURABLE_SIZE       // also sync open files every so many MB
+};
+
+// This function sets the durability policy from the string policy, which is
+// "none", "close", a number of seconds followed by "s" (e.g. "10s"), or a
+// number of MB followed by "MB" (e.g. "100MB").  It aborts the program if
+// the policy cannot be understood.
+void setdurability(const char* const policy);
+
+// This function starts the background thread, unless there is no
+// durability policy.  It is called before any file is closed.
+void Opendurable();
+
+// This function is called after writing to the open file w.  Under the
+// periodic and size policies, when w is due it flushes w and asks for it to
+// be synced.
+void Syncwriter(PZdabWriter* const w);
+
+// This function is called once the file w has been closed, before w is
+// deleted.  The checksum of w is appended to the file lockname (unless it is
+// NULL) once w is durable, or at once if there is no durability policy.  A
+// file on the output targets (see targets.h) is only synced once its copies
+// have been written, and gets no lock file if none of them was.  It may be
+// called from the rotation thread (see rotation.h) as well as the event
+// loop; it raises no alarm, and errors are alarmed by Finishdurable.
+void Syncclose(PZdabWriter* const w, const char* const lockname);
+
+// This function marks the lock files of every output file, those written
+// already and those still to come, as suspect, by appending a comment line
+// ("# suspect: " followed by why).  Readers of lock files take the checksum
+// from the last line which is not a comment.
+void Marksuspect(const char* const why);
+
+// This function waits until every file asked for has been synced and its
+// lock file written, and prints how long the syncs took.  It is called after
+// Finishtargets, once the files on the output targets have been written.
+void Finishdurable();
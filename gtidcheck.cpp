@@ -0,0 +1,191 @@
+// GTID Check
+//
+// Bit i of the bitmap is set if GTID p has been seen, for the GTIDs p in the
+// window (top - GTID_WINDOW, top] with p % GTID_WINDOW == i.  top is the
+// highest GTID seen, unwrapped, so that it keeps counting past the 24-bit
+// rollover.  When top advances, the bits for the new GTIDs are the bits of
+// the GTIDs leaving the window, so they are counted (if unset) and cleared
+// a word at a time.  The GTIDs in the window from before the check last
+// started (at the first event, or after a jump) were never expected: their
+// bits are set as they are seen, but they are not counted as duplicated when
+// seen again, nor as missing when they leave the window unseen.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "gtidcheck.h"
+#include "redis.h"
+#include "curl.h"
+#include "counters.h"
+
+// Number of 64-bit words in the bitmap
+static const int GTID_WORDS = GTID_WINDOW/64;
+
+// The check used by the functions which are not passed one
+static gtidstate defaultgtid;
+
+// This function adds the counts in b to a
+static void Add(gtidcounts & a, const gtidcounts & b){
+  a.events += b.events;
+  a.missing += b.missing;
+  a.duplicate += b.duplicate;
+  a.late += b.late;
+  a.jumps += b.jumps;
+  a.wraps += b.wraps;
+}
+
+// This function clears n bits of the bitmap of g from bit lo (without wrapping
+// around the end) and returns how many of them were unset
+static uint32_t Evict(gtidstate & g, uint32_t lo, uint32_t n){
+  uint32_t unseen = 0;
+  while(n){
+    const uint32_t bit = lo & 63;
+    const uint32_t nb = n < 64 - bit ? n : 64 - bit;
+    const uint64_t mask = (nb == 64 ? ~0ULL : (1ULL << nb) - 1) << bit;
+    uint64_t & word = g.seen[lo >> 6];
+    unseen += nb - __builtin_popcountll(word & mask);
+    word &= ~mask;
+    lo += nb;
+    n -= nb;
+  }
+  return unseen;
+}
+
+// This function sets n bits of the bitmap of g from bit lo (without wrapping
+// around the end)
+static void Fill(gtidstate & g, uint32_t lo, uint32_t n){
+  while(n){
+    const uint32_t bit = lo & 63;
+    const uint32_t nb = n < 64 - bit ? n : 64 - bit;
+    g.seen[lo >> 6] |= (nb == 64 ? ~0ULL : (1ULL << nb) - 1) << bit;
+    lo += nb;
+    n -= nb;
+  }
+}
+
+// This function returns how many of the n oldest GTIDs in the window of g
+// came before the check last started
+static uint32_t Early(const gtidstate & g, const uint32_t n){
+  if(g.start + GTID_WINDOW <= g.top + 1)
+    return 0;
+  const uint64_t early = g.start + GTID_WINDOW - (g.top + 1);
+  return early < n ? early : n;
+}
+
+// This function advances the top of the window of g by k GTIDs, and returns
+// how many of the GTIDs leaving the window were never seen
+static uint32_t Advance(gtidstate & g, uint32_t k){
+  uint32_t unseen = 0;
+  while(k){
+    const uint32_t lo = (g.top + 1) & (GTID_WINDOW - 1);
+    uint32_t n = k < GTID_WINDOW ? k : GTID_WINDOW;
+    if(n > GTID_WINDOW - lo)
+      n = GTID_WINDOW - lo;
+    Fill(g, lo, Early(g, n));
+    unseen += Evict(g, lo, n);
+    g.top += n;
+    k -= n;
+  }
+  return unseen;
+}
+
+// This function starts the check again at gtid
+static void Restart(gtidstate & g, const uint32_t gtid){
+  memset(g.seen, 0, sizeof(g.seen));
+  g.top = (g.top & ~0xffffffULL) | gtid;
+  g.start = g.top;
+  g.seen[(g.top >> 6) & (GTID_WORDS - 1)] |= 1ULL << (g.top & 63);
+}
+
+// This function checks the GTID of the next event
+void CheckGTID(gtidstate & g, const uint32_t gtid){
+  g.interval.events++;
+  if(!g.started){
+    Restart(g, gtid);
+    g.started = true;
+    return;
+  }
+
+  // Distance from the top of the window, across the 24-bit rollover
+  const int32_t d = (int32_t)((gtid - (uint32_t)g.top) << 8) >> 8;
+  if(d > GTID_MAX_SKIP || d < -GTID_MAX_SKIP){
+    g.interval.missing += Advance(g, GTID_WINDOW);
+    g.interval.jumps++;
+    Restart(g, gtid);
+    return;
+  }
+  if(d > 0){
+    const uint64_t oldtop = g.top;
+    g.interval.missing += Advance(g, d);
+    if((g.top ^ oldtop) >> 24)
+      g.interval.wraps++;
+    g.seen[(g.top >> 6) & (GTID_WORDS - 1)] |= 1ULL << (g.top & 63);
+  }
+  else if(d > -GTID_WINDOW){
+    const uint64_t p = g.top + d;
+    uint64_t & word = g.seen[(p >> 6) & (GTID_WORDS - 1)];
+    const uint64_t bit = 1ULL << (p & 63);
+    if((word & bit) && p >= g.start)
+      g.interval.duplicate++;
+    word |= bit;
+  }
+  else{
+    g.interval.late++;
+  }
+}
+
+// This function reports the counts since the last report
+void Reportgtid(gtidstate & g, l2stats & stat){
+  Count(stat.gtidmissing.id, g.interval.missing);
+  Count(stat.gtiddup.id, g.interval.duplicate + g.interval.late);
+  if(g.interval.missing || g.interval.duplicate || g.interval.late ||
+     g.interval.jumps){
+    char msg[256];
+    sprintf(msg, "Stonehenge: GTID check found %lu missing, %lu duplicated,"
+            " %lu late and %lu jumps in the last second\n",
+            (unsigned long) g.interval.missing,
+            (unsigned long) g.interval.duplicate,
+            (unsigned long) g.interval.late, (unsigned long) g.interval.jumps);
+    fprintf(stderr, msg);
+    alarm(30, msg, 0);
+  }
+  Add(g.total, g.interval);
+  memset(&g.interval, 0, sizeof(g.interval));
+}
+
+// This function finishes the check at the end of the file
+void FinishGTID(gtidstate & g){
+  if(g.started){
+    // The GTIDs from before the start are not missing
+    const uint32_t lo = (g.top + 1) & (GTID_WINDOW - 1);
+    const uint32_t early = Early(g, GTID_WINDOW);
+    const uint32_t n = early < GTID_WINDOW - lo ? early : GTID_WINDOW - lo;
+    Fill(g, lo, n);
+    Fill(g, 0, early - n);
+    uint32_t unseen = 0;
+    for(int i=0; i<GTID_WORDS; i++)
+      unseen += 64 - __builtin_popcountll(g.seen[i]);
+    g.interval.missing += unseen;
+  }
+  Add(g.total, g.interval);
+  memset(&g.interval, 0, sizeof(g.interval));
+  fprintf(stderr, "GTID check: %lu events, %lu missing, %lu duplicated,"
+          " %lu late, %lu jumps, %lu rollovers\n",
+          (unsigned long) g.total.events, (unsigned long) g.total.missing,
+          (unsigned long) g.total.duplicate, (unsigned long) g.total.late,
+          (unsigned long) g.total.jumps, (unsigned long) g.total.wraps);
+}
+
+// The functions below check the default stream
+
+void CheckGTID(const uint32_t gtid){
+  CheckGTID(defaultgtid, gtid);
+}
+
+void Reportgtid(l2stats & stat){
+  Reportgtid(defaultgtid, stat);
+}
+
+void FinishGTID(){
+  FinishGTID(defaultgtid);
+}
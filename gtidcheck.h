@@ -0,0 +1,63 @@
+// GTID Check Header
+//
+// Checks the continuity of the GTIDs of the events as they are read, with a
+// rolling bitmap of which of the most recent GTID_WINDOW GTIDs have been
+// seen.  A GTID is missing if it leaves the window without being seen, so
+// events which arrive a little out of order are not counted as gaps.  Each
+// event costs a few word operations on the bitmap.
+
+#ifndef __GTIDCHECK_H__
+#define __GTIDCHECK_H__
+
+#include <stdint.h>
+
+struct l2stats;
+
+// Number of GTIDs in the rolling bitmap (a power of 2, and at least 64)
+#define GTID_WINDOW 4096
+
+// A jump of more GTIDs than this (either way) is not counted as missing or
+// late events; the check starts again from the new GTID
+#define GTID_MAX_SKIP 65536
+
+// The things we count
+struct gtidcounts
+{
+uint64_t events;    // events checked
+uint64_t missing;   // GTIDs which left the window unseen
+uint64_t duplicate; // GTIDs seen again within the window
+uint64_t late;      // GTIDs older than the window (late or duplicated)
+uint64_t jumps;     // jumps of more than GTID_MAX_SKIP
+uint64_t wraps;     // rollovers of the 24-bit GTID
+};
+
+// This structure holds the check of one stream of events.  It starts zeroed.
+struct gtidstate
+{
+uint64_t seen[GTID_WINDOW/64]; // The rolling bitmap
+uint64_t top;                  // Highest GTID seen (unwrapped)
+uint64_t start;                // GTID the check last started from (unwrapped)
+bool started;                  // Whether we have seen a GTID yet
+gtidcounts interval;           // Counts since the last report
+gtidcounts total;              // Counts for the file
+};
+
+// Each function below checks the stream g; the version without g checks a
+// single default stream.
+
+// This function checks the 24-bit GTID of the next event
+void CheckGTID(gtidstate & g, const uint32_t gtid);
+void CheckGTID(const uint32_t gtid);
+
+// This function adds the GTIDs found missing and duplicated since it was last
+// called to stat, to be written to redis, and raises a single alarm for all
+// of them.  It should be called each time the wall second advances.
+void Reportgtid(gtidstate & g, l2stats & stat);
+void Reportgtid(l2stats & stat);
+
+// This function counts the GTIDs still unseen in the window at the end of
+// the file as missing, and prints the totals for the file.
+void FinishGTID(gtidstate & g);
+void FinishGTID();
+
+#endif // __GTIDCHECK_H__
@@ -0,0 +1,156 @@
+// Input Check
+//
+// The background thread reads what the event loop has already read, so the
+// blocks it reads are still in the page cache.  Compressed input is read
+// through a second decompressing stream, since the builder's checksum is of
+// the uncompressed file, as the output checksums are.  The thread is joined
+// at the end of the file, after being told to read on to the end whatever
+// the event loop managed.
+
+#include "inputcheck.h"
+#include "MD5Checksum.h"
+#include "curl.h"
+#include "placement.h"
+#include "clock.h"
+#ifdef WITH_ZSTD
+#include "PZdabZstd.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <string>
+#include <pthread.h>
+
+int64_t inputposition = 0;
+
+// What is being checked
+static bool checking = false;
+static std::string inputname, lockname;
+static FILE* source = NULL;
+static pthread_t thread;
+
+// What the background thread found, read once it has been joined
+static MD5Checksum md5;
+static int64_t checked = 0;   // bytes read
+static bool readerror = false;
+
+// This function reads the input as far as the event loop has, and then to
+// the end once inputposition is set to INT64_MAX
+static void* Checkthread(void*){
+  Placethread(ROLE_VERIFY);
+  static BYTE buff[INPUTCHECK_CHUNK];
+  const timespec wait = {0, INPUTCHECK_WAIT};
+  while(true){
+    const int64_t target = __atomic_load_n(&inputposition, __ATOMIC_RELAXED);
+    if(checked >= target){
+      nanosleep(&wait, NULL);
+      continue;
+    }
+    const int64_t want = target - checked < INPUTCHECK_CHUNK ?
+                         target - checked : INPUTCHECK_CHUNK;
+    const size_t got = fread(buff, 1, want, source);
+    md5.Update(buff, got);
+    checked += got;
+    if(got < (size_t) want){
+      readerror = ferror(source);
+      break;
+    }
+  }
+  return NULL;
+}
+
+// This function returns the checksum in the lock file name: the last line
+// which is neither empty nor a comment
+static std::string Readchecksum(const char* const name){
+  std::string sum;
+  FILE* const fp = fopen(name, "r");
+  if(!fp)
+    return sum;
+  char line[256];
+  while(fgets(line, sizeof(line), fp)){
+    line[strcspn(line, "\r\n")] = '\0';
+    if(line[0] && line[0] != '#')
+      sum = line;
+  }
+  fclose(fp);
+  return sum;
+}
+
+// This function starts the background thread
+void Openinputcheck(const char* const infilename, const char* const lock){
+  struct stat st;
+  if(stat(infilename, &st) || !S_ISREG(st.st_mode)){
+    fprintf(stderr, "Input check: %s is not a file, so it cannot be read "
+            "again to check it\n", infilename);
+    alarm(30, "Stonehenge: Input is not a file.  Not checking it.", 0);
+    return;
+  }
+  source = fopen(infilename, "rb");
+#ifdef WITH_ZSTD
+  if(source && IsZstdFile(source)){
+    fclose(source);
+    source = ZstdOpenRead(infilename);
+  }
+#endif
+  if(!source){
+    fprintf(stderr, "Input check: could not open %s\n", infilename);
+    alarm(30, "Stonehenge: Could not open input again.  Not checking it.", 0);
+    return;
+  }
+  inputname = infilename;
+  lockname = lock;
+  if(pthread_create(&thread, NULL, Checkthread, NULL)){
+    fprintf(stderr, "Could not start the input check thread\n");
+    alarm(30, "Stonehenge: Could not start input check thread.  Not "
+          "checking input.", 0);
+    fclose(source);
+    source = NULL;
+    return;
+  }
+  checking = true;
+}
+
+// This function finishes the checksum and compares it with the builder's
+bool Closeinputcheck(){
+  if(!checking)
+    return true;
+  const double start = Now();
+  Inputread(INT64_MAX);
+  pthread_join(thread, NULL);
+  const double waited = Now() - start;
+  fclose(source);
+  source = NULL;
+  checking = false;
+
+  char buff[512];
+  if(readerror){
+    snprintf(buff, 512, "Stonehenge: Error reading %s to check it.  Output "
+             "marked as suspect.\n", inputname.c_str());
+    fprintf(stderr, "%s", buff);
+    alarm(30, buff, 0);
+    return false;
+  }
+
+  const std::string sum = md5.GetMD5();
+  const std::string expected = Readchecksum(lockname.c_str());
+  fprintf(stderr, "Input check: MD5 %s of %lld bytes, finished %.1f ms after"
+          " the last record\n", sum.c_str(), (long long) checked, 1e3*waited);
+  if(expected.empty()){
+    fprintf(stderr, "Input check: no checksum in %s\n", lockname.c_str());
+    alarm(30, "Stonehenge: No checksum for the input.  Not checked.", 0);
+    return true;
+  }
+  if(strcasecmp(sum.c_str(), expected.c_str())){
+    snprintf(buff, 512, "Stonehenge: Input %s does not match its checksum %s"
+             " in %s.  Output marked as suspect.\n", inputname.c_str(),
+             expected.c_str(), lockname.c_str());
+    fprintf(stderr, "%s", buff);
+    alarm(30, buff, 0);
+    return false;
+  }
+  fprintf(stderr, "Input check: matches %s\n", lockname.c_str());
+  return true;
+}
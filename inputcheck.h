@@ -0,0 +1,46 @@
+// Input Check Header
+//
+// The event builder publishes the MD5 checksum of each subfile it writes in
+// a lock file beside it.  With stonehenge -v, the input is checked against
+// that checksum: a background thread reads the input a second time, through
+// its own stream, following the event loop through the file, and feeds it
+// to MD5Checksum as it goes.  The event loop only publishes how far it has
+// read (one store per record), so reading the input is not slowed, and at
+// the end of the file the checksum is ready after, at most, the last few
+// blocks.  A corrupt subfile usually shows up as an error part way through,
+// after some of the output has been written; if the checksums do not match,
+// every output lock file is marked as suspect (see Marksuspect in durable.h).
+
+#ifndef __INPUTCHECK_H__
+#define __INPUTCHECK_H__
+
+#include <stdint.h>
+
+// Bytes the background thread reads at a time
+#define INPUTCHECK_CHUNK (1 << 20)
+
+// How long the background thread sleeps when it has caught up (ns)
+#define INPUTCHECK_WAIT 5000000
+
+// Bytes of the input read by the event loop so far.  Only the event loop
+// writes it.
+extern int64_t inputposition;
+
+// This function starts checking the input file infilename against the
+// checksum in the lock file lockname.  If the input cannot be read again
+// (if it is a pipe, say), it raises an alarm and nothing is checked.
+void Openinputcheck(const char* const infilename, const char* const lockname);
+
+// This function tells the background thread that the event loop has read
+// bytes bytes of the input.
+inline void Inputread(const int64_t bytes){
+  __atomic_store_n(&inputposition, bytes, __ATOMIC_RELAXED);
+}
+
+// This function waits for the background thread to finish the file, and
+// compares the checksums.  It returns false if they do not match, or the
+// input could not be read, in which case the output should be marked as
+// suspect, and true otherwise (including when there was nothing to check).
+bool Closeinputcheck();
+
+#endif // __INPUTCHECK_H__
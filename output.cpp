@@ -1,23 +1,90 @@
 #include "PZdabFile.h"
 #include "PZdabWriter.h"
+#include "output.h"
+#include "PZdabRing.h"
+#include "targets.h"
 #include <stdint.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include "curl.h"
 #include "ctype.h"
+#include <string>
+#include <vector>
+#ifdef WITH_ZSTD
+#include "PZdabZstd.h"
+#endif
+
+// Whether output files are written as compressed (seekable zstd) files
+static bool compress = false;
+
+// Shared-memory ring the L2 records are published to (NULL if none)
+static PZdabRingWriter* ring = NULL;
+
+// Whether output files are written with direct I/O, and the size of the
+// extents in which they are preallocated
+static bool direct = false;
+static int64_t directextent = 0;
+
+// Names of the output streams for each class of event, which are appended
+// to the base name of the output files
+static const char * const streamnames[NUM_STREAMS] = {
+  "ext", "pedpulse", "nhit", "retrig"
+};
+
+// This function returns the number of words of data in the ZDAB record of
+// writer bank index, which is still in the file byte order.  The length of
+// event records is taken from the record's sub-field directory.
+static int Nwords(nZDAB * const data, const int index, PZdabFile * const zfile){
+  return index == kZDABindex ?
+    zfile->GetSubFieldDir(data)->size/sizeof(uint32_t) :
+    PZdabWriter::GetBankNWords(index);
+}
 
 // This function writes out the ZDAB record
 void OutZdab(nZDAB * const data, PZdabWriter * const zwrite,
                     PZdabFile * const zfile){
+  OutZdab(data, &zwrite, 1, zfile);
+}
+
+// This function writes out the ZDAB record to each file
+// The record is still in the file byte order, and is written as it is
+// (swapped as it is copied into each file).
+void OutZdab(nZDAB * const data, PZdabWriter * const zwrite[], const int n,
+             PZdabFile * const zfile){
   if(!data) return;
   const int index = PZdabWriter::GetIndex(data->bank_name);
   if(index < 0){
      fprintf(stderr, "Unrecognized bank name\n");
      alarm(40, "Outzdab: unrecognized bank name.", 5);
+     return;
   }
-  else{
-    uint32_t * const bank = zfile->GetBank(data);
-    zwrite->WriteBank(bank, index);
+  const int nwords = Nwords(data, index, zfile);
+  for(int i=0; i<n; i++)
+    zwrite[i]->WriteExternalBank((uint32_t*) (data + 1), index, nwords,
+                                 !zfile->IsExternalOrder());
+}
+
+// This function opens the shared-memory ring
+void OpenRing(const char* const name){
+  ring = new PZdabRingWriter(name);
+  if(!ring->IsOpen()){
+    fprintf(stderr, "Could not open shared-memory ring %s\n", name);
+    alarm(40, "Output: Cannot open shared-memory ring.", 15);
+    exit(1);
+  }
+}
+
+// This function publishes the ZDAB record to the shared-memory ring
+// The record is published in native byte order, so readers on this machine
+// can use it directly.
+void OutRing(nZDAB * const data, PZdabFile * const zfile){
+  if(!ring || !data) return;
+  const int index = PZdabWriter::GetIndex(data->bank_name);
+  if(index < 0 || index == kMASTindex) return;
+  if(ring->Publish(data->bank_name, (uint32_t*) (data + 1),
+                   Nwords(data, index, zfile), zfile->GetFileSwap())){
+    fprintf(stderr, "Record too big for the shared-memory ring\n");
+    alarm(30, "Output: record too big for the shared-memory ring.", 0);
   }
 }
 
@@ -46,67 +113,192 @@ void OutHeader(nZDAB* nzdab, PZdabWriter* const w){
       alarm(40, "Outheader: You never see this!", 6);
       exit(1);
     }
-    if(w->WriteBank(PZdabFile::GetBank(nzdab), index)){
+    // The header buffer is kept in native format
+    if(w->WriteBank((uint32_t*) (nzdab+1), index)){
       fprintf(stderr,"Error writing to zdab file\n");
       alarm(40, "Outheader: error writing to zdab file.", 7);
     }
-    // If bank is successfully written to file, unswap buffer for future use
-    else{
-      SWAP_INT32(nzdab+1, nzdab->data_words);
+  }
+}
+
+
+// This function records an alarm in err
+void Outputfail(outputerror & err, const int level, const char* const text,
+                const int id, const bool fatal){
+  if(err.fatal || (err.level && !fatal))
+    return;
+  err.level = level;
+  err.id = id;
+  snprintf(err.text, sizeof(err.text), "%s", text);
+  err.fatal = fatal;
+}
+
+// This function raises the alarm in err
+void Raiseoutput(const outputerror & err){
+  if(err.level)
+    alarm(err.level, err.text, err.id);
+  if(err.fatal)
+    exit(1);
+}
+
+// This function makes room for an output file
+int Makeroom(const char* const name, const bool clobber, outputerror & err){
+  if(!access(name, W_OK)){
+    if(!clobber){
+      fprintf(stderr, "%s already exists and you told me not to "
+              "overwrite it!\n", name);
+      Outputfail(err, 40, "Output: Should not overwrite that file.", 9, true);
+      return 1;
     }
+    unlink(name);
+  }
+  else if(!access(name, F_OK)){
+    fprintf(stderr, "%s already exists and we can't overwrite it!\n",
+            name);
+    Outputfail(err, 40, "Output: Cannot overwrite that file.", 10, true);
+    return 1;
   }
+  return 0;
 }
 
+// This function builds a new output file on the output targets.  The file
+// is written by their writer threads, so it is never written with direct
+// I/O.
+static PZdabWriter * Targetoutput(const char * const base, bool clobber,
+                                  outputerror & err){
+  const int maxlen = 1024;
+  char filename[maxlen], outfilename[maxlen];
+  const char * const ext = compress ? "zdab.zst" : "zdab";
+  if(snprintf(filename, maxlen, "%s.%s", base, ext) >= maxlen){
+    fprintf(stderr, "WARNING: Output filename truncated to %s\n", filename);
+    Outputfail(err, 40, "Output: output filename truncated", 8, false);
+  }
 
-// This function builds a new output file.  If it can't open 
-// the file, it aborts the program, so the return pointer does not
-// need to be checked.
-// The optional argument burst states whether to write to the burst
-// directory instead of the data directory.  Defaults to false.
-PZdabWriter * Output(const char * const base, bool clobber, bool burst){
+  FILE * stream = Targetopen(filename, clobber, outfilename, maxlen, err);
+#ifdef WITH_ZSTD
+  if(stream && compress)
+    stream = ZstdOpenWrite(stream);
+#endif
+  PZdabWriter * ret = stream ?
+    new PZdabWriter(stream, outfilename, 1) : NULL;
+
+  if(!ret || !ret->IsOpen()){
+    fprintf(stderr, "Could not open output file %s on the targets\n",
+            filename);
+    Outputfail(err, 40, "Output: Cannot open file.", 11, true);
+    delete ret;
+    ret = NULL;
+  }
+  return ret;
+}
+
+// This function builds a new output file, putting what went wrong in err.
+// It returns NULL if it can't open the file.
+// The argument burst states whether to write to the burst directory instead
+// of the data directory.
+static PZdabWriter * Build(const char * const base, bool clobber, bool burst,
+                           outputerror & err){
   const int maxlen = 1024;
   char outfilename[maxlen];
+  const char * const ext = compress ? "zdab.zst" : "zdab";
+
+  if(!burst && Targetsinuse())
+    return Targetoutput(base, clobber, err);
 
   if(!burst){
-    if(snprintf(outfilename, maxlen, "/home/trigger/zdab/%s.zdab", base) >= maxlen){
+    if(snprintf(outfilename, maxlen, "/home/trigger/zdab/%s.%s", base, ext) >= maxlen){
       outfilename[maxlen-1] = 0; // or does snprintf do this already?
       fprintf(stderr, "WARNING: Output filename truncated to %s\n",
               outfilename);
-      alarm(40, "Output: output filename truncated", 8);
+      Outputfail(err, 40, "Output: output filename truncated", 8, false);
     }
   }
   else{
-    if(snprintf(outfilename, maxlen, "/raid/data/burst/%s.zdab", base) >= maxlen){
+    if(snprintf(outfilename, maxlen, "/raid/data/burst/%s.%s", base, ext) >= maxlen){
       outfilename[maxlen-1] = 0;
       fprintf(stderr, "WARNING: Output filename truncated to %s\n",
               outfilename);
-      alarm(40, "Output: output filename truncated", 8);
+      Outputfail(err, 40, "Output: output filename truncated", 8, false);
     }
   }
 
-  if(!access(outfilename, W_OK)){
-    if(!clobber){
-      fprintf(stderr, "%s already exists and you told me not to "
-              "overwrite it!\n", outfilename);
-      alarm(40, "Output: Should not overwrite that file.", 9);
-      exit(1);
-    }
-    unlink(outfilename);
-  }
-  else if(!access(outfilename, F_OK)){
-    fprintf(stderr, "%s already exists and we can't overwrite it!\n",
-            outfilename);
-    alarm(40, "Output: Cannot overwrite that file.", 10);
-    exit(1);
-  }
+  if(Makeroom(outfilename, clobber, err))
+    return NULL;
 
-  PZdabWriter * const ret = new PZdabWriter(outfilename, 1);
+#ifdef WITH_ZSTD
+  PZdabWriter * ret = compress ?
+    new PZdabWriter(ZstdOpenWrite(outfilename), outfilename, 1) :
+    new PZdabWriter(outfilename, 1);
+#else
+  PZdabWriter * ret = new PZdabWriter(outfilename, 1);
+#endif
 
   if(!ret || !ret->IsOpen()){
     fprintf(stderr, "Could not open output file %s\n", outfilename);
-    alarm(40, "Output: Cannot open file.", 11);
-    exit(1);
+    Outputfail(err, 40, "Output: Cannot open file.", 11, true);
+    delete ret;
+    return NULL;
   }
+  if(direct && !compress && ret->SetDirectIO(directextent))
+    fprintf(stderr, "Writing %s without direct I/O\n", outfilename);
   return ret;
 }
 
+// This function builds a new output file.  If it can't open 
+// the file, it aborts the program, so the return pointer does not
+// need to be checked.
+// The optional argument burst states whether to write to the burst
+// directory instead of the data directory.  Defaults to false.
+PZdabWriter * Output(const char * const base, bool clobber, bool burst){
+  outputerror err = outputerror();
+  PZdabWriter * const ret = Build(base, clobber, burst, err);
+  Raiseoutput(err);
+  return ret;
+}
+
+// This function builds a new output file without raising any alarm
+PZdabWriter * Tryoutput(const char * const base, const bool clobber,
+                        outputerror & err){
+  return Build(base, clobber, false, err);
+}
+
+// This function deletes the copies of a discarded file once they have been
+// written (called back from the output targets)
+static void Unlinkcopies(const std::vector<std::string> & copies, void*){
+  for(size_t i=0; i<copies.size(); i++)
+    unlink(copies[i].c_str());
+}
+
+// This function abandons an unused output file
+void Discard(PZdabWriter* const w){
+  w->Close();
+  if(!Targetwritten(w->GetFilename(), Unlinkcopies, NULL))
+    unlink(w->GetFilename());
+  delete w;
+}
+
+// This function builds the base name of the output stream for class i
+void StreamBase(char* const buff, const int len, const char* const base,
+                const int i){
+  snprintf(buff, len, "%s_%s", base, streamnames[i]);
+}
+
+// This function sets whether output files are compressed
+void setcompress(const bool on){
+#ifdef WITH_ZSTD
+  compress = on;
+#else
+  if(on){
+    fprintf(stderr, "Compressed output needs stonehenge built with "
+            "WITH_ZSTD=1\n");
+    alarm(40, "Output: built without compression support.", 13);
+    exit(1);
+  }
+#endif
+}
+
+// This function sets whether output files use direct I/O
+void setdirect(const int64_t extent){
+  direct = true;
+  directextent = extent;
+}
@@ -3,21 +3,104 @@
 // K Labe, September 24 2014
 // K Labe, July 14      2015 - Move hexdump function to here
 
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
 #include "PZdabWriter.h"
 #include "PZdabFile.h"
 
+// Classes of accepted events which can be split into their own output
+// streams.  An event may belong to more than one class.
+enum streamclass{
+  STREAM_EXTERNAL,  // external triggers (config.bitmask), except the below
+  STREAM_PEDPULSE,  // pedestal and pulse-GT events
+  STREAM_NHIT,      // high-nhit physics (nhit or trigger sum cut)
+  STREAM_RETRIG,    // retriggers of accepted events
+  NUM_STREAMS
+};
+
 // This function writes out to the file zwrite the ZDAB record pointed to 
 // by data in the file zfile.
 void OutZdab(nZDAB* const data, PZdabWriter* const zwrite, PZdabFile* const zfile);
 
+// This function writes out the ZDAB record pointed to by data in the file
+// zfile to each of the n files in zwrite.  Every file is written from the 
+// record where it lies in the input buffer, so it is never copied.
+void OutZdab(nZDAB* const data, PZdabWriter* const zwrite[], const int n,
+             PZdabFile* const zfile);
+
 // This function prints ZDAB records to the screen in a human-readable format
 // ptr is the place to begin read the record, len is the number of characters
 // to read (4 x number of words to read);
 void hexdump(char* const ptr, int const len);
 
 // This function writes out a header record hdr of type j to file w.
+// The record must be in native format, as kept in the header buffer.
 void OutHeader(nZDAB* nzdab, PZdabWriter* const w);
 
+// This function opens the shared-memory ring name (see PZdabRing.h), to which
+// the L2 records are also published for live consumers.  If it cannot open 
+// the ring, it aborts the program.
+void OpenRing(const char* const name);
+
+// This function publishes the ZDAB record pointed to by data in the file 
+// zfile to the shared-memory ring, if one is open.
+void OutRing(nZDAB* const data, PZdabFile* const zfile);
+
+// What went wrong building an output file, when it is built away from the
+// event loop: the alarm to raise (level 0 if there is none), and whether
+// the program must then be aborted
+struct outputerror{
+  int level, id;
+  char text[256];
+  bool fatal;
+};
+
 // This function builds a new output file.  If it cannot open the file, it 
-// aborts the program, so the pointer does not need to be checked.
+// aborts the program, so the pointer does not need to be checked.  Files
+// other than burst files are written to the output targets, if they are in
+// use (see targets.h).
 PZdabWriter* Output(const char * const base, bool clobber, bool burst=0);
+
+// This function builds a new output file as Output does, but raises no
+// alarm: what went wrong is put in err (which should start out zeroed), and
+// NULL is returned if the file could not be opened.  It may be called from
+// any thread.
+PZdabWriter* Tryoutput(const char* const base, const bool clobber,
+                       outputerror & err);
+
+// This function records the alarm text of level and id in err, unless err
+// already holds one which is fatal, or which is not and this is not either.
+void Outputfail(outputerror & err, const int level, const char* const text,
+                const int id, const bool fatal);
+
+// This function raises the alarm in err, if there is one, and aborts the
+// program if it was fatal.
+void Raiseoutput(const outputerror & err);
+
+// This function makes room for the output file name: if it exists, it is
+// removed if clobber is true, and otherwise a fatal error is put in err and
+// 1 is returned.  It returns 0 if there is room.
+int Makeroom(const char* const name, const bool clobber, outputerror & err);
+
+// This function abandons an output file w which was opened in advance but
+// never used, and deletes the file.
+void Discard(PZdabWriter* const w);
+
+// This function writes into buff (of length len) the base name of the output
+// stream for events of class i, which is built from base.
+void StreamBase(char* const buff, const int len, const char* const base,
+                const int i);
+
+// This function sets whether output files are written compressed, as
+// seekable zstd files with the extension .zdab.zst.  Compression requires
+// building with WITH_ZSTD=1; otherwise asking for it aborts the program.
+void setcompress(const bool on);
+
+// This function sets output files to be written with direct I/O, bypassing
+// the page cache, and preallocated extent bytes at a time.  Files which
+// cannot use direct I/O (compressed files, or file systems without it) are
+// written as normal.
+void setdirect(const int64_t extent);
+
+#endif // __OUTPUT_H__
@@ -0,0 +1,83 @@
+// Pipeline Header
+//
+// A pipeline holds all the state of the L2 decision, the burst buffer and
+// the statistics for one stream of ZDAB records, so that a process can run
+// several of them side by side (for instance a shadow configuration next to
+// the real one, or several subfiles being reprocessed at once).  Things
+// shared by every pipeline in a process, such as the alarm, redis and
+// database connections and the output options, are not part of it.
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <stdint.h>
+#include "PZdabWriter.h"
+#include "struct.h"
+#include "snbuf.h"
+#include "redis.h"
+#include "output.h"
+#include "gtidcheck.h"
+#include "ratemon.h"
+#include "rotation.h"
+#include "counters.h"
+#include "decide.h"
+
+// This structure holds one pipeline.  It should be created zeroed, for
+// instance with new pipeline().
+struct pipeline
+{
+// Names
+const char* name;        // Prefix of the files the burst buffer is saved in
+char* infilename;        // Input file
+char* outfilebase;       // Base name of the output files
+bool redis;              // Whether the statistics are written to redis
+bool gtidoff;            // Whether the GTID check is turned off
+bool ratesoff;           // Whether the rate monitor is turned off
+
+// The cuts
+configuration config;        // The cuts in use
+configuration allconfigs[2]; // The cuts read from the configuration file
+bool configknown;            // Whether the cuts have been set for this run
+int nhitcut;                 // The nhit cut now: nhithi, or nhitlo for a
+                             // while after a large event
+decider decide;              // The decision for the shape of the cuts
+
+// Times
+alltimes alltime;   // The times of the present event
+alltimes standard;  // Previous unproblematic timestamp
+bool problem;       // Was there a problem with the previous timestamp?
+
+// The present event
+hitinfo hits;
+caeninfo caen;
+bool passretrig;    // Whether a retrigger of this event gets the retrigger cut
+bool retrig;        // Whether this event is a retrigger
+
+// Statistics, kept as counters (see counters.h)
+int events;         // Events read
+int keys[16];       // Events passing each combination of cuts
+int bursts;         // Bursts begun
+l2stats stat;       // Statistics written to redis, and their counters
+gtidstate gtids;    // GTID continuity check
+ratestate rates;    // Trigger rate monitor
+
+// The burst buffer, and the burst file while a burst is ongoing
+snbuffer buf;
+PZdabWriter* b;
+
+// The output files
+// If the output is rotated, each file is written in pieces, all started
+// together, and the next piece of each is always open ahead of time
+PZdabWriter* w1;                   // L2 file (the present piece, if rotated)
+PZdabWriter* next;                 // Next piece (NULL while it is opened)
+rotation rotate;                   // Closing and opening of the pieces
+int piece;                         // Number of the present piece
+bool piecestarted;                 // Whether the present piece has events
+uint64_t piecestart;               // Time of its first event
+char streambase[NUM_STREAMS][256]; // Base names of the split streams
+PZdabWriter* streams[NUM_STREAMS]; // Split streams, if any
+PZdabWriter* streamnext[NUM_STREAMS];   // and their next pieces
+rotation streamrotate[NUM_STREAMS];
+};
+
+#endif // __PIPELINE_H__
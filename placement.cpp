@@ -0,0 +1,240 @@
+// Thread Placement
+//
+// Each thread places itself as it starts, since a new thread inherits the
+// CPUs and scheduling of the thread that created it.  The NUMA nodes are
+// read from sysfs and the memory policy is set with the system call, so
+// that libnuma is not needed.  A thread's memory is only tied to a node if
+// all of its CPUs are on that node, and then only preferred, so that
+// running short on that node never fails an allocation.
+
+#include "placement.h"
+#include "curl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+// Most NUMA nodes looked for, which is the bits in one nodemask word
+#define MAXNODES 64
+
+static const char* const rolenames[ROLES] =
+  { "main", "sync", "control", "connect", "verify", "target",
+    "rotate" };
+
+// What was asked for
+static bool placed = false;         // whether anything was
+static bool roleset[ROLES];         // whether a role was given CPUs
+static cpu_set_t rolecpus[ROLES];   // and which
+static int rtprio = 0;              // real-time priority of the main thread
+
+// What the machine has, found by the first thread placed
+static pthread_once_t found = PTHREAD_ONCE_INIT;
+static cpu_set_t startcpus;         // the CPUs the program started on
+static int nnodes = 0;
+static int nodenumber[MAXNODES];
+static cpu_set_t nodecpus[MAXNODES];
+
+// This function reads a list of CPUs such as 0-3,8 into cpus.  It returns
+// false if the list cannot be understood or is empty.
+static bool Readcpus(const char* list, cpu_set_t & cpus){
+  CPU_ZERO(&cpus);
+  while(*list && *list != '\n'){
+    char* end;
+    const long first = strtol(list, &end, 10);
+    long last = first;
+    if(end == list)
+      return false;
+    if(*end == '-'){
+      list = end + 1;
+      last = strtol(list, &end, 10);
+      if(end == list)
+        return false;
+    }
+    if(first < 0 || last < first || last >= CPU_SETSIZE)
+      return false;
+    for(long i=first; i<=last; i++)
+      CPU_SET(i, &cpus);
+    if(*end == ',')
+      end++;
+    else if(*end && *end != '\n')
+      return false;
+    list = end;
+  }
+  return CPU_COUNT(&cpus) > 0;
+}
+
+// This function writes the CPUs in cpus into buff (of length len) as a list
+// such as 0-3,8
+static void Writecpus(char* const buff, const int len, const cpu_set_t & cpus){
+  int used = 0;
+  buff[0] = '\0';
+  for(int i=0; i<CPU_SETSIZE && used < len; i++){
+    if(!CPU_ISSET(i, &cpus))
+      continue;
+    int last = i;
+    while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &cpus))
+      last++;
+    if(last == i)
+      used += snprintf(buff + used, len - used, "%s%d", used ? "," : "", i);
+    else
+      used += snprintf(buff + used, len - used, "%s%d-%d", used ? "," : "",
+                       i, last);
+    i = last;
+  }
+}
+
+// This function finds the CPUs the program started on, and the NUMA nodes
+static void Findmachine(){
+  sched_getaffinity(0, sizeof(startcpus), &startcpus);
+  for(int node=0; node<MAXNODES; node++){
+    char fn[64], list[1024];
+    snprintf(fn, 64, "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* const f = fopen(fn, "r");
+    if(!f)
+      continue;
+    if(fgets(list, sizeof(list), f) && Readcpus(list, nodecpus[nnodes]))
+      nodenumber[nnodes++] = node;
+    fclose(f);
+  }
+}
+
+// This function returns the NUMA node holding all of cpus, or -1 if they
+// are on more than one (or the nodes are not known)
+static int Nodeof(const cpu_set_t & cpus){
+  for(int n=0; n<nnodes; n++){
+    cpu_set_t outside;
+    CPU_XOR(&outside, &cpus, &nodecpus[n]);
+    CPU_AND(&outside, &outside, &cpus);
+    if(CPU_COUNT(&outside) == 0)
+      return nodenumber[n];
+  }
+  return -1;
+}
+
+// This function reports a problem placing a thread.  Only the main thread
+// raises an alarm, since the alarm connection belongs to it.
+static void Problem(const threadrole role, const char* const what,
+                    const int err){
+  char buff[256];
+  snprintf(buff, 256, "Stonehenge: could not %s for the %s thread: %s\n",
+           what, rolenames[role], strerror(err));
+  fprintf(stderr, "%s", buff);
+  if(role == ROLE_MAIN)
+    alarm(30, buff, 0);
+}
+
+// This function sets where the threads of one role run
+void setplacement(const char* const spec){
+  const char* const equals = strchr(spec, '=');
+  int role = ROLES;
+  if(equals)
+    for(role=0; role<ROLES; role++)
+      if(strlen(rolenames[role]) == (size_t) (equals - spec) &&
+         !strncmp(spec, rolenames[role], equals - spec))
+        break;
+  if(role == ROLES || !Readcpus(equals + 1, rolecpus[role])){
+    char buff[256];
+    snprintf(buff, 256, "Stonehenge: placement %s is not of the form"
+             " role=cpus, with role main, sync, control, connect, verify,"
+             " target or rotate\n", spec);
+    fprintf(stderr, buff);
+    alarm(40, buff, 2);
+    exit(1);
+  }
+  roleset[role] = true;
+  placed = true;
+}
+
+// This function asks for the main thread to be run SCHED_FIFO
+void setrealtime(const int prio){
+  if(prio < 1 || prio > RTPRIO_MAX){
+    char buff[256];
+    snprintf(buff, 256, "Stonehenge: real-time priority %d is not between 1"
+             " and %d\n", prio, RTPRIO_MAX);
+    fprintf(stderr, buff);
+    alarm(40, buff, 2);
+    exit(1);
+  }
+  rtprio = prio;
+  placed = true;
+}
+
+// This function places the calling thread and reports where it is
+void Placethread(const threadrole role){
+  if(!placed)
+    return;
+  pthread_once(&found, Findmachine);
+  const pthread_t self = pthread_self();
+
+  // The CPUs
+  const cpu_set_t & cpus = roleset[role] ? rolecpus[role] : startcpus;
+  int err = pthread_setaffinity_np(self, sizeof(cpus), &cpus);
+  if(err)
+    Problem(role, "set the CPUs", err);
+
+  // The memory
+  const int node = roleset[role] ? Nodeof(cpus) : -1;
+  if(node >= 0){
+    const unsigned long mask = 1UL << node;
+    if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, MAXNODES + 1))
+      Problem(role, "set the memory policy", errno);
+  }
+
+  // The scheduling
+  sched_param param;
+  memset(&param, 0, sizeof(param));
+  if(role == ROLE_MAIN && rtprio){
+    param.sched_priority = rtprio;
+    if((err = pthread_setschedparam(self, SCHED_FIFO, &param)))
+      Problem(role, "set real-time scheduling", err);
+  }
+  else if(rtprio && (err = pthread_setschedparam(self, SCHED_OTHER, &param)))
+    Problem(role, "set normal scheduling", err);
+
+  // Check what was done
+  cpu_set_t now;
+  char cpulist[256], wanted[256];
+  CPU_ZERO(&now);
+  pthread_getaffinity_np(self, sizeof(now), &now);
+  Writecpus(cpulist, 256, now);
+  const int nownode = Nodeof(now);
+
+  int mode = MPOL_DEFAULT;
+  unsigned long mask = 0;
+  syscall(SYS_get_mempolicy, &mode, &mask, MAXNODES + 1, NULL, 0);
+  char memory[64] = "memory from any node";
+  if(mode == MPOL_PREFERRED && mask)
+    snprintf(memory, 64, "memory from node %d", __builtin_ctzl(mask));
+
+  int policy = SCHED_OTHER;
+  pthread_getschedparam(self, &policy, &param);
+  char sched[64] = "normal scheduling";
+  if(policy == SCHED_FIFO)
+    snprintf(sched, 64, "SCHED_FIFO priority %d", param.sched_priority);
+
+  char msg[1024];
+  int len = sprintf(msg, "Placement: %s thread on CPUs %s", rolenames[role],
+                    cpulist);
+  if(nownode >= 0 && nnodes > 1)
+    len += sprintf(msg + len, " (node %d)", nownode);
+  if(!CPU_EQUAL(&now, &cpus)){
+    Writecpus(wanted, 256, cpus);
+    len += sprintf(msg + len, " instead of %s", wanted);
+  }
+  sprintf(msg + len, ", %s, %s\n", memory, sched);
+  fprintf(stderr, "%s", msg);
+}
+
+// This function starts a detached thread
+int Startthread(void* (*start)(void*), void* const arg){
+  pthread_t thread;
+  const int err = pthread_create(&thread, NULL, start, arg);
+  if(!err)
+    pthread_detach(thread);
+  return err;
+}
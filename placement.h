@@ -0,0 +1,57 @@
+// Thread Placement Header
+//
+// On machines with several sockets, where a thread runs and where its
+// memory comes from both matter for how steady the event loop is.  Each of
+// Stonehenge's threads can be bound to a set of CPUs, with its memory taken
+// from the NUMA node those CPUs belong to, and the main thread (which reads,
+// decides and writes the events) can be run with real-time scheduling.
+// Nothing is changed unless it is asked for.
+
+#ifndef __PLACEMENT_H__
+#define __PLACEMENT_H__
+
+// The threads which can be placed
+enum threadrole{
+  ROLE_MAIN,     // reads the input, decides and writes the events
+  ROLE_SYNC,     // syncs the output files (durable.h)
+  ROLE_CONTROL,  // serves the control socket (control.h)
+  ROLE_CONNECT,  // connects to redis and to the database
+  ROLE_VERIFY,   // checks the input against its checksum (inputcheck.h)
+  ROLE_TARGET,   // writes the output to its directories (targets.h)
+  ROLE_ROTATE,   // closes and opens the pieces of the output (rotation.h)
+  ROLES
+};
+
+// Highest real-time priority allowed, which keeps the main thread below the
+// kernel's interrupt threads
+#define RTPRIO_MAX 49
+
+// This function sets where the threads of one role run, from a string of
+// the form role=cpus, where role is main, sync, control, connect, verify,
+// target or rotate, and cpus is a list such as 2 or 0-3,8.  It aborts the program if
+// the string cannot be understood.
+void setplacement(const char* const spec);
+
+// This function asks for the main thread to be run with the SCHED_FIFO
+// policy at priority prio, from 1 to RTPRIO_MAX.  It aborts the program if
+// prio is out of range.
+void setrealtime(const int prio);
+
+// This function places the calling thread, which plays the part role, and
+// reports where it ended up.  Each thread calls it as it starts, the main
+// thread before any other is started.  Threads of roles not given CPUs are
+// returned to the CPUs the program started on, and to normal scheduling,
+// so that they do not inherit the main thread's.
+void Placethread(const threadrole role);
+
+// This function starts a thread running start(arg), and returns 0 on
+// success.  The thread is detached, so that one stuck on a slow server or
+// disk never holds up exit(), after an alarm or at the end.  (Threads which
+// are joined, such as the input check, are started with pthread_create.)
+// Since such a thread may still be running while the program exits, the
+// mutexes and condition variables it uses should be statically initialized
+// (PTHREAD_MUTEX_INITIALIZER and the like) and never destroyed, so that
+// nothing is torn down under it by the exit.
+int Startthread(void* (*start)(void*), void* const arg);
+
+#endif // __PLACEMENT_H__
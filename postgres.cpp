@@ -0,0 +1,147 @@
+// PostgreSQL Connection
+//
+// A single background thread connects to the database as soon as it is
+// started, then runs the queued statements in order.  The statements it has
+// run wait in a second queue for the main thread to report them, since the
+// alarm connection belongs to the main thread.
+
+#include "postgres.h"
+#include "curl.h"
+#include "placement.h"
+#include <libpq-fe.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+// Seconds Closepostgres waits for the queued statements
+#define POSTGRES_WAIT 5
+
+// A statement to run, and what became of it
+struct pgrequest{
+  std::string insert;
+  std::string text;
+  bool connected;   // whether the database could be reached
+  bool logged;      // whether the statement succeeded
+};
+
+static const char* const conninfo = "dbname = test";
+
+// State shared with the background thread
+static pthread_mutex_t pgmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pgwake = PTHREAD_COND_INITIALIZER; // work to do
+static pthread_cond_t pgidle = PTHREAD_COND_INITIALIZER; // work done
+static bool pgstarted = false;
+static bool pgclosing = false;
+static bool pgbusy = false;
+static std::vector<pgrequest> pgqueue; // statements to run
+static std::vector<pgrequest> pgdone;  // statements run, to report
+
+// This function connects to the database and runs the queued statements
+static void* Postgresthread(void*){
+  Placethread(ROLE_CONNECT);
+  PGconn* const conn = PQconnectdb(conninfo);
+  pthread_mutex_lock(&pgmutex);
+  for(;;){
+    while(pgqueue.empty() && !pgclosing)
+      pthread_cond_wait(&pgwake, &pgmutex);
+    if(pgqueue.empty())
+      break;
+    std::vector<pgrequest> work;
+    work.swap(pgqueue);
+    pgbusy = true;
+    pthread_mutex_unlock(&pgmutex);
+
+    for(size_t i=0; i<work.size(); i++){
+      work[i].connected = PQstatus(conn) == CONNECTION_OK;
+      work[i].logged = false;
+      if(work[i].connected){
+        PGresult* const res = PQexec(conn, work[i].insert.c_str());
+        work[i].logged = PQresultStatus(res) == PGRES_COMMAND_OK;
+        PQclear(res);
+      }
+    }
+
+    pthread_mutex_lock(&pgmutex);
+    pgdone.insert(pgdone.end(), work.begin(), work.end());
+    pgbusy = false;
+    pthread_cond_broadcast(&pgidle);
+  }
+  pthread_mutex_unlock(&pgmutex);
+  PQfinish(conn);
+  return NULL;
+}
+
+// This function starts the thread, if it has not been.  The mutex must be
+// held.
+static void Start(){
+  if(pgstarted)
+    return;
+  if(Startthread(Postgresthread, NULL)){
+    fprintf(stderr, "Could not start the database thread\n");
+    return;
+  }
+  pgstarted = true;
+}
+
+// This function starts connecting to the database
+void Openpostgres(){
+  pthread_mutex_lock(&pgmutex);
+  Start();
+  pthread_mutex_unlock(&pgmutex);
+}
+
+// This function queues a statement to be run
+void Logpostgres(const char* const insert, const char* const text){
+  pgrequest request;
+  request.insert = insert;
+  request.text = text;
+  request.connected = request.logged = false;
+
+  pthread_mutex_lock(&pgmutex);
+  Start();
+  if(pgstarted){
+    pgqueue.push_back(request);
+    pthread_cond_signal(&pgwake);
+  }
+  else
+    pgdone.push_back(request);
+  pthread_mutex_unlock(&pgmutex);
+}
+
+// This function reports the statements run
+void Checkpostgres(){
+  std::vector<pgrequest> done;
+  pthread_mutex_lock(&pgmutex);
+  done.swap(pgdone);
+  pthread_mutex_unlock(&pgmutex);
+
+  for(size_t i=0; i<done.size(); i++){
+    if(!done[i].logged){
+      alarm(30, "Could not log parameters to database!  Logging here instead.\n", 0);
+      alarm(30, done[i].text.c_str(), 0);
+    }
+    if(done[i].connected)
+      fprintf(stdout, "%s", done[i].text.c_str());
+  }
+}
+
+// This function waits for the queued statements, and stops the thread
+void Closepostgres(){
+  timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += POSTGRES_WAIT;
+
+  pthread_mutex_lock(&pgmutex);
+  pgclosing = true;
+  pthread_cond_signal(&pgwake);
+  while(pgstarted && (pgbusy || !pgqueue.empty()))
+    if(pthread_cond_timedwait(&pgidle, &pgmutex, &deadline))
+      break;
+  // Anything the thread could not get to is logged as an alarm
+  pgdone.insert(pgdone.end(), pgqueue.begin(), pgqueue.end());
+  pgqueue.clear();
+  pthread_mutex_unlock(&pgmutex);
+  Checkpostgres();
+}
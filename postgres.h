@@ -0,0 +1,22 @@
+// PostgreSQL Connection Header
+//
+// The cut parameters are logged to the database by a background thread, so
+// that neither connecting nor inserting holds up the event loop.  Whatever
+// the thread has to report is reported from the main thread by
+// Checkpostgres.
+
+// This function starts connecting to the database in the background.
+void Openpostgres();
+
+// This function queues the SQL statement insert to be run, logging the
+// parameters in text.  If the database cannot be reached, text is logged
+// as an alarm instead.
+void Logpostgres(const char* const insert, const char* const text);
+
+// This function reports the results of the statements run since it was last
+// called.  It should be called each time the wall second advances.
+void Checkpostgres();
+
+// This function waits (for a few seconds at most) for the queued statements
+// to be run, reports them, and closes the connection.
+void Closepostgres();
@@ -0,0 +1,89 @@
+// Rate Monitor
+//
+// For a rate x (Hz), the baseline is updated with weight a = 1/RATE_TAU:
+//   mean += a*(x - mean)
+//   var   = (1 - a)*(var + a*(x - mean)^2)
+// and its deviation is (x - mean)/sqrt(var + mean + 1).  The mean is added
+// to the variance so that a steady low rate, whose variance would otherwise
+// be tiny, is allowed its counting fluctuations.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "ratemon.h"
+#include "curl.h"
+
+ratestate defaultrates;
+
+// The names of the rates watched
+static const char* const ratenames[RATE_N] = {
+  "NHIT_100_LO", "NHIT_100_MED", "NHIT_100_HI", "NHIT_20", "NHIT_20_LB",
+  "ESUM_LO", "ESUM_HI", "OWLN", "OWLE_LO", "OWLE_HI", "PULSE_GT", "PRESCALE",
+  "PEDESTAL", "PONG", "SYNC", "EXT_ASYNC", "HYDROPHONE", "EXT3", "EXT4",
+  "EXT5", "EXT6", "NCD_SHAPER", "EXT8", "SPECIAL_RAW", "NCD_MUX", "SOFT_GT",
+  "L1", "L2"
+};
+
+// This function updates the rate baselines of r
+void Updaterates(ratestate & r, const int walltime, const uint64_t l1,
+                 const uint64_t l2){
+  uint64_t count[RATE_N];
+  for(int i=0; i<RATE_BITS; i++)
+    count[i] = r.trigcount[i];
+  count[RATE_BITS] = l1;
+  count[RATE_BITS + 1] = l2;
+
+  // The first call only starts the counts
+  if(!r.lastwalltime){
+    r.lastwalltime = walltime;
+    memcpy(r.lastcount, count, sizeof(count));
+    return;
+  }
+  const int dt = walltime - r.lastwalltime;
+  if(dt <= 0)
+    return;
+
+  const double a = 1./RATE_TAU;
+  char msg[2048];
+  int len = sprintf(msg, "Stonehenge: unusual rates:");
+  int nalarms = 0;
+  for(int i=0; i<RATE_N; i++){
+    // The trigger counters are 32 bits, and may have rolled over
+    const uint64_t n = i < RATE_BITS ? (uint32_t)(count[i] - r.lastcount[i]) :
+                                        count[i] - r.lastcount[i];
+    const double x = (double)n/dt;
+    ratebaseline & b = r.baselines[i];
+    if(r.nupdates == 0){
+      b.mean = x;
+      b.var = 0;
+      b.lastalarm = 0;
+      continue;
+    }
+    const double dev = (x - b.mean)/sqrt(b.var + b.mean + 1);
+    if(r.nupdates >= RATE_WARMUP && fabs(dev) > RATE_THRESHOLD &&
+       walltime - b.lastalarm >= RATE_REPEAT && len < 1900){
+      len += sprintf(msg + len, " %s %.1f Hz (usually %.1f Hz);",
+                     ratenames[i], x, b.mean);
+      b.lastalarm = walltime;
+      nalarms++;
+    }
+    const double diff = x - b.mean;
+    b.mean += a*diff;
+    b.var = (1 - a)*(b.var + a*diff*diff);
+  }
+  r.nupdates++;
+  r.lastwalltime = walltime;
+  memcpy(r.lastcount, count, sizeof(count));
+
+  if(nalarms){
+    msg[len - 1] = '\n';
+    fprintf(stderr, msg);
+    alarm(30, msg, 0);
+  }
+}
+
+// This function updates the default rate baselines
+void Updaterates(const int walltime, const uint64_t l1, const uint64_t l2){
+  Updaterates(defaultrates, walltime, l1, l2);
+}
@@ -0,0 +1,72 @@
+// Rate Monitor Header
+//
+// Watches the rate of each MTC trigger bit and of the L1 and L2 totals for
+// sudden changes, such as an external trigger stuck on or the NHIT_100_LO
+// rate collapsing.  Each rate has a baseline mean and variance which are
+// exponentially weighted moving averages, updated once a second, and a rate
+// far from its baseline raises an alarm.
+
+#ifndef __RATEMON_H__
+#define __RATEMON_H__
+
+#include <stdint.h>
+
+// Number of MTC trigger bits watched (TRIG_NHIT_100_LO to TRIG_SOFT_GT)
+#define RATE_BITS 26
+
+// Time constant of the baselines, in seconds
+#define RATE_TAU 300
+
+// Seconds of data needed before a baseline is trusted
+#define RATE_WARMUP 60
+
+// Deviation from the baseline, in standard deviations, which raises an alarm
+#define RATE_THRESHOLD 6
+
+// Seconds before another alarm is raised for the same rate
+#define RATE_REPEAT 60
+
+// Number of rates watched: the trigger bits, then L1 and L2
+#define RATE_N (RATE_BITS + 2)
+
+// The baseline of a rate
+struct ratebaseline
+{
+double mean;     // Hz
+double var;      // Hz^2
+int lastalarm;   // wall time of the last alarm for this rate
+};
+
+// This structure holds the rates of one stream of events.  It starts zeroed.
+struct ratestate
+{
+uint32_t trigcount[RATE_BITS];  // Number of events seen with each trigger bit
+ratebaseline baselines[RATE_N];
+uint64_t lastcount[RATE_N];     // Counts at the last update
+int lastwalltime;               // Wall time of the last update
+int nupdates;                   // Number of updates so far
+};
+
+// The rates used by the functions which are not passed one
+extern ratestate defaultrates;
+
+// This function counts the trigger bits of an event's trigger word in r.  It
+// is called for every event, so it does the same increments whatever the
+// word is, without branches.
+inline void CountTrigger(ratestate & r, const uint32_t word){
+  for(int i=0; i<RATE_BITS; i++)
+    r.trigcount[i] += (word >> i) & 1;
+}
+inline void CountTrigger(const uint32_t word){
+  CountTrigger(defaultrates, word);
+}
+
+// This function updates the rate baselines of r at wall time walltime (s),
+// given the total numbers of L1 and L2 events so far.  It raises a single
+// alarm for all the rates which are far from their baselines.  It should be
+// called each time the wall second advances.
+void Updaterates(ratestate & r, const int walltime, const uint64_t l1,
+                 const uint64_t l2);
+void Updaterates(const int walltime, const uint64_t l1, const uint64_t l2);
+
+#endif // __RATEMON_H__
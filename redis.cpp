@@ -5,71 +5,155 @@
 #include "hiredis.h"
 #include "redis.h"
 #include "curl.h"
+#include "placement.h"
+#include "counters.h"
+#include <stdio.h>
+#include <pthread.h>
+
+// The connection is opened by a background thread, so that Stonehenge can
+// start work without waiting for the server.  The thread leaves its result
+// in connection and sets the state to REDIS_DONE; the main thread then
+// takes it over the next time it uses redis.
+enum redisstate {REDIS_CLOSED, REDIS_CONNECTING, REDIS_DONE, REDIS_OPEN};
 
 static redisContext* redis = NULL; // hiredis connection object
+static redisContext* connection = NULL; // connection opened by the thread
+static int state = REDIS_CLOSED;
 
 // This function resets the redis statistics
 void ResetStatistics(l2stats & stat){
-  stat.l1 = 0;
-  stat.l2 = 0;
+  stat.l1.written = Readcounter(stat.l1.id);
+  stat.l2.written = Readcounter(stat.l2.id);
   stat.burstbool = false;
-  stat.orphan = 0;
+  stat.orphan.written = Readcounter(stat.orphan.id);
   stat.gtid = 0;
   stat.run = 0;
+  stat.gtidmissing.written = Readcounter(stat.gtidmissing.id);
+  stat.gtiddup.written = Readcounter(stat.gtiddup.id);
 }
 
-// This function opens the redis connections
-void Openredis(l2stats & stat){
-  redis = redisConnect("192.168.80.128", 6379);
-  if((redis)->err){
-    printf("Error: %s\n", (redis)->errstr);
+// This function returns the change in the counter c since it was last
+// written
+static int Delta(const rediscounter & c){
+  return Readcounter(c.id) - c.written;
+}
+
+// This function opens the redis connection in the background
+static void* Connectthread(void*){
+  Placethread(ROLE_CONNECT);
+  connection = redisConnect("192.168.80.128", 6379);
+  __atomic_store_n(&state, REDIS_DONE, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// This function takes over the connection once the thread has opened it
+static void Checkconnect(){
+  if(__atomic_load_n(&state, __ATOMIC_ACQUIRE) != REDIS_DONE)
+    return;
+  if(!connection || connection->err){
+    printf("Error: %s\n", connection ? connection->errstr : "no memory");
     alarm(10, "Openredis: cannot connect to redis server.", 0);
+    if(connection)
+      redisFree(connection);
     redis = NULL;
+    state = REDIS_CLOSED;
   }
   else{
     printf("Connected to Redis.\n");
     alarm(21, "Openredis: connected to server!", 0);
+    redis = connection;
+    state = REDIS_OPEN;
   }
+  connection = NULL;
+}
+
+// This function starts opening the redis connection
+void Openredis(l2stats & stat){
   ResetStatistics(stat);
+  if(state != REDIS_CLOSED)
+    return;
+  state = REDIS_CONNECTING;
+  if(Startthread(Connectthread, NULL)){
+    alarm(10, "Openredis: cannot start the connection.", 0);
+    state = REDIS_CLOSED;
+    return;
+  }
 }
 
-// This function closes the redis connection
+// This function closes the redis connection.  A connection still being
+// opened is left to the thread.
 void Closeredis(){
-  redisFree(redis);
+  Checkconnect();
+  if(state == REDIS_OPEN){
+    redisFree(redis);
+    redis = NULL;
+    state = REDIS_CLOSED;
+  }
+}
+
+// This function returns whether the redis connection is open, or being
+// opened
+bool Redisopen(){
+  Checkconnect();
+  return state == REDIS_CONNECTING || state == REDIS_OPEN;
 }
 
 // This function writes statistics to redis database
 void Writetoredis(l2stats & stat, const int time){
+  // Until the connection is open, the statistics are kept and written with
+  // the next second's
+  Checkconnect();
+  if(state == REDIS_CONNECTING)
+    return;
   if(!redis){
     alarm(30, "Cannot connect to redis.", 0);
     return;
   }
+  const int l1 = Delta(stat.l1);
+  const int l2 = Delta(stat.l2);
+  const int orphan = Delta(stat.orphan);
+  const int gtidmissing = Delta(stat.gtidmissing);
+  const int gtiddup = Delta(stat.gtiddup);
   const char* message = "Writetoredis failed.";
   const int NumInt = 17;
   const int intervals[NumInt] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536};
   for(int i=0; i < NumInt; i++){
     int ts = time/intervals[i];
-    void* reply = redisCommand(redis, "INCRBY ts:%d:%d:L1 %d", intervals[i], ts, stat.l1);
+    void* reply = redisCommand(redis, "INCRBY ts:%d:%d:L1 %d", intervals[i], ts, l1);
     if(!reply)
       alarm(30, message, 0);
     reply = redisCommand(redis, "EXPIRE ts:%d:%d:L1 %d", intervals[i], ts, 2400*intervals[i]);
     if(!reply)
       alarm(30, message, 0);
 
-    reply = redisCommand(redis, "INCRBY ts:%d:%d:L2 %d", intervals[i], ts, stat.l2);
+    reply = redisCommand(redis, "INCRBY ts:%d:%d:L2 %d", intervals[i], ts, l2);
     if(!reply)
       alarm(30, message, 0);
     reply = redisCommand(redis, "EXPIRE ts:%d:%d:L2 %d", intervals[i], ts, 2400*intervals[i]);
     if(!reply)
       alarm(30, message, 0);
 
-    reply = redisCommand(redis, "INCRBY ts:%d:%d:ORPHANS %d", intervals[i], ts, stat.orphan);
+    reply = redisCommand(redis, "INCRBY ts:%d:%d:ORPHANS %d", intervals[i], ts, orphan);
     if(!reply)
       alarm(30, message, 0);
     reply = redisCommand(redis, "EXPIRE ts:%d:%d:ORPHANS %d", intervals[i], ts, 2400*intervals[i]);
     if(!reply)
       alarm(30, message, 0);
 
+    reply = redisCommand(redis, "INCRBY ts:%d:%d:GTIDMISSING %d", intervals[i], ts, gtidmissing);
+    if(!reply)
+      alarm(30, message, 0);
+    reply = redisCommand(redis, "EXPIRE ts:%d:%d:GTIDMISSING %d", intervals[i], ts, 2400*intervals[i]);
+    if(!reply)
+      alarm(30, message, 0);
+
+    reply = redisCommand(redis, "INCRBY ts:%d:%d:GTIDDUP %d", intervals[i], ts, gtiddup);
+    if(!reply)
+      alarm(30, message, 0);
+    reply = redisCommand(redis, "EXPIRE ts:%d:%d:GTIDDUP %d", intervals[i], ts, 2400*intervals[i]);
+    if(!reply)
+      alarm(30, message, 0);
+
     reply = redisCommand(redis, "SET ts:%d:%d:L2:gtid %d", intervals[i], ts, stat.gtid);
     if(!reply)
       alarm(30, message, 0);
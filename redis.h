@@ -6,34 +6,56 @@
 // K Labe, February 4 2014 - change gtid function to accept a hitinfo object
 //                           instead of a PmtEventRecord object
 
+#ifndef __REDIS_H__
+#define __REDIS_H__
+
 #include <stdint.h>
 #include "Record_Info.h"
 #include "struct.h"
 
+// A statistic written to redis as the change in a counter (see counters.h)
+// since it was last written
+struct rediscounter
+{
+int id;           // The counter
+uint64_t written; // Its value when last written
+};
+
 // This structure holds the data which gets written to the redis server
 struct l2stats
 {
-int l1;
-int l2;
+rediscounter l1;          // Records read
+rediscounter l2;          // Records written
 bool burstbool;
-int orphan;
+rediscounter orphan;
 uint32_t gtid;
 uint32_t run;
+rediscounter gtidmissing; // GTIDs missing (see gtidcheck.h)
+rediscounter gtiddup;     // GTIDs duplicated, or too late to tell
 };
 
-// This function resets the redis statistics and is automatically called by 
-// the Writetoredis function.
+// This function resets the redis statistics, so that the counters are
+// written from their present values, and is automatically called by the
+// Writetoredis function.
 void ResetStatistics(l2stats & stat);
 
-// This function opens the redis connection.
+// This function starts opening the redis connection in the background, and
+// resets the statistics.  Until the connection is open, Writetoredis keeps
+// the statistics to write later.
 void Openredis(l2stats & stat);
 
 // This function closes the redis connection.
 void Closeredis();
 
+// This function returns whether the redis connection is open, or being
+// opened.
+bool Redisopen();
+
 // This function writes the statistics contained in stat to the redis database,
 // timestamped with time, and then resets them.
 void Writetoredis(l2stats & stat, const int time);
 
 // This function retrieves the current gtid and run for writing to redis
 void gtid(l2stats & stat, hitinfo hits);
+
+#endif // __REDIS_H__
@@ -0,0 +1,87 @@
+// Output Rotation
+//
+// The rotations handed over wait in a queue for the thread.  The event loop
+// takes each job back at its output's next rotation, or at the end of the
+// file, by which time it is normally long done, so it does not wait.
+
+#include "rotation.h"
+#include "durable.h"
+#include "placement.h"
+#include "curl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <deque>
+#include <pthread.h>
+
+// State shared with the rotation thread
+// (statically initialized; see Startthread in placement.h)
+static pthread_mutex_t rotatemutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rotatewake = PTHREAD_COND_INITIALIZER;  // a job is handed over
+static pthread_cond_t rotatedone = PTHREAD_COND_INITIALIZER;  // one is done
+static std::deque<rotation*> queue;
+static bool started = false;
+
+// This function is the rotation thread
+static void* Rotatethread(void*){
+  Placethread(ROLE_ROTATE);
+  pthread_mutex_lock(&rotatemutex);
+  while(true){
+    while(queue.empty())
+      pthread_cond_wait(&rotatewake, &rotatemutex);
+    rotation & r = *queue.front();
+    queue.pop_front();
+    pthread_mutex_unlock(&rotatemutex);
+
+    // The next piece is opened first, so that on striped output targets
+    // the last of the old piece is not yet queued when they are chosen
+    r.next = Tryoutput(r.base.c_str(), r.clobber, r.err);
+    r.w->Close();
+    Syncclose(r.w, r.lockname.c_str());
+    delete r.w;
+
+    pthread_mutex_lock(&rotatemutex);
+    r.done = true;
+    pthread_cond_broadcast(&rotatedone);
+  }
+  return NULL;
+}
+
+// This function hands over a rotation
+void Rotatestart(rotation & r, PZdabWriter* const w,
+                 const char* const lockname, const char* const base,
+                 const bool clobber){
+  if(!started){
+    if(Startthread(Rotatethread, NULL)){
+      fprintf(stderr, "Could not start the rotation thread\n");
+      alarm(40, "Stonehenge: Could not start the rotation thread.", 14);
+      exit(1);
+    }
+    started = true;
+  }
+  pthread_mutex_lock(&rotatemutex);
+  r.w = w;
+  r.lockname = lockname;
+  r.base = base;
+  r.clobber = clobber;
+  r.next = NULL;
+  r.err = outputerror();
+  r.handed = true;
+  r.done = false;
+  queue.push_back(&r);
+  pthread_cond_signal(&rotatewake);
+  pthread_mutex_unlock(&rotatemutex);
+}
+
+// This function takes a rotation back
+PZdabWriter* Rotatefinish(rotation & r){
+  pthread_mutex_lock(&rotatemutex);
+  while(r.handed && !r.done)
+    pthread_cond_wait(&rotatedone, &rotatemutex);
+  const bool handed = r.handed;
+  r.handed = false;
+  pthread_mutex_unlock(&rotatemutex);
+  if(!handed)
+    return NULL;
+  Raiseoutput(r.err);
+  return r.next;
+}
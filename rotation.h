@@ -0,0 +1,50 @@
+// Output Rotation Header
+//
+// When the L2 output is rotated (stonehenge -l or -t), the next piece is
+// always open in advance, so at a rotation the event loop only switches to
+// it and writes the header records into it.  Closing the piece just
+// finished (flushing and closing it, and handing it to the durability
+// policy) and opening the piece after next are left to the rotation
+// thread, so that neither a slow close nor a slow open holds up the event
+// loop.  The thread raises no alarms: whatever went wrong opening the piece
+// is handed back with it, and raised by the event loop when it takes it.
+//
+// Each output which is rotated (the L2 output and each split stream of
+// each pipeline) has a rotation of its own, which holds its job; the one
+// thread does the jobs of every rotation in the order they are handed over.
+
+#ifndef __ROTATION_H__
+#define __ROTATION_H__
+
+#include "PZdabWriter.h"
+#include "output.h"
+#include <string>
+
+// The job of one rotated output, and what came of it.  It belongs to the
+// rotation thread while it is handed over and not done.
+struct rotation{
+  PZdabWriter* w;        // piece to close
+  std::string lockname;  // its lock file
+  std::string base;      // piece to open
+  bool clobber;
+  PZdabWriter* next;     // the piece opened, or NULL
+  outputerror err;       // what went wrong opening it
+  bool handed;           // handed over, and not taken back
+  bool done;             // and done
+};
+
+// This function hands the rotation thread the closing of the piece w, whose
+// checksum goes in the lock file lockname (see Syncclose in durable.h), and
+// the opening of the output file base (see Output in output.h), as the job
+// of the rotation r.  It starts the thread the first time.  Rotatefinish
+// must be called for r before r is handed over again.
+void Rotatestart(rotation & r, PZdabWriter* const w,
+                 const char* const lockname, const char* const base,
+                 const bool clobber);
+
+// This function waits for the rotation thread to finish the job of r,
+// raises any alarm passed back (aborting the program if the piece could not
+// be opened), and returns the piece it opened.
+PZdabWriter* Rotatefinish(rotation & r);
+
+#endif // __ROTATION_H__
@@ -11,96 +11,111 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "struct.h"
 #include "snbuf.h"
 #include "curl.h"
 #include "output.h"
+#include "durable.h"
 
 #define MAXSIZE 30472 // Largest possible event
-struct burststate
-{
-int head;
-int tail;
-bool burst;
-};
-
-static const uint64_t maxtime = (1UL << 43);
-static char* burstname;
+#define BUFSIZE ((size_t) MAXSIZE*sizeof(uint32_t)*EVENTNUM) // Buffer bytes
 
-// Stuff for the burst buffer
-static const int EVENTNUM = 1000;        // Maximum Burst buffer depth
-static const int ENDWINDOW = 1*50000000; // Integration window for ending bursts
-static char* burstev[EVENTNUM];      // Burst Event Buffer
-static uint64_t bursttime[EVENTNUM]; // Burst Time Buffer
-static burststate burstptr; // Object to hold pointers to head and tail of burst
-static uint64_t starttick = 0;   // Start time (in 50 MHz ticks) of burst
-static int burstindex = 0;  // Number of bursts seen
-static int bcount = 0;      // Number of events in present burst
+static char* burstname;
 
 // Stuff for the header buffer
-static const int headertypes = 3;
 static const uint32_t Headernames[headertypes] = 
   { RHDR_RECORD, TRIG_RECORD, EPED_RECORD };
-static char* header[headertypes];
+
+// The buffer used by the functions which are not passed one
+static snbuffer defaultbuf;
 
 // These are the filenames for storing the buffer between subfiles
 static const char* fnburststate = "burststate.txt";
 static const char* fnburstev    = "burstev.bin";
 static const char* fnbursttime  = "bursttime.txt";
 
+// This function writes into buff (of length len) the name of the file fn in
+// which the buffer s is kept between subfiles
+static void Statefile(char* const buff, const int len, const snbuffer & s,
+                      const char* const fn){
+  snprintf(buff, len, "%s%s", s.name, fn);
+}
+
+// This function maps the event buffer.  If the file f holds a saved buffer,
+// the buffer starts as a private copy of it, and otherwise empty.  Either
+// way, pages are only read or zeroed as they are first used, so that
+// starting up costs nothing however large the buffer is.
+static char* Mapbuffer(FILE* const f){
+  void* buf = MAP_FAILED;
+  struct stat st;
+  if(f && !fstat(fileno(f), &st) && st.st_size == (off_t) BUFSIZE)
+    buf = mmap(NULL, BUFSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+               fileno(f), 0);
+  if(buf == MAP_FAILED)
+    buf = mmap(NULL, BUFSIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(buf == MAP_FAILED){
+    printf("Error: SN Buffer could not be initialized.\n");
+    alarm(40, "Stonehenge: SN Buffer could not be initialized.", 12);
+    exit(1);
+  }
+  return (char*) buf;
+}
+
 // This function initializes the two SN Buffers.  It tries to read in the 
 // state of the buffer from file, or otherwise initializes it empty.  It also 
 // initializes the header buffer.
-void InitializeBuf(){
+void InitializeBuf(snbuffer & s, const char* const name){
+  s.name = name;
+  s.starttick = 0;
+  s.burstindex = 0;
+  s.bcount = 0;
+  s.forced = false;
+
   // Try to read from file
-  FILE* fburststate = fopen(fnburststate, "r");
-  FILE* fburstev    = fopen(fnburstev,    "rb");
-  FILE* fbursttime  = fopen(fnbursttime,  "r");
+  char fn[3][256];
+  Statefile(fn[0], 256, s, fnburststate);
+  Statefile(fn[1], 256, s, fnburstev);
+  Statefile(fn[2], 256, s, fnbursttime);
+  FILE* fburststate = fopen(fn[0], "r");
+  FILE* fburstev    = fopen(fn[1], "rb");
+  FILE* fbursttime  = fopen(fn[2], "r");
   if(fburststate && fburstev && fbursttime){
-    fscanf(fburststate, "%d %d %d", &burstptr.head, &burstptr.tail,
-                                    &burstptr.burst);
-    burstev[0] = (char*) malloc(MAXSIZE*sizeof(uint32_t)*EVENTNUM);
-    if(burstev[0] == NULL){
-      printf("Error: SN Buffer could not be initialized.\n");
-      alarm(40, "Stonehenge: SN Buffer could not be initialized.", 12);
-      exit(1);
-    }
+    fscanf(fburststate, "%d %d %d", &s.burstptr.head, &s.burstptr.tail,
+                                    &s.burstptr.burst);
+    // The events are mapped, not read
+    s.burstev[0] = Mapbuffer(fburstev);
     for(int i=0; i<EVENTNUM; i++){
-      if(fscanf(fbursttime, "%llu \n", &bursttime[i]) != 1)
-        bursttime[i] = 0;
-      burstev[i] = (char*) (burstev[0] + i*MAXSIZE*sizeof(uint32_t));
-    }
-    double fburstevsize = ftell(fburstev);
-    if(fread(burstev[0], sizeof(char), sizeof(burstev), fburstev) != fburstevsize){
-      memset(burstev[0], 0, MAXSIZE*sizeof(uint32_t)*EVENTNUM);
+      if(fscanf(fbursttime, "%llu \n", &s.bursttime[i]) != 1)
+        s.bursttime[i] = 0;
+      s.burstev[i] = (char*) (s.burstev[0] + i*MAXSIZE*sizeof(uint32_t));
     }
     // TODO: Handle the case of burst on file start correctly
     // For now, just pretend we're not in the middle of a burst
-    if(burstptr.burst){
-      burstptr.burst = false;
+    if(s.burstptr.burst){
+      s.burstptr.burst = false;
     }
   }
   // Otherwise, initialize empty
   else{
-    burstev[0] = (char*) malloc(MAXSIZE*sizeof(uint32_t)*EVENTNUM);
-    if(burstev[0] == NULL){
-      printf("Error: SN Buffer could not be initialized.\n");
-      alarm(40, "Stonehenge: SN Buffer could not be initialized.", 12);
-      exit(1);
-    }
+    s.burstev[0] = Mapbuffer(NULL);
     for(int i=0; i<EVENTNUM; i++){
-      burstev[i] = (char*) (burstev[0] + i*MAXSIZE*sizeof(uint32_t));
-      bursttime[i]=0;
+      s.burstev[i] = (char*) (s.burstev[0] + i*MAXSIZE*sizeof(uint32_t));
+      s.bursttime[i]=0;
     }
-    burstptr.head = -1;
-    burstptr.tail = -1;
-    burstptr.burst = false;
+    s.burstptr.head = -1;
+    s.burstptr.tail = -1;
+    s.burstptr.burst = false;
   }
 
   // Set up the header buffer
   for(int i=0; i<headertypes; i++){
-    header[i] = (char*) malloc(NWREC);
-    memset(header[i], 0, NWREC);
+    s.header[i] = (char*) malloc(NWREC);
+    memset(s.header[i], 0, NWREC);
   }
 
   // Close files if necessary
@@ -110,78 +125,63 @@ void InitializeBuf(){
 }
 
 // This function clears the pre-loaded buffer if the times are in the future
-void Checkbuffer(uint64_t firsttime){
-  if(!burstptr.head==-1){
-    uint64_t oldtime = bursttime[burstptr.head];
+void Checkbuffer(snbuffer & s, uint64_t firsttime){
+  if(!s.burstptr.head==-1){
+    uint64_t oldtime = s.bursttime[s.burstptr.head];
     if( firsttime < oldtime ){
-      memset(burstev[0], 0, MAXSIZE*sizeof(uint32_t)*EVENTNUM);
+      memset(s.burstev[0], 0, MAXSIZE*sizeof(uint32_t)*EVENTNUM);
       for(int i=0; i<EVENTNUM; i++){
-        bursttime[i] = 0;
+        s.bursttime[i] = 0;
       }
-      burstptr.head = -1;
-      burstptr.tail = -1;
+      s.burstptr.head = -1;
+      s.burstptr.tail = -1;
     }
   }
 }
 
 // This function drops old events from the buffer once they expire
-void UpdateBuf(uint64_t longtime, int BurstLength){
-  // The case that the buffer is empty
-  if(burstptr.head==-1)
-    return;
-  // Normal Case
-  int BurstTicks = BurstLength*50000000; // length in ticks
-  while((bursttime[burstptr.head] < longtime - BurstTicks) && (burstptr.head!=-1)){
-    bursttime[burstptr.head] = 0;
-    memset(burstev[burstptr.head], 0, MAXSIZE*sizeof(uint32_t));
-    AdvanceHead();
-    // Reset to empty state if we have emptied the queue
-    if(burstptr.head==burstptr.tail){
-      burstptr.head=-1;
-      burstptr.tail=-1;
-    }
-  }
+void UpdateBuf(snbuffer & s, uint64_t longtime, int BurstLength){
+  Expire(s, longtime, BurstLength, [&](const int i){
+    memset(s.burstev[i], 0, MAXSIZE*sizeof(uint32_t)); });
 }
 
 // This fuction adds events to an open Burst File
-void AddEvBFile(PZdabWriter* const b){
+// The buffered events are in external format, and the length of each was
+// stored in its nZDAB header by AddEvBuf.
+void AddEvBFile(snbuffer & s, PZdabWriter* const b){
   // Write out the data
-  if(b->WriteBank(
-        PZdabFile::GetBank((nZDAB*) burstev[burstptr.head]), kZDABindex)){
+  nZDAB* const nzdab = (nZDAB*) s.burstev[s.burstptr.head];
+  if(b->WriteExternalBank((uint32_t*) (nzdab + 1), kZDABindex,
+                          nzdab->data_words)){
     fprintf(stderr, "Error writing zdab to burst file\n");
     alarm(30, "Stonehenge: Error writing zdab to burst file", 0);
   }
+  Syncwriter(b);
   // Drop the data from the buffer
-  memset(burstev[burstptr.head], 0, MAXSIZE*sizeof(uint32_t));
-  bursttime[burstptr.head] = 0;
-  AdvanceHead();
-  bcount++;
+  memset(s.burstev[s.burstptr.head], 0, MAXSIZE*sizeof(uint32_t));
+  Writehead(s);
 }
 
 // This function adds a new event to the buffer
-void AddEvBuf(const nZDAB* const zrec, const uint64_t longtime, 
-              const uint32_t reclen, PZdabWriter* const b){
-  // Check whether we will overflow the buffer
-  // If so, first drop oldest event, then write
-  if(burstptr.head==burstptr.tail && burstptr.head!=-1){
+void AddEvBuf(snbuffer & s, const nZDAB* const zrec, const uint64_t longtime,
+              const uint32_t reclen, PZdabWriter* const b,
+              PZdabFile* const zfile){
+  // If the buffer overflows, the oldest event is written first
+  const int place = Addtime(s, longtime, [&]{ AddEvBFile(s, b); }, [&]{
     fprintf(stderr, "ALARM: Burst Buffer has overflowed!\n");
     alarm(30, "Stonehenge: Burst buffer has overflown.", 0);
-    if(!burstptr.burst){
+    if(!s.burstptr.burst){
       fprintf(stderr, "ALARM: Burst Threshold larger than buffer!\n");
       alarm(30, "Stonehenge: Burst threshold larger than buffer.", 0);
-    }
-    else
-      AddEvBFile(b);
-  }
-  
+    } });
+
   // Write the event to the buffer
-  // If buffer empty, set pointers appropriately
-  if(burstptr.tail==-1){
-    burstptr.tail=0;
-    burstptr.head=0;
-  }
   if(reclen < MAXSIZE*4){
-    memcpy(burstev[burstptr.tail], zrec, reclen);
+    nZDAB* const copy = (nZDAB*) s.burstev[place];
+    memcpy(copy, zrec, sizeof(nZDAB));
+    copy->data_words = reclen/sizeof(uint32_t) - NZDAB_WORD_SIZE;
+    zfile->CopyToExternal((uint32_t*) (copy + 1), (const uint32_t*) (zrec + 1),
+                          copy->data_words);
   }
   else{
     char buf[128];
@@ -190,176 +190,225 @@ void AddEvBuf(const nZDAB* const zrec, const uint64_t longtime,
     fprintf(stderr, buf);
     alarm(30, buf, 0);
   }
-  bursttime[burstptr.tail] = longtime;
-  if(burstptr.tail<EVENTNUM - 1)
-    burstptr.tail++;
-  else
-    burstptr.tail=0;
-}
-
-// This function computes the number of burst candidate events currently
-// in the buffer
-int Burstlength(){
-  int burstlength = 0;
-  if(burstptr.head!=-1){
-    if(burstptr.head<burstptr.tail)
-      burstlength = burstptr.tail - burstptr.head;
-    else
-      burstlength = EVENTNUM + burstptr.tail - burstptr.head;
-  }
-  return burstlength;
 }
 
 // This function writes out the allowable portion of the buffer to a burst file
-void Writeburst(uint64_t longtime, PZdabWriter* b){
-  while((bursttime[burstptr.head] < longtime - ENDWINDOW) && (burstptr.head < burstptr.tail)){
-    AddEvBFile(b);
-  }
+void Writeburst(snbuffer & s, uint64_t longtime, PZdabWriter* b){
+  Writeready(s, longtime, [&]{ AddEvBFile(s, b); });
 }
 
 // This function opens a new burst file
-void Openburst(PZdabWriter* & b, uint64_t longtime, char* outfilebase, 
-               bool clobber){
-  starttick = bursttime[burstptr.head];
+void Openburst(snbuffer & s, PZdabWriter* & b, uint64_t longtime,
+               char* outfilebase, bool clobber){
+  s.starttick = s.bursttime[s.burstptr.head];
   char buff[128];
-  sprintf(buff, "Burst %i has begun!\n", burstindex);
+  sprintf(buff, "Burst %i has begun!\n", s.burstindex);
   fprintf(stderr, buff);
   alarm(20, buff, 0);
   char namebuff[128];
-  sprintf(namebuff, "%s_%s_%i", burstname, outfilebase, burstindex);
+  sprintf(namebuff, "%s_%s_%i", burstname, outfilebase, s.burstindex);
   b = Output(namebuff, clobber, 1);
+  OutHeaders(s, b);
+}
+
+// This function writes the records in the header buffer to a new file
+void OutHeaders(const snbuffer & s, PZdabWriter* const w){
   for(int i=0; i<headertypes; i++){
-    OutHeader((nZDAB*) header[i], b);
+    OutHeader((nZDAB*) s.header[i], w);
   }
 }
 
 // This function writes out the remainder of the buffer when burst ends
-void Finishburst(PZdabWriter* & b, uint64_t longtime){
-  while(burstptr.head < burstptr.tail+1){
-    AddEvBFile(b);
-  }
-  burstptr.head = -1;
-  burstptr.tail = -1;
+void Finishburst(snbuffer & s, PZdabWriter* & b, uint64_t longtime){
+  const int bcount = Endburst(s, [&]{ AddEvBFile(s, b); });
   b->Close();
+  Syncclose(b, NULL);
   delete b;
-  uint64_t btime = longtime - starttick;
+  uint64_t btime = longtime - s.starttick;
   float btimesec = btime/50000000.;
   char buff[256];
   sprintf(buff, "Burst %i has ended.  It contains %i events and lasted"
-                  " %.2f seconds.\n", burstindex, bcount, btimesec);
+                  " %.2f seconds.\n", s.burstindex, bcount, btimesec);
   fprintf(stderr, buff);
   alarm(20, buff, 0);
-  burstindex++;
-  // Reset to prepare for next burst
-  bcount = 0;
-  burstptr.burst = false;
+  s.burstindex++;
+}
+
+// This function writes the events in the buffer to the file fn, at their
+// places in the buffer.  The rest of the file is left as holes, which read
+// as zeros, so only the events are written.  The file is written under
+// another name and then renamed, since the buffer may be a mapping of the
+// file it replaces.
+static void Saveevents(const snbuffer & s, const char* const fn){
+  char tmp[272];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", fn);
+  const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0 && !ftruncate(fd, BUFSIZE);
+  if(ok && s.burstptr.head != -1){
+    int i = s.burstptr.head;
+    do{
+      const nZDAB* const nzdab = (const nZDAB*) s.burstev[i];
+      size_t len = (NZDAB_WORD_SIZE + nzdab->data_words)*sizeof(uint32_t);
+      if(len > MAXSIZE*sizeof(uint32_t))
+        len = MAXSIZE*sizeof(uint32_t);
+      ok = ok && pwrite(fd, nzdab, len, (off_t) i*MAXSIZE*sizeof(uint32_t))
+                 == (ssize_t) len;
+      i = i < EVENTNUM - 1 ? i + 1 : 0;
+    } while(i != s.burstptr.tail);
+  }
+  if(fd >= 0)
+    ok = !close(fd) && ok;
+  if(!ok || rename(tmp, fn)){
+    fprintf(stderr, "Error saving the burst buffer to %s\n", fn);
+    alarm(30, "Stonehenge: Error saving the burst buffer.", 0);
+    unlink(tmp);
+  }
 }
 
 // This function saves the buffer state to disk.
 // Burstev is saved in binary, bursttime and burststate are saved in ascii
-void Saveburstbuff(){
-  FILE* fburststate = fopen(fnburststate, "w");
-  FILE* fburstev = fopen(fnburstev, "wb");
-  FILE* fbursttime = fopen(fnbursttime, "w");
-  fwrite(burstev[0], sizeof(char), MAXSIZE*sizeof(uint32_t)*EVENTNUM, fburstev);
+void Saveburstbuff(const snbuffer & s){
+  char fn[3][256];
+  Statefile(fn[0], 256, s, fnburststate);
+  Statefile(fn[1], 256, s, fnburstev);
+  Statefile(fn[2], 256, s, fnbursttime);
+  Saveevents(s, fn[1]);
+  FILE* fburststate = fopen(fn[0], "w");
+  FILE* fbursttime = fopen(fn[2], "w");
   for(int i=0; i<EVENTNUM; i++){
-    fprintf(fbursttime, "%llu \n", bursttime[i]);
+    fprintf(fbursttime, "%llu \n", s.bursttime[i]);
   }
-  fprintf(fburststate, "%d %d %d", burstptr.head, burstptr.tail, burstptr.burst);
+  fprintf(fburststate, "%d %d %d", s.burstptr.head, s.burstptr.tail, s.burstptr.burst);
   fclose(fburststate);
-  fclose(fburstev);
   fclose(fbursttime);
 }
 
 // This function manages the writing of events into a burst file.
-bool Burstfile(PZdabWriter* & b, configuration config, alltimes alltime, 
-               char* outfilebase, bool clobber){
-  // Open a new burst file if a burst starts
-  if(!burstptr.burst){
-    if(Burstlength() > config.burstsize){
-      Openburst(b, alltime.longtime, outfilebase, clobber);
-      burstptr.burst = true;
-    }
-  }
-  
-  // While in a burst
-  if(burstptr.burst){
-    Writeburst(alltime.longtime, b);
-    // Check whether the burst has ended
-    if(Burstlength() < config.endrate){
-      Finishburst(b, alltime.longtime);
-    }
-  }
-  return burstptr.burst;
+bool Burstfile(snbuffer & s, PZdabWriter* & b, configuration config,
+               alltimes alltime, char* outfilebase, bool clobber){
+  return Stepburst(s, alltime.longtime, config.burstsize, config.endrate,
+                   [&]{ Openburst(s, b, alltime.longtime, outfilebase,
+                                  clobber); },
+                   [&]{ AddEvBFile(s, b); },
+                   [&]{ Finishburst(s, b, alltime.longtime); });
 }
 
 // This function wraps up the burst buffer when the end of file is reached
-void BurstEndofFile(PZdabWriter* & b, uint64_t longtime){
-  Saveburstbuff();
-  if(burstptr.burst)
-    Finishburst(b, longtime);
-}
-
-// This function advances the head pointer appropriately
-void AdvanceHead(){
-  if(burstptr.head < EVENTNUM - 1)
-    burstptr.head++;
-  else
-    burstptr.head = 0;
+void BurstEndofFile(snbuffer & s, PZdabWriter* & b, uint64_t longtime){
+  Saveburstbuff(s);
+  if(s.burstptr.burst)
+    Finishburst(s, b, longtime);
 }
 
 // This function is used to reset the buffer if the events 
 // arrive out of order in a non-recoverable way.
-void ClearBuffer(PZdabWriter* & b, uint64_t longtime){
-  if(burstptr.burst)
-    Finishburst(b, longtime);
-  else{
-    memset(burstev[0], 0, MAXSIZE*sizeof(uint32_t)*EVENTNUM);
-    for(int i=0; i<EVENTNUM; i++){
-      bursttime[i] = 0;
-    }
-    burstptr.head = -1;
-    burstptr.tail = -1;
-    burstptr.burst = false;
-  }
+void ClearBuffer(snbuffer & s, PZdabWriter* & b, uint64_t longtime){
+  if(!s.burstptr.burst)
+    memset(s.burstev[0], 0, MAXSIZE*sizeof(uint32_t)*EVENTNUM);
+  Clearburst(s, [&]{ Finishburst(s, b, longtime); });
 }
 
 // This function checks whether the passed record is a header record, and,
 // if it is, writes it to the header buffer.
 // It also checks the run type for RHDR records.  It returns 0 if the record
 // was not a RHDR, and the run type if it was.
-uint32_t FillHeaderBuffer(nZDAB* const zrec){
+uint32_t FillHeaderBuffer(snbuffer & s, nZDAB* const zrec,
+                          PZdabFile* const zfile){
   uint32_t runtype = 0;
   for(int i=0; i<headertypes; i++){
     if(zrec->bank_name == Headernames[i]){
-      memset(header[i], 0, NWREC);
-      // Add 9 words for the length of the nZDAB header itself
-      // Copy the data to buffer in native format
-      uint32_t recLen = zrec->data_words+9;
-      memcpy(header[i], zrec, recLen*sizeof(uint32_t));
+      memset(s.header[i], 0, NWREC);
+      // Copy the nZDAB header and then the data to buffer in native format
+      nZDAB* const copy = (nZDAB*) s.header[i];
+      memcpy(copy, zrec, sizeof(nZDAB));
+      zfile->CopyToNative((uint32_t*) (copy+1), (const uint32_t*) (zrec+1),
+                          zrec->data_words);
       // For RHDR's pull out run type to return
       if(i==0){
-        RunRecord* rhdr = (RunRecord*) (zrec+1);
-        SWAP_INT32(rhdr, 9);
+        RunRecord* rhdr = (RunRecord*) (copy+1);
         runtype = rhdr->RunMask;
         fprintf(stderr, "runtype: %d\n", runtype);
-        SWAP_INT32(rhdr, 9);
       }
     }
   }
   return runtype;
 }
 
-// This function returns the epoch value used to write timestamp
-// bursttime[burstptr.head]
-int GetEpoch()
-{
-  uint64_t time = bursttime[burstptr.head];
-  int epoch = time/maxtime;
-  return epoch;
-}
-
 // This function sets the burst directory
 void setburst(char* burstdir){
   burstname = burstdir;
 }
+
+// The functions below work on the default buffer
+
+void InitializeBuf(){
+  InitializeBuf(defaultbuf);
+}
+
+void Checkbuffer(uint64_t firsttime){
+  Checkbuffer(defaultbuf, firsttime);
+}
+
+void UpdateBuf(uint64_t longtime, int BurstLength){
+  UpdateBuf(defaultbuf, longtime, BurstLength);
+}
+
+void AddEvBFile(PZdabWriter* const b){
+  AddEvBFile(defaultbuf, b);
+}
+
+void AddEvBuf(const nZDAB* const zrec, const uint64_t longtime, 
+              const uint32_t reclen, PZdabWriter* const b,
+              PZdabFile* const zfile){
+  AddEvBuf(defaultbuf, zrec, longtime, reclen, b, zfile);
+}
+
+int Burstlength(){
+  return Burstlength(defaultbuf);
+}
+
+void Writeburst(uint64_t longtime, PZdabWriter* b){
+  Writeburst(defaultbuf, longtime, b);
+}
+
+void Openburst(PZdabWriter* & b, uint64_t longtime, char* outfilebase, 
+               bool clobber){
+  Openburst(defaultbuf, b, longtime, outfilebase, clobber);
+}
+
+void OutHeaders(PZdabWriter* const w){
+  OutHeaders(defaultbuf, w);
+}
+
+void Finishburst(PZdabWriter* & b, uint64_t longtime){
+  Finishburst(defaultbuf, b, longtime);
+}
+
+void Saveburstbuff(){
+  Saveburstbuff(defaultbuf);
+}
+
+bool Burstfile(PZdabWriter* & b, configuration config, alltimes alltime, 
+               char* outfilebase, bool clobber){
+  return Burstfile(defaultbuf, b, config, alltime, outfilebase, clobber);
+}
+
+void BurstEndofFile(PZdabWriter* & b, uint64_t longtime){
+  BurstEndofFile(defaultbuf, b, longtime);
+}
+
+void AdvanceHead(){
+  AdvanceHead(defaultbuf);
+}
+
+void ClearBuffer(PZdabWriter* & b, uint64_t longtime){
+  ClearBuffer(defaultbuf, b, longtime);
+}
+
+uint32_t FillHeaderBuffer(nZDAB* const zrec, PZdabFile* const zfile){
+  return FillHeaderBuffer(defaultbuf, zrec, zfile);
+}
+
+int GetEpoch(){
+  return GetEpoch(defaultbuf);
+}
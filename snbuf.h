@@ -11,21 +11,51 @@
 // K Labe, December 5 2014   - Add setburst() function
 // K Labe, April 7 2016      - Modify FillHeaderBuffer() to return run type
 
+#ifndef __SNBUF_H__
+#define __SNBUF_H__
+
+#include <stdint.h>
+#include "struct.h"
+#include "bursttrigger.h"
+
+// All the state of the burst buffer lives in an snbuffer object, so that each
+// stream handled by a program has its own.  Every function below takes the
+// buffer it works on; the version without that argument works on a single
+// default buffer, for programs which handle just one stream.
+
+// Number of kinds of header records kept
+static const int headertypes = 3;
+
+// This structure holds a burst buffer, whose times and pointers are those
+// of the burst trigger (see bursttrigger.h), and its header buffer
+struct snbuffer : burstring
+{
+const char* name;             // Prefix of the files it is saved in
+char* burstev[EVENTNUM];      // Burst Event Buffer
+int burstindex;               // Number of bursts seen
+char* header[headertypes];    // Header Buffer
+};
+
 // This function should be called once at the beginning of a subfile to set
 // up the burst buffers.  It tries to read in the buffer state from file, or
 // otherwise initializes empty.  It also initializes the header buffer.
+// The files the state is kept in between subfiles have the prefix name.
+void InitializeBuf(snbuffer & s, const char* const name = "");
 void InitializeBuf();
 
 // This function should be called after reading the first timestamp in a new
 // file to decide whether or not to throw out the loaded buffer data.
+void Checkbuffer(snbuffer & s, uint64_t firsttime);
 void Checkbuffer(uint64_t firsttime);
 
 // This function drops old events from the buffer once they expire
 // longtime specifies the current time (see comment elsewhere for exact def.)
 // Events older than BurstLength (in secs) are expired.
+void UpdateBuf(snbuffer & s, uint64_t longtime, int BurstLength);
 void UpdateBuf(uint64_t longtime, int BurstLength);
 
 // This function writes an event to an open Burst File b
+void AddEvBFile(snbuffer & s, PZdabWriter* const b);
 void AddEvBFile(PZdabWriter* const b);
 
 // This function adds an event to the buffer
@@ -33,8 +63,14 @@ void AddEvBFile(PZdabWriter* const b);
 // enter the buffer.  (This should not occur).
 // The PZdabWriter object is required so that an event can be written to file
 // if a burst is ongoing and the buffer overflows.
+// The event is stored in external format whatever the byte order of the input
+// file zfile.
+void AddEvBuf(snbuffer & s, const nZDAB* const zrec, const uint64_t longtime,
+              const uint32_t reclen, PZdabWriter* const b,
+              PZdabFile* const zfile);
 void AddEvBuf(const nZDAB* const zrec, const uint64_t longtime,
-              const uint32_t reclen, PZdabWriter* const b);
+              const uint32_t reclen, PZdabWriter* const b,
+              PZdabFile* const zfile);
 
 // This function returns the number of events in the buffer
 int Burstlength();
@@ -44,32 +80,45 @@ int Burstlength();
 // for definition).  By allowable, we mean that portion of the burst not
 // occuring within the integration period used to determine whether the burst 
 // has ended.
+void Writeburst(snbuffer & s, uint64_t longtime, PZdabWriter* b);
 void Writeburst(uint64_t longtime, PZdabWriter* b);
 
 // This function opens a new burst file b.  Longtime is the present time (see 
 // definition elsewhere).  Headertypes in the number of distinct kinds of header
 // records saved in the header buffer (header[]).  Clobber tells whether to
 // write over existing files.
+void Openburst(snbuffer & s, PZdabWriter* & b, uint64_t longtime,
+               char* outfilebase, bool clobber);
 void Openburst(PZdabWriter* & b, uint64_t longtime, char* outfilebase,
                bool clobber);
 
+// This function writes the header records saved in the header buffer to the
+// newly opened file w, so that it can be read on its own.
+void OutHeaders(const snbuffer & s, PZdabWriter* const w);
+void OutHeaders(PZdabWriter* const w);
+
 // This function writes out the remainder of the burst buffer when the burst
 // ends into the file b, and closes it.  Longtime is the present time (see 
 // definition elsewhere), which is used to provide some statistics about the
 // burst in the log.
+void Finishburst(snbuffer & s, PZdabWriter* & b, uint64_t longtime);
 void Finishburst(PZdabWriter* & b, uint64_t longtime);
 
 // This function is used to save the state of the burstbuffer to disk so that
 // the burst detection algorithm can pick up from where it left off when the 
 // next file begins.
+void Saveburstbuff(const snbuffer & s);
 void Saveburstbuff();
 
 // This function manages the writing of events into a burst file.  It returns
 // a bool stating whether a burst is ongoing.
+bool Burstfile(snbuffer & s, PZdabWriter* & b, configuration config,
+               alltimes alltime, char* outfilebase, bool clobber);
 bool Burstfile(PZdabWriter* & b, configuration config, alltimes alltime, 
                char* outfilebase, bool clobber);
 
 // This function wraps up the burst buffer when the end of a subfile is reached.
+void BurstEndofFile(snbuffer & s, PZdabWriter* & b, uint64_t longtime);
 void BurstEndofFile(PZdabWriter* & b, uint64_t longtime);
 
 // This function just advances the pointer to the head of the burst properly
@@ -80,15 +129,22 @@ void AdvanceHead();
 // the event timestamps have jumped in a non-recoverable way.  b and longtime 
 // are used in the event that a burst is ongoing when the buffer needs to be 
 // cleared.
+void ClearBuffer(snbuffer & s, PZdabWriter* & b, uint64_t longtime);
 void ClearBuffer(PZdabWriter* & b, uint64_t longtime);
 
 // This function checks the zdab record zrec, and if it is one of the header-
-// type records, it records it in the header buffer.
+// type records, it records it in the header buffer in native format.
 // If the record was a RHDR, it returns the run type; otherwise 0.
-uint32_t FillHeaderBuffer(nZDAB* const zrec);
+uint32_t FillHeaderBuffer(snbuffer & s, nZDAB* const zrec,
+                          PZdabFile* const zfile);
+uint32_t FillHeaderBuffer(nZDAB* const zrec, PZdabFile* const zfile);
 
 // This function checks the burst buffer to return the value of the epoch
 // parameter at the time of the last available write
 int GetEpoch();
 
+// This function sets the directory burst files are written to, for all
+// buffers
 void setburst(char* burstdir);
+
+#endif // __SNBUF_H__
@@ -5,8 +5,8 @@
 // low-latency way, designed to meet the needs of the level two 
 // trigger and the supernova trigger.  The utilities are these:
 // 1. Supernova buffer, an analogue to RAT's burst processor.
-// 2. Chopper, available in older version (see tag: FinalChopper),
-//     for splitting a ZDAB into smaller pieces
+// 2. Chopper, for splitting the L2 output into pieces by size or duration
+//     as it is written (the standalone version is in tag: FinalChopper)
 // 3. L2 cut, currently based on nhit, but generalizable
 // 4. Some data quality checks, particularly on time.
 // 5. Interface to Redis database for recording information about cut
@@ -33,37 +33,35 @@
 #include <errno.h>
 #include <math.h>
 #include <limits.h>
-#include <fstream>
 #include <signal.h>
 #include <time.h>
-#include <libpq-fe.h>
 #include "redis.h"
 #include "curl.h"
 #include "curl/curl.h"
 #include "snbuf.h"
+#include "bursttrigger.h"
 #include "output.h"
 #include "config.h"
+#include "caen.h"
+#include "durable.h"
+#include "gtidcheck.h"
+#include "ratemon.h"
+#include "pipeline.h"
+#include "control.h"
+#include "postgres.h"
+#include "placement.h"
+#include "counters.h"
+#include "decide.h"
+#include "inputcheck.h"
+#include "targets.h"
+#include "rotation.h"
+#include "clock.h"
+#ifdef WITH_ZSTD
+#include "PZdabZstd.h"
+#endif
 
 /* constants */
 #define BASE_BUFFSIZE       32768UL     // base size of zdab record buffer
-#define MAX_BUFFSIZE        0x400000UL  // maximum size of zdab record buffer (4 MB)
-
-// the builder won't put out events with NHIT > 10000
-// (note that these are possible due to hardware problems)
-// but XSNOED can write an event with up to 10240 channels
-#define MAX_NHIT            10240
-
-// This variable holds the configuration of the parameters that determine the
-// behavior of the filter
-static configuration config;
-
-// This variable holds the data on all the configurations read out of the 
-// configuration file
-static configuration allconfigs[2];
-
-// This variable holds the current Nhitcut, which can be either the Hi or 
-// Lo Nhitcut, depending on what has been going on
-static int NHITCUT;
 
 // Whether to overwrite existing output
 static bool clobber = true;
@@ -71,19 +69,57 @@ static bool clobber = true;
 // Whether to write to redis database
 static bool yesredis = false;
 
+// Whether to also split accepted events into an output stream for each class
+static bool splitstreams = false;
+
+// Size (bytes) and duration (50 MHz ticks) at which the L2 output is rotated
+// into a new file.  Zero means no limit.
+static uint64_t rotatebytes = 0;
+static uint64_t rotateticks = 0;
+
 // Whether to silence alarms
 static bool silent = false;
 
-// Tells us when the 50MHz clock rolls over
-static const uint64_t maxtime = (1UL << 43);
-
-// Maximum time allowed between events without a complaint
-static const uint64_t maxjump = 10*50000000; // 50 MHz time
+static char* password = NULL;
 
-// Maximum time drift allowed between two clocks without a complaint
-static const int maxdrift = 5000; // 50 MHz ticks (1 us)
+// The shared-memory ring, counters and control socket, opened once the
+// main thread has been placed
+static char* ringname = NULL;
+static char* countername = NULL;
+static char* controlpath = NULL;
+
+// The builder's lock file for the input, which it is checked against
+static char* inputlock = NULL;
+
+// Startup is timed phase by phase, and the times reported once the first 
+// event has been decided
+static const int MAXPHASES = 16;
+static const char* phasenames[MAXPHASES];
+static double phasetimes[MAXPHASES]; // s
+static int nphases = 0;
+static double mainstart = 0;  // Time main() started
+static double phasestart = 0; // Time the present phase started
+
+// This function ends the present phase of startup, which is called name
+static void Phase(const char* const name){
+  const double now = Now();
+  if(nphases < MAXPHASES){
+    phasenames[nphases] = name;
+    phasetimes[nphases++] = now - phasestart;
+  }
+  phasestart = now;
+}
 
-static char* password = NULL;
+// This function reports the time taken by each phase of startup
+static void Reportstartup(){
+  char msg[1024];
+  int len = sprintf(msg, "Startup:");
+  for(int i=0; i<nphases; i++)
+    len += sprintf(msg + len, " %s %.1f ms,", phasenames[i],
+                   phasetimes[i]*1e3);
+  sprintf(msg + len, " first decision at %.1f ms\n", (Now() - mainstart)*1e3);
+  fprintf(stderr, msg);
+}
 
 // This function closes the completed primary chunk and  moves the file
 // to the appropriate directory.  It should be used here in place of the 
@@ -97,13 +133,83 @@ static void Close(const char* const base, PZdabWriter* const & w)
   snprintf(buff3, 256, "%s.lock", base);
   const char* outname = buff2;
   w->Close();
-  char* checksum = w->GetMD5();
+  // The checksum goes in the lock file once the file is durable
+  Syncclose(w, buff3);
   delete w;
+}
+
+// This function writes into buff the base name of piece i of the output
+// file base, which is split into pieces when it is rotated
+static void PieceBase(char* const buff, const char* const base, const int i)
+{
+  snprintf(buff, 256, "%s_p%03i", base, i);
+}
+
+// This function opens the output file base of p as w, and if the output is
+// rotated, opens its next piece in advance as next
+static void Openoutput(pipeline & p, const char* const base,
+                       PZdabWriter* & w, PZdabWriter* & next)
+{
+  if(rotatebytes || rotateticks){
+    char piece[256];
+    PieceBase(piece, base, p.piece);
+    w = Output(piece, clobber);
+    PieceBase(piece, base, p.piece + 1);
+    next = Output(piece, clobber);
+  }
+  else
+    w = Output(base, clobber);
+}
 
-  std::ofstream myfile;
-  myfile.open(buff3, std::fstream::app);
-  myfile << checksum << "\n"; 
-  myfile.close();
+// This function closes the output file base of p, w, at the end of the
+// subfile, and if the output is rotated, discards its next piece, once the
+// rotation r has opened it
+static void Closeoutput(pipeline & p, const char* const base,
+                        PZdabWriter* & w, PZdabWriter* & next, rotation & r)
+{
+  if(rotatebytes || rotateticks){
+    char piece[256];
+    PieceBase(piece, base, p.piece);
+    if(!next)
+      next = Rotatefinish(r);
+    Close(piece, w);
+    Discard(next);
+  }
+  else if(w)
+    Close(base, w);
+  w = next = NULL;
+}
+
+// This function rotates the output file base of p: it switches w to the
+// next piece, which was opened in advance, and seeds it with the header
+// records.  The rotation r closes the present piece, writing its lock file,
+// and opens the piece after next, so the event loop waits for neither.
+static void Rotateoutput(pipeline & p, const char* const base,
+                         PZdabWriter* & w, PZdabWriter* & next, rotation & r)
+{
+  char piece[256];
+  char lock[512];
+  PieceBase(piece, base, p.piece);
+  snprintf(lock, 512, "%s.lock", piece);
+  if(!next)
+    next = Rotatefinish(r);
+  PZdabWriter* const finished = w;
+  w = next;
+  next = NULL;
+  OutHeaders(p.buf, w);
+  PieceBase(piece, base, p.piece + 2);
+  Rotatestart(r, finished, lock, piece, clobber);
+}
+
+// This function rotates the L2 output of p, and its split streams with it
+static void Rotate(pipeline & p)
+{
+  Rotateoutput(p, p.outfilebase, p.w1, p.next, p.rotate);
+  for(int i=0; splitstreams && i<NUM_STREAMS; i++)
+    Rotateoutput(p, p.streambase[i], p.streams[i], p.streamnext[i],
+                 p.streamrotate[i]);
+  p.piece++;
+  Targetalarms();
 }
 
 // Function to assist in parsing the input variables                  
@@ -160,12 +266,52 @@ static void printhelp()
   "  -n: Do not overwrite existing output (default is to do so)\n"
   "  -r: Write statistics to the redis database.\n"
   "  -s [int]: 1 to silence alarms; 0 to play alarms\n"
+  "  -z: Write compressed (seekable zstd) output files\n"
+  "  -p: Also write accepted events to a file for each class of event\n"
+  "      (_ext, _pedpulse, _nhit, _retrig), with the header records in each\n"
+  "  -l [float]: Start a new L2 output file after this many MB\n"
+  "  -t [float]: Start a new L2 output file after this many seconds\n"
+  "      (with -p, each split stream starts a new piece along with it)\n"
+  "      (the files are named with _p000, _p001, ...)\n"
+  "  -d [float]: Write output files with direct I/O, bypassing the page\n"
+  "      cache, and preallocate them this many MB at a time\n"
+  "  -f [string]: Durability policy: none (default), close (sync each file\n"
+  "      before writing its lock file), [float]s (also sync every so many\n"
+  "      seconds) or [float]MB (also sync every so many MB)\n"
+  "  -m [string]: Also publish the L2 records to the shared-memory ring of\n"
+  "      this name (e.g. /stonehenge), for live readers such as zdabfollow\n"
+  "  -e [string]: Keep the counters in shared memory of this name (e.g.\n"
+  "      /stonehenge.counters), for other programs to read\n"
+  "  -k [string]: Serve the control socket at this path, to change the cuts,\n"
+  "      open or close bursts and so on while running (send it help)\n"
+  "  -a [string]: Run the threads of a role on these CPUs, as role=cpus,\n"
+  "      e.g. main=2 or sync=4-7,12; the roles are main (reading, deciding\n"
+  "      and writing), sync, control, connect, verify, target and\n"
+  "      rotate.  Memory is taken from the NUMA node of the CPUs.  May be\n"
+  "      given once for each role\n"
+  "  -x [int]: Run the main thread with real-time (SCHED_FIFO) scheduling\n"
+  "      at this priority, from 1 to 49\n"
+  "  -g: Make the decisions with the generic code, rather than the code\n"
+  "      compiled for the shape of the cuts in use\n"
+  "  -v [string]: Check the input against the MD5 checksum in this lock\n"
+  "      file, written by the builder, as it is read; if they do not match,\n"
+  "      the output lock files are marked as suspect\n"
+  "  -w [string]: Write the L2 output to several directories, each by its\n"
+  "      own thread, as mirror:dir,dir,... (every file in each) or\n"
+  "      stripe:dir,dir,... (the files in each in turn), in place of\n"
+  "      /home/trigger/zdab; directories which stall or fail are avoided\n"
   "  -h: This help text\n"
   );
 }
 
 // This function prints some information at the end of the file
-static void PrintClosing(char* outfilebase, counts count, int stats[]){
+static void PrintClosing(char* outfilebase, const pipeline & p){
+  int stats[16];
+  for(int i=0; i<16; i++)
+    stats[i] = Readcounter(p.keys[i]);
+  int caenpass = 0;
+  for(int i=8; i<16; i++)
+    caenpass += stats[i];
   char messg[2048];
   sprintf(messg, "Stonehenge: Subfile %s finished."
                  "  %lu records,  %lu events processed.\n"
@@ -176,10 +322,12 @@ static void PrintClosing(char* outfilebase, counts count, int stats[]){
                  "%i events pass only retrigger cut\n"
                  "%i events pass both retrigger cut and nhit cut\n"
                  "%i events pass both retrigger cut and nhit cut\n"
-                 "%i events pass all three cuts\n",
-         outfilebase, count.recordn, count.eventn,
+                 "%i events pass all three cuts\n"
+                 "%i events pass the trigger sum cut\n",
+         outfilebase, (unsigned long) Readcounter(p.stat.l1.id),
+         (unsigned long) Readcounter(p.events),
          stats[0], stats[1], stats[2],
-         stats[3], stats[4], stats[5], stats[6], stats[7]);
+         stats[3], stats[4], stats[5], stats[6], stats[7], caenpass);
 
   alarm(21, messg, 0);
   fprintf(stderr, messg);
@@ -187,15 +335,14 @@ static void PrintClosing(char* outfilebase, counts count, int stats[]){
 
 // This function interprets the command line arguments to the program
 static void parse_cmdline(int argc, char ** argv, char * & infilename,
-                          char * & outfilebase)
+                          char * & outfilebase, char * & configfile)
 {
-  char* configfile = NULL;
   char* burstdir = NULL;
-  const char * const opts = "hi:o:l:b:t:u:c:s:nr";
+  const char * const opts = "hi:o:l:b:t:u:c:s:d:f:m:e:k:a:x:v:w:nrzpg";
 
   bool done = false;
   
-  infilename = outfilebase = NULL;
+  infilename = outfilebase = configfile = NULL;
   int silentword;
 
   while(!done){ 
@@ -212,6 +359,20 @@ static void parse_cmdline(int argc, char ** argv, char * & infilename,
 
       case 'n': clobber = false; break;
       case 'r': yesredis = true; password = optarg; break;
+      case 'z': setcompress(true); break;
+      case 'p': splitstreams = true; break;
+      case 'g': setgeneric(true); break;
+      case 'l': rotatebytes = getcmdline_d(ch)*1e6; break;
+      case 't': rotateticks = getcmdline_d(ch)*50000000; break;
+      case 'd': setdirect(getcmdline_d(ch)*1e6); break;
+      case 'f': setdurability(optarg); break;
+      case 'm': ringname = optarg; break;
+      case 'e': countername = optarg; break;
+      case 'k': controlpath = optarg; break;
+      case 'a': setplacement(optarg); break;
+      case 'x': setrealtime(getcmdline_l(ch)); break;
+      case 'v': inputlock = optarg; break;
+      case 'w': settargets(optarg); break;
 
       case 'h': printhelp(); exit(0);
       default:  printhelp(); exit(1);
@@ -241,32 +402,24 @@ static void parse_cmdline(int argc, char ** argv, char * & infilename,
     printhelp();
     exit(1);
   }
-
-  ReadConfig(configfile, allconfigs);
-
 }
 
 // This function checks the clocks for various anomalies and raises alarms.
 // It returns true if the event passes the tests, false otherwise
 bool IsConsistent(alltimes & newat, alltimes standard, const int dd){
-  // Check for time running backward:
-  if(newat.time50 < standard.time50){
-    // Is it reasonable that the clock rolled over?
-    if((standard.time50 + newat.time50 < maxtime + maxjump) &&
-        dd < maxdrift && (standard.time50 > maxtime - maxjump) ){
-      fprintf(stderr, "New Epoch\n");
-      alarm(20, "Stonehenge: new epoch.", 0);
-      newat.epoch++;
-    }
-    else{
-      const char msg[128] = "Stonehenge: Time running backward!\n";
-      alarm(30, msg, 0);
-      fprintf(stderr, msg);
-      return false;
-    }  
+  const int found = Checktime(newat.time50, standard.time50, dd);
+  if(found & TIME_NEWEPOCH){
+    fprintf(stderr, "New Epoch\n");
+    alarm(20, "Stonehenge: new epoch.", 0);
+    newat.epoch++;
   }
-  // Check that time has not jumped too far ahead
-  if(newat.time50 - standard.time50 > maxjump){
+  if(found & TIME_BACKWARD){
+    const char msg[128] = "Stonehenge: Time running backward!\n";
+    alarm(30, msg, 0);
+    fprintf(stderr, msg);
+    return false;
+  }
+  if(found & TIME_JUMP){
     char msg[128] = "Stonehenge: Large time gap between events!\n";
     alarm(30, msg, 0);
     fprintf(stderr, msg);
@@ -276,24 +429,20 @@ bool IsConsistent(alltimes & newat, alltimes standard, const int dd){
     return true;
 }
 
-// This function calculates the time of an event as measured by the
-// varlous clocks we are interested in.
-static alltimes compute_times(hitinfo hits, alltimes oldat, counts & count, 
-                              bool & passretrig, bool & retrig,
-                              l2stats & stat, PZdabWriter* & b)
+// This function calculates the time of an event of pipeline p as measured 
+// by the varlous clocks we are interested in.
+static alltimes compute_times(pipeline & p, hitinfo hits, alltimes oldat)
 {
-  static alltimes standard; // Previous unproblematic timestamp
-  static bool problem;      // Was there a problem with previous timestamp?
   alltimes newat = oldat;
   // For first event
-  if(count.eventn == 1){
+  if(Readcounter(p.events) == 1){
     newat.time50 = hits.time50;
     newat.time10 = hits.time10;
-    if(newat.time50 == 0) stat.orphan++;
+    if(newat.time50 == 0) Count(p.stat.orphan.id);
     newat.longtime = newat.time50;
-    standard = newat;
-    problem = false;
-    Checkbuffer(newat.time50);
+    p.standard = newat;
+    p.problem = false;
+    Checkbuffer(p.buf, newat.time50);
   }
   // Otherwise
   else{
@@ -320,76 +469,69 @@ static alltimes compute_times(hitinfo hits, alltimes oldat, counts & count,
 
     // Check for retriggers
     if (newat.time50 - oldat.time50 > 0 &&
-        newat.time50 - oldat.time50 <= config.retrigwindow){
-      retrig = true;
+        newat.time50 - oldat.time50 <= p.config.retrigwindow){
+      p.retrig = true;
     }
     else{
-      retrig = false;
-      passretrig = false;
+      p.retrig = false;
+      p.passretrig = false;
     }
 
     // Check for pathological case
     if (newat.time50 == 0){
       newat.time50 = oldat.time50;
-      stat.orphan++;
+      Count(p.stat.orphan.id);
       return newat;
     }
 
     // Check for well-orderedness
-    if(IsConsistent(newat, standard, dd)){
+    if(IsConsistent(newat, p.standard, dd)){
       newat.longtime = newat.time50 + maxtime*newat.epoch;
-      standard = newat;
-      problem = false;
+      p.standard = newat;
+      p.problem = false;
     }
-    else if(problem){
+    else if(p.problem){
       // RESET EVERYTHING
       alarm(40, "Stonehenge: Events out of order - Resetting buffers.", 3);
-      ClearBuffer(b, standard.longtime);
-      NHITCUT = config.nhithi;
+      ClearBuffer(p.buf, p.b, p.standard.longtime);
+      p.nhitcut = p.config.nhithi;
       newat.epoch = 0;
       newat.longtime = newat.time50;
       newat.exptime = 0; 
-      standard = newat;
-      problem = false;
+      p.standard = newat;
+      p.problem = false;
     }
     else{
-      problem = true;
-      newat = standard;
+      p.problem = true;
+      newat = p.standard;
     }
   }
   return newat;
 }
 
-// This Function performs the actual L2 cut
-// It returns true if we write out the event and false otherwise
-// Keep event if it is over nhit threshold
-// or, if it was externally triggered
-// or, if it is a retrigger to an accepted event
-bool l2filter(const uint16_t nhit, const uint32_t word, const bool passretrig, 
-              const bool retrig, int stats[]){
-  bool pass = false;
-  int key = 0;
-  if(nhit > NHITCUT){
-    pass = true;
-    key +=1;
-  }
-  if((word & config.bitmask) != 0){
-    pass = true;
-    key +=2;
-  }
-  if(passretrig && retrig && nhit > config.retrigcut){
-    pass = true;
-    key +=4;
-  }
-  for(int i=0; i<8; i++){
-    if(key == i)
-      stats[i]++;
-  }
-  return pass;
+// This function collects into w the output files for an event accepted with
+// the l2filter key and trigger word: the L2 file w1, and the split stream
+// for each class the event belongs to.  It returns the number of files.
+static int Streams(const int key, const uint32_t word, PZdabWriter* const w1,
+                   PZdabWriter* const streams[], PZdabWriter* w[]){
+  int n = 0;
+  w[n++] = w1;
+  if(!splitstreams)
+    return n;
+  const bool pedpulse = (word & (TRIG_PEDESTAL | TRIG_PULSE_GT)) != 0;
+  if(pedpulse)
+    w[n++] = streams[STREAM_PEDPULSE];
+  if((key & 2) && !pedpulse)
+    w[n++] = streams[STREAM_EXTERNAL];
+  if(key & (1 | 8))
+    w[n++] = streams[STREAM_NHIT];
+  if(key & 4)
+    w[n++] = streams[STREAM_RETRIG];
+  return n;
 }
 
 // This function writes the configuration parameters to postgresql
-void WriteConfig(char* infilename){
+void WriteConfig(const configuration & config, char* infilename){
   //TODO: Parse run number and subfile number from infilename
   char configtext[1024];
   snprintf(configtext, 1024, "runnumber: %d\n \
@@ -418,53 +560,49 @@ void WriteConfig(char* infilename){
            config.bitmask, config.nhitbcut, config.burstwindow,
            config.burstsize, config.endrate);
 
-  const char* conninfo = "dbname = test";
-  PGConn* conn = PQconnectdb(conninfo);
-  if( PQstatus(conn) != CONNECTION_OK){
-    alarm(30, "Could not log parameters to database!  Logging here instead.\n", 0);
-    alarm(30, configtext, 0);
-    return;
-  }
+  // The insert is run in the background
+  Logpostgres(insertstmt, configtext);
+}
 
-  PGresult* res = PQexec(conn, insertstmt);
-  if(PQresultStatus(res) != PGRES_TUPLES_OK){
-    alarm(30, "Could not log parameters to database!  Logging here instead.\n", 0);
-    alarm(30, configtext, 0);
-  }
-  fprintf(stdout, configtext);
-  return;
+// This function registers the counter name (with its help text) of the
+// pipeline p, naming it after p, and returns its number
+static int Register(const pipeline & p, const char* const name,
+                    const char* const help){
+  char buff[COUNTERNAME];
+  snprintf(buff, COUNTERNAME, "%s%s", p.name, name);
+  return Registercounter(buff, help);
 }
 
-// This function zeros out the counters
-counts CountInit(){
-  counts count;
-  count.eventn = 0;
-  count.recordn = 0;
-  return count;
+// This function registers the counters of the pipeline p
+static void Registerpipeline(pipeline & p){
+  p.stat.l1.id = Register(p, "records", "Records read (L1)");
+  p.events = Register(p, "events", "Events read");
+  p.stat.l2.id = Register(p, "l2records", "Records written to the L2 file");
+  for(int i=0; i<16; i++){
+    char name[32];
+    sprintf(name, "cutkey{key=\"%d\"}", i);
+    p.keys[i] = Register(p, name, "Events passing each combination of cuts"
+                         " (1 nhit, 2 external, 4 retrigger, 8 trigger sum)");
+  }
+  p.stat.orphan.id = Register(p, "orphans", "Events with no 50 MHz clock");
+  p.bursts = Register(p, "bursts", "Bursts begun");
+  p.stat.gtidmissing.id = Register(p, "gtid_missing", "GTIDs missing");
+  p.stat.gtiddup.id = Register(p, "gtid_duplicated",
+                               "GTIDs duplicated, or too late to tell");
+  ResetStatistics(p.stat);
 }
 
-// This function initialzes the time object
-static alltimes InitTime(){
+// This function initialzes the time object, following on from the burst
+// buffer buf
+static alltimes InitTime(const snbuffer & buf){
   alltimes alltime;
   alltime.walltime = 0;
   alltime.oldwalltime = 0;
   alltime.exptime = 0;
-  alltime.epoch = GetEpoch();
+  alltime.epoch = GetEpoch(buf);
   return alltime;
 }
 
-// This function sets the trigger threshold appropriately
-// The "Kalpana" solution
-static void setthreshold(uint16_t nhit, alltimes & alltime){
-  if(nhit > config.lothresh){
-    alltime.exptime = alltime.longtime + config.lowindow;
-    NHITCUT = config.nhitlo;
-  }
-  if(alltime.longtime > alltime.exptime){
-    NHITCUT = config.nhithi;
-  }
-}
-
 // This function checks unix time to see whether to update the times
 static void updatetime(alltimes & alltime){
   if(alltime.walltime!=0)
@@ -487,23 +625,28 @@ static hitinfo InitHit(){
 }
 
 // This function reads out the information about each event that we need
-// for making decisions/processing.  It then restores the hit data to its
-// external format.
-// This is based on PZdabFile::GetPmtRecord but it does not leave things
-// in a byte-swapped state.
+// for making decisions/processing.
+// This is based on PZdabFile::GetPmtRecord but it works on a native copy of
+// the record header, and so leaves the record in its external format.
+// The sub-fields are found from the record's sub-field directory, which also
+// gives the record length used by the writers.
+// If the trigger sum cuts in config are in use, the CAEN sub-field is decoded
+// into caen.
 // If the function is passed a non ZDAB_RECORD it returns 1.
-static int ReadHits(nZDAB* zrec, hitinfo& hit){
-  PmtEventRecord* pmtEventPtr;
+static int ReadHits(nZDAB* zrec, PZdabFile* const zfile, hitinfo& hit,
+                    caeninfo& caen, const configuration & config){
   // Check that the record is a ZDAB bank
   if( zrec->bank_name != ZDAB_RECORD ){
     return 1;
   }
 
-  pmtEventPtr = (PmtEventRecord*) (zrec + 1);
+  PmtEventRecord pmtEvent;
+  zfile->CopyToNative((u_int32*) &pmtEvent, (const u_int32*) (zrec + 1),
+                      WORD_SIZE(PmtEventRecord));
+  const PmtEventRecord* const pmtEventPtr = &pmtEvent;
 
   // Read nhit and check that it is sensible
   // If not, throw alarm and return empty object
-  SWAP_PMT_RECORD( pmtEventPtr );
   hit.nhit = pmtEventPtr->NPmtHit;
   if(hit.nhit > MAX_NHIT){
     fprintf(stderr, "Read error: Bad ZDAB -- %d pmt hit!\x07\n", hit.nhit);
@@ -532,170 +675,311 @@ static int ReadHits(nZDAB* zrec, hitinfo& hit){
   // Then report the length of the record in words
   // 9 words for nZDAB, 11 words for PmtEventRecord, 3 words per nhit
   // plus the length of any subrecords
-  // This method copied from PZdabFile
-  uint32_t event_size = 20 + 3*hit.nhit;
-  uint32_t* sub_header = &pmtEventPtr->CalPckType;
-  while( *sub_header & SUB_NOT_LAST ){
-    uint32_t jump = (*sub_header & SUB_LENGTH_MASK);
-    if( jump > MAX_BUFFSIZE/4 ){
-      fprintf(stderr, "Error: wanted to jump past the end of the buffer\n");
-      return(0);
-    }
-    SWAP_INT32(sub_header, 1);
-    sub_header += jump;
-    SWAP_INT32(sub_header, 1);
-    uint32_t datawords = (*sub_header & SUB_LENGTH_MASK);
-    event_size += datawords;
-    SWAP_INT32(sub_header, datawords);
+  SubFieldDir* const dir = zfile->GetSubFieldDir(zrec);
+  if(dir->error)
+    fprintf(stderr, "Error: wanted to jump past the end of the buffer\n");
+  hit.reclen = NZDAB_WORD_SIZE + dir->size/sizeof(uint32_t);
+
+  ClearCaen(caen);
+  if(config.caenpeak || config.caenint){
+    const SubFieldEntry* const sub = PZdabFile::FindSubField(dir, SUB_TYPE_CAEN);
+    if(sub && sub->length > 0)
+      DecodeCaen((u_int32*) (zrec + 1) + sub->offset + 1, sub->length - 1,
+                 zfile->GetFileSwap(), config.caenthresh, caen);
   }
-  hit.reclen = event_size;
-
-  // Finally, restore the record to its external state
-  SWAP_PMT_RECORD( pmtEventPtr );
-  SWAP_INT32( pmtEventPtr+1, 3*hit.nhit);
   return 0;
 }
 
-// MAIN FUCTION 
-int main(int argc, char *argv[])
+// This function sets up the pipeline p, which reads infilename and writes 
+// files starting with outfilebase, with the cuts read from configfile.  Its
+// burst buffer is kept between subfiles in files starting with name.
+static void Openpipeline(pipeline & p, const char* const name,
+                         char* const infilename, char* const outfilebase,
+                         const char* const configfile, const bool redis)
 {
+  p.name = name;
+  p.infilename = infilename;
+  p.outfilebase = outfilebase;
+  p.redis = redis;
+  ReadConfig(configfile, p.allconfigs);
+  Phase("configuration");
   // This states whether we have received the Run Header, and therefore set
   // the cut configuration
-  bool configknown = false;
-
-  // Connect to minard for monitoring
-  Opencurl(password);
-
-  // Configure the system
-  char * infilename = NULL, * outfilebase = NULL;
-
-  parse_cmdline(argc, argv, infilename, outfilebase);
-
-  FILE* infile = fopen(infilename, "rb");
-
-  PZdabFile* zfile = new PZdabFile();
-  if (zfile->Init(infile) < 0){
-    fprintf(stderr, "Did not open file\n");
-    alarm(40, "Stonehenge could not open input file.  Aborting.", 4);
-    exit(1);
-  }
-
-  // Prepare to record statistics in redis database
-  l2stats stat;
-  if(yesredis) 
-    Openredis(stat);
-
+  p.configknown = false;
 
   // Setup initial output file
-  PZdabWriter* w1  = Output(outfilebase, clobber);
-  PZdabWriter* b = NULL; // Burst event file
+  Openoutput(p, outfilebase, p.w1, p.next);
+  p.b = NULL; // Burst event file
+
+  // Output files for each class of event, if we split them
+  if(splitstreams){
+    for(int i=0; i<NUM_STREAMS; i++){
+      StreamBase(p.streambase[i], 256, outfilebase, i);
+      Openoutput(p, p.streambase[i], p.streams[i], p.streamnext[i]);
+    }
+  }
+  Phase("output files");
 
   // Set up the Burst Buffer
-  InitializeBuf();
+  InitializeBuf(p.buf, name);
+  Phase("burst buffer");
 
   // Initialize the various clocks and the hitinfo object
-  alltimes alltime = InitTime();
-  hitinfo hits = InitHit();
+  p.alltime = InitTime(p.buf);
+  p.hits = InitHit();
+  ClearCaen(p.caen);
 
   // Flags for the retriggering logic:
   // passretrig true means that if the next event is a retrigger, we should 
   // apply the special retrigger threshold.
   // retrig true means that this event is a retrigger (defined in the sense
   // 0 < dt < 460 ns ).
-  bool passretrig = false;
-  bool retrig = false;
-
-  // Loop over ZDAB Records
-  counts count = CountInit();
-  int stats[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-  while(nZDAB * const zrec = zfile->NextRecord()){
-    // Fill Header buffer if necessary
-    // Check for runtype, configure and record parameters if necessary
-    uint32_t runtype = FillHeaderBuffer(zrec);
-    if(runtype && !configknown){
-      SetConfig(runtype, allconfigs, config);
-      WriteConfig(infilename);
-      configknown = true;
+  p.passretrig = false;
+  p.retrig = false;
+  p.decide = Choosedecider(p.config);
+
+  Registerpipeline(p);
+}
+
+// This function passes the ZDAB record zrec, read from zfile, through the
+// pipeline p
+static void Processrecord(pipeline & p, nZDAB* const zrec,
+                          PZdabFile* const zfile)
+{
+  hitinfo & hits = p.hits;
+  caeninfo & caen = p.caen;
+  alltimes & alltime = p.alltime;
+  l2stats & stat = p.stat;
+  const configuration & config = p.config;
+  PZdabWriter* w[NUM_STREAMS + 1]; // Files a record is written to
+
+  // Fill Header buffer if necessary
+  // Check for runtype, configure and record parameters if necessary
+  uint32_t runtype = FillHeaderBuffer(p.buf, zrec, zfile);
+  if(runtype && !p.configknown){
+    SetConfig(runtype, p.allconfigs, p.config);
+    p.decide = Choosedecider(p.config);
+    WriteConfig(p.config, p.infilename);
+    p.configknown = true;
+  }
+  if(runtype && p.configknown){
+    alarm(30, "Stonehenge: RHDR Record in the middle of a run!\n", 0);
+  }
+
+  // If the record has an associated time, compute all the time
+  // variables.  Non-hit records don't have times.
+  if(! ReadHits(zrec, zfile, hits, caen, config)){
+    Count(p.events);
+    if(!p.gtidoff)
+      CheckGTID(p.gtids, hits.gtid);
+    alltime = compute_times(p, hits, alltime);
+
+    // Write statistics to Redis if necessary
+    updatetime(alltime);
+    if (alltime.walltime!=alltime.oldwalltime){
+      Reportgtid(p.gtids, stat);
+      // (this event is counted in the next second)
+      if(!p.ratesoff){
+        const uint64_t events = Readcounter(p.events) - 1;
+        Updaterates(p.rates, alltime.walltime, events,
+                    events - Readcounter(p.keys[0]));
+      }
+      if(p.redis){
+        gtid(stat, hits);
+        Writetoredis(stat, alltime.oldwalltime);
+      }
+      Checkpostgres();
+      Flusherrors();
     }
-    if(runtype && configknown){
-      alarm(30, "Stonehenge: RHDR Record in the middle of a run!\n", 0);
+
+    // If we don't have the run type yet, use defaults and throw error
+    if(!p.configknown){
+      SetConfig(0, p.allconfigs, p.config);
+      p.decide = Choosedecider(p.config);
+      WriteConfig(p.config, p.infilename);
+      alarm(30, "Stonehenge: No RHDR Record found!  Using default cuts!\n", 0);
+      p.configknown = true;
     }
 
-    // If the record has an associated time, compute all the time
-    // variables.  Non-hit records don't have times.
-    if(! ReadHits(zrec, hits)){
-      count.eventn++;
-      alltime = compute_times(hits, alltime, count, passretrig, retrig, stat, b);
-
-      // Write statistics to Redis if necessary
-      updatetime(alltime);
-      if (alltime.walltime!=alltime.oldwalltime){
-        if(yesredis){
-          gtid(stat, hits);
-          Writetoredis(stat, alltime.oldwalltime);
+    // Adjust the trigger threshold, and decide whether the event is a
+    // burst candidate and which L2 cuts it passes
+    bool candidate;
+    const int key = p.decide(p, hits.nhit, hits.triggertype, caen, candidate);
+    Count(p.keys[key]);
+    if(!p.ratesoff)
+      CountTrigger(p.rates, hits.triggertype);
+
+    // Burst Detection Here
+    // If the current event is over our burst nhit threshold (nhitbcut), or
+    // its trigger sum integral is over caenint, and it is not externally
+    // triggered:
+    //   * First update the buffer by dropping events older than burstwindow
+    //   * Then add the new event to the buffer
+    //   * If we were not in a burst, check whether one has started
+    //   * If we were in a burst: write event to file, and check if the burst has ended
+
+    uint32_t word = hits.triggertype; 
+    uint32_t reclen = hits.reclen;
+
+    if(candidate){
+      UpdateBuf(p.buf, alltime.longtime, config.burstwindow);
+      AddEvBuf(p.buf, zrec, alltime.longtime, reclen*sizeof(uint32_t), p.b,
+               zfile);
+
+      // Write to burst file if necessary
+      // A comment here about the following bit of opaque code:
+      // Burstfile returns whether a burst is ongoing, but we want burstbool
+      // to remain true after the burst ends, until it is reset.  We therefore
+      // logical-OR the return value of Burstfile with the existing value of 
+      // stat.burstbool.
+      const bool wasburst = p.buf.burstptr.burst;
+      stat.burstbool = (stat.burstbool | Burstfile(p.buf, p.b, config,
+                        alltime, p.outfilebase, clobber) );
+      if(!wasburst && p.buf.burstptr.burst)
+        Count(p.bursts);
+
+    } // End Burst Loop
+    // L2 Filter
+    if(key){
+      // Start a new piece of the output if this one is full
+      if(rotatebytes || rotateticks){
+        if(p.piecestarted &&
+           ((rotatebytes && p.w1->GetBytesWritten() >= rotatebytes) ||
+            (rotateticks && alltime.longtime - p.piecestart >= rotateticks))){
+          Rotate(p);
+          p.piecestarted = false;
+        }
+        if(!p.piecestarted){
+          p.piecestart = alltime.longtime;
+          p.piecestarted = true;
         }
-        Flusherrors();
       }
+      const int n = Streams(key, word, p.w1, p.streams, w);
+      OutZdab(zrec, w, n, zfile);
+      OutRing(zrec, zfile);
+      for(int i=0; i<n; i++)
+        Syncwriter(w[i]);
+      p.passretrig = true;
+      Count(stat.l2.id);
+    }
+  } // End Loop for Event Records
 
-      // If we don't have the run type yet, use defaults and throw error
-      if(!configknown){
-        SetConfig(0, allconfigs, config);
-        WriteConfig(infilename);
-        alarm(30, "Stonehenge: No RHDR Record found!  Using default cuts!\n", 0);
-        configknown = true;
-      }
+  // Write out all non-event records (to every file, so that each split
+  // stream has the header records too):
+  else{
+    int n = 0;
+    w[n++] = p.w1;
+    for(int i=0; splitstreams && i<NUM_STREAMS; i++)
+      w[n++] = p.streams[i];
+    OutZdab(zrec, w, n, zfile);
+    OutRing(zrec, zfile);
+    for(int i=0; i<n; i++)
+      Syncwriter(w[i]);
+    Count(stat.l2.id);
+  }
+  Count(stat.l1.id);
+}
 
-      // Should we adjust the trigger threshold?
-      setthreshold(hits.nhit, alltime);
-
-      // Burst Detection Here
-      // If the current event is over our burst nhit threshold (nhitbcut):
-      //   * First update the buffer by dropping events older than burstwindow
-      //   * Then add the new event to the buffer
-      //   * If we were not in a burst, check whether one has started
-      //   * If we were in a burst: write event to file, and check if the burst has ended
-
-      uint32_t word = hits.triggertype; 
-      uint32_t reclen = hits.reclen;
-
-      if(hits.nhit > config.nhitbcut && ((word & config.bitmask) == 0) ){
-        UpdateBuf(alltime.longtime, config.burstwindow);
-        AddEvBuf(zrec, alltime.longtime, reclen*sizeof(uint32_t), b);
-
-        // Write to burst file if necessary
-        // A comment here about the following bit of opaque code:
-        // Burstfile returns whether a burst is ongoing, but we want burstbool
-        // to remain true after the burst ends, until it is reset.  We therefore
-        // logical-OR the return value of Burstfile with the existing value of 
-        // stat.burstbool.
-        stat.burstbool = (stat.burstbool | Burstfile(b, config, alltime,
-                          outfilebase, clobber) );
-
-      } // End Burst Loop
-      // L2 Filter
-      if(l2filter(hits.nhit, word, passretrig, retrig, stats)){
-        OutZdab(zrec, w1, zfile);
-        passretrig = true;
-        stat.l2++;
-      }
-    } // End Loop for Event Records
+// This function closes the output files of the pipeline p at the end of the
+// subfile, and saves its burst buffer
+static void Closepipeline(pipeline & p)
+{
+  Closeoutput(p, p.outfilebase, p.w1, p.next, p.rotate);
+  for(int i=0; splitstreams && i<NUM_STREAMS; i++)
+    Closeoutput(p, p.streambase[i], p.streams[i], p.streamnext[i],
+                p.streamrotate[i]);
+  BurstEndofFile(p.buf, p.b, p.alltime.longtime);
+  FinishGTID(p.gtids);
+}
 
-    // Write out all non-event records:
-    else{
-      OutZdab(zrec, w1, zfile);
-      stat.l2++;
+// MAIN FUCTION 
+int main(int argc, char *argv[])
+{
+  mainstart = phasestart = Now();
+
+  // Connect to minard for monitoring
+  Opencurl(password);
+  Phase("alarms");
+
+  // Configure the system
+  char * infilename = NULL, * outfilebase = NULL, * configfile = NULL;
+
+  parse_cmdline(argc, argv, infilename, outfilebase, configfile);
+  Phase("options");
+
+  // The main thread is placed before it allocates anything, and before
+  // any other thread is started
+  Placethread(ROLE_MAIN);
+  if(ringname)
+    OpenRing(ringname);
+  if(countername)
+    Opencounters(countername);
+  if(controlpath)
+    Opencontrol(controlpath);
+  Opentargets();
+  Opendurable();
+  Phase("placement");
+
+  // The state of the trigger for this stream
+  pipeline* const p = new pipeline();
+
+  // The redis and database connections are opened in the background, so
+  // that processing can begin while they connect
+  if(yesredis) 
+    Openredis(p->stat);
+  Openpostgres();
+  Phase("connections");
+
+  FILE* infile = fopen(infilename, "rb");
+#ifdef WITH_ZSTD
+  // Compressed input files are decompressed as they are read
+  if(infile && IsZstdFile(infile)){
+    fclose(infile);
+    infile = ZstdOpenRead(infilename);
+  }
+#endif
+
+  PZdabFile* zfile = new PZdabFile();
+  if (zfile->Init(infile) < 0){
+    fprintf(stderr, "Did not open file\n");
+    alarm(40, "Stonehenge could not open input file.  Aborting.", 4);
+    exit(1);
+  }
+  Phase("input file");
+
+  Openpipeline(*p, "", infilename, outfilebase, configfile, yesredis);
+  if(inputlock)
+    Openinputcheck(infilename, inputlock);
+
+  // Loop over ZDAB Records, which are read from the file in batches
+  // Commands from the control socket are carried out between records
+  bool decided = false;
+  for(ZdabRecordRef & ref : ZdabRecordRange(zfile)){
+    Inputread(zfile->GetFilePos());
+    if(Controlpending())
+      Applycontrol(*p, clobber);
+    Processrecord(*p, ref.rec, zfile);
+    if(!decided && Readcounter(p->events)){
+      Reportstartup();
+      decided = true;
     }
-    count.recordn++;
-    stat.l1++;
-  } // End of the Event Loop for this subrun file
-  if(w1) Close(outfilebase, w1);
-  BurstEndofFile(b, alltime.longtime);
+  }
+
+  // The output still open is marked as it is closed
+  if(!Closeinputcheck())
+    Marksuspect("input does not match the builder's checksum");
+  Closepipeline(*p);
   delete zfile;
+  Finishtargets();
+  Finishdurable();
 
+  Closecontrol();
+  Closepostgres();
   Flusherrors();
-  if(yesredis)
+  if(Redisopen())
     Closeredis();
-  PrintClosing(outfilebase, count, stats);
+  PrintClosing(outfilebase, *p);
+  delete p;
   Closecurl();
   return 0;
 }
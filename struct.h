@@ -3,6 +3,9 @@
 // K Labe, September 24 2014
 // K Labe, February 4 2015 - Add hitinfo struct
 
+#ifndef __STRUCT_H__
+#define __STRUCT_H__
+
 #include <stdint.h>
 
 // This structure holds the variables set by the configuration file and recorded
@@ -21,6 +24,10 @@ int nhitbcut;     // The nhit cut for inclusion in bursts
 int burstwindow;  // The integration time for spotting bursts (in secs)
 int burstsize;    // The count to exceed to be a burst
 int endrate;      // Rate below which burst ends
+int caenchan;     // The CAEN digitizer channel used by the trigger sum cuts
+int caenthresh;   // The threshold for the trigger sum time over threshold
+int caenpeak;     // The trigger sum peak height cut for L2 (0 to disable)
+int caenint;      // The trigger sum integral cut for bursts (0 to disable)
 };
 
 // Structure to hold all the relevant times
@@ -35,14 +42,6 @@ int oldwalltime;
 uint64_t exptime;
 };
 
-// Structure to hold all the things we count
-struct counts
-{
-uint64_t prescalen;
-uint64_t eventn;
-uint64_t recordn;
-};
-
 // Structure to hold all the information we want to read out of the hits
 // object of a ZDAB record
 struct hitinfo
@@ -55,3 +54,18 @@ uint32_t reclen;
 uint32_t gtid;
 uint32_t run;
 };
+
+// Structure to hold the quantities computed from the CAEN trigger sum data
+// of an event
+#define CAEN_CHANNELS 8
+struct caeninfo
+{
+bool present;                    // Whether the event has decoded CAEN data
+uint32_t mask;                   // Mask of the channels present
+int nsamples;                    // Number of samples per channel
+uint16_t peak[CAEN_CHANNELS];    // Peak height below baseline (ADC counts)
+int32_t integral[CAEN_CHANNELS]; // Integral below baseline (ADC counts x samples)
+uint16_t tot[CAEN_CHANNELS];     // Number of samples over threshold
+};
+
+#endif // __STRUCT_H__
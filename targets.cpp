@@ -0,0 +1,751 @@
+// Output Targets
+//
+// A file on the targets is a stdio stream (fopencookie) with a large
+// buffer, so PZdabWriter, and the compressor, write it like any other file.
+// Each time the buffer fills, the data is copied once and queued for the
+// writer thread of every directory holding a copy; the queued data is
+// shared between them and freed once the last has written it.  A job stays
+// at the front of its queue while it is written, so how long the front job
+// has waited is how far the directory is behind.  Closing the stream only
+// queues the close of each copy.  The file is kept among the closing files
+// until every copy still kept has been written and closed, abandoning any
+// that stall while another copy is done, and then whoever asked to be told
+// (the durability policy, which syncs every copy and writes the lock file)
+// is called back, from the thread which finished it.
+//
+// The queues, copies and health are guarded by one mutex.  Files are
+// opened and closed by the event loop, or for a rotated output by the
+// rotation thread, and compressed files are written from the compression
+// thread, so alarms are only raised from Targetalarms and Finishtargets.
+
+#include "targets.h"
+#include "output.h"
+#include "counters.h"
+#include "placement.h"
+#include "curl.h"
+#include "clock.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <deque>
+#include <map>
+#include <pthread.h>
+
+enum targethealth{
+  TARGET_HEALTHY,
+  TARGET_STALLED,  // slow or behind; recovers once its writes are quick again
+  TARGET_FAILED    // a write failed; tried again after TARGET_RETRY
+};
+
+static const char* const healthnames[3] = { "healthy", "stalled", "failed" };
+
+// Data waiting to be written, shared by the copies it is queued for
+struct targetdata{
+  char* data;
+  size_t len;
+  int refs;  // jobs still to write it
+};
+
+struct targetdevice;
+
+// One copy of a file, in one directory
+struct targetcopy{
+  targetdevice* dev;
+  std::string path;
+  int fd;
+  bool closing;    // its close has been queued
+  bool closed;     // and done
+  bool abandoned;  // given up on; its thread deletes it once closed
+  bool failed;     // a write failed
+};
+
+// A file, written to each of its copies
+struct targetfile{
+  std::string name;
+  std::vector<targetcopy*> copies;  // those not abandoned
+  char* buffer;                     // the stream's buffer
+  targetdone done;                  // called once it is written (or NULL)
+  void* donearg;
+};
+
+// A write, or the close (if data is NULL), of a copy
+struct targetjob{
+  targetcopy* copy;
+  targetdata* data;
+  double queued;  // time it was queued (s)
+};
+
+// A directory, and its writer thread
+struct targetdevice{
+  std::string dir;
+  pthread_cond_t wake;
+  std::deque<targetjob> queue;
+  uint64_t queuedbytes;
+  targethealth health;
+  double failedat;             // time it failed (s)
+  double stalledat;            // time it stalled (s)
+  double writing;              // time the write under way began (s), or 0
+  unsigned long files;         // copies opened
+  unsigned long abandoned;     // copies abandoned
+  unsigned long stalls, errors;
+  uint64_t writes, bytes;
+  double latency, latmax;      // time in write() (s)
+  double recent;               // recent time per write (s, moving average)
+  unsigned long samples;       // writes in the average
+  int cbytes, cwrites, cwriteus, cstalls, cerrors;  // counters
+};
+
+static targetpolicy policy = TARGETS_NONE;
+static targetdevice devices[MAXTARGETS];
+static int ndevices = 0;
+static int nextstripe = 0;
+static bool started = false;
+
+// State shared with the writer threads
+// (statically initialized; see Startthread in placement.h)
+static pthread_mutex_t targetmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t targetprogress = PTHREAD_COND_INITIALIZER;  // a job is done
+static std::map<std::string, targetfile*> openfiles;
+static std::map<std::string, targetfile*> closingfiles;  // not yet written
+static int finishing = 0;             // files whose callbacks are running
+static std::vector<std::string> unreported;  // copies abandoned, not yet
+                                             // alarmed or renamed
+static unsigned long unreportedlost = 0;     // files with no copy, likewise
+
+// This function writes all of buff to fd, and returns 0 on success
+static int Writeall(const int fd, const char* buff, size_t len){
+  while(len){
+    const ssize_t n = write(fd, buff, len);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n == 0)
+      errno = ENOSPC;
+    if(n <= 0)
+      return 1;
+    buff += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// This function queues the close of the copy c
+static void Queueclose(targetcopy* const c){
+  targetjob job = { c, NULL, Now() };
+  c->closing = true;
+  c->dev->queue.push_back(job);
+  pthread_cond_signal(&c->dev->wake);
+}
+
+// This function returns whether the directory d is behind at time now
+static bool Behind(const targetdevice & d, const double now){
+  return d.queuedbytes > TARGET_QUEUE ||
+         (!d.queue.empty() && now - d.queue.front().queued > TARGET_STALL);
+}
+
+// This function returns whether the writes to the directory d are slow at
+// time now: whether its recent writes, or the one under way, have taken
+// longer than TARGET_SLOW
+static bool Slow(const targetdevice & d, const double now){
+  return (d.samples && d.recent > TARGET_SLOW) ||
+         (d.writing && now - d.writing > TARGET_SLOW);
+}
+
+// This function marks the directory d as stalled at time now, unless it is
+// already stalled or has failed
+static void Stall(targetdevice & d, const double now){
+  if(d.health != TARGET_HEALTHY)
+    return;
+  d.health = TARGET_STALLED;
+  d.stalledat = now;
+  d.stalls++;
+  Count(d.cstalls);
+}
+
+// This function marks the directories of the file f which are behind as
+// stalled, and abandons the copies of f which have failed, or are behind
+// while another copy is keeping up
+static void Failover(targetfile & f, const double now){
+  bool anykeeping = false;
+  for(size_t i=0; i<f.copies.size(); i++){
+    const targetcopy & c = *f.copies[i];
+    const bool behind = Behind(*c.dev, now);
+    if(behind)
+      Stall(*c.dev, now);
+    if(!c.failed && (c.closed || !behind))
+      anykeeping = true;
+  }
+
+  std::vector<targetcopy*> kept;
+  for(size_t i=0; i<f.copies.size(); i++){
+    targetcopy* const c = f.copies[i];
+    if(c->failed || (anykeeping && !c->closed && Behind(*c->dev, now))){
+      fprintf(stderr, "Abandoning output copy %s (%s)\n", c->path.c_str(),
+              c->failed ? "write failed" : "directory stalled");
+      c->abandoned = true;
+      c->dev->abandoned++;
+      unreported.push_back(c->path);
+      if(c->closed)
+        delete c;
+      else if(!c->closing)
+        Queueclose(c);
+    }
+    else
+      kept.push_back(c);
+  }
+  f.copies.swap(kept);
+}
+
+// This function moves the closing files which have been written, and which
+// someone has asked about (or every one written, if all is true), from
+// closingfiles to finished, with the mutex held.  It fails over the others.
+static void Collect(std::vector<targetfile*> & finished, const bool all){
+  const double now = Now();
+  std::map<std::string, targetfile*>::iterator i = closingfiles.begin();
+  while(i != closingfiles.end()){
+    targetfile & f = *i->second;
+    Failover(f, now);
+    bool done = true;
+    for(size_t j=0; j<f.copies.size(); j++)
+      done &= f.copies[j]->closed;
+    if(done && (f.done || all)){
+      finished.push_back(&f);
+      finishing++;
+      closingfiles.erase(i++);
+    }
+    else
+      i++;
+  }
+}
+
+// This function tells whoever asked that the closed file f has been
+// written, with the paths of the copies written in full, and deletes f.  It
+// is called without the mutex.
+static void Written(targetfile* const f){
+  std::vector<std::string> copies;
+  pthread_mutex_lock(&targetmutex);
+  for(size_t i=0; i<f->copies.size(); i++){
+    if(!f->copies[i]->failed)
+      copies.push_back(f->copies[i]->path);
+    else{
+      f->copies[i]->dev->abandoned++;
+      unreported.push_back(f->copies[i]->path);
+    }
+    delete f->copies[i];
+  }
+  if(copies.empty()){
+    fprintf(stderr, "No copy of %s was written in full\n", f->name.c_str());
+    unreportedlost++;
+  }
+  pthread_mutex_unlock(&targetmutex);
+
+  if(f->done)
+    f->done(copies, f->donearg);
+  delete f;
+
+  pthread_mutex_lock(&targetmutex);
+  finishing--;
+  pthread_cond_broadcast(&targetprogress);
+  pthread_mutex_unlock(&targetmutex);
+}
+
+// This function is the writer thread of the directory arg
+static void* Targetthread(void* arg){
+  targetdevice & d = *(targetdevice*) arg;
+  Placethread(ROLE_TARGET);
+  std::vector<targetfile*> finished;
+  pthread_mutex_lock(&targetmutex);
+  while(true){
+    while(d.queue.empty())
+      pthread_cond_wait(&d.wake, &targetmutex);
+    const targetjob job = d.queue.front();
+    targetcopy* const c = job.copy;
+    const bool skip = c->abandoned || c->failed;
+    if(job.data && !skip)
+      d.writing = Now();
+    pthread_mutex_unlock(&targetmutex);
+
+    int err = 0;
+    double dt = 0;
+    if(job.data && !skip){
+      const double start = Now();
+      err = Writeall(c->fd, job.data->data, job.data->len) ? errno : 0;
+      dt = Now() - start;
+    }
+    else if(!job.data)
+      err = close(c->fd) ? errno : 0;
+    if(job.data && !skip){
+      Count(d.cwrites);
+      Count(d.cbytes, job.data->len);
+      Count(d.cwriteus, (uint64_t) (dt*1e6));
+    }
+    if(err)
+      Count(d.cerrors);
+
+    pthread_mutex_lock(&targetmutex);
+    const double now = Now();
+    d.writing = 0;
+    if(job.data){
+      if(!skip){
+        d.writes++;
+        d.bytes += job.data->len;
+        d.latency += dt;
+        if(dt > d.latmax)
+          d.latmax = dt;
+        d.recent = d.samples++ ? 0.9*d.recent + 0.1*dt : dt;
+      }
+      d.queuedbytes -= job.data->len;
+      if(--job.data->refs == 0){
+        free(job.data->data);
+        delete job.data;
+      }
+    }
+    if(err){
+      fprintf(stderr, "Error writing output copy %s: %s\n", c->path.c_str(),
+              strerror(err));
+      c->failed = true;
+      d.errors++;
+      d.health = TARGET_FAILED;
+      d.failedat = now;
+    }
+    d.queue.pop_front();
+    if(!job.data){
+      c->closed = true;
+      if(c->abandoned)
+        delete c;
+    }
+
+    // A directory is stalled for as long as its writes are slow
+    if(Slow(d, now))
+      Stall(d, now);
+    else if(d.health == TARGET_STALLED && !Behind(d, now))
+      d.health = TARGET_HEALTHY;
+
+    if(!job.data){
+      Collect(finished, false);
+      if(!finished.empty()){
+        pthread_mutex_unlock(&targetmutex);
+        for(size_t i=0; i<finished.size(); i++)
+          Written(finished[i]);
+        finished.clear();
+        pthread_mutex_lock(&targetmutex);
+      }
+    }
+    pthread_cond_broadcast(&targetprogress);
+  }
+  return NULL;
+}
+
+// This function waits, with the mutex held, until a writer thread has done
+// a job or a tenth of a second has passed, whichever is first
+static void Waitprogress(){
+  timespec until;
+  clock_gettime(CLOCK_REALTIME, &until);
+  until.tv_nsec += 100000000;
+  if(until.tv_nsec >= 1000000000){
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+  pthread_cond_timedwait(&targetprogress, &targetmutex, &until);
+}
+
+// This function renames the abandoned copies, and raises the alarms.  It
+// is done by the event loop, whose thread, unlike a writer thread stuck on
+// a slow disk, is sure to get to it before the program exits.
+void Targetalarms(){
+  std::vector<std::string> abandoned;
+  pthread_mutex_lock(&targetmutex);
+  abandoned.swap(unreported);
+  const unsigned long lost = unreportedlost;
+  unreportedlost = 0;
+  pthread_mutex_unlock(&targetmutex);
+  for(size_t i=0; i<abandoned.size(); i++)
+    if(rename(abandoned[i].c_str(), (abandoned[i] + ".partial").c_str()))
+      fprintf(stderr, "Could not rename abandoned output copy %s\n",
+              abandoned[i].c_str());
+  if(!abandoned.empty())
+    alarm(30, "Stonehenge: Output directory stalled or failed.  Abandoned"
+          " copies of the output.", 0);
+  if(lost)
+    alarm(40, "Stonehenge: No copy of an output file was written.", 11);
+}
+
+// This function queues size bytes of buff for every copy of the file cookie,
+// and waits only if every copy is behind
+static ssize_t Targetwrite(void* cookie, const char* buff, size_t size){
+  targetfile & f = *(targetfile*) cookie;
+  targetdata* const data = new targetdata;
+  data->data = (char*) malloc(size);
+  if(!data->data){
+    delete data;
+    errno = ENOMEM;
+    return -1;
+  }
+  memcpy(data->data, buff, size);
+  data->len = size;
+  data->refs = 0;
+
+  pthread_mutex_lock(&targetmutex);
+  double now = Now();
+  Failover(f, now);
+  for(size_t i=0; i<f.copies.size(); i++){
+    targetjob job = { f.copies[i], data, now };
+    f.copies[i]->dev->queue.push_back(job);
+    f.copies[i]->dev->queuedbytes += size;
+    data->refs++;
+    pthread_cond_signal(&f.copies[i]->dev->wake);
+  }
+  if(!data->refs){
+    pthread_mutex_unlock(&targetmutex);
+    free(data->data);
+    delete data;
+    errno = EIO;
+    return -1;
+  }
+
+  // Wait while every copy is behind, or until the others can be given up on
+  while(true){
+    bool keeping = false;
+    for(size_t i=0; i<f.copies.size(); i++)
+      keeping |= !Behind(*f.copies[i]->dev, now);
+    if(keeping || f.copies.empty())
+      break;
+    Waitprogress();
+    now = Now();
+    Failover(f, now);
+  }
+  const bool lost = f.copies.empty();
+  std::vector<targetfile*> finished;
+  Collect(finished, false);
+  pthread_mutex_unlock(&targetmutex);
+  for(size_t i=0; i<finished.size(); i++)
+    Written(finished[i]);
+  if(lost){
+    errno = EIO;
+    return -1;
+  }
+  return size;
+}
+
+// This function queues the close of every copy of the file cookie, which
+// is then among the closing files until they are written
+static int Targetclose(void* cookie){
+  targetfile* const f = (targetfile*) cookie;
+  std::vector<targetfile*> finished;
+  pthread_mutex_lock(&targetmutex);
+  for(size_t i=0; i<f->copies.size(); i++)
+    Queueclose(f->copies[i]);
+  openfiles.erase(f->name);
+  closingfiles[f->name] = f;
+  Collect(finished, false);
+  pthread_mutex_unlock(&targetmutex);
+  free(f->buffer);
+  f->buffer = NULL;
+  for(size_t i=0; i<finished.size(); i++)
+    Written(finished[i]);
+  return 0;
+}
+
+// This function sets the output targets
+void settargets(const char* const spec){
+  const char* const colon = strchr(spec, ':');
+  if(colon && colon - spec == 6 && !strncmp(spec, "mirror", 6))
+    policy = TARGETS_MIRROR;
+  else if(colon && colon - spec == 6 && !strncmp(spec, "stripe", 6))
+    policy = TARGETS_STRIPE;
+  ndevices = 0;
+  for(const char* dir = colon ? colon + 1 : NULL; dir && *dir; ){
+    const size_t len = strcspn(dir, ",");
+    if(len && ndevices < MAXTARGETS)
+      devices[ndevices++].dir.assign(dir, len);
+    else{
+      ndevices = 0;
+      break;
+    }
+    dir += len + (dir[len] == ',');
+  }
+  if(policy == TARGETS_NONE || !ndevices){
+    char buff[256];
+    snprintf(buff, 256, "Stonehenge: output targets %s are not of the form"
+             " mirror:dir,dir,... or stripe:dir,dir,... (at most %d)\n",
+             spec, MAXTARGETS);
+    fprintf(stderr, buff);
+    alarm(40, buff, 2);
+    exit(1);
+  }
+}
+
+// This function returns whether targets are in use
+bool Targetsinuse(){
+  return policy != TARGETS_NONE;
+}
+
+// This function starts the writer threads
+void Opentargets(){
+  if(policy == TARGETS_NONE)
+    return;
+  // Each counter is registered for every directory in turn, so that the
+  // counters of one name are listed together
+  static const char* const counternames[5][2] = {
+    {"target_bytes", "Bytes written to each output directory"},
+    {"target_writes", "Writes to each output directory"},
+    {"target_write_us", "Time spent writing to each output directory (us)"},
+    {"target_stalls", "Times each output directory stalled"},
+    {"target_errors", "Failed writes to each output directory"}
+  };
+  for(int k=0; k<5; k++){
+    for(int i=0; i<ndevices; i++){
+      targetdevice & d = devices[i];
+      int* const ids[5] = {&d.cbytes, &d.cwrites, &d.cwriteus, &d.cstalls,
+                           &d.cerrors};
+      char name[COUNTERNAME];
+      snprintf(name, COUNTERNAME, "%s{target=\"%d\"}", counternames[k][0], i);
+      *ids[k] = Registercounter(name, counternames[k][1]);
+    }
+  }
+
+  for(int i=0; i<ndevices; i++){
+    targetdevice & d = devices[i];
+    pthread_cond_init(&d.wake, NULL);
+    d.queuedbytes = 0;
+    d.health = TARGET_HEALTHY;
+    if(Startthread(Targetthread, &d)){
+      fprintf(stderr, "Could not start the writer thread for %s\n",
+              d.dir.c_str());
+      alarm(40, "Stonehenge: Could not start an output writer thread.", 14);
+      exit(1);
+    }
+  }
+  started = true;
+}
+
+// This function returns the directories to write a new file to.  Under the
+// mirror policy they are the healthy ones (or ones due to be tried again),
+// or if there are none, all of them.  Under the stripe policy it is the next
+// healthy one in turn which has nothing left to write, or if there is none,
+// the one least behind, healthy if possible.
+static std::vector<targetdevice*> Choosetargets(){
+  const double now = Now();
+  std::vector<targetdevice*> chosen;
+  for(int i=0; i<ndevices; i++){
+    targetdevice & d = devices[i];
+    if(Slow(d, now) || Behind(d, now))
+      Stall(d, now);
+    if(d.health == TARGET_FAILED && now - d.failedat > TARGET_RETRY)
+      d.health = TARGET_HEALTHY;
+    // A stalled directory is given another file once it has caught up,
+    // and its writes timed afresh
+    if(d.health == TARGET_STALLED && now - d.stalledat > TARGET_RETRY &&
+       d.queue.empty()){
+      d.health = TARGET_HEALTHY;
+      d.samples = 0;
+    }
+  }
+  if(policy == TARGETS_MIRROR){
+    for(int i=0; i<ndevices; i++)
+      if(devices[i].health == TARGET_HEALTHY)
+        chosen.push_back(&devices[i]);
+    if(chosen.empty())
+      for(int i=0; i<ndevices; i++)
+        chosen.push_back(&devices[i]);
+    return chosen;
+  }
+  int best = -1;
+  for(int n=0; n<ndevices; n++){
+    const int i = (nextstripe + n) % ndevices;
+    const targetdevice & d = devices[i];
+    if(d.health == TARGET_HEALTHY && d.queue.empty()){
+      best = i;
+      break;
+    }
+    const bool healthy = d.health == TARGET_HEALTHY;
+    const bool besthealthy = best >= 0 &&
+                             devices[best].health == TARGET_HEALTHY;
+    if(best < 0 || (healthy && !besthealthy) ||
+       (healthy == besthealthy && d.queuedbytes < devices[best].queuedbytes))
+      best = i;
+  }
+  nextstripe = (best + 1) % ndevices;
+  chosen.push_back(&devices[best]);
+  return chosen;
+}
+
+// This function opens a file on the targets
+FILE* Targetopen(const char* const filename, const bool clobber,
+                 char* const name, const int len, outputerror & err){
+  // A directory which cannot be opened has failed, so it is not chosen
+  // again: a striped file moves on to the next directory
+  targetfile* const f = new targetfile();
+  int failures = 0;
+  for(int attempt=0; attempt<ndevices && f->copies.empty(); attempt++){
+    pthread_mutex_lock(&targetmutex);
+    const std::vector<targetdevice*> chosen = Choosetargets();
+    pthread_mutex_unlock(&targetmutex);
+    for(size_t i=0; i<chosen.size(); i++){
+      const std::string path = chosen[i]->dir + "/" + filename;
+      if(Makeroom(path.c_str(), clobber, err)){
+        for(size_t j=0; j<f->copies.size(); j++){
+          close(f->copies[j]->fd);
+          delete f->copies[j];
+        }
+        delete f;
+        return NULL;
+      }
+      const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if(fd < 0){
+        fprintf(stderr, "Could not open output copy %s: %s\n", path.c_str(),
+                strerror(errno));
+        pthread_mutex_lock(&targetmutex);
+        chosen[i]->errors++;
+        chosen[i]->health = TARGET_FAILED;
+        chosen[i]->failedat = Now();
+        pthread_mutex_unlock(&targetmutex);
+        Count(chosen[i]->cerrors);
+        failures++;
+        continue;
+      }
+      targetcopy* const c = new targetcopy();
+      c->dev = chosen[i];
+      c->path = path;
+      c->fd = fd;
+      f->copies.push_back(c);
+    }
+  }
+  if(failures)
+    Outputfail(err, 30, "Stonehenge: Could not open an output copy.", 0,
+               false);
+  if(f->copies.empty()){
+    delete f;
+    return NULL;
+  }
+
+  f->name = f->copies[0]->path;
+  snprintf(name, len, "%s", f->name.c_str());
+  // (stdio ignores the size asked for unless it is given the buffer)
+  f->buffer = (char*) malloc(TARGET_BUFFER);
+  cookie_io_functions_t funcs = { NULL, Targetwrite, NULL, Targetclose };
+  FILE* const stream = f->buffer ? fopencookie(f, "wb", funcs) : NULL;
+  if(!stream){
+    free(f->buffer);
+    for(size_t i=0; i<f->copies.size(); i++){
+      close(f->copies[i]->fd);
+      delete f->copies[i];
+    }
+    delete f;
+    return NULL;
+  }
+  setvbuf(stream, f->buffer, _IOFBF, TARGET_BUFFER);
+
+  std::vector<targetfile*> finished;
+  pthread_mutex_lock(&targetmutex);
+  for(size_t i=0; i<f->copies.size(); i++)
+    f->copies[i]->dev->files++;
+  openfiles[f->name] = f;
+  Collect(finished, false);
+  pthread_mutex_unlock(&targetmutex);
+  for(size_t i=0; i<finished.size(); i++)
+    Written(finished[i]);
+  return stream;
+}
+
+// This function finds the copies of an open file
+bool Targetcopies(const char* const name, std::vector<std::string> & copies){
+  copies.clear();
+  pthread_mutex_lock(&targetmutex);
+  std::map<std::string, targetfile*>::iterator o = openfiles.find(name);
+  const bool found = o != openfiles.end();
+  if(found)
+    for(size_t i=0; i<o->second->copies.size(); i++)
+      if(!o->second->copies[i]->failed)
+        copies.push_back(o->second->copies[i]->path);
+  pthread_mutex_unlock(&targetmutex);
+  return found;
+}
+
+// This function asks to be told when a closed file is written
+bool Targetwritten(const char* const name, const targetdone done,
+                   void* const arg){
+  std::vector<targetfile*> finished;
+  pthread_mutex_lock(&targetmutex);
+  std::map<std::string, targetfile*>::iterator c = closingfiles.find(name);
+  const bool found = c != closingfiles.end();
+  if(found){
+    c->second->done = done;
+    c->second->donearg = arg;
+    Collect(finished, false);
+  }
+  pthread_mutex_unlock(&targetmutex);
+  for(size_t i=0; i<finished.size(); i++)
+    Written(finished[i]);
+  return found;
+}
+
+// This function writes the health of each directory
+int Writetargets(char* const buff, const int len){
+  if(policy == TARGETS_NONE)
+    return snprintf(buff, len, "no output targets\n");
+  int n = 0;
+  pthread_mutex_lock(&targetmutex);
+  const double now = Now();
+  for(int i=0; i<ndevices && n < len; i++){
+    const targetdevice & d = devices[i];
+    n += snprintf(buff + n, len - n, "%d %s: %s, %lu files (%lu abandoned),"
+                  " %.1f MB in %lu writes (mean %.2f ms, recent %.2f ms, max"
+                  " %.2f ms), %.1f MB queued for %.2f s, %lu stalls, %lu"
+                  " errors\n", i, d.dir.c_str(), healthnames[d.health],
+                  d.files, d.abandoned, d.bytes/1e6, (unsigned long) d.writes,
+                  d.writes ? 1e3*d.latency/d.writes : 0., 1e3*d.recent,
+                  1e3*d.latmax, d.queuedbytes/1e6,
+                  d.queue.empty() ? 0. : now - d.queue.front().queued,
+                  d.stalls, d.errors);
+  }
+  pthread_mutex_unlock(&targetmutex);
+  return n < len ? n : len - 1;
+}
+
+// This function waits for the closed files to be written, and prints the
+// health of each directory
+void Finishtargets(){
+  if(!started)
+    return;
+  std::vector<targetfile*> finished;
+  pthread_mutex_lock(&targetmutex);
+  while(true){
+    Collect(finished, true);
+    if(!finished.empty()){
+      pthread_mutex_unlock(&targetmutex);
+      for(size_t i=0; i<finished.size(); i++)
+        Written(finished[i]);
+      finished.clear();
+      pthread_mutex_lock(&targetmutex);
+    }
+    if(closingfiles.empty() && !finishing)
+      break;
+    Waitprogress();
+  }
+  pthread_mutex_unlock(&targetmutex);
+  Targetalarms();
+
+  char buff[MAXTARGETS*512];
+  Writetargets(buff, sizeof(buff));
+  unsigned long abandoned = 0;
+  pthread_mutex_lock(&targetmutex);
+  for(int i=0; i<ndevices; i++)
+    abandoned += devices[i].abandoned;
+  pthread_mutex_unlock(&targetmutex);
+
+  fprintf(stderr, "Targets: %s policy over %d directories\n",
+          policy == TARGETS_MIRROR ? "mirror" : "stripe", ndevices);
+  for(char* line = strtok(buff, "\n"); line; line = strtok(NULL, "\n"))
+    fprintf(stderr, "Targets: %s\n", line);
+  if(abandoned){
+    char msg[256];
+    snprintf(msg, 256, "Stonehenge: %lu copies of output files were"
+             " abandoned\n", abandoned);
+    fprintf(stderr, msg);
+    alarm(30, msg, 0);
+  }
+}
@@ -0,0 +1,108 @@
+// Output Targets Header
+//
+// The L2 output (every output file except the burst files) can be written
+// to several directories, each on its own device, rather than to
+// /home/trigger/zdab alone.  Under the mirror policy each file is written
+// in full to every directory; under the stripe policy the files, as they
+// are rotated, go to the directories in turn.  Each directory has its own
+// writer thread, so the event loop hands over the data and goes on, and a
+// slow or full disk holds up only its own thread.
+//
+// The health of each directory is tracked from its writes: how long they
+// take, how far its thread is behind, and whether they fail.  A directory
+// is stalled while its recent writes take longer than TARGET_SLOW seconds
+// each (or the one under way has), or while its thread is more than
+// TARGET_QUEUE bytes or TARGET_STALL seconds behind; one whose write fails
+// has failed.  Stalled and failed directories are given no new files until
+// they recover: a stalled one once its writes are quick again, and either
+// is tried again after TARGET_RETRY seconds (a stalled one only once it has
+// caught up).  A mirrored copy on a directory which is behind, or has
+// failed, is abandoned as long as another copy of the file is keeping up,
+// and renamed with .partial on the end by the event loop when it next
+// calls Targetalarms; the event loop only waits when every copy of a file
+// is behind.  A striped file has just the one copy, so it is waited for.
+//
+// Closing a file does not wait for its copies to be written.  Whoever needs
+// to know (the durability policy, which syncs the copies and writes the
+// lock file) asks to be called back once they are.
+
+#ifndef __TARGETS_H__
+#define __TARGETS_H__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+struct outputerror;  // output.h
+
+enum targetpolicy{
+  TARGETS_NONE,    // one file in /home/trigger/zdab, written by the event loop
+  TARGETS_MIRROR,  // each file in every directory
+  TARGETS_STRIPE   // the files in each directory in turn
+};
+
+#define MAXTARGETS   8          // directories
+#define TARGET_BUFFER (1 << 20) // bytes handed to the writer threads at a time
+#define TARGET_QUEUE (64 << 20) // bytes a directory may be behind
+#define TARGET_STALL 2.0        // seconds a directory may be behind
+#define TARGET_SLOW  0.1        // seconds a write may take, on recent average
+#define TARGET_RETRY 30.0       // seconds before a directory is retried
+
+// This function sets the output targets from the string spec, which is
+// "mirror:" or "stripe:" followed by a comma-separated list of directories
+// (e.g. "mirror:/disk1/zdab,/disk2/zdab").  It aborts the program if the
+// string cannot be understood.
+void settargets(const char* const spec);
+
+// This function returns whether the L2 output is written to the targets.
+bool Targetsinuse();
+
+// This function starts the writer threads and registers the counters of
+// each directory.  It does nothing unless targets have been set.
+void Opentargets();
+
+// This function opens the output file filename (with no directory) on the
+// targets, after making room for it as Makeroom does with clobber, and
+// returns a stream which writes it.  The name of the first copy is written
+// into name (of length len), and stands for the file afterwards.  It
+// returns NULL if no copy could be opened.  It raises no alarm, but puts
+// what went wrong in err (see Tryoutput in output.h), so it may be called
+// from any thread.
+FILE* Targetopen(const char* const filename, const bool clobber,
+                 char* const name, const int len, outputerror & err);
+
+// This function fills copies with the paths of the copies of the open file
+// name which are being written in full.  It returns false if name is not
+// open on the targets.
+bool Targetcopies(const char* const name, std::vector<std::string> & copies);
+
+// Called once a closed file has been written, with the paths of the copies
+// written in full (none if every copy was lost), and the argument given
+typedef void (*targetdone)(const std::vector<std::string> & copies,
+                           void* arg);
+
+// This function asks for done(copies, arg) to be called once the file name,
+// which has been closed, has been written.  It is called from the thread
+// which finishes the file, which may be a writer thread or the caller.  It
+// returns false, and done is not called, if name was not written to the
+// targets.
+bool Targetwritten(const char* const name, const targetdone done,
+                   void* const arg);
+
+// This function writes the health of each directory into buff (of length
+// len), one line each, and returns the length written.  It may be called
+// from any thread.
+int Writetargets(char* const buff, const int len);
+
+// This function renames the copies abandoned since it was last called with
+// .partial on the end, and raises an alarm for them, and for any file of
+// which no copy was written.  It is called by the event loop at each
+// rotation, and by Finishtargets.
+void Targetalarms();
+
+// This function waits for every closed file to be written, prints the
+// health of each directory, and raises an alarm if any copies were
+// abandoned.
+void Finishtargets();
+
+#endif // __TARGETS_H__
@@ -0,0 +1,819 @@
+// ZDAB Check
+//
+// Checks the structure of a ZDAB file without processing it:  the steering
+// blocks and their bank numbers, the control and pilot records of each
+// logical record, the containment of each bank in its record, the sub-field
+// chains of the PMT event records and their hit counts.  The file is divided
+// into ranges of physical records which are checked in parallel, while
+// another task recomputes the MD5 checksum and compares it to the one
+// stonehenge wrote to the .lock file.  All anomalies found are reported.
+// Several files may be checked at once; the ranges of all of them share one
+// pool of threads, and the reports are printed in the order of the files.
+
+#include "PZdabFile.h"
+#include "MD5Checksum.h"
+#include "PZdabPool.h"
+#ifdef WITH_ZSTD
+#include "PZdabZstd.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define NSTEERING         ((u_int32)(sizeof(ZEBRA_ST)/sizeof(u_int32)))
+#define MIN_RANGE_BLOCKS  64      // fewest blocks checked by one task
+#define RANGES_PER_THREAD 4       // ranges of a large file for each thread
+#define MAX_ANOMALIES     1000    // anomalies kept per range (the rest are counted)
+#define READ_BUFFER       0x100000
+
+// An anomaly found in the file
+struct anomaly{
+  int64_t offset; // byte offset in file
+  std::string what;
+};
+
+// The results of checking one range of blocks
+struct rangeresult{
+  int64_t start, end;       // words of the file whose steering blocks are checked
+  int64_t firststeering;    // first steering block found in range (words, -1 if none)
+  int64_t nextsteering;     // steering block after the range (words, -1 if none)
+  int64_t firstrec, lastrec; // first and last bank numbers (MPR[5]) in range
+  bool endofrun;            // an end of run block was found
+  unsigned long nsteering, nrecords, nevents, nanomalies;
+  std::vector<anomaly> anomalies;
+};
+
+// A physical record read into the stream of logical record words
+struct physrec{
+  int64_t fileword; // offset of steering block in file (words)
+  int64_t start;    // stream position of first data word
+  u_int32 ndata;    // number of data words (including any fast blocks)
+  u_int32 mpr6;     // offset of first control record (MPR[6])
+  bool gap;         // found by skipping a corrupt part of the file
+};
+
+// A file to check
+struct inputfile{
+  std::string name;
+  std::string lock;   // lock file holding its checksum
+  bool zstd;          // compressed
+  int swap;           // in the opposite byte order to the host
+  int64_t bytes, words;
+};
+
+// The report on one file
+struct filereport{
+  std::string text;
+  int errors;
+};
+
+// This function opens another stream on the input file.  Each range reads
+// through its own stream.
+static FILE* OpenInput(const inputfile & in){
+#ifdef WITH_ZSTD
+  if(in.zstd)
+    return ZstdOpenRead(in.name.c_str());
+#endif
+  FILE* const fp = fopen(in.name.c_str(), "rb");
+  if(fp)
+    setvbuf(fp, NULL, _IOFBF, READ_BUFFER);
+  return fp;
+}
+
+// This function converts a word from the file byte order
+static inline u_int32 Word(const int swap, const u_int32 w){
+  return swap ? ByteSwap::Word(w) : w;
+}
+
+// This function checks whether the 8 words hold a steering block signature
+static bool IsSteering(const int swap, const u_int32* const mpr){
+  return Word(swap, mpr[0]) == ZEBRA_SIG0 && Word(swap, mpr[1]) == ZEBRA_SIG1 &&
+         Word(swap, mpr[2]) == ZEBRA_SIG2 && Word(swap, mpr[3]) == ZEBRA_SIG3;
+}
+
+// This function appends formatted text to a report
+static void Print(filereport & report, const char* fmt, ...){
+  char buff[512];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(buff, sizeof(buff), fmt, ap);
+  va_end(ap);
+  report.text += buff;
+}
+
+// This class checks the physical and logical records whose steering blocks
+// lie in one range of the file.  The logical record which is still open at
+// the end of the range is followed into the next range, up to the first
+// physical record in which a new logical record begins; the checks of the
+// next range start from that record.
+class RangeChecker{
+public:
+  RangeChecker(const inputfile & f, rangeresult & r) : in(f), res(r),
+    fp(NULL), filepos(-1), pos(0), base(0), check(0), next(0), done(false),
+    gap(false) {}
+  ~RangeChecker(){ if(fp) fclose(fp); }
+  void Run();
+
+private:
+  void Report(int64_t fileword, const char* fmt, ...);
+  bool Owned(const int64_t fileword){ return fileword < res.end; }
+  int64_t FileWord(int64_t spos);
+  bool Read(const int64_t fileword, u_int32* const buf, const u_int32 n);
+  int64_t FindSteering(int64_t fileword, const int64_t limit);
+  void CheckEnd(int64_t fileword);
+  bool ReadPhys();
+  bool Need(const int64_t spos);
+  bool Resync(size_t i);
+  bool CheckStarts();
+  void CheckData(const int64_t rec, const int64_t end);
+  void CheckBank(const int64_t hdr, const u_int32 name, const u_int32 nwords);
+  u_int32 W(const int64_t spos){ return Word(data[spos - base]); }
+  u_int32 Word(const u_int32 w){ return ::Word(in.swap, w); }
+  bool IsSteering(const u_int32* const mpr){ return ::IsSteering(in.swap, mpr); }
+
+  const inputfile & in;
+  rangeresult & res;
+  FILE* fp;
+  int64_t filepos;            // position of fp in file (words)
+  std::vector<u_int32> data;  // logical record words from the file
+  std::vector<physrec> phys;  // physical records holding the words
+  int64_t pos;                // stream position of next logical record
+  int64_t base;               // stream position of data[0]
+  size_t check;               // next physical record whose MPR[6] is checked
+  int64_t next;               // next steering block (words)
+  int64_t lastrec;            // last bank number (MPR[5]) read
+  bool done;                  // no more physical records can be read
+  bool gap;                   // the last physical record read followed a gap
+};
+
+// This function records an anomaly at a word offset in the file
+void RangeChecker::Report(int64_t fileword, const char* fmt, ...){
+  res.nanomalies++;
+  if(res.anomalies.size() >= MAX_ANOMALIES)
+    return;
+  char buff[256];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(buff, sizeof(buff), fmt, ap);
+  va_end(ap);
+  anomaly a = { fileword*(int64_t)sizeof(u_int32), buff };
+  res.anomalies.push_back(a);
+}
+
+// This function returns the word offset in the file of a stream position
+int64_t RangeChecker::FileWord(int64_t spos){
+  for(size_t i = phys.size(); i-- > 0; )
+    if(spos >= phys[i].start)
+      return phys[i].fileword + NSTEERING + (spos - phys[i].start);
+  return -1;
+}
+
+// This function reads n words at a word offset in the file.  It returns
+// false if they could not all be read.
+bool RangeChecker::Read(const int64_t fileword, u_int32* const buf,
+                        const u_int32 n){
+  if(fileword + n > in.words)
+    return false;
+  if(filepos != fileword &&
+     fseeko(fp, fileword*(off_t)sizeof(u_int32), SEEK_SET)){
+    filepos = -1;
+    return false;
+  }
+  const size_t got = fread(buf, sizeof(u_int32), n, fp);
+  filepos = fileword + got;
+  return got == n;
+}
+
+// This function returns the first block from fileword (which must be at a
+// block boundary) to limit which starts with a steering block signature,
+// or -1 if there is none.
+int64_t RangeChecker::FindSteering(int64_t fileword, const int64_t limit){
+  u_int32 mpr[NSTEERING];
+  for(; fileword < limit; fileword += ZEBRA_BLOCKSIZE){
+    if(!Read(fileword, mpr, NSTEERING))
+      return -1;
+    if(IsSteering(mpr))
+      return fileword;
+  }
+  return -1;
+}
+
+// This function checks the end of the file from the first end of run block,
+// which should be followed only by more end of run blocks.
+void RangeChecker::CheckEnd(int64_t fileword){
+  res.endofrun = true;
+  u_int32 mpr[NSTEERING];
+  while(fileword < in.words){
+    if(!Read(fileword, mpr, NSTEERING) || !IsSteering(mpr) ||
+       !(Word(mpr[4]) & (ZEBRA_EMERGENCY_STOP | ZEBRA_END_OF_RUN))){
+      Report(fileword, "Data after end of run");
+      return;
+    }
+    fileword += ZEBRA_BLOCKSIZE;
+  }
+  if(fileword != in.words)
+    Report(in.words, "File does not end at a block boundary");
+}
+
+// This function reads the next physical record and appends its data to the
+// stream.  It returns false if there are no more records to read.
+bool RangeChecker::ReadPhys(){
+  u_int32 mpr[NSTEERING];
+  gap = false;
+  while(!done){
+    const int64_t f = next;
+    const bool owned = Owned(f);
+    if(!owned && res.nextsteering < 0)
+      res.nextsteering = f;
+    if(f >= in.words){
+      if(owned)
+        Report(f, "No end of run block (file truncated?)");
+      break;
+    }
+    if(!Read(f, mpr, NSTEERING)){
+      if(owned)
+        Report(f, "File truncated in steering block");
+      break;
+    }
+    if(!IsSteering(mpr)){
+      if(!owned)
+        break;
+      // skip to the next block with a steering signature
+      next = FindSteering((f/ZEBRA_BLOCKSIZE + 1)*ZEBRA_BLOCKSIZE, in.words);
+      Report(f, "Invalid steering block signature, skipped %lld words",
+             (long long)((next < 0 ? in.words : next) - f));
+      if(next < 0)
+        break;
+      gap = true;
+      lastrec = -1;
+      continue;
+    }
+    const u_int32 flags = Word(mpr[4]);
+    if(flags & (ZEBRA_EMERGENCY_STOP | ZEBRA_END_OF_RUN)){
+      // (the end of the file is checked from the first end of run block)
+      if(owned && !(f == res.firststeering && f > 0 &&
+                    Read(f - ZEBRA_BLOCKSIZE, mpr, NSTEERING) && IsSteering(mpr) &&
+                    (Word(mpr[4]) & (ZEBRA_EMERGENCY_STOP | ZEBRA_END_OF_RUN))))
+        CheckEnd(f);
+      else if(owned)
+        res.endofrun = true;
+      break;
+    }
+    const u_int32 blocksize = flags & ZEBRA_BLOCK_SIZE_MASK;
+    const u_int32 nfast = Word(mpr[7]);
+    if(blocksize <= NSTEERING || blocksize > ZEBRA_BLOCKSIZE ||
+       (uint64_t)blocksize*(1 + nfast) > MAX_BUFFSIZE){
+      if(!owned)
+        break;
+      Report(f, "Illegal block size %u with %u fast blocks", blocksize, nfast);
+      next = FindSteering((f/ZEBRA_BLOCKSIZE + 1)*ZEBRA_BLOCKSIZE, in.words);
+      if(next < 0)
+        break;
+      gap = true;
+      continue;
+    }
+    if(owned){
+      if(blocksize != ZEBRA_BLOCKSIZE)
+        Report(f, "Block size %u is not %u", blocksize, ZEBRA_BLOCKSIZE);
+      const u_int32 rec = Word(mpr[5]);
+      if(lastrec >= 0 && rec != (u_int32)(lastrec + 1))
+        Report(f, "Wrong ZEBRA bank number %u (should be %u)", rec,
+               (u_int32)(lastrec + 1));
+      if(res.firstrec < 0)
+        res.firstrec = rec;
+      res.lastrec = lastrec = rec;
+      res.nsteering++;
+    }
+
+    physrec p = { f, base + (int64_t)data.size(),
+                  blocksize*(1 + nfast) - (u_int32)NSTEERING, Word(mpr[6]), gap };
+    data.resize(data.size() + p.ndata);
+    u_int32* const pdata = &data[data.size() - p.ndata];
+    if(!Read(f + NSTEERING, pdata, p.ndata)){
+      if(owned)
+        Report(f, "File truncated in physical record");
+      data.resize(data.size() - p.ndata);
+      break;
+    }
+    // fast blocks are not steering blocks
+    if(owned)
+      for(u_int32 i = 1; i <= nfast; i++)
+        if(IsSteering(pdata + i*blocksize - NSTEERING))
+          Report(f + i*blocksize, "Fast block %u of %u has a steering signature",
+                 i, nfast);
+    phys.push_back(p);
+    next = f + (int64_t)blocksize*(1 + nfast);
+    return true;
+  }
+  done = true;
+  gap = false;
+  return false;
+}
+
+// This function makes sure the stream holds the words before spos.  It
+// returns false if they could not be read, or if a corrupt part of the file
+// was skipped to read them.
+bool RangeChecker::Need(const int64_t spos){
+  while(base + (int64_t)data.size() < spos){
+    if(!ReadPhys() || gap)
+      return false;
+  }
+  return true;
+}
+
+// This function continues with the first logical record which begins in
+// phys[i] or a later physical record.  It returns false if there are no
+// more to check in this range.
+bool RangeChecker::Resync(size_t i){
+  for(;; i++){
+    while(i >= phys.size())
+      if(!ReadPhys())
+        return false;
+    const physrec & p = phys[i];
+    if(!Owned(p.fileword))
+      return false;
+    if(p.mpr6 < NSTEERING){
+      Report(p.fileword, "Invalid control record offset %u", p.mpr6);
+      continue;
+    }
+    if(p.mpr6 - NSTEERING < p.ndata){
+      pos = p.start + p.mpr6 - NSTEERING;
+      check = i + 1;
+      return true;
+    }
+  }
+}
+
+// This function checks that the offset of the first control record (MPR[6])
+// of each physical record which has been reached agrees with the logical
+// records read.  It returns false once the checks of this range are done.
+bool RangeChecker::CheckStarts(){
+  while(check < phys.size() && phys[check].start <= pos){
+    const physrec & p = phys[check];
+    const int64_t end = p.start + p.ndata;
+    const bool starts = p.mpr6 >= NSTEERING && p.mpr6 - NSTEERING < p.ndata;
+    if(!starts && pos < end){
+      Report(FileWord(pos), "Logical record begins where MPR[6]=%u says none does",
+             p.mpr6);
+      return Resync(check + 1);
+    }
+    if(starts && pos != p.start + p.mpr6 - NSTEERING){
+      Report(FileWord(pos), "Logical record begins at word %lld of physical "
+             "record, MPR[6] says %u", (long long)(pos - p.start + NSTEERING),
+             p.mpr6);
+      pos = p.start + p.mpr6 - NSTEERING;
+    }
+    check++;
+    // the next range goes on from the first record it starts itself
+    if(starts && !Owned(p.fileword))
+      return false;
+  }
+  return true;
+}
+
+// This function checks a ZEBRA bank of a data record
+void RangeChecker::CheckBank(const int64_t hdr, const u_int32 name,
+                             const u_int32 nwords){
+  if(name != ZDAB_RECORD)
+    return;
+  res.nevents++;
+  PmtEventRecord* const pmt = (PmtEventRecord*)&data[hdr + NZDAB_WORD_SIZE - base];
+  if(nwords < sizeof(aPmtEventRecord)/sizeof(u_int32)){
+    Report(FileWord(hdr), "PMT record of %u words is shorter than its header",
+           nwords);
+    return;
+  }
+  // (NPmtHit is the low 16 bits of the word once it is in native format)
+  const u_int32 nhit = Word(((u_int32*)pmt)[3]) & 0xffff;
+  if(nhit > MAX_NHIT)
+    Report(FileWord(hdr), "NPmtHit %u is more than %u", nhit, MAX_NHIT);
+  SubFieldDir dir;
+  PZdabFile::BuildSubFieldDir(pmt, nwords, in.swap, &dir);
+  if(dir.error)
+    Report(FileWord(hdr), "Corrupt sub-field chain");
+  else if(dir.size > nwords*sizeof(u_int32))
+    Report(FileWord(hdr), "PMT record of %u bytes is larger than its bank",
+           dir.size);
+}
+
+// This function checks the pilot and bank headers of a data record, which
+// occupies the stream from rec to end
+void RangeChecker::CheckData(const int64_t rec, const int64_t end){
+  if(end - rec < (int64_t)(sizeof(pilotHeader)/sizeof(u_int32))){
+    Report(FileWord(rec), "Record length %lld is too short for the pilot",
+           (long long)(end - rec));
+    return;
+  }
+  // skip over control and pilot blocks, and pilot6 + pilot9 words
+  const int64_t skip = rec + sizeof(pilotHeader)/sizeof(u_int32) +
+                       (int64_t)W(rec + 8) + W(rec + 11);
+  if(skip >= end){
+    Report(FileWord(rec), "Pilot lengths point past the end of the record");
+    return;
+  }
+  int64_t hdr = skip + (W(skip) & 0xffff) - 12 + 1;
+  while(true){
+    if(hdr < rec + (int64_t)(sizeof(pilotHeader)/sizeof(u_int32)) ||
+       hdr + (int64_t)NZDAB_WORD_SIZE > end){
+      Report(FileWord(rec), "Bank header is outside the record");
+      return;
+    }
+    const u_int32 name = W(hdr + 4);
+    const u_int32 nwords = W(hdr + 7);
+    const int64_t io = hdr + NZDAB_WORD_SIZE + nwords;
+    if(io > end){
+      Report(FileWord(hdr), "Bank 0x%08x of %u words extends past the end of "
+             "the record", name, nwords);
+      return;
+    }
+    CheckBank(hdr, name, nwords);
+    // further banks in the record follow the i/o control word
+    if(io >= end || (W(io) & 0xffff) < 12)
+      return;
+    hdr = io + (W(io) & 0xffff) - 2 - NZDAB_WORD_SIZE;
+  }
+}
+
+// This function checks the range
+void RangeChecker::Run(){
+  if(!(fp = OpenInput(in))){
+    Report(res.start, "Could not open %s", in.name.c_str());
+    return;
+  }
+  // a range may begin in the fast blocks of a physical record
+  res.firststeering = FindSteering(res.start, std::min(res.end, in.words));
+  if(res.firststeering < 0)
+    return;
+  next = res.firststeering;
+  lastrec = -1;
+  if(!Resync(0))
+    return;
+
+  while(true){
+    // after a corrupt part of the file go on from the next record start
+    if(!Need(pos + 1) && (!gap || !Resync(phys.size() - 1)))
+      return;
+    if(!CheckStarts())
+      return;
+    if(pos >= base + (int64_t)data.size())
+      continue;
+
+    // drop the words before this record
+    if(pos - base > READ_BUFFER){
+      while(phys.size() > 1 && phys[0].start + phys[0].ndata <= pos){
+        phys.erase(phys.begin());
+        check--;
+      }
+      data.erase(data.begin(), data.begin() + (pos - base));
+      base = pos;
+    }
+
+    const u_int32 length = W(pos);
+    if(length == 0){      // 1 word padding record
+      pos++;
+      continue;
+    }
+    const bool havetype = Need(pos + 2);
+    const u_int32 type = havetype ? W(pos + 1) : 0;
+    int64_t end;
+    if(!havetype)
+      end = pos + 2;
+    else if(type == 5)
+      end = pos + length + 1;
+    else if(type >= 1 && type <= 4)
+      end = pos + length + 2;
+    else{
+      Report(FileWord(pos), "Unknown record type 0x%x, length 0x%x", type, length);
+      if(!Resync(check))
+        return;
+      continue;
+    }
+    if((uint64_t)length + 2 > MAX_BUFFSIZE){
+      Report(FileWord(pos), "Record length %u is too large", length);
+      if(!Resync(check))
+        return;
+      continue;
+    }
+    if(!havetype || !Need(end)){
+      if(gap){
+        Report(FileWord(pos), "Record cut off by a corrupt steering block");
+        if(!Resync(phys.size() - 1))
+          return;
+        continue;
+      }
+      if(Owned(FileWord(pos)))
+        Report(FileWord(pos), "Record of %u words cut off by the end of the data",
+               length);
+      return;
+    }
+    if(type >= 2 && type <= 4){
+      CheckData(pos, end);
+      res.nrecords++;
+    }
+    pos = end;
+  }
+}
+
+// This function checks the blocks [first, last) of the file, which has
+// nblocks blocks
+static rangeresult CheckRange(const inputfile & in, const int64_t first,
+                              const int64_t last, const int64_t nblocks){
+  rangeresult r;
+  r.start = first*ZEBRA_BLOCKSIZE;
+  r.end = last < nblocks ? last*ZEBRA_BLOCKSIZE : INT64_MAX;
+  r.firststeering = r.nextsteering = r.firstrec = r.lastrec = -1;
+  r.endofrun = false;
+  r.nsteering = r.nrecords = r.nevents = r.nanomalies = 0;
+  RangeChecker checker(in, r);
+  checker.Run();
+  return r;
+}
+
+// This function computes the MD5 checksum of the file
+static void ComputeMD5(const inputfile & in, std::string* const md5,
+                       bool* const ok){
+  FILE* const fp = OpenInput(in);
+  *ok = false;
+  if(!fp)
+    return;
+  std::vector<BYTE> buff(READ_BUFFER);
+  MD5Checksum sum;
+  size_t n;
+  while((n = fread(&buff[0], 1, buff.size(), fp)) > 0)
+    sum.Update(&buff[0], n);
+  *ok = !ferror(fp);
+  fclose(fp);
+  *md5 = sum.GetMD5();
+}
+
+// This function returns the checksum recorded in the lock file, or an empty
+// string if there is none.  stonehenge appends a line to the file each time
+// it closes the zdab file, so the last line is used.  Lines beginning with #
+// are comments; if one marks the file as suspect, the reason is put in
+// suspect.
+static std::string ReadLock(const char* const lockname,
+                            std::string & suspect){
+  std::string md5;
+  FILE* const fp = fopen(lockname, "r");
+  if(!fp)
+    return md5;
+  char line[256];
+  while(fgets(line, sizeof(line), fp)){
+    line[strcspn(line, "\r\n")] = '\0';
+    if(!strncmp(line, "# suspect: ", 11))
+      suspect = line + 11;
+    else if(line[0] && line[0] != '#')
+      md5 = line;
+  }
+  fclose(fp);
+  return md5;
+}
+
+// This function prints the usage information
+static void printhelp(){
+  printf(
+  "zdabcheck: check the structure and checksum of ZDAB files.\n"
+  "\n"
+  "  zdabcheck -i [in.zdab] [more.zdab ...]\n"
+  "  -j: Number of threads to check with (default: number of CPUs)\n"
+  "  -l: Lock file holding the MD5 checksum (default: the input file name\n"
+  "      with .lock in place of .zdab; only with a single file)\n"
+  "  -h: This help text\n"
+  );
+}
+
+// This function opens the file name and finds its size and byte order.  It
+// returns false, having said why, if it is not a ZDAB file that can be read.
+static bool Openfile(const char* const name, const char* const lockname,
+                     inputfile & in){
+  in.name = name;
+  in.zstd = false;
+  in.swap = 0;
+  FILE* fp = fopen(name, "rb");
+  if(!fp){
+    fprintf(stderr, "Could not open input file %s\n", name);
+    return false;
+  }
+#ifdef WITH_ZSTD
+  if(IsZstdFile(fp)){
+    in.zstd = true;
+    fclose(fp);
+    fp = OpenInput(in);
+    if(!fp){
+      fprintf(stderr, "Could not open compressed file %s\n", name);
+      return false;
+    }
+  }
+#endif
+  u_int32 mpr[NSTEERING];
+  if(fread(mpr, sizeof(mpr), 1, fp) != 1 || fseeko(fp, 0, SEEK_END)){
+    fprintf(stderr, "Could not read %s\n", name);
+    fclose(fp);
+    return false;
+  }
+  in.bytes = ftello(fp);
+  fclose(fp);
+  in.words = in.bytes/sizeof(u_int32);
+  if(!IsSteering(in.swap, mpr)){
+    in.swap = 1;
+    if(!IsSteering(in.swap, mpr)){
+      fprintf(stderr, "%s is not a ZDAB file\n", name);
+      return false;
+    }
+  }
+
+  if(lockname){
+    in.lock = lockname;
+  }
+  else{
+    in.lock = name;
+    const char* const exts[] = { ".zdab.zst", ".zdab" };
+    for(int i = 0; i < 2; i++){
+      const size_t len = strlen(exts[i]);
+      if(in.lock.size() > len &&
+         !in.lock.compare(in.lock.size() - len, len, exts[i])){
+        in.lock.erase(in.lock.size() - len);
+        break;
+      }
+    }
+    in.lock += ".lock";
+  }
+  return true;
+}
+
+// This function checks one file, with the threads of the pool.  strictlock
+// tells whether a missing checksum is an error.
+static filereport Checkfile(PZdabPool & pool, const inputfile & in,
+                            const bool strictlock){
+  filereport report;
+  report.errors = 0;
+
+  timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // the checksum is computed alongside the ranges
+  std::string md5;
+  bool md5ok = false;
+  PZdabTaskGroup md5task;
+  pool.Submit(md5task, [&in, &md5, &md5ok](){ ComputeMD5(in, &md5, &md5ok); });
+
+  // divide the blocks into ranges, a few for each thread so that a thread
+  // which finishes early can take over the work of one which is behind
+  const int64_t nblocks = (in.words + ZEBRA_BLOCKSIZE - 1)/ZEBRA_BLOCKSIZE;
+  const int64_t nparts = (int64_t)pool.GetThreads()*RANGES_PER_THREAD;
+  const int64_t perrange = std::max((int64_t)MIN_RANGE_BLOCKS,
+                                    (nblocks + nparts - 1)/nparts);
+  std::vector<rangeresult> ranges;
+  pool.MapRanges(std::max(nblocks, (int64_t)1), perrange, ranges,
+                 [&in, nblocks](int64_t first, int64_t last){
+                   return CheckRange(in, first, last, nblocks); });
+  pool.Wait(md5task);
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  // check that each range goes on from where the last one left off
+  std::vector<anomaly> anomalies;
+  unsigned long nanomalies = 0, nsteering = 0, nrecords = 0, nevents = 0;
+  int64_t expect = -1, lastrec = -1;
+  bool endofrun = false;
+  for(size_t i = 0; i < ranges.size(); i++){
+    rangeresult & r = ranges[i];
+    if(r.firststeering >= 0){
+      if(expect >= 0 && expect != r.firststeering){
+        anomaly a = { std::min(expect, r.firststeering)*(int64_t)sizeof(u_int32),
+                      "Steering blocks do not follow on from the last physical record" };
+        anomalies.push_back(a);
+        nanomalies++;
+      }
+      expect = r.nextsteering;
+    }
+    if(r.firstrec >= 0){
+      if(lastrec >= 0 && r.firstrec != lastrec + 1){
+        char buff[128];
+        snprintf(buff, sizeof(buff), "Wrong ZEBRA bank number %lld (should be %lld)",
+                 (long long)r.firstrec, (long long)(lastrec + 1));
+        anomaly a = { r.firststeering*(int64_t)sizeof(u_int32), buff };
+        anomalies.push_back(a);
+        nanomalies++;
+      }
+      lastrec = r.lastrec;
+    }
+    anomalies.insert(anomalies.end(), r.anomalies.begin(), r.anomalies.end());
+    nanomalies += r.nanomalies;
+    nsteering += r.nsteering;
+    nrecords += r.nrecords;
+    nevents += r.nevents;
+    endofrun |= r.endofrun;
+  }
+  if(!endofrun && nanomalies == 0){
+    anomaly a = { in.bytes, "No end of run block (file truncated?)" };
+    anomalies.push_back(a);
+    nanomalies++;
+  }
+  if(in.bytes % sizeof(u_int32)){
+    anomaly a = { in.bytes, "File is not a whole number of words" };
+    anomalies.push_back(a);
+    nanomalies++;
+  }
+
+  std::stable_sort(anomalies.begin(), anomalies.end(),
+                   [](const anomaly & a, const anomaly & b){
+                     return a.offset < b.offset; });
+  for(size_t i = 0; i < anomalies.size(); i++)
+    Print(report, "Block %lld (byte %lld): %s\n",
+          (long long)(anomalies[i].offset/(ZEBRA_BLOCKSIZE*sizeof(u_int32))),
+          (long long)anomalies[i].offset, anomalies[i].what.c_str());
+  if(nanomalies > anomalies.size())
+    Print(report, "... and %lu more\n",
+          nanomalies - (unsigned long)anomalies.size());
+
+  const double seconds = (stop.tv_sec - start.tv_sec) +
+                         (stop.tv_nsec - start.tv_nsec)*1e-9;
+  Print(report, "%s: %lu physical records, %lu logical records, %lu events, "
+        "%lu anomalies\n", in.name.c_str(), nsteering, nrecords, nevents,
+        nanomalies);
+  Print(report, "Checked %.1f MB in %.2f s with %d threads (%d ranges, %.0f MB/s)\n",
+        in.bytes/1e6, seconds, pool.GetThreads(), (int)ranges.size(),
+        seconds > 0 ? in.bytes/1e6/seconds : 0.);
+
+  report.errors = nanomalies ? 1 : 0;
+  std::string suspect;
+  const std::string lockmd5 = ReadLock(in.lock.c_str(), suspect);
+  if(!md5ok){
+    Print(report, "Could not read %s to compute its MD5 checksum\n",
+          in.name.c_str());
+    report.errors = 1;
+  }
+  else if(lockmd5.empty()){
+    Print(report, "MD5 %s (no checksum in %s)\n", md5.c_str(), in.lock.c_str());
+    if(strictlock)
+      report.errors = 1;
+  }
+  else if(lockmd5 != md5){
+    Print(report, "MD5 %s does not match %s in %s\n", md5.c_str(),
+          lockmd5.c_str(), in.lock.c_str());
+    report.errors = 1;
+  }
+  else{
+    Print(report, "MD5 %s matches %s\n", md5.c_str(), in.lock.c_str());
+  }
+  if(!suspect.empty()){
+    Print(report, "%s marks the file as suspect: %s\n", in.lock.c_str(),
+          suspect.c_str());
+    report.errors = 1;
+  }
+  return report;
+}
+
+int main(int argc, char** argv){
+  const char* lockname = NULL;
+  std::vector<const char*> names;
+  int nthreads = 0;
+
+  int ch;
+  while((ch = getopt(argc, argv, "hi:j:l:")) != -1){
+    switch(ch){
+      case 'i': names.push_back(optarg); break;
+      case 'j': nthreads = std::max(atoi(optarg), 1); break;
+      case 'l': lockname = optarg; break;
+      case 'h': printhelp(); exit(0);
+      default:  printhelp(); exit(1);
+    }
+  }
+  // further files may follow the options
+  for(int i = optind; i < argc; i++)
+    names.push_back(argv[i]);
+  if(names.empty() || (lockname && names.size() > 1)){
+    printhelp();
+    exit(1);
+  }
+
+  int errors = 0;
+  std::vector<inputfile> files;
+  for(size_t i = 0; i < names.size(); i++){
+    inputfile in;
+    if(Openfile(names[i], lockname, in))
+      files.push_back(in);
+    else
+      errors = 1;
+  }
+  if(files.empty())
+    exit(1);
+
+  // the files are checked at once, and reported on in order
+  PZdabPool pool(nthreads);
+  std::vector<filereport> reports;
+  pool.Map(files.size(), reports, [&pool, &files, lockname](int64_t i){
+             return Checkfile(pool, files[i], lockname != NULL); });
+  for(size_t i = 0; i < reports.size(); i++){
+    fputs(reports[i].text.c_str(), stdout);
+    errors |= reports[i].errors;
+  }
+  return errors;
+}
@@ -0,0 +1,138 @@
+// ZDAB Follow
+//
+// Follows the L2 records Stonehenge publishes to a shared-memory ring (see
+// PZdabRing.h) as they are written.  It either writes them to a ZDAB file,
+// or prints the rate of records and of lost records once a second.  It
+// never slows Stonehenge down: if it falls behind, records are lost and
+// counted.
+
+#include "PZdabFile.h"
+#include "PZdabWriter.h"
+#include "PZdabRing.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+// Time to sleep when there is nothing to read (ns)
+#define POLL_NS 20000
+
+// Set when the program is interrupted
+static volatile sig_atomic_t interrupted = 0;
+
+// This function records that the program was interrupted
+static void interrupt(int){
+  interrupted = 1;
+}
+
+// This function prints the usage information
+static void printhelp(){
+  printf(
+  "zdabfollow: follow the L2 records in a Stonehenge shared-memory ring.\n"
+  "\n"
+  "  -m [string]: Name of the ring (as given to stonehenge -m)\n"
+  "  -o [string]: Write the records to this ZDAB file, rather than\n"
+  "               printing the rates\n"
+  "  -a: Start with the oldest record in the ring, not the next one\n"
+  "  -n [int]: Stop after this many records\n"
+  "  -h: This help text\n"
+  );
+}
+
+int main(int argc, char** argv){
+  char* ringname = NULL;
+  char* outfilename = NULL;
+  int fromstart = 0;
+  unsigned long maxrecords = 0;
+
+  int ch;
+  while((ch = getopt(argc, argv, "hm:o:an:")) != -1){
+    switch(ch){
+      case 'm': ringname = optarg; break;
+      case 'o': outfilename = optarg; break;
+      case 'a': fromstart = 1; break;
+      case 'n': maxrecords = strtoul(optarg, NULL, 10); break;
+      case 'h': printhelp(); exit(0);
+      default:  printhelp(); exit(1);
+    }
+  }
+  if(!ringname){
+    printhelp();
+    exit(1);
+  }
+
+  PZdabRingReader ring;
+  if(ring.Init(ringname, fromstart) < 0)
+    exit(1);
+
+  PZdabWriter* w = NULL;
+  if(outfilename){
+    // PZdabWriter would append to an existing file
+    if(!access(outfilename, F_OK)){
+      fprintf(stderr, "%s already exists\n", outfilename);
+      exit(1);
+    }
+    w = new PZdabWriter(outfilename);
+    if(!w->IsOpen()){
+      fprintf(stderr, "Could not open output file %s\n", outfilename);
+      exit(1);
+    }
+  }
+
+  signal(SIGINT, interrupt);
+  signal(SIGTERM, interrupt);
+
+  int errors = 0;
+  unsigned long nrecords = 0, nevents = 0, lastrecords = 0;
+  uint64_t lastlost = 0;
+  double last = Now();
+  while(!interrupted && (!maxrecords || nrecords < maxrecords)){
+    u_int32 bank_name, nwords;
+    u_int32* const data = ring.NextRecord(bank_name, nwords);
+    if(!data){
+      if(ring.IsAbandoned()){
+        fprintf(stderr, "The ring has been replaced by a new one\n");
+        errors++;
+        break;
+      }
+      const timespec ts = {0, POLL_NS};
+      nanosleep(&ts, NULL);
+    }
+    else{
+      nrecords++;
+      if(bank_name == ZDAB_RECORD)
+        nevents++;
+      const int index = PZdabWriter::GetIndex(bank_name);
+      if(w && index >= 0 && w->WriteBank(data, index)){
+        errors++;
+        break;
+      }
+    }
+
+    if(!w){
+      const double now = Now();
+      if(now - last >= 1){
+        printf("%.0f records/s, %.0f lost/s (%lu records, %lu events, "
+               "%lu lost in %lu overruns)\n",
+               (nrecords - lastrecords)/(now - last),
+               (ring.GetLost() - lastlost)/(now - last), nrecords, nevents,
+               (unsigned long)ring.GetLost(), (unsigned long)ring.GetOverruns());
+        fflush(stdout);
+        lastrecords = nrecords;
+        lastlost = ring.GetLost();
+        last = now;
+      }
+    }
+  }
+
+  if(w){
+    errors += w->Close();
+    delete w;
+  }
+  fprintf(stderr, "Followed %lu records (%lu events); %lu lost in %lu "
+          "overruns\n", nrecords, nevents, (unsigned long)ring.GetLost(),
+          (unsigned long)ring.GetOverruns());
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+// ZDAB Pack
+//
+// Converts ZDAB files to the compact packed-hit format described in
+// PZdabPack.h, and back again.  Unpacked files are written by PZdabWriter,
+// so a round trip gives the same file as writing the original records
+// with PZdabWriter.  MAST banks are not stored, since PZdabWriter writes
+// them itself.
+
+#include "PZdabFile.h"
+#include "PZdabWriter.h"
+#include "PZdabPack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+// This function prints the usage information
+static void printhelp(){
+  printf(
+  "zdabpack: convert between ZDAB and the packed-hit format.\n"
+  "\n"
+  "  zdabpack -i [in.zdab] -o [out.zpk]   pack a ZDAB file\n"
+  "  zdabpack -u -i [in.zpk] -o [out.zdab]  unpack to a ZDAB file\n"
+  "  zdabpack -s -i [in.zpk]              scan the event headers of a\n"
+  "                                       packed file without unpacking hits\n"
+  "  -h: This help text\n"
+  );
+}
+
+// This function packs the ZDAB file in into the packed file out.
+// It returns the number of errors.
+static int Pack(FILE* const in, FILE* const out){
+  PZdabFile zfile;
+  if(zfile.Init(in) < 0)
+    return 1;
+  PZdabPacker packer(out);
+  int errors = 0;
+  unsigned long nrec = 0;
+  for(ZdabRecordRef & ref : ZdabRecordRange(&zfile)){
+    nZDAB* const zrec = ref.rec;
+    if(zrec->bank_name == MAST_RECORD)
+      continue;
+    if(zrec->bank_name == ZDAB_RECORD){
+      PmtEventRecord* const pmt = zfile.GetPmtRecord(zrec);
+      if(!pmt){
+        fprintf(stderr, "Skipping bad ZDAB record\n");
+        errors++;
+        continue;
+      }
+      packer.AddEvent(pmt, PZdabFile::GetSize(pmt)/sizeof(uint32_t));
+    }
+    else{
+      packer.AddBank(zrec->bank_name, zfile.GetBank(zrec), zrec->data_words);
+    }
+    if(packer.GetError())
+      break;
+    nrec++;
+  }
+  errors += packer.Close();
+  fprintf(stderr, "Packed %lu records\n", nrec);
+  return errors;
+}
+
+// This function unpacks the packed file in and writes it with w.
+// It returns the number of errors.
+static int Unpack(FILE* const in, PZdabWriter & w){
+  PZdabPackFile pfile;
+  if(pfile.Init(in) < 0)
+    return 1;
+  int errors = 0;
+  unsigned long nrec = 0;
+  u_int32 bank_name, nwords;
+  while(u_int32* const data = pfile.NextRecord(bank_name, nwords)){
+    const int index = PZdabWriter::GetIndex(bank_name);
+    if(index < 0){
+      fprintf(stderr, "Skipping unknown bank %s\n",
+              PZdabFile::BankNameString(bank_name));
+      errors++;
+      continue;
+    }
+    if(w.WriteBank(data, index))
+      return errors + 1;
+    nrec++;
+  }
+  fprintf(stderr, "Unpacked %lu records\n", nrec);
+  return errors;
+}
+
+// This function reads the event headers of the packed file in, to show
+// how quickly a file can be scanned.  It returns the number of errors.
+static int Scan(FILE* const in){
+  PZdabPackFile pfile;
+  if(pfile.Init(in) < 0)
+    return 1;
+  const clock_t start = clock();
+  unsigned long nevent = 0, nhit = 0;
+  u_int32 bank_name, nwords;
+  while(u_int32* const data = pfile.NextRecord(bank_name, nwords, 1)){
+    if(bank_name != ZDAB_RECORD)
+      continue;
+    nevent++;
+    nhit += ((PmtEventRecord*) data)->NPmtHit;
+  }
+  fprintf(stderr, "%lu events with %lu hits in %d blocks, scanned in %.3f s\n",
+          nevent, nhit, pfile.GetNumBlocks(),
+          (double)(clock() - start)/CLOCKS_PER_SEC);
+  return 0;
+}
+
+int main(int argc, char** argv){
+  char* infilename = NULL;
+  char* outfilename = NULL;
+  bool unpack = false, scan = false;
+
+  int ch;
+  while((ch = getopt(argc, argv, "hi:o:us")) != -1){
+    switch(ch){
+      case 'i': infilename = optarg; break;
+      case 'o': outfilename = optarg; break;
+      case 'u': unpack = true; break;
+      case 's': scan = true; break;
+      case 'h': printhelp(); exit(0);
+      default:  printhelp(); exit(1);
+    }
+  }
+  if(!infilename || (!outfilename && !scan)){
+    printhelp();
+    exit(1);
+  }
+
+  FILE* const in = fopen(infilename, "rb");
+  if(!in){
+    fprintf(stderr, "Could not open input file %s\n", infilename);
+    exit(1);
+  }
+  if(scan){
+    const int errors = Scan(in);
+    fclose(in);
+    return errors ? 1 : 0;
+  }
+
+  // PZdabWriter would append to an existing file
+  if(!access(outfilename, F_OK)){
+    fprintf(stderr, "%s already exists\n", outfilename);
+    exit(1);
+  }
+
+  int errors;
+  if(unpack){
+    PZdabWriter w(outfilename);
+    if(!w.IsOpen()){
+      fprintf(stderr, "Could not open output file %s\n", outfilename);
+      exit(1);
+    }
+    errors = Unpack(in, w);
+    errors += w.Close();
+  }
+  else{
+    FILE* const out = fopen(outfilename, "wb");
+    if(!out){
+      fprintf(stderr, "Could not open output file %s\n", outfilename);
+      exit(1);
+    }
+    errors = Pack(in, out);
+    if(fclose(out))
+      errors++;
+  }
+  fclose(in);
+  return errors ? 1 : 0;
+}